@@ -0,0 +1,185 @@
+////////////////////////////////////////////////////////////////////////////////
+// DScript Scripting Language
+// Copyright (C) 2003 Bryan "daerid" Ross
+//
+// Permission to copy, use, modify, sell and distribute this software is
+// granted provided this copyright notice appears in all copies. This
+// software is provided "as is" without express or implied warranty, and
+// with no claim as to its suitability for any purpose.
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Standard Library Includes
+#include <cctype>
+#include <climits>
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// DScript Includes
+#include "array.h"
+#include "stringtable.h"
+////////////////////////////////////////////////////////////////////////////////
+
+using namespace std;
+using namespace dscript;
+
+namespace
+{
+    /// Checks if an index belongs in the dense part of an array, which is
+    /// the case for non-negative ints and their canonical string forms
+    bool get_dense_index(const value& index,size_t& i)
+    {
+        if(index.type == value::type_int)
+        {
+            if(index.intval < 0)
+                return false;
+            i = index.intval;
+            return true;
+        }
+        if(index.type == value::type_array)
+            return false;
+
+        // a float is the same index as its string form, so 1.0 is 1
+        string str =
+            index.type == value::type_str
+                ? string(index.str_begin(),index.str_length())
+                : index.to_str();
+        if(str.empty() || str.size() > 10 || (str[0] == '0' && str.size() > 1))
+            return false;
+        unsigned long n = 0;
+        for(size_t c = 0; c < str.size(); ++c)
+        {
+            if(!isdigit(static_cast<unsigned char>(str[c])))
+                return false;
+            n = n * 10 + (str[c] - '0');
+        }
+        if(n > INT_MAX)
+            return false;
+        i = n;
+        return true;
+    }
+
+    /// Case insensitive FNV-1a
+    size_t hash_key(const string& key)
+    {
+        size_t hash = 2166136261u;
+        for(size_t c = 0; c < key.size(); ++c)
+        {
+            hash ^= static_cast<unsigned char>(tolower(key[c]));
+            hash *= 16777619u;
+        }
+        return hash;
+    }
+}
+
+size_t array_data::find_slot(const string& key,size_t hash) const
+{
+    // linear probing, the table size is always a power of 2
+    size_t mask = hashed.size() - 1;
+    size_t slot = hash & mask;
+    while(hashed[slot].used)
+    {
+        if(
+            hashed[slot].hash == hash &&
+            equal_ste(hashed[slot].key.c_str(),key.c_str())
+            )
+            break;
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+void array_data::grow()
+{
+    vector<hash_entry> old;
+    old.swap(hashed);
+    hashed.resize(old.empty() ? 8 : old.size() * 2);
+    for(size_t i = 0; i < old.size(); ++i)
+    {
+        if(old[i].used)
+        {
+            hash_entry& entry = hashed[find_slot(old[i].key,old[i].hash)];
+            entry.key.swap(old[i].key);
+            entry.hash = old[i].hash;
+            entry.used = true;
+            entry.val = old[i].val;
+        }
+    }
+}
+
+const value* array_data::find(const value& index) const
+{
+    size_t i;
+    if(get_dense_index(index,i) && i < dense.size())
+        return &dense[i];
+    if(hash_count == 0)
+        return 0;
+    string key = index.to_str();
+    const hash_entry& entry = hashed[find_slot(key,hash_key(key))];
+    return entry.used ? &entry.val : 0;
+}
+
+value& array_data::get(const value& index)
+{
+    size_t i;
+    bool is_dense = get_dense_index(index,i);
+    if(is_dense && i < dense.size())
+        return dense[i];
+
+    string key = index.to_str();
+    size_t hash = hash_key(key);
+    if(hash_count != 0)
+    {
+        hash_entry& entry = hashed[find_slot(key,hash)];
+        if(entry.used)
+            return entry.val;
+    }
+
+    // a new element. The next index in line extends the dense part
+    if(is_dense && i == dense.size())
+    {
+        dense.push_back(value());
+        return dense.back();
+    }
+
+    // keep the load factor under 3/4
+    if((hash_count + 1) * 4 > hashed.size() * 3)
+        grow();
+    hash_entry& entry = hashed[find_slot(key,hash)];
+    entry.key = key;
+    entry.hash = hash;
+    entry.used = true;
+    ++hash_count;
+    return entry.val;
+}
+
+array_data& dscript::make_unique_array(value& v)
+{
+    if(v.type != value::type_array)
+    {
+        array_data* arr = new array_data;
+        v.clear();
+        v.type = value::type_array;
+        v.arrval = arr;
+    }
+    else if(v.arrval->refs > 1)
+    {
+        // copy on write
+        array_data* arr = new array_data(*v.arrval);
+        arr->refs = 1;
+        --v.arrval->refs;
+        v.arrval = arr;
+    }
+    return *v.arrval;
+}
+
+void value::retain_array(array_data* arr)
+{
+    ++arr->refs;
+}
+
+void value::release_array(array_data* arr)
+{
+    if(--arr->refs == 0)
+        delete arr;
+}
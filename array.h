@@ -0,0 +1,75 @@
+////////////////////////////////////////////////////////////////////////////////
+// DScript Scripting Language
+// Copyright (C) 2003 Bryan "daerid" Ross
+//
+// Permission to copy, use, modify, sell and distribute this software is
+// granted provided this copyright notice appears in all copies. This
+// software is provided "as is" without express or implied warranty, and
+// with no claim as to its suitability for any purpose.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __DSCRIPT_ARRAY_H__
+#define __DSCRIPT_ARRAY_H__
+
+////////////////////////////////////////////////////////////////////////////////
+// Standard Library Includes
+#include <string>
+#include <vector>
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// DScript Includes
+#include "value.h"
+////////////////////////////////////////////////////////////////////////////////
+
+namespace dscript
+{
+    /// The elements of an array value. Integer indexes from 0 up live in
+    /// a dense vector, any other index in a hash table keyed by its string
+    /// form (case insensitive, like variable names). "1", 1 and 1.0 are
+    /// all the same index.
+    ///
+    /// Arrays are shared between values by reference count, and copied
+    /// before being changed while shared (see make_unique_array()), so
+    /// assigning an array still copies it as far as scripts can tell.
+    class array_data
+    {
+    public:
+        array_data() : refs(1), hash_count(0) {}
+
+        /// Returns the element at index, or 0 if there is none
+        const value* find(const value& index) const;
+
+        /// Returns the element at index, creating it if needed. The
+        /// reference is good until the next element is created.
+        value& get(const value& index);
+
+        /// The number of elements
+        size_t size() const { return dense.size() + hash_count; }
+
+        size_t refs;
+
+    private:
+        struct hash_entry
+        {
+            hash_entry() : hash(0), used(false) {}
+            std::string key;
+            size_t hash;
+            bool used;
+            value val;
+        };
+
+        size_t find_slot(const std::string& key,size_t hash) const;
+        void grow();
+
+        std::vector<value> dense;
+        std::vector<hash_entry> hashed;
+        size_t hash_count;
+    };
+
+    /// Makes v an array that nothing else shares, so its elements can be
+    /// changed. A value that isn't an array becomes an empty one.
+    array_data& make_unique_array(value& v);
+}
+
+#endif//__DSCRIPT_ARRAY_H__
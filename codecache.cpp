@@ -0,0 +1,108 @@
+////////////////////////////////////////////////////////////////////////////////
+// DScript Scripting Language
+// Copyright (C) 2003 Bryan "daerid" Ross
+//
+// Permission to copy, use, modify, sell and distribute this software is
+// granted provided this copyright notice appears in all copies. This
+// software is provided "as is" without express or implied warranty, and
+// with no claim as to its suitability for any purpose.
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// DScript Includes
+#include "codecache.h"
+////////////////////////////////////////////////////////////////////////////////
+
+using namespace std;
+using namespace dscript;
+
+namespace
+{
+    /// FNV-1a of the source, and whether it is compiled with array
+    /// aliases
+    size_t hash_source(const string& source,bool array_aliases)
+    {
+        size_t hash = 2166136261u;
+        for(size_t c = 0; c < source.size(); ++c)
+        {
+            hash ^= static_cast<unsigned char>(source[c]);
+            hash *= 16777619u;
+        }
+        hash ^= array_aliases ? 1 : 0;
+        hash *= 16777619u;
+        return hash;
+    }
+}
+
+code_cache::code_cache(size_t max_entries) : m_max_entries(max_entries)
+{
+}
+
+codeblock_ptr code_cache::find(const string& source,bool array_aliases)
+{
+    pair<hash_index::iterator,hash_index::iterator> found =
+        m_index.equal_range(hash_source(source,array_aliases));
+    for(; found.first != found.second; ++found.first)
+    {
+        entry_list::iterator e = found.first->second;
+        if(e->array_aliases == array_aliases && e->source == source)
+        {
+            // it's the most recently used now
+            m_entries.splice(m_entries.begin(),m_entries,e);
+            return e->code;
+        }
+    }
+    return codeblock_ptr();
+}
+
+void code_cache::insert(
+    const string& source,
+    bool array_aliases,
+    const codeblock_ptr& code,
+    vector<codeblock_ptr>& evicted
+    )
+{
+    if(m_max_entries == 0)
+    {
+        // kept by nothing, so it is evicted straight away
+        evicted.push_back(code);
+        return;
+    }
+    entry e;
+    e.hash = hash_source(source,array_aliases);
+    e.source = source;
+    e.array_aliases = array_aliases;
+    e.code = code;
+    m_entries.push_front(e);
+    m_index.insert(make_pair(e.hash,m_entries.begin()));
+    evict(evicted);
+}
+
+void code_cache::set_max_entries(
+    size_t max_entries,
+    vector<codeblock_ptr>& evicted
+    )
+{
+    m_max_entries = max_entries;
+    evict(evicted);
+}
+
+void code_cache::evict(vector<codeblock_ptr>& evicted)
+{
+    while(m_entries.size() > m_max_entries)
+    {
+        entry_list::iterator last = --m_entries.end();
+        pair<hash_index::iterator,hash_index::iterator> found =
+            m_index.equal_range(last->hash);
+        for(; found.first != found.second; ++found.first)
+        {
+            if(found.first->second == last)
+            {
+                m_index.erase(found.first);
+                break;
+            }
+        }
+        evicted.push_back(last->code);
+        m_entries.erase(last);
+    }
+}
@@ -0,0 +1,97 @@
+////////////////////////////////////////////////////////////////////////////////
+// DScript Scripting Language
+// Copyright (C) 2003 Bryan "daerid" Ross
+//
+// Permission to copy, use, modify, sell and distribute this software is
+// granted provided this copyright notice appears in all copies. This
+// software is provided "as is" without express or implied warranty, and
+// with no claim as to its suitability for any purpose.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __DSCRIPT_CODECACHE_H__
+#define __DSCRIPT_CODECACHE_H__
+
+////////////////////////////////////////////////////////////////////////////////
+// Standard Library Includes
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Boost Includes (http://www.boost.org)
+#include <boost/shared_ptr.hpp>
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// DScript Includes
+#include "instruction.h"
+////////////////////////////////////////////////////////////////////////////////
+
+namespace dscript
+{
+    /// A codeblock shared by the cache that compiled it and whatever is
+    /// still running it, or has functions defined in it
+    typedef boost::shared_ptr<codeblock_t> codeblock_ptr;
+
+    /// Keeps the code compiled from a number of sources, keyed by a hash
+    /// of the source, so the same source isn't compiled twice. Once it
+    /// is full, the least recently used codeblock is evicted to make
+    /// room for the next one.
+    class code_cache
+    {
+    public:
+        struct entry
+        {
+            size_t hash;
+            std::string source;
+            bool array_aliases;
+            codeblock_ptr code;
+        };
+        typedef std::list<entry>::const_iterator const_iterator;
+
+        explicit code_cache(size_t max_entries);
+
+        /// Returns the code compiled from source, with or without array
+        /// aliases, or an empty pointer if it isn't in the cache
+        codeblock_ptr find(const std::string& source,bool array_aliases);
+
+        /// Adds the code compiled from source. The codeblocks evicted to
+        /// make room are added to evicted, as is code itself if the
+        /// cache keeps none.
+        void insert(
+            const std::string& source,
+            bool array_aliases,
+            const codeblock_ptr& code,
+            std::vector<codeblock_ptr>& evicted
+            );
+
+        /// Changes how many codeblocks the cache keeps, 0 for none. The
+        /// codeblocks past it are added to evicted.
+        void set_max_entries(
+            size_t max_entries,
+            std::vector<codeblock_ptr>& evicted
+            );
+        size_t get_max_entries() const { return m_max_entries; }
+
+        size_t size() const { return m_entries.size(); }
+
+        /// The entries, the most recently used first
+        const_iterator begin() const { return m_entries.begin(); }
+        const_iterator end() const { return m_entries.end(); }
+
+    private:
+        /// Evicts the least recently used entries past m_max_entries
+        void evict(std::vector<codeblock_ptr>& evicted);
+
+        typedef std::list<entry> entry_list;
+        typedef std::multimap<size_t,entry_list::iterator> hash_index;
+
+        entry_list m_entries;
+        hash_index m_index;
+        size_t m_max_entries;
+    };
+}
+
+#endif//__DSCRIPT_CODECACHE_H__
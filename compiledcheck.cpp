@@ -0,0 +1,102 @@
+////////////////////////////////////////////////////////////////////////////////
+// DScript Scripting Language
+// Copyright (C) 2003 Bryan "daerid" Ross
+//
+// Permission to copy, use, modify, sell and distribute this software is
+// granted provided this copyright notice appears in all copies. This
+// software is provided "as is" without express or implied warranty, and
+// with no claim as to its suitability for any purpose.
+////////////////////////////////////////////////////////////////////////////////
+
+// compiledcheck: runs compiledcheck.ds with its script functions compiled
+// to C++ by dscript2cpp (see native.h), and host functions that declare
+// more functions while those run.
+//
+// usage: compiledcheck compiledcheck.ds
+//
+// The script calls check(value,expected,what) for everything it checks.
+// declare(count) declares count more functions, declared_0() on, each
+// returning its number. Exits with 1 if any check fails, or the script
+// doesn't run.
+
+////////////////////////////////////////////////////////////////////////////////
+// Standard Library Includes
+#include <iostream>
+#include <sstream>
+#include <string>
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// DScript Includes
+#include "dscript.h"
+#include "stdlib.h"
+////////////////////////////////////////////////////////////////////////////////
+
+#define ARGS const dscript::args_t& args,dscript::context& ctx
+
+using namespace std;
+using namespace dscript;
+
+// written by dscript2cpp
+void link_compiledcheck(context& ctx);
+
+namespace
+{
+    size_t failed = 0;
+    int declared = 0;
+
+    void declare(ARGS)
+    {
+        int count = args[0].to_int();
+        for(int i = 0; i < count; ++i, ++declared)
+        {
+            stringstream code;
+            code << "function declared_" << declared << "() { return "
+                << declared << "; }";
+            ctx.eval(code.str());
+        }
+    }
+
+    void check(ARGS)
+    {
+        if(args[0].to_str() == args[1].to_str())
+            return;
+        cout << args[2].to_str() << ": got \"" << args[0].to_str()
+            << "\", expected \"" << args[1].to_str() << '"' << endl;
+        ++failed;
+    }
+}
+
+int main(int argc,char* argv[])
+{
+    if(argc != 2)
+    {
+        cerr << "usage: compiledcheck compiledcheck.ds" << endl;
+        return 1;
+    }
+
+    context ctx;
+    ctx.enable_logging(&cout);
+    link_stdlib(ctx);
+    ctx.link_function("declare",declare,1,1,"declare(count)");
+    ctx.link_function("check",check,3,3,"check(value,expected,what)");
+    link_compiledcheck(ctx);
+    if(!ctx.exec(argv[1]))
+        ++failed;
+
+    // and called by the host
+    args_t args(1,value(64));
+    if(ctx.call("grow",args).to_int() != 64)
+    {
+        cout << "a compiled function called by the host returns after "
+            "declaring functions" << endl;
+        ++failed;
+    }
+
+    if(failed != 0)
+    {
+        cout << failed << " checks failed" << endl;
+        return 1;
+    }
+    return 0;
+}
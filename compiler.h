@@ -15,6 +15,12 @@
 // Standard Library Include Files
 #include <string>
 #include <stdexcept>
+#include <vector>
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Boost Includes (http://www.boost.org)
+#include <boost/shared_ptr.hpp>
 ////////////////////////////////////////////////////////////////////////////////
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -26,14 +32,52 @@
 
 namespace dscript
 {
-    /// Compile a string of dscript code into a codeblock
+    /// Changes whenever compile() would compile the same source to
+    /// different code, so that code compiled by an older version isn't
+    /// mistaken for it (see context::enable_compile_cache())
+    const unsigned int compiler_version = 1;
+
+    /// Compile a string of dscript code into a codeblock. With
+    /// array_aliases, $a[1] is compiled as the variable $a_1 instead of
+    /// an element of the array $a, like older versions of DScript did.
     codeblock_t compile(
         const std::string& code,
         string_table& strings,
-        float_table& floats
+        float_table& floats,
+        bool array_aliases = false
         );
 
-    /// Saves a compiled codeblock to a binary file, for faster loading times
+    /// Threads jumps, drops unreachable code and removes instructions that
+    /// undo each other in a compiled codeblock. compile() does this
+    /// already.
+    void optimize_codeblock(codeblock_t& code);
+
+    /// Compiles calls to short script functions declared in a codeblock
+    /// inline, behind a guard that makes the call instead once the
+    /// function is redefined, or while it calls a host function that may
+    /// use its %locals (see context::link_function()). compile() does
+    /// this already.
+    void inline_functions(codeblock_t& code,string_table& strings);
+
+    /// Optimizes the body of each function in a compiled codeblock through
+    /// an SSA form: common subexpressions, invariant code in loops and
+    /// stores to locals never read again. compile() does this already.
+    void optimize_functions(codeblock_t& code,string_table& strings);
+
+    /// Checks that a codeblock is safe for the vmachine to run: every
+    /// op_code is valid and has all of its operands, every jump lands on
+    /// an instruction of the function it is in, and the runtime stack
+    /// never underflows, is as deep on every path into an instruction
+    /// and is empty again when a function returns. Throws a
+    /// verify_error if it isn't. Records how deep each function takes
+    /// the runtime stack in the profile of its op_decl_func, and returns
+    /// how deep the code at file scope takes it. vmachine::link() does
+    /// this already.
+    size_t verify_codeblock(codeblock_t& code);
+
+    /// Saves a compiled codeblock to a binary file, for faster loading
+    /// times. The file is replaced in one step, so a file being loaded at
+    /// the same time is read either whole or not at all.
     void save_codeblock(
         const std::string& filename,
         const codeblock_t& code
@@ -47,6 +91,103 @@ namespace dscript
         float_table& floats
         );
 
+    /// Returns a compiled codeblock in the .dsc format save_codeblock()
+    /// writes, to be kept somewhere other than a file of its own
+    std::string write_compiled_data(const codeblock_t& code);
+
+    /// Loads a codeblock written by write_compiled_data() from memory
+    codeblock_t load_compiled_data(
+        const char* data,
+        size_t size,
+        string_table& strings,
+        float_table& floats
+        );
+
+    /// A compiled file loaded by load_compiled_lazy(). The file is kept
+    /// mapped, and the body of each function declared at file scope is
+    /// only decoded from it the first time the function is called.
+    class compiled_image
+    {
+    public:
+        virtual ~compiled_image() {}
+
+        /// Returns the code of the index'th function in the file's
+        /// directory, starting with its op_decl_func, and decodes it the
+        /// first time
+        virtual codeblock_t& get_function(
+            size_t index,
+            string_table& strings,
+            float_table& floats
+            ) = 0;
+
+        /// How many functions the directory has, and how many of them
+        /// have been decoded so far
+        virtual size_t get_function_count() const = 0;
+        virtual size_t get_decoded_count() const = 0;
+
+        /// Marks the strings the image has added to strings, see
+        /// string_table::mark()
+        virtual void mark_strings(string_table& strings) const = 0;
+    };
+    typedef boost::shared_ptr<compiled_image> compiled_image_ptr;
+
+    /// Loads a compiled file like load_compiled_file(), except that the
+    /// body of each function declared at file scope is left in the file,
+    /// behind an op_load_func that decodes it from image when it is first
+    /// called. image has to outlive the codeblock.
+    codeblock_t load_compiled_lazy(
+        const std::string& filename,
+        string_table& strings,
+        float_table& floats,
+        compiled_image_ptr& image
+        );
+
+    /// Packs a number of compiled scripts into one file, code[i] being
+    /// the script called names[i], with the constants they use pooled.
+    /// With compress, their code is deflated, which needs a build with
+    /// DSCRIPT_ZLIB defined.
+    void save_bundle(
+        const std::string& filename,
+        const std::vector<std::string>& names,
+        const std::vector<codeblock_t>& code,
+        bool compress
+        );
+
+    /// The compiled scripts in a file written by save_bundle()
+    class compiled_bundle
+    {
+    public:
+        virtual ~compiled_bundle() {}
+
+        /// How many scripts it has, and the name of each, in the order
+        /// they were packed in
+        virtual size_t get_script_count() const = 0;
+        virtual std::string get_script_name(size_t index) const = 0;
+
+        /// Returns whether it has a script called name
+        virtual bool has_script(const std::string& name) const = 0;
+
+        /// Loads the script called name the way load_compiled_lazy()
+        /// loads a file. The constants of the bundle are only added to
+        /// the tables once, so every script has to be loaded with the
+        /// same ones.
+        virtual codeblock_t load_script(
+            const std::string& name,
+            string_table& strings,
+            float_table& floats,
+            compiled_image_ptr& image
+            ) = 0;
+
+        /// Marks the strings the bundle has added to strings, see
+        /// string_table::mark()
+        virtual void mark_strings(string_table& strings) const = 0;
+    };
+    typedef boost::shared_ptr<compiled_bundle> compiled_bundle_ptr;
+
+    /// Opens a file written by save_bundle(). It is kept open until the
+    /// bundle, and every codeblock loaded from it, is gone.
+    compiled_bundle_ptr open_bundle(const std::string& filename);
+
     /// This is a support structure for tracking parse and compile
     /// errors, using exceptions.
     struct code_position
@@ -74,6 +215,16 @@ namespace dscript
             : runtime_error(msg), pos(p)
         {}
     };
+
+    /// This is thrown when a codeblock doesn't pass verify_codeblock(),
+    /// offset being where in the codeblock
+    struct verify_error : public std::runtime_error
+    {
+        size_t offset;
+        verify_error(const std::string& msg,size_t off)
+            : runtime_error(msg), offset(off)
+        {}
+    };
 }
 
 #endif//__DSCRIPT_COMPILER_H__
@@ -0,0 +1,417 @@
+////////////////////////////////////////////////////////////////////////////////
+// DScript Scripting Language
+// Copyright (C) 2003 Bryan "daerid" Ross
+//
+// Permission to copy, use, modify, sell and distribute this software is
+// granted provided this copyright notice appears in all copies. This
+// software is provided "as is" without express or implied warranty, and
+// with no claim as to its suitability for any purpose.
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Standard Library Include Files
+#include <climits>
+#include <cmath>
+#include <string>
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// DScript Include Files
+#include "compiler_emit.h"
+#include "operators.h"
+////////////////////////////////////////////////////////////////////////////////
+
+using namespace std;
+using namespace dscript;
+
+namespace
+{
+    /// Finds the last instruction emitted since start, and how many were
+    /// emitted. Returns false if there are none, or if any of them jumps
+    /// to the end of the code, since a superinstruction fused onto the last
+    /// one would swallow that jump target.
+    bool find_last_instr(
+        const compile_context& ctx,
+        size_t start,
+        size_t& last,
+        size_t& count
+        )
+    {
+        count = 0;
+        for(size_t off = start; off < ctx.code.size(); ++count)
+        {
+            const char* operands = get_op_operands(ctx.code[off].get_op_code());
+            for(size_t i = 1; *operands != '\0'; ++operands, ++i)
+            {
+                if(
+                    *operands == 'o' &&
+                    size_t(ctx.code[off + i].get_int()) == ctx.code.size()
+                    )
+                    return false;
+            }
+            last = off;
+            off += get_instr_size(ctx.code.begin() + off);
+        }
+        return count != 0;
+    }
+
+    /// Returns the superinstruction that pushes the value of a single
+    /// instruction expression straight onto the param stack, or op_invalid
+    op_code get_param_op(op_code push_op)
+    {
+        switch(push_op)
+        {
+        case op_push_str:   return op_param_str;
+        case op_push_int:   return op_param_int;
+        case op_push_var:   return op_param_var;
+        case op_push_local: return op_param_local;
+        default:            return op_invalid;
+        }
+    }
+
+    /// Returns the superinstruction that compares and jumps if false,
+    /// or op_invalid
+    op_code get_cmp_jmp_false_op(op_code cmp_op)
+    {
+        switch(cmp_op)
+        {
+        case op_cmp_less_eq:    return op_cmp_less_eq_jmp_false;
+        case op_cmp_less:       return op_cmp_less_jmp_false;
+        case op_cmp_grtr_eq:    return op_cmp_grtr_eq_jmp_false;
+        case op_cmp_grtr:       return op_cmp_grtr_jmp_false;
+        case op_eq:             return op_eq_jmp_false;
+        case op_neq:            return op_neq_jmp_false;
+        default:                return op_invalid;
+        }
+    }
+
+    /// Reads the constant an op_push_int, op_push_float or op_push_str at
+    /// off pushes. Returns false if the instruction is something else.
+    bool get_constant(const compile_context& ctx, size_t off, value& val)
+    {
+        switch(ctx.code[off].get_op_code())
+        {
+        case op_push_int:
+            val = ctx.code[off + 1].get_int();
+            return true;
+        case op_push_float:
+            val = *(ctx.code[off + 1].get_flt());
+            return true;
+        case op_push_str:
+            val = ctx.code[off + 1].get_str();
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    /// Reads the constant the expression compiled from start to end pushes,
+    /// if it is nothing but a constant
+    bool get_constant_expr(
+        const compile_context& ctx,
+        size_t start,
+        size_t end,
+        value& val
+        )
+    {
+        return end == start + 2 && get_constant(ctx,start,val);
+    }
+
+    /// Returns whether val can be pushed as a constant. The float table
+    /// can't tell -0.0 from 0.0, and can't hold a NaN at all.
+    bool is_constant(const value& val)
+    {
+        if(val.type != value::type_flt)
+            return true;
+        return val.fltval == val.fltval && (val.fltval != 0 || !signbit(val.fltval));
+    }
+
+    /// Replaces the code compiled since start with a push of val
+    void emit_constant(const value& val, size_t start, compile_context& ctx)
+    {
+        ctx.code.resize(start);
+        switch(val.type)
+        {
+        case value::type_int:
+            ctx.code.push_back(op_push_int);
+            ctx.code.push_back(val.intval);
+            break;
+        case value::type_flt:
+            ctx.code.push_back(op_push_float);
+            ctx.code.push_back(ctx.floats.insert(val.fltval));
+            break;
+        default:
+            ctx.code.push_back(op_push_str);
+            ctx.code.push_back(
+                ctx.strings.insert(string(val.str_begin(),val.str_length()))
+                );
+            break;
+        }
+    }
+
+    /// Finds the type of the value the expression compiled from start to
+    /// end leaves on the stack, where its last op_code always leaves the
+    /// same type. Returns false if it doesn't.
+    bool get_expr_type(
+        const compile_context& ctx,
+        size_t start,
+        size_t end,
+        value::ty& type
+        )
+    {
+        if(start == end)
+            return false;
+        size_t last = start;
+        for(size_t off = start; off < end; off += get_instr_size(ctx.code.begin() + off))
+            last = off;
+        switch(ctx.code[last].get_op_code())
+        {
+        case op_push_int:
+        case op_neg:
+        case op_log_not:
+        case op_bit_not:
+        case op_mod:
+        case op_shl:
+        case op_shr:
+        case op_cmp_less_eq:
+        case op_cmp_less:
+        case op_cmp_grtr_eq:
+        case op_cmp_grtr:
+        case op_eq:
+        case op_neq:
+        case op_bit_and:
+        case op_bit_or:
+        case op_bit_xor:
+        case op_bool:
+            type = value::type_int;
+            return true;
+        case op_push_float:
+            type = value::type_flt;
+            return true;
+        case op_push_str:
+        case op_cat:
+            type = value::type_str;
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    /// Returns whether a binary op can be done at compile time. Anything that
+    /// is an error at runtime, or undefined for C++ ints, is left to the
+    /// vmachine.
+    bool can_fold(op_code op, const value& lhs, const value& rhs)
+    {
+        bool ints = lhs.type == value::type_int && rhs.type == value::type_int;
+        switch(op)
+        {
+        case op_add:
+        case op_sub:
+        case op_mul:
+            {
+                if(!ints)
+                    return true;
+                long long l = lhs.intval;
+                long long r = rhs.intval;
+                long long result = op == op_add ? l + r : op == op_sub ? l - r : l * r;
+                return result >= INT_MIN && result <= INT_MAX;
+            }
+        case op_div:
+            return !ints || (
+                rhs.intval != 0 &&
+                !(lhs.intval == INT_MIN && rhs.intval == -1)
+                );
+        case op_mod:
+            {
+                int divisor = rhs.to_int();
+                return divisor != 0 && !(lhs.to_int() == INT_MIN && divisor == -1);
+            }
+        case op_shl:
+        case op_shr:
+            {
+                int count = rhs.to_int();
+                return count >= 0 && count < 32 && (op == op_shr || lhs.to_int() >= 0);
+            }
+        default:
+            return true;
+        }
+    }
+
+    /// Returns whether lhs op rhs is lhs, for every lhs of the given type
+    bool is_identity(op_code op, value::ty type, const value& rhs)
+    {
+        if(type == value::type_str)
+            return op == op_cat && rhs.type == value::type_str && rhs.str_length() == 0;
+        if(type != value::type_int || rhs.type != value::type_int)
+            return false;
+        switch(op)
+        {
+        case op_add:
+        case op_sub:
+        case op_shl:
+        case op_shr:
+        case op_bit_or:
+        case op_bit_xor:
+            return rhs.intval == 0;
+        case op_mul:
+        case op_div:
+            return rhs.intval == 1;
+        default:
+            return false;
+        }
+    }
+}
+
+int dscript::local_slot(const string& token, compile_context& ctx)
+{
+    if(ctx.locals == 0 || token[0] != '%')
+        return -1;
+    compile_context::slot_map::const_iterator found =
+        ctx.locals->find(token.c_str());
+    if(found == ctx.locals->end())
+        return -1;
+    return found->second;
+}
+
+void dscript::emit_var_op(
+    op_code named_op,
+    op_code slot_op,
+    const string& token,
+    compile_context& ctx
+    )
+{
+    int slot = local_slot(token,ctx);
+    if(slot == -1)
+    {
+        ctx.code.push_back(named_op);
+        ctx.code.push_back(ctx.strings.insert(token));
+    }
+    else
+    {
+        ctx.code.push_back(slot_op);
+        ctx.code.push_back(slot);
+    }
+}
+
+void dscript::emit_push_param(size_t start, compile_context& ctx)
+{
+    size_t last, count;
+    if(find_last_instr(ctx,start,last,count) && count == 1)
+    {
+        op_code param_op = get_param_op(ctx.code[last].get_op_code());
+        if(param_op != op_invalid)
+        {
+            ctx.code[last] = param_op;
+            return;
+        }
+    }
+    ctx.code.push_back(op_push_param);
+}
+
+void dscript::emit_bool(size_t start, compile_context& ctx)
+{
+    size_t last, count;
+    if(find_last_instr(ctx,start,last,count))
+    {
+        switch(ctx.code[last].get_op_code())
+        {
+        case op_cmp_less_eq:
+        case op_cmp_less:
+        case op_cmp_grtr_eq:
+        case op_cmp_grtr:
+        case op_eq:
+        case op_neq:
+        case op_log_not:
+        case op_bool:
+            return;
+        default:
+            break;
+        }
+    }
+    ctx.code.push_back(op_bool);
+}
+
+void dscript::emit_jmp_false(size_t start, compile_context& ctx)
+{
+    size_t last, count;
+    if(find_last_instr(ctx,start,last,count))
+    {
+        op_code jmp_op = get_cmp_jmp_false_op(ctx.code[last].get_op_code());
+        if(jmp_op != op_invalid)
+        {
+            ctx.code[last] = jmp_op;
+            return;
+        }
+    }
+    ctx.code.push_back(op_jmp_false);
+}
+
+void dscript::emit_binary(
+    op_code op,
+    size_t lhs_start,
+    size_t rhs_start,
+    compile_context& ctx
+    )
+{
+    value lhs;
+    value rhs;
+    if(get_constant_expr(ctx,rhs_start,ctx.code.size(),rhs))
+    {
+        if(
+            get_constant_expr(ctx,lhs_start,rhs_start,lhs) &&
+            can_fold(op,lhs,rhs)
+            )
+        {
+            asn_func asn = get_asn_func(op);
+            if(asn != 0)
+                asn(lhs,rhs);
+            else
+                lhs = static_cast<int>(compare(op,lhs,rhs));
+            if(is_constant(lhs))
+            {
+                emit_constant(lhs,lhs_start,ctx);
+                return;
+            }
+        }
+
+        value::ty type;
+        if(
+            get_expr_type(ctx,lhs_start,rhs_start,type) &&
+            is_identity(op,type,rhs)
+            )
+        {
+            ctx.code.resize(rhs_start);
+            return;
+        }
+    }
+    ctx.code.push_back(op);
+}
+
+void dscript::emit_unary(op_code op, size_t start, compile_context& ctx)
+{
+    value val;
+    if(get_constant_expr(ctx,start,ctx.code.size(),val))
+    {
+        // like the vmachine, promote to int
+        val.set_type(value::type_int);
+        if(op != op_neg || val.intval != INT_MIN)
+        {
+            if(op == op_neg)
+                val.intval = -val.intval;
+            else if(op == op_log_not)
+                val.intval = !val.intval;
+            else
+                val.intval = ~val.intval;
+            emit_constant(val,start,ctx);
+            return;
+        }
+    }
+    ctx.code.push_back(op);
+}
+
+void dscript::optimize_compiled(compile_context& ctx)
+{
+    inline_functions(ctx.code,ctx.strings);
+    optimize_functions(ctx.code,ctx.strings);
+    optimize_codeblock(ctx.code);
+}
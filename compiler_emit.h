@@ -0,0 +1,108 @@
+////////////////////////////////////////////////////////////////////////////////
+// DScript Scripting Language
+// Copyright (C) 2003 Bryan "daerid" Ross
+//
+// Permission to copy, use, modify, sell and distribute this software is
+// granted provided this copyright notice appears in all copies. This
+// software is provided "as is" without express or implied warranty, and
+// with no claim as to its suitability for any purpose.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __DSCRIPT_COMPILER_EMIT_H__
+#define __DSCRIPT_COMPILER_EMIT_H__
+
+////////////////////////////////////////////////////////////////////////////////
+// Standard Library Include Files
+#include <map>
+#include <stack>
+#include <string>
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// DScript Include Files
+#include "compiler.h"
+////////////////////////////////////////////////////////////////////////////////
+
+// The code generation shared by the two front ends of the compiler: the
+// recursive descent parser compile() uses, and the Spirit parse tree
+// compile_spirit() (see compiler_spirit.h) uses.
+
+namespace dscript
+{
+    /// This struct contains all the information that the compiler
+    /// needs to emit a codeblock
+    struct compile_context
+    {
+        compile_context(
+            string_table& _strings,
+            float_table& _floats,
+            bool _array_aliases
+            ) : strings(_strings), floats(_floats),
+            array_aliases(_array_aliases), func_depth(0), loop_count(0), locals(0)
+        {
+        }
+        string_table& strings;
+        float_table& floats;
+
+        // compile $a[1] as $a_1 (see dscript::compile)
+        bool array_aliases;
+
+        size_t func_depth;
+        size_t loop_count;
+
+        // the frame slots of the function being compiled (0 at file scope)
+        typedef std::map<string_table::entry,int,cmp_ste> slot_map;
+        slot_map* locals;
+
+        std::stack< std::stack<size_t> > break_indices;
+        std::stack< std::stack<size_t> > continue_indices;
+
+        codeblock_t code; // get the count by calling size()
+    };
+
+    /// Returns the frame slot of a variable in the function being compiled,
+    /// or -1 if the variable has to be looked up by name at runtime
+    int local_slot(const std::string& token, compile_context& ctx);
+
+    /// Emits an op_code that works on a named variable, using the frame
+    /// slot form of the op_code if the variable has a slot
+    void emit_var_op(
+        op_code named_op,
+        op_code slot_op,
+        const std::string& token,
+        compile_context& ctx
+        );
+
+    /// Pushes the value of the expression compiled since start onto the
+    /// param stack. A constant or a variable is fused with the push.
+    void emit_push_param(size_t start, compile_context& ctx);
+
+    /// Makes sure the expression compiled since start leaves 0 or 1 on the
+    /// stack. Comparisons and logical ops already do.
+    void emit_bool(size_t start, compile_context& ctx);
+
+    /// Emits the op_jmp_false testing the expression compiled since start.
+    /// The caller emits the offset. A comparison at the end of the
+    /// expression is fused with the jump.
+    void emit_jmp_false(size_t start, compile_context& ctx);
+
+    /// Emits a binary op, whose left operand was compiled from lhs_start and
+    /// its right one from rhs_start. Two constant operands are folded into
+    /// a constant, done with the same operators the vmachine uses, and an op
+    /// that can't change its left operand (such as an int + 0) is left out.
+    void emit_binary(
+        op_code op,
+        size_t lhs_start,
+        size_t rhs_start,
+        compile_context& ctx
+        );
+
+    /// Emits op_neg, op_log_not or op_bit_not on the expression compiled
+    /// since start, folding it into a constant operand
+    void emit_unary(op_code op, size_t start, compile_context& ctx);
+
+    /// Runs the passes over a compiled codeblock that compile() runs
+    void optimize_compiled(compile_context& ctx);
+}
+
+#endif//__DSCRIPT_COMPILER_EMIT_H__
@@ -0,0 +1,507 @@
+////////////////////////////////////////////////////////////////////////////////
+// DScript Scripting Language
+// Copyright (C) 2003 Bryan "daerid" Ross
+//
+// Permission to copy, use, modify, sell and distribute this software is
+// granted provided this copyright notice appears in all copies. This
+// software is provided "as is" without express or implied warranty, and
+// with no claim as to its suitability for any purpose.
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Standard Library Include Files
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// DScript Include Files
+#include "compiler.h"
+////////////////////////////////////////////////////////////////////////////////
+
+using namespace std;
+using namespace dscript;
+
+namespace
+{
+    const size_t npos = size_t(-1);
+
+    // functions with longer bodies are always called
+    const size_t max_inline_size = 32;
+
+    /// Returns whether op reads or writes a variable by a name only known
+    /// at runtime, which could be one of the function's %locals
+    bool is_dynamic_op(op_code op)
+    {
+        switch(op)
+        {
+        case op_push_var_value:
+        case op_assign:
+        case op_mul_asn:
+        case op_div_asn:
+        case op_mod_asn:
+        case op_add_asn:
+        case op_sub_asn:
+        case op_cat_asn:
+        case op_band_asn:
+        case op_bor_asn:
+        case op_bxor_asn:
+        case op_shl_asn:
+        case op_shr_asn:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    /// Returns the named variable form of a frame slot op_code, for code
+    /// inlined where %locals have no frame slots
+    op_code get_named_op(op_code op)
+    {
+        switch(op)
+        {
+        case op_push_local:         return op_push_var;
+        case op_pop_param_local:    return op_pop_param;
+        case op_param_local:        return op_param_var;
+        case op_push_elem_local:    return op_push_elem;
+        case op_asn_elem_local:     return op_asn_elem;
+        case op_inc_local:          return op_inc_var;
+        case op_dec_local:          return op_dec_var;
+        case op_assign_local:       return op_assign_var;
+        case op_mul_asn_local:      return op_mul_asn_var;
+        case op_div_asn_local:      return op_div_asn_var;
+        case op_mod_asn_local:      return op_mod_asn_var;
+        case op_add_asn_local:      return op_add_asn_var;
+        case op_sub_asn_local:      return op_sub_asn_var;
+        case op_cat_asn_local:      return op_cat_asn_var;
+        case op_band_asn_local:     return op_band_asn_var;
+        case op_bor_asn_local:      return op_bor_asn_var;
+        case op_bxor_asn_local:     return op_bxor_asn_var;
+        case op_shl_asn_local:      return op_shl_asn_var;
+        case op_shr_asn_local:      return op_shr_asn_var;
+        default:                    return op_invalid;
+        }
+    }
+
+    /// A script function declared in the codeblock, which can be
+    /// compiled inline
+    struct inline_func
+    {
+        size_t decl;
+        size_t start;
+        size_t end;
+        size_t param_count;
+        // the names its %locals get where it is inlined
+        vector<string_table::entry> local_names;
+        // whether it can return without a value
+        bool returns_nothing;
+    };
+
+    /// Where calls are compiled: the body of a function, or code outside
+    /// of any, whose %locals have no frame slots
+    struct scope
+    {
+        scope() : decl(npos), end(npos), slot_count(0) {}
+
+        size_t decl;
+        size_t end;
+        size_t slot_count;
+        // the first frame slot each function inlined in it uses
+        map<string_table::symbol,size_t> bases;
+    };
+
+    /// The codeblock being compiled with calls inline. The code is laid
+    /// out again into a new codeblock.
+    class inliner
+    {
+    public:
+        inliner(const codeblock_t& code,string_table& strings)
+            : m_code(code),
+              m_strings(strings),
+              m_new_offsets(code.size() + 1,npos)
+        {}
+
+        /// Returns false if there is no call to inline
+        bool find_calls()
+        {
+            find_funcs();
+            if(m_funcs.empty())
+                return false;
+            find_sites();
+            return !m_sites.empty();
+        }
+
+        void inline_calls(codeblock_t& out)
+        {
+            vector<scope> scopes(1);
+            scopes.back().end = m_code.size();
+            for(size_t off = 0; off < m_code.size(); )
+            {
+                while(off >= scopes.back().end)
+                    scopes.pop_back();
+                m_new_offsets[off] = out.size();
+                op_code op = m_code[off].get_op_code();
+                if(op == op_decl_func)
+                {
+                    scopes.push_back(m_scopes[off]);
+                    emit_decl(off,scopes.back(),out);
+                }
+                else if(m_sites.count(off) != 0)
+                    emit_inline(off,scopes.back(),out);
+                else
+                    copy(off,out);
+                off += size(off);
+            }
+            m_new_offsets[m_code.size()] = out.size();
+
+            for(size_t i = 0; i < m_fixups.size(); ++i)
+            {
+                size_t target = out[m_fixups[i]].get_int();
+                out[m_fixups[i]] = static_cast<int>(m_new_offsets[target]);
+            }
+        }
+
+    private:
+        size_t size(size_t off) const
+        {
+            return get_instr_size(m_code.begin() + off);
+        }
+
+        string_table::symbol name_at(size_t off) const
+        {
+            return string_table::get_symbol(m_code[off].get_str());
+        }
+
+        /// Finds the functions that can be compiled inline: the short
+        /// ones, declared only once, that don't call themselves or name
+        /// their %locals at runtime, nor declare functions of their own.
+        /// A host function they call could still name their %locals, so
+        /// the guard makes the call instead when one of them may (see
+        /// vmachine::is_inlined()).
+        void find_funcs()
+        {
+            set<string_table::symbol> declared;
+            for(size_t off = 0; off < m_code.size(); off += size(off))
+            {
+                if(m_code[off].get_op_code() != op_decl_func)
+                    continue;
+                string_table::symbol name = name_at(off + 1);
+                if(!declared.insert(name).second)
+                {
+                    m_funcs.erase(name);
+                    continue;
+                }
+
+                inline_func func;
+                func.decl = off;
+                func.end = m_code[off + 2].get_int();
+                func.start = off + size(off);
+                func.param_count = 0;
+                if(func.end - func.start > max_inline_size || !check_body(func))
+                    continue;
+
+                // %name in function f is %f.name inlined
+                string prefix = string("%") + m_code[off + 1].get_str() + '.';
+                size_t slot_count = m_code[off + 3].get_int();
+                for(size_t slot = 0; slot < slot_count; ++slot)
+                {
+                    string local = m_code[off + 4 + slot].get_str();
+                    func.local_names.push_back(m_strings.insert(prefix + local.substr(1)));
+                }
+                m_funcs[name] = func;
+            }
+        }
+
+        /// Checks the code of a function can be inlined, and finds its
+        /// parameters and whether it can return without a value
+        bool check_body(inline_func& func) const
+        {
+            string_table::symbol name = name_at(func.decl + 1);
+            bool params = true;
+            for(size_t off = func.start; off < func.end; off += size(off))
+            {
+                op_code op = m_code[off].get_op_code();
+                if(op == op_pop_param_local && params)
+                {
+                    ++func.param_count;
+                    continue;
+                }
+                params = false;
+                if(
+                    op == op_decl_func ||
+                    op == op_pop_param ||
+                    op == op_pop_param_local ||
+                    op == op_inline_guard ||
+                    is_dynamic_op(op)
+                    )
+                    return false;
+                if(
+                    (op == op_call_func || op == op_call_load_ret) &&
+                    name_at(off + 1) == name
+                    )
+                    return false;
+                if(get_op_operands(op)[0] == 'n')
+                {
+                    string_table::entry var = m_code[off + 1].get_str();
+                    if(var[0] == '%')
+                        return false;
+                }
+            }
+
+            // the op_return the compiler puts at the end of every
+            // function usually can't be got to
+            func.returns_nothing = false;
+            vector<bool> seen(func.end - func.start + 1,false);
+            vector<size_t> work(1,func.start);
+            while(!work.empty())
+            {
+                size_t off = work.back();
+                work.pop_back();
+                if(off >= func.end || seen[off - func.start])
+                    continue;
+                seen[off - func.start] = true;
+                op_code op = m_code[off].get_op_code();
+                if(op == op_return)
+                    func.returns_nothing = true;
+                const char* operands = get_op_operands(op);
+                if(operands[0] == 'o')
+                    work.push_back(m_code[off + 1].get_int());
+                if(op != op_jmp && op != op_return && op != op_return_value)
+                    work.push_back(off + size(off));
+            }
+            return true;
+        }
+
+        /// Finds the calls to inline, and the frame slots each function
+        /// needs for the ones inlined in it
+        void find_sites()
+        {
+            vector<size_t> decls(1,npos);
+            vector<size_t> ends(1,m_code.size());
+            for(size_t off = 0; off < m_code.size(); off += size(off))
+            {
+                while(off >= ends.back())
+                {
+                    decls.pop_back();
+                    ends.pop_back();
+                }
+                op_code op = m_code[off].get_op_code();
+                if(op == op_decl_func)
+                {
+                    decls.push_back(off);
+                    ends.push_back(m_code[off + 2].get_int());
+                    scope& s = m_scopes[off];
+                    s.decl = off;
+                    s.end = m_code[off + 2].get_int();
+                    s.slot_count = m_code[off + 3].get_int();
+                    continue;
+                }
+                if(op != op_call_func && op != op_call_load_ret)
+                    continue;
+
+                string_table::symbol name = name_at(off + 1);
+                map<string_table::symbol,inline_func>::const_iterator func =
+                    m_funcs.find(name);
+                if(
+                    func == m_funcs.end() ||
+                    func->second.decl == decls.back() ||
+                    size_t(m_code[off + 2].get_int()) != func->second.param_count
+                    )
+                    continue;
+                m_sites.insert(off);
+
+                // inlined in a function, it gets frame slots of its own
+                if(decls.back() == npos)
+                    continue;
+                scope& s = m_scopes[decls.back()];
+                if(s.bases.find(name) == s.bases.end())
+                {
+                    s.bases[name] = s.slot_count;
+                    s.slot_count += func->second.local_names.size();
+                }
+            }
+        }
+
+        /// Copies an instruction, with its offsets to be fixed up
+        void copy(size_t off,codeblock_t& out)
+        {
+            const char* operands = get_op_operands(m_code[off].get_op_code());
+            out.push_back(m_code[off]);
+            for(size_t i = 1; *operands != '\0'; ++operands, ++i)
+            {
+                if(*operands == 'o' || *operands == 'd')
+                    m_fixups.push_back(out.size());
+                out.push_back(m_code[off + i]);
+            }
+        }
+
+        /// Copies a function declaration, with a frame slot for each
+        /// %local of every function inlined in it
+        void emit_decl(size_t off,const scope& s,codeblock_t& out)
+        {
+            size_t slot_count = m_code[off + 3].get_int();
+            out.push_back(op_decl_func);
+            out.push_back(m_code[off + 1]);
+            m_fixups.push_back(out.size());
+            out.push_back(m_code[off + 2]);
+            out.push_back(static_cast<int>(s.slot_count));
+            out.insert(
+                out.end(),
+                m_code.begin() + off + 4,
+                m_code.begin() + off + 4 + slot_count
+                );
+
+            vector<string_table::entry> names(s.slot_count - slot_count);
+            map<string_table::symbol,size_t>::const_iterator base = s.bases.begin();
+            for(; base != s.bases.end(); ++base)
+            {
+                const inline_func& func = m_funcs[base->first];
+                for(size_t i = 0; i < func.local_names.size(); ++i)
+                    names[base->second - slot_count + i] = func.local_names[i];
+            }
+            out.insert(out.end(),names.begin(),names.end());
+        }
+
+        /// Writes an instruction of an inlined function that works on one
+        /// of its %locals
+        void emit_local_op(
+            size_t off,
+            const inline_func& func,
+            const scope& s,
+            size_t base,
+            codeblock_t& out
+            )
+        {
+            op_code op = m_code[off].get_op_code();
+            size_t slot = m_code[off + 1].get_int();
+            if(s.decl == npos)
+            {
+                out.push_back(get_named_op(op));
+                out.push_back(func.local_names[slot]);
+            }
+            else
+            {
+                out.push_back(op);
+                out.push_back(static_cast<int>(base + slot));
+            }
+            out.insert(
+                out.end(),
+                m_code.begin() + off + 2,
+                m_code.begin() + off + size(off)
+                );
+        }
+
+        /// Writes the function a call calls in place of the call, after
+        /// an op_inline_guard jumping to the call itself
+        void emit_inline(size_t off,const scope& s,codeblock_t& out)
+        {
+            string_table::symbol name = name_at(off + 1);
+            const inline_func& func = m_funcs[name];
+            size_t base = s.decl == npos ? 0 : s.bases.find(name)->second;
+
+            size_t guard = out.size();
+            out.push_back(op_inline_guard);
+            out.push_back(0);
+            m_fixups.push_back(out.size());
+            out.push_back(static_cast<int>(func.decl));
+            out.push_back(m_code[off + 1]);
+            out.push_back(size_t(0));
+            out.push_back(size_t(0));
+
+            // the call clears the return value, and starts the function
+            // with all of its %locals empty
+            string_table::entry empty = m_strings.insert("");
+            if(func.returns_nothing)
+            {
+                out.push_back(op_push_str);
+                out.push_back(empty);
+                out.push_back(op_store_ret);
+            }
+            for(size_t slot = func.param_count; slot < func.local_names.size(); ++slot)
+            {
+                out.push_back(op_push_str);
+                out.push_back(empty);
+                if(s.decl == npos)
+                {
+                    out.push_back(op_assign_var);
+                    out.push_back(func.local_names[slot]);
+                }
+                else
+                {
+                    out.push_back(op_assign_local);
+                    out.push_back(static_cast<int>(base + slot));
+                }
+            }
+
+            // returning leaves the return value in the register, like a
+            // call does, and goes to the end
+            vector<size_t> new_offsets(func.end - func.start + 1);
+            vector<size_t> jumps;
+            vector<size_t> returns;
+            for(size_t body = func.start; body < func.end; body += size(body))
+            {
+                new_offsets[body - func.start] = out.size();
+                op_code op = m_code[body].get_op_code();
+                const char* operands = get_op_operands(op);
+                if(op == op_return_value)
+                    out.push_back(op_store_ret);
+                if(op == op_return_value || op == op_return)
+                {
+                    out.push_back(op_jmp);
+                    returns.push_back(out.size());
+                    out.push_back(0);
+                }
+                else if(operands[0] == 'l')
+                    emit_local_op(body,func,s,base,out);
+                else
+                {
+                    out.push_back(m_code[body]);
+                    for(size_t i = 1; *operands != '\0'; ++operands, ++i)
+                    {
+                        if(*operands == 'o')
+                            jumps.push_back(out.size());
+                        out.push_back(m_code[body + i]);
+                    }
+                }
+            }
+
+            // the call, for when the function has been redefined
+            out[guard + 1] = static_cast<int>(out.size());
+            out.push_back(op_call_func);
+            out.insert(out.end(),m_code.begin() + off + 1,m_code.begin() + off + 5);
+
+            size_t done = out.size();
+            new_offsets[func.end - func.start] = done;
+            for(size_t i = 0; i < returns.size(); ++i)
+                out[returns[i]] = static_cast<int>(done);
+            for(size_t i = 0; i < jumps.size(); ++i)
+            {
+                size_t target = out[jumps[i]].get_int() - func.start;
+                out[jumps[i]] = static_cast<int>(new_offsets[target]);
+            }
+            if(m_code[off].get_op_code() == op_call_load_ret)
+                out.push_back(op_load_ret);
+        }
+
+        const codeblock_t& m_code;
+        string_table& m_strings;
+        map<string_table::symbol,inline_func> m_funcs;
+        map<size_t,scope> m_scopes;
+        set<size_t> m_sites;
+        vector<size_t> m_new_offsets;
+        vector<size_t> m_fixups;
+    };
+}
+
+void dscript::inline_functions(codeblock_t& code,string_table& strings)
+{
+    inliner calls(code,strings);
+    if(!calls.find_calls())
+        return;
+    codeblock_t out;
+    out.reserve(code.size() * 2);
+    calls.inline_calls(out);
+    code.swap(out);
+}
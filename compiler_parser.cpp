@@ -0,0 +1,1183 @@
+////////////////////////////////////////////////////////////////////////////////
+// DScript Scripting Language
+// Copyright (C) 2003 Bryan "daerid" Ross
+//
+// Permission to copy, use, modify, sell and distribute this software is
+// granted provided this copyright notice appears in all copies. This
+// software is provided "as is" without express or implied warranty, and
+// with no claim as to its suitability for any purpose.
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Standard Library Include Files
+#include <cstddef>
+#include <stack>
+#include <string>
+#include <vector>
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// DScript Include Files
+#include "compiler_emit.h"
+#include "lexer.h"
+////////////////////////////////////////////////////////////////////////////////
+
+// The recursive descent parser compile() uses. It follows the Spirit grammar
+// in compiler_spirit.cpp rule for rule, trying the alternatives of each in
+// the same order, and emits the same code the parse tree compiler does as it
+// goes, without building a tree. Where the code comes out in a different order
+// than the source (function params, the iteration statement of a for loop,
+// the indexes of an array element that is incremented), the code already
+// emitted is moved.
+
+using namespace std;
+using namespace dscript;
+
+namespace
+{
+    /// Adds delta to the jump targets in code[begin,end) that are at or
+    /// past from
+    void relocate(
+        codeblock_t& code,
+        size_t begin,
+        size_t end,
+        size_t from,
+        ptrdiff_t delta
+        )
+    {
+        for(size_t off = begin; off < end; off += get_instr_size(code.begin() + off))
+        {
+            const char* operands = get_op_operands(code[off].get_op_code());
+            for(size_t i = 1; *operands != '\0'; ++operands, ++i)
+            {
+                if(*operands == 'o' && code[off + i].get_offset() >= from)
+                    code[off + i] = size_t(code[off + i].get_offset() + delta);
+            }
+        }
+    }
+
+    /// Adds by to the offsets waiting to be resolved that are at or past
+    /// from
+    void shift_indices(stack<size_t>& indices,size_t from,size_t by)
+    {
+        if(indices.empty())
+            return;
+        size_t index = indices.top();
+        indices.pop();
+        shift_indices(indices,from,by);
+        indices.push(index >= from ? index + by : index);
+    }
+
+    void shift_indices(stack< stack<size_t> >& indices,size_t from,size_t by)
+    {
+        if(indices.empty())
+            return;
+        stack<size_t> top = indices.top();
+        indices.pop();
+        shift_indices(indices,from,by);
+        shift_indices(top,from,by);
+        indices.push(top);
+    }
+
+    /// Points the offsets waiting to be resolved at target
+    void resolve(stack<size_t>& indices,size_t target,codeblock_t& code)
+    {
+        while(indices.size() > 0)
+        {
+            code[indices.top()] = target;
+            indices.pop();
+        }
+    }
+
+    /// A variable the parser has matched. The code of the indexes of an
+    /// array element is emitted where the variable is, the op_code that
+    /// uses it is left to the caller.
+    struct var_ref
+    {
+        string token; // the name, $ or % included
+        bool is_elem;
+        size_t index_count;
+
+        // where the code of the indexes starts and ends. With array
+        // aliases, it pushes the name first and appends each index to it.
+        size_t start;
+        size_t end;
+    };
+
+    class parser
+    {
+    public:
+        parser(const string& source,compile_context& ctx)
+            : m_ctx(ctx), m_code(ctx.code),
+            m_lex(source.data(),source.data() + source.size()),
+            m_error(0), m_error_pos(0)
+        {
+        }
+
+        /// Parses the whole source, as a list of statements
+        void parse_script()
+        {
+            // like Spirit, the first statement starts past the white space
+            m_lex.skip();
+            while(stmt())
+            {
+                if(m_error != 0)
+                    throw compiler_error(m_error,m_lex.get_position(m_error_pos));
+            }
+            m_lex.skip();
+            if(!m_lex.at_end())
+            {
+                lexer::position pos = m_lex.tell();
+                if(m_lex.furthest() > pos)
+                    pos = m_lex.furthest();
+                throw compiler_error("Parse Error",m_lex.get_position(pos));
+            }
+        }
+
+    private:
+        /// What has to be put back to try another alternative
+        struct mark
+        {
+            lexer::position pos;
+            size_t code_size;
+            size_t slot_count;
+            bool has_error;
+        };
+
+        mark get_mark() const
+        {
+            mark m;
+            m.pos = m_lex.tell();
+            m.code_size = m_code.size();
+            m.slot_count = m_slots.size();
+            m.has_error = m_error != 0;
+            return m;
+        }
+
+        void restore(const mark& m)
+        {
+            m_lex.seek(m.pos);
+            m_code.resize(m.code_size);
+            while(m_slots.size() > m.slot_count)
+            {
+                m_ctx.locals->erase(m_slots.back());
+                m_slots.pop_back();
+            }
+            if(!m.has_error)
+                m_error = 0;
+            // a break or continue in code that is thrown away
+            drop_indices(m_ctx.break_indices,m.code_size);
+            drop_indices(m_ctx.continue_indices,m.code_size);
+        }
+
+        static void drop_indices(stack< stack<size_t> >& indices,size_t size)
+        {
+            if(indices.empty())
+                return;
+            while(!indices.top().empty() && indices.top().top() >= size)
+                indices.top().pop();
+        }
+
+        /// Records a compile error, thrown once the statement it is in is
+        /// parsed. Spirit only compiled statements that parsed.
+        void error(const char* msg,lexer::position pos)
+        {
+            if(m_error != 0)
+                return;
+            m_error = msg;
+            m_error_pos = pos;
+        }
+
+        /// Appends a copy of code that was emitted at old_start
+        void append_code(const codeblock_t& code,size_t old_start)
+        {
+            size_t start = m_code.size();
+            m_code.insert(m_code.end(),code.begin(),code.end());
+            relocate(
+                m_code,
+                start,
+                m_code.size(),
+                old_start,
+                static_cast<ptrdiff_t>(start) - static_cast<ptrdiff_t>(old_start)
+                );
+        }
+
+        /// Removes the code from start on, and returns it
+        codeblock_t take_code(size_t start)
+        {
+            codeblock_t code(m_code.begin() + start,m_code.end());
+            m_code.resize(start);
+            return code;
+        }
+
+        /// Gives a %local of the function being parsed a frame slot, the
+        /// first time it appears
+        void add_slot(const string& token)
+        {
+            if(m_ctx.locals == 0 || token[0] != '%')
+                return;
+            string_table::entry ste = m_ctx.strings.insert(token);
+            if(m_ctx.locals->find(ste) != m_ctx.locals->end())
+                return;
+            (*m_ctx.locals)[ste] = static_cast<int>(m_slots.size());
+            m_slots.push_back(ste);
+        }
+
+        void begin_loop()
+        {
+            ++m_ctx.loop_count;
+            m_ctx.break_indices.push(stack<size_t>());
+            m_ctx.continue_indices.push(stack<size_t>());
+        }
+
+        void end_loop()
+        {
+            --m_ctx.loop_count;
+            m_ctx.continue_indices.pop();
+            m_ctx.break_indices.pop();
+        }
+
+        ////////////////////////////////////////////////////////////////////
+        // Statements
+
+        bool stmt()
+        {
+            // where Spirit's node for the statement starts, which is
+            // before the white space
+            lexer::position pos = m_lex.tell();
+            mark m = get_mark();
+            if(func_call(op_call_func))
+            {
+                if(m_lex.match(';'))
+                    return true;
+                restore(m);
+            }
+            if(func_decl())
+                return true;
+            if(return_stmt(pos))
+            {
+                if(m_lex.match(';'))
+                    return true;
+                restore(m);
+            }
+            if(assign_stmt())
+            {
+                if(m_lex.match(';'))
+                    return true;
+                restore(m);
+            }
+            if(stmt_block() || if_stmt() || while_stmt())
+                return true;
+            if(m_lex.match("break"))
+            {
+                if(m_lex.match(';'))
+                {
+                    emit_jump_out(m_ctx.break_indices,"break encountered outside of loop",pos);
+                    return true;
+                }
+                restore(m);
+            }
+            if(m_lex.match("continue"))
+            {
+                if(m_lex.match(';'))
+                {
+                    emit_jump_out(m_ctx.continue_indices,"continue encountered outside of loop",pos);
+                    return true;
+                }
+                restore(m);
+            }
+            if(for_stmt())
+                return true;
+            // null statement
+            return m_lex.match(';');
+        }
+
+        /// Emits the op_jmp of a break or continue, resolved at the end of
+        /// the loop
+        void emit_jump_out(
+            stack< stack<size_t> >& indices,
+            const char* msg,
+            lexer::position pos
+            )
+        {
+            if(m_ctx.loop_count == 0)
+            {
+                error(msg,pos);
+                return;
+            }
+            m_code.push_back(op_jmp);
+            indices.top().push(m_code.size());
+            m_code.push_back(0); // to be resolved
+        }
+
+        bool stmt_block()
+        {
+            mark m = get_mark();
+            if(!m_lex.match('{'))
+                return false;
+            while(stmt())
+                ;
+            if(m_lex.match('}'))
+                return true;
+            restore(m);
+            return false;
+        }
+
+        bool func_call(op_code call_op)
+        {
+            mark m = get_mark();
+            string name;
+            if(!m_lex.match_ident(name) || !m_lex.match('('))
+            {
+                restore(m);
+                return false;
+            }
+            // where the code of each param starts
+            vector<size_t> params;
+            if(param(params))
+            {
+                for(;;)
+                {
+                    mark next = get_mark();
+                    if(!m_lex.match(','))
+                        break;
+                    if(!param(params))
+                    {
+                        restore(next);
+                        break;
+                    }
+                }
+            }
+            if(!m_lex.match(')'))
+            {
+                restore(m);
+                return false;
+            }
+            // the params are pushed from right to left
+            if(params.size() > 1)
+            {
+                size_t first = params.front();
+                codeblock_t code = take_code(first);
+                params.push_back(first + code.size());
+                for(size_t i = params.size() - 1; i-- > 0; )
+                {
+                    append_code(
+                        codeblock_t(
+                            code.begin() + (params[i] - first),
+                            code.begin() + (params[i + 1] - first)
+                            ),
+                        params[i]
+                        );
+                }
+                params.pop_back();
+            }
+            m_code.push_back(call_op);
+            m_code.push_back(m_ctx.strings.insert(name));
+            // the number of params pushed
+            m_code.push_back(static_cast<int>(params.size()));
+            // room for the call site's inline cache
+            m_code.push_back(size_t(0));
+            m_code.push_back(size_t(0));
+            return true;
+        }
+
+        bool param(vector<size_t>& params)
+        {
+            size_t start = m_code.size();
+            if(!expr())
+                return false;
+            // push it onto the param stack (popping it from the runtime
+            // stack)
+            emit_push_param(start,m_ctx);
+            params.push_back(start);
+            return true;
+        }
+
+        bool func_decl()
+        {
+            mark m = get_mark();
+            string name;
+            if(
+                !m_lex.match("function") ||
+                !m_lex.match_ident(name) ||
+                !m_lex.match('(')
+                )
+            {
+                restore(m);
+                return false;
+            }
+
+            ++m_ctx.func_depth;
+
+            // start the function declaration
+            m_code.push_back(op_decl_func);
+            m_code.push_back(m_ctx.strings.insert(name));
+            size_t resolve = m_code.size();
+            m_code.push_back(0); // the end, resolved below
+
+            // every statically named %local gets a frame slot, parameters
+            // first. The slot count and the name of each slot follow the
+            // end offset, but the slots are only known once the body is
+            // parsed.
+            size_t header = m_code.size();
+            compile_context::slot_map locals;
+            compile_context::slot_map* outer_locals = m_ctx.locals;
+            m_ctx.locals = &locals;
+            vector<string_table::entry> outer_slots;
+            outer_slots.swap(m_slots);
+
+            bool parsed = params() && m_lex.match(')') && stmt_block();
+            if(parsed)
+            {
+                // in case there's no explicit return statement
+                m_code.push_back(op_return);
+
+                size_t count = m_slots.size();
+                m_code.insert(m_code.begin() + header,count + 1,instruction());
+                m_code[header] = static_cast<int>(count);
+                for(size_t i = 0; i < count; ++i)
+                    m_code[header + 1 + i] = m_slots[i];
+                relocate(m_code,header + count + 1,m_code.size(),header,count + 1);
+                if(m_ctx.loop_count != 0)
+                {
+                    shift_indices(m_ctx.break_indices,header,count + 1);
+                    shift_indices(m_ctx.continue_indices,header,count + 1);
+                }
+
+                // resolve now the offset of the end of the function
+                m_code[resolve] = m_code.size();
+            }
+
+            m_ctx.locals = outer_locals;
+            m_slots.swap(outer_slots);
+            --m_ctx.func_depth;
+
+            if(!parsed)
+                restore(m);
+            return parsed;
+        }
+
+        /// Parses the parameter list of a function declaration
+        bool params()
+        {
+            string token;
+            if(!lvar(token))
+                return true;
+            emit_var_op(op_pop_param,op_pop_param_local,token,m_ctx);
+            for(;;)
+            {
+                mark next = get_mark();
+                if(!m_lex.match(','))
+                    return true;
+                if(!lvar(token))
+                {
+                    restore(next);
+                    return true;
+                }
+                emit_var_op(op_pop_param,op_pop_param_local,token,m_ctx);
+            }
+        }
+
+        bool lvar(string& token)
+        {
+            mark m = get_mark();
+            if(!m_lex.match_var(token) || token[0] != '%')
+            {
+                restore(m);
+                return false;
+            }
+            add_slot(token);
+            return true;
+        }
+
+        bool return_stmt(lexer::position pos)
+        {
+            if(!m_lex.match("return"))
+                return false;
+            if(m_ctx.func_depth == 0)
+                error("return statement found at global scope",pos);
+            if(expr())
+            {
+                // store it in the return value register, and return
+                m_code.push_back(op_return_value);
+            }
+            else
+                m_code.push_back(op_return);
+            return true;
+        }
+
+        bool assign_stmt()
+        {
+            mark m = get_mark();
+            var_ref var;
+            bool inc;
+            if(inc_dec_op(inc))
+            {
+                if(this->var(var))
+                {
+                    emit_inc_dec_stmt(var,inc);
+                    return true;
+                }
+                restore(m);
+                return false;
+            }
+            if(!this->var(var))
+                return false;
+
+            // an assignment op and an increment can't both match, so the
+            // variable is only parsed once
+            char op = assign_op();
+            if(op != 0)
+            {
+                if(!expr())
+                {
+                    restore(m);
+                    return false;
+                }
+                emit_assign(var,op);
+                return true;
+            }
+            if(inc_dec_op(inc))
+            {
+                emit_inc_dec_stmt(var,inc);
+                return true;
+            }
+            restore(m);
+            return false;
+        }
+
+        /// Matches an assignment op, and returns its first character, or 0
+        char assign_op()
+        {
+            if(m_lex.match('='))
+                return '=';
+            if(m_lex.match("<<="))
+                return '<';
+            if(m_lex.match(">>="))
+                return '>';
+            static const char ops[] = "*/%+-&|^@";
+            for(const char* op = ops; *op != '\0'; ++op)
+            {
+                char str[] = { *op, '=', '\0' };
+                if(m_lex.match(str))
+                    return *op;
+            }
+            return 0;
+        }
+
+        /// Emits an assignment to var, whose indexes and value are already
+        /// compiled
+        void emit_assign(const var_ref& var,char op)
+        {
+            bool do_var = !var.is_elem || !m_ctx.array_aliases;
+            op_code opcode = op_invalid;
+            op_code slot_opcode = op_invalid;
+            switch(op)
+            {
+            case '=':
+                opcode = do_var ? op_assign_var : op_assign;
+                slot_opcode = op_assign_local;
+                break;
+            case '*':
+                opcode = do_var ? op_mul_asn_var : op_mul_asn;
+                slot_opcode = op_mul_asn_local;
+                break;
+            case '/':
+                opcode = do_var ? op_div_asn_var : op_div_asn;
+                slot_opcode = op_div_asn_local;
+                break;
+            case '%':
+                opcode = do_var ? op_mod_asn_var : op_mod_asn;
+                slot_opcode = op_mod_asn_local;
+                break;
+            case '+':
+                opcode = do_var ? op_add_asn_var : op_add_asn;
+                slot_opcode = op_add_asn_local;
+                break;
+            case '-':
+                opcode = do_var ? op_sub_asn_var : op_sub_asn;
+                slot_opcode = op_sub_asn_local;
+                break;
+            case '@':
+                opcode = do_var ? op_cat_asn_var : op_cat_asn;
+                slot_opcode = op_cat_asn_local;
+                break;
+            case '&':
+                opcode = do_var ? op_band_asn_var : op_band_asn;
+                slot_opcode = op_band_asn_local;
+                break;
+            case '|':
+                opcode = do_var ? op_bor_asn_var : op_bor_asn;
+                slot_opcode = op_bor_asn_local;
+                break;
+            case '^':
+                opcode = do_var ? op_bxor_asn_var : op_bxor_asn;
+                slot_opcode = op_bxor_asn_local;
+                break;
+            case '<':
+                opcode = do_var ? op_shl_asn_var : op_shl_asn;
+                slot_opcode = op_shl_asn_local;
+                break;
+            case '>':
+                opcode = do_var ? op_shr_asn_var : op_shr_asn;
+                slot_opcode = op_shr_asn_local;
+                break;
+            }
+
+            if(var.is_elem && do_var)
+            {
+                // the op_code to apply to the element is an operand
+                emit_var_op(op_asn_elem,op_asn_elem_local,var.token,m_ctx);
+                m_code.push_back(static_cast<int>(var.index_count));
+                m_code.push_back(static_cast<int>(opcode));
+            }
+            else if(do_var)
+                emit_var_op(opcode,slot_opcode,var.token,m_ctx);
+            else
+                m_code.push_back(opcode);
+        }
+
+        bool inc_dec_op(bool& inc)
+        {
+            inc = m_lex.match("++");
+            return inc || m_lex.match("--");
+        }
+
+        void emit_inc_dec(const var_ref& var,bool inc)
+        {
+            if(inc)
+                emit_var_op(op_inc_var,op_inc_local,var.token,m_ctx);
+            else
+                emit_var_op(op_dec_var,op_dec_local,var.token,m_ctx);
+        }
+
+        /// Emits the increment or decrement of an array element, after its
+        /// indexes
+        void emit_elem_inc_dec(const var_ref& var,bool inc)
+        {
+            emit_var_op(op_asn_elem,op_asn_elem_local,var.token,m_ctx);
+            m_code.push_back(static_cast<int>(var.index_count));
+            m_code.push_back(static_cast<int>(inc ? op_inc_var : op_dec_var));
+        }
+
+        void emit_inc_dec_stmt(const var_ref& var,bool inc)
+        {
+            if(var.is_elem && !m_ctx.array_aliases)
+                emit_elem_inc_dec(var,inc);
+            else
+            {
+                // an array alias increments the array itself
+                m_code.resize(var.start);
+                emit_inc_dec(var,inc);
+            }
+        }
+
+        bool if_stmt()
+        {
+            mark m = get_mark();
+            if(!m_lex.match("if") || !m_lex.match('('))
+            {
+                restore(m);
+                return false;
+            }
+            size_t start = m_code.size();
+            if(!expr() || !m_lex.match(')'))
+            {
+                restore(m);
+                return false;
+            }
+            // jmp if false
+            emit_jmp_false(start,m_ctx);
+            size_t end_if = m_code.size();
+            m_code.push_back(0); // to be resolved later
+
+            // the body for the true block
+            if(!stmt())
+            {
+                restore(m);
+                return false;
+            }
+
+            mark no_else = get_mark();
+            if(m_lex.match("else"))
+            {
+                // set the jmp to the end of the else block
+                m_code.push_back(op_jmp);
+                size_t end_else = m_code.size();
+                m_code.push_back(0); // to resolve later
+                m_code[end_if] = m_code.size();
+                if(stmt())
+                {
+                    m_code[end_else] = m_code.size();
+                    return true;
+                }
+                restore(no_else);
+            }
+            m_code[end_if] = m_code.size();
+            return true;
+        }
+
+        bool while_stmt()
+        {
+            mark m = get_mark();
+            if(!m_lex.match("while") || !m_lex.match('('))
+            {
+                restore(m);
+                return false;
+            }
+            begin_loop();
+
+            // this is the point where the loop continues
+            size_t continue_index = m_code.size();
+            bool parsed = expr() && m_lex.match(')');
+            if(parsed)
+            {
+                // jump if false to end of loop
+                emit_jmp_false(continue_index,m_ctx);
+                m_ctx.break_indices.top().push(m_code.size());
+                m_code.push_back(0); // resolve later
+                parsed = stmt();
+            }
+            if(parsed)
+            {
+                // jump back to the beginning
+                m_code.push_back(op_jmp);
+                m_code.push_back(continue_index);
+                resolve(m_ctx.continue_indices.top(),continue_index,m_code);
+                resolve(m_ctx.break_indices.top(),m_code.size(),m_code);
+            }
+
+            end_loop();
+            if(!parsed)
+                restore(m);
+            return parsed;
+        }
+
+        bool for_stmt()
+        {
+            mark m = get_mark();
+            if(!m_lex.match("for") || !m_lex.match('('))
+            {
+                restore(m);
+                return false;
+            }
+            begin_loop();
+
+            // the init statement
+            assign_stmt();
+            bool parsed = m_lex.match(';');
+
+            // loop start
+            size_t test_expr_start = m_code.size();
+            if(parsed && expr())
+            {
+                // add the jump if false, resolved to the break index
+                emit_jmp_false(test_expr_start,m_ctx);
+                m_ctx.break_indices.top().push(m_code.size());
+                m_code.push_back(0); // to resolve later
+            }
+            parsed = parsed && m_lex.match(';');
+
+            // the iteration statement goes at the continue point, after
+            // the body
+            size_t iter_start = m_code.size();
+            if(parsed)
+                assign_stmt();
+            codeblock_t iter = take_code(iter_start);
+
+            parsed = parsed && m_lex.match(')') && stmt();
+            if(parsed)
+            {
+                // now we're at the continue point
+                resolve(m_ctx.continue_indices.top(),m_code.size(),m_code);
+                append_code(iter,iter_start);
+
+                // jump unconditionally to the loop start
+                m_code.push_back(op_jmp);
+                m_code.push_back(test_expr_start);
+
+                // now we're at the break point (end of the loop)
+                resolve(m_ctx.break_indices.top(),m_code.size(),m_code);
+            }
+
+            end_loop();
+            if(!parsed)
+                restore(m);
+            return parsed;
+        }
+
+        ////////////////////////////////////////////////////////////////////
+        // Expressions
+
+        typedef bool (parser::*sub_expr_fn)();
+        typedef op_code (parser::*expr_op_fn)();
+
+        /// Parses operands of sub_expr separated by the ops of get_op,
+        /// which are all left associative
+        bool binary_expr(sub_expr_fn sub_expr,expr_op_fn get_op)
+        {
+            size_t start = m_code.size();
+            if(!(this->*sub_expr)())
+                return false;
+            for(;;)
+            {
+                mark m = get_mark();
+                op_code op = (this->*get_op)();
+                if(op == op_invalid)
+                    return true;
+                size_t rhs_start = m_code.size();
+                if(!(this->*sub_expr)())
+                {
+                    restore(m);
+                    return true;
+                }
+                emit_binary(op,start,rhs_start,m_ctx);
+            }
+        }
+
+        bool expr()
+        {
+            size_t start = m_code.size();
+            if(!bitwise_expr())
+                return false;
+            // && and || short circuit. The left side, as 0 or 1, is the
+            // result if it decides it, and the right side isn't evaluated.
+            // Otherwise it is popped, and the right side (as 0 or 1) is the
+            // result.
+            for(bool first = true; ; first = false)
+            {
+                mark m = get_mark();
+                op_code op = op_invalid;
+                if(m_lex.match("||"))
+                    op = op_jmp_true_peek;
+                else if(m_lex.match("&&"))
+                    op = op_jmp_false_peek;
+                else
+                    return true;
+                // after the first op, the left side is already 0 or 1
+                if(first)
+                    emit_bool(start,m_ctx);
+                m_code.push_back(op);
+                size_t skip = m_code.size();
+                m_code.push_back(0); // resolved past the right side
+                size_t right_start = m_code.size();
+                if(!bitwise_expr())
+                {
+                    restore(m);
+                    return true;
+                }
+                emit_bool(right_start,m_ctx);
+                m_code[skip] = m_code.size();
+            }
+        }
+
+        bool bitwise_expr()
+        {
+            return binary_expr(&parser::equality_expr,&parser::bitwise_op);
+        }
+
+        op_code bitwise_op()
+        {
+            if(m_lex.match('&'))
+                return op_bit_and;
+            if(m_lex.match('|'))
+                return op_bit_or;
+            if(m_lex.match('^'))
+                return op_bit_xor;
+            return op_invalid;
+        }
+
+        bool equality_expr()
+        {
+            return binary_expr(&parser::compare_expr,&parser::equality_op);
+        }
+
+        op_code equality_op()
+        {
+            if(m_lex.match("=="))
+                return op_eq;
+            if(m_lex.match("!="))
+                return op_neq;
+            return op_invalid;
+        }
+
+        bool compare_expr()
+        {
+            return binary_expr(&parser::shift_expr,&parser::compare_op);
+        }
+
+        op_code compare_op()
+        {
+            // the longest one that matches
+            if(m_lex.match("<="))
+                return op_cmp_less_eq;
+            if(m_lex.match(">="))
+                return op_cmp_grtr_eq;
+            if(m_lex.match('<'))
+                return op_cmp_less;
+            if(m_lex.match('>'))
+                return op_cmp_grtr;
+            return op_invalid;
+        }
+
+        bool shift_expr()
+        {
+            return binary_expr(&parser::add_expr,&parser::shift_op);
+        }
+
+        op_code shift_op()
+        {
+            if(m_lex.match("<<"))
+                return op_shl;
+            if(m_lex.match(">>"))
+                return op_shr;
+            return op_invalid;
+        }
+
+        bool add_expr()
+        {
+            return binary_expr(&parser::mul_expr,&parser::add_op);
+        }
+
+        op_code add_op()
+        {
+            if(m_lex.match('+'))
+                return op_add;
+            if(m_lex.match('-'))
+                return op_sub;
+            if(m_lex.match('@'))
+                return op_cat;
+            return op_invalid;
+        }
+
+        bool mul_expr()
+        {
+            return binary_expr(&parser::unary_expr,&parser::mul_op);
+        }
+
+        op_code mul_op()
+        {
+            if(m_lex.match('*'))
+                return op_mul;
+            if(m_lex.match('/'))
+                return op_div;
+            if(m_lex.match('%'))
+                return op_mod;
+            return op_invalid;
+        }
+
+        bool unary_expr()
+        {
+            mark m = get_mark();
+            var_ref var;
+            bool inc;
+
+            // pre increment or decrement
+            if(inc_dec_op(inc))
+            {
+                if(this->var(var))
+                {
+                    if(var.is_elem && !m_ctx.array_aliases)
+                    {
+                        // the element's indexes get evaluated again
+                        emit_elem_inc_dec(var,inc);
+                        append_code(
+                            codeblock_t(m_code.begin() + var.start,m_code.begin() + var.end),
+                            var.start
+                            );
+                    }
+                    else
+                    {
+                        codeblock_t indexes = take_code(var.start);
+                        emit_inc_dec(var,inc);
+                        append_code(indexes,var.start);
+                    }
+                    emit_push_var(var);
+                    return true;
+                }
+                restore(m);
+            }
+
+            // a variable, post incremented or decremented or not. Without
+            // a unary op, an expr_atom that starts with a variable is one.
+            if(this->var(var))
+            {
+                emit_push_var(var);
+                if(inc_dec_op(inc))
+                {
+                    if(var.is_elem && !m_ctx.array_aliases)
+                    {
+                        // the element's indexes get evaluated again
+                        append_code(
+                            codeblock_t(m_code.begin() + var.start,m_code.begin() + var.end),
+                            var.start
+                            );
+                        emit_elem_inc_dec(var,inc);
+                    }
+                    else
+                        emit_inc_dec(var,inc);
+                }
+                return true;
+            }
+
+            op_code op = op_invalid;
+            if(m_lex.match('!'))
+                op = op_log_not;
+            else if(m_lex.match('+'))
+                ; // positive is the default
+            else if(m_lex.match('-'))
+                op = op_neg;
+            else if(m_lex.match('~'))
+                op = op_bit_not;
+            size_t start = m_code.size();
+            if(!expr_atom())
+            {
+                restore(m);
+                return false;
+            }
+            if(op != op_invalid)
+                emit_unary(op,start,m_ctx);
+            return true;
+        }
+
+        bool expr_atom()
+        {
+            double flt;
+            int i;
+            string token;
+            var_ref var;
+            if(m_lex.match_float(flt))
+            {
+                m_code.push_back(op_push_float);
+                m_code.push_back(m_ctx.floats.insert(flt));
+                return true;
+            }
+            if(m_lex.match_int(i))
+            {
+                m_code.push_back(op_push_int);
+                m_code.push_back(i);
+                return true;
+            }
+            if(m_lex.match_str(token))
+            {
+                m_code.push_back(op_push_str);
+                m_code.push_back(m_ctx.strings.insert(unescape(token)));
+                return true;
+            }
+            if(this->var(var))
+            {
+                emit_push_var(var);
+                return true;
+            }
+            mark m = get_mark();
+            if(m_lex.match('('))
+            {
+                if(expr() && m_lex.match(')'))
+                    return true;
+                restore(m);
+            }
+            // call, and load the return value to the top of the stack
+            return func_call(op_call_load_ret);
+        }
+
+        /// Matches a variable, and emits the code of its indexes if it is
+        /// an array element
+        bool var(var_ref& var)
+        {
+            if(!m_lex.match_var(var.token))
+                return false;
+            add_slot(var.token);
+            var.is_elem = false;
+            var.index_count = 0;
+            var.start = m_code.size();
+            var.end = var.start;
+
+            mark m = get_mark();
+            if(!m_lex.match('['))
+                return true;
+            if(m_ctx.array_aliases)
+            {
+                // push the name of the variable as a string
+                m_code.push_back(op_push_str);
+                m_code.push_back(m_ctx.strings.insert(var.token));
+            }
+            size_t count = 0;
+            if(index())
+            {
+                for(count = 1; ; ++count)
+                {
+                    mark next = get_mark();
+                    if(!m_lex.match(','))
+                        break;
+                    if(!index())
+                    {
+                        restore(next);
+                        break;
+                    }
+                }
+            }
+            if(count == 0 || !m_lex.match(']'))
+            {
+                restore(m);
+                return true;
+            }
+            var.is_elem = true;
+            var.index_count = count;
+            var.end = m_code.size();
+            return true;
+        }
+
+        bool index()
+        {
+            if(!expr())
+                return false;
+            // with array aliases, append it to the name
+            if(m_ctx.array_aliases)
+                m_code.push_back(op_cat_aidx_expr);
+            return true;
+        }
+
+        /// Emits the push of the value of var, after its indexes
+        void emit_push_var(const var_ref& var)
+        {
+            if(!var.is_elem)
+                emit_var_op(op_push_var,op_push_local,var.token,m_ctx);
+            else if(!m_ctx.array_aliases)
+            {
+                emit_var_op(op_push_elem,op_push_elem_local,var.token,m_ctx);
+                m_code.push_back(static_cast<int>(var.index_count));
+            }
+            else
+            {
+                // this op takes the name of the variable on the top of the
+                // stack, and replaces it with the value of that variable
+                m_code.push_back(op_push_var_value);
+            }
+        }
+
+        compile_context& m_ctx;
+        codeblock_t& m_code;
+        lexer m_lex;
+
+        // the %locals of the function being parsed, in slot order
+        vector<string_table::entry> m_slots;
+
+        // the first compile error in the statement being parsed
+        const char* m_error;
+        lexer::position m_error_pos;
+    };
+}
+
+codeblock_t dscript::compile(
+    const string& code,
+    string_table& strings,
+    float_table& floats,
+    bool array_aliases
+    )
+{
+    compile_context ctx(strings,floats,array_aliases);
+    parser script(code,ctx);
+    script.parse_script();
+    optimize_compiled(ctx);
+    return ctx.code;
+}
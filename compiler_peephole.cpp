@@ -0,0 +1,304 @@
+////////////////////////////////////////////////////////////////////////////////
+// DScript Scripting Language
+// Copyright (C) 2003 Bryan "daerid" Ross
+//
+// Permission to copy, use, modify, sell and distribute this software is
+// granted provided this copyright notice appears in all copies. This
+// software is provided "as is" without express or implied warranty, and
+// with no claim as to its suitability for any purpose.
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Standard Library Include Files
+#include <vector>
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// DScript Include Files
+#include "compiler.h"
+////////////////////////////////////////////////////////////////////////////////
+
+using namespace std;
+using namespace dscript;
+
+namespace
+{
+    /// Returns whether control never falls through op to the next
+    /// instruction
+    bool is_terminator(op_code op)
+    {
+        return op == op_jmp || op == op_return || op == op_return_value;
+    }
+
+    /// Returns whether op jumps, rather than just holding an offset
+    bool is_jump(op_code op)
+    {
+        switch(op)
+        {
+        case op_jmp:
+        case op_jmp_false:
+        case op_jmp_false_peek:
+        case op_jmp_true_peek:
+        case op_cmp_less_eq_jmp_false:
+        case op_cmp_less_jmp_false:
+        case op_cmp_grtr_eq_jmp_false:
+        case op_cmp_grtr_jmp_false:
+        case op_eq_jmp_false:
+        case op_neq_jmp_false:
+        case op_inline_guard:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    /// Returns whether op jumps without popping the value it tests
+    bool is_peek(op_code op)
+    {
+        return op == op_jmp_false_peek || op == op_jmp_true_peek;
+    }
+
+    /// Returns the offset operand of the jump at off
+    size_t jump_target(const codeblock_t& code, size_t off)
+    {
+        return code[off + 1].get_int();
+    }
+
+    /// The codeblock being optimized. Each instruction is kept at its old
+    /// offset until the code is laid out again by pack().
+    class peephole
+    {
+    public:
+        peephole(codeblock_t& code) : m_code(code), m_live(code.size())
+        {
+            // an instruction starts at every offset in m_starts. They
+            // stay put even where an instruction is replaced by a
+            // shorter one.
+            m_index.resize(code.size() + 1);
+            for(size_t off = 0; off < code.size(); off += size(off))
+            {
+                m_index[off] = m_starts.size();
+                m_starts.push_back(off);
+            }
+            // and one more starts at the end
+            m_index[code.size()] = m_starts.size();
+            m_starts.push_back(code.size());
+        }
+
+        void optimize()
+        {
+            thread_jumps();
+            find_targets();
+            collapse_pairs();
+            find_live();
+            drop_jumps_to_next();
+            pack();
+        }
+
+    private:
+        size_t size(size_t off) const
+        {
+            return get_instr_size(m_code.begin() + off);
+        }
+
+        op_code op_at(size_t off) const
+        {
+            return off < m_code.size() ? m_code[off].get_op_code() : op_invalid;
+        }
+
+        /// Points every jump at the end of the chain of op_jmps it lands
+        /// on. An op_jmp landing on a return becomes that return, and a
+        /// peek jump landing on the same peek jump takes that one's jump,
+        /// since the value it tests is the same.
+        void thread_jumps()
+        {
+            for(size_t i = 0; i + 1 < m_starts.size(); ++i)
+            {
+                size_t off = m_starts[i];
+                op_code op = op_at(off);
+                if(!is_jump(op))
+                    continue;
+                size_t target = jump_target(m_code,off);
+                // a chain can't be longer than the code, but can loop
+                for(size_t hops = 0; hops < m_starts.size(); ++hops)
+                {
+                    op_code next = op_at(target);
+                    if(next == op_jmp || (is_peek(op) && next == op))
+                        target = jump_target(m_code,target);
+                    else
+                        break;
+                }
+                m_code[off + 1] = static_cast<int>(target);
+
+                op_code landing = op_at(target);
+                if(
+                    op == op_jmp &&
+                    (landing == op_return || landing == op_return_value)
+                    )
+                    m_code[off] = landing;
+            }
+        }
+
+        /// Marks every offset something jumps to, or a function ends at
+        void find_targets()
+        {
+            m_target.assign(m_code.size() + 1,false);
+            for(size_t i = 0; i + 1 < m_starts.size(); ++i)
+            {
+                size_t off = m_starts[i];
+                const char* operands = get_op_operands(op_at(off));
+                for(size_t n = 1; *operands != '\0'; ++operands, ++n)
+                {
+                    if(*operands == 'o')
+                        m_target[m_code[off + n].get_int()] = true;
+                }
+            }
+        }
+
+        /// Removes pairs of instructions that undo each other, and turns
+        /// op_call_load_ret + op_return_value into op_call_func +
+        /// op_return, which leaves the return value where it is
+        void collapse_pairs()
+        {
+            m_removed.assign(m_code.size(),false);
+            for(size_t i = 0; i + 2 < m_starts.size(); ++i)
+            {
+                size_t first = m_starts[i];
+                size_t second = m_starts[i + 1];
+                if(m_target[second] || m_removed[first])
+                    continue;
+                op_code lhs = op_at(first);
+                op_code rhs = op_at(second);
+                if(lhs == op_call_load_ret && rhs == op_return_value)
+                {
+                    m_code[first] = op_call_func;
+                    m_code[second] = op_return;
+                }
+                else if(
+                    (lhs == op_load_ret && rhs == op_store_ret) ||
+                    (lhs == op_push_local && rhs == op_assign_local &&
+                    m_code[first + 1].get_int() == m_code[second + 1].get_int())
+                    )
+                {
+                    m_removed[first] = true;
+                    m_removed[second] = true;
+                }
+            }
+        }
+
+        /// Finds the instructions that can run: from the start of the
+        /// code and of every function declared, along every jump and
+        /// fall through
+        void find_live()
+        {
+            vector<size_t> work;
+            work.push_back(0);
+            while(!work.empty())
+            {
+                size_t off = work.back();
+                work.pop_back();
+                if(off >= m_code.size() || m_live[off])
+                    continue;
+                m_live[off] = true;
+                op_code op = op_at(off);
+                if(op == op_decl_func)
+                {
+                    // the function body runs when the function is
+                    // called, and is skipped here
+                    work.push_back(off + size(off));
+                    work.push_back(m_code[off + 2].get_int());
+                    continue;
+                }
+                if(is_jump(op))
+                    work.push_back(jump_target(m_code,off));
+                if(!is_terminator(op))
+                    work.push_back(off + size(off));
+            }
+        }
+
+        /// Returns whether off is kept
+        bool kept(size_t off) const
+        {
+            return m_live[off] && !m_removed[off];
+        }
+
+        /// Returns the first kept instruction at or after the one at off
+        size_t next_kept(size_t off) const
+        {
+            size_t i = m_index[off];
+            while(m_starts[i] < m_code.size() && !kept(m_starts[i]))
+                ++i;
+            return m_starts[i];
+        }
+
+        /// Removes op_jmps to the next instruction that is kept
+        void drop_jumps_to_next()
+        {
+            for(size_t i = 0; i + 1 < m_starts.size(); ++i)
+            {
+                size_t off = m_starts[i];
+                if(!kept(off) || op_at(off) != op_jmp)
+                    continue;
+                size_t target = jump_target(m_code,off);
+                if(next_kept(m_starts[m_index[off] + 1]) == next_kept(target))
+                    m_removed[off] = true;
+            }
+        }
+
+        /// Lays the kept instructions out again, and points every offset
+        /// operand, jump or declaration, at the new offset of its
+        /// instruction. An offset of an
+        /// instruction that was removed goes to the next one kept, which
+        /// does the same.
+        void pack()
+        {
+            vector<size_t> new_off(m_code.size() + 1);
+            size_t packed = 0;
+            for(size_t i = 0; i + 1 < m_starts.size(); ++i)
+            {
+                size_t off = m_starts[i];
+                new_off[off] = packed;
+                if(kept(off))
+                    packed += size(off);
+            }
+            new_off[m_code.size()] = packed;
+
+            codeblock_t code;
+            code.reserve(packed);
+            for(size_t i = 0; i + 1 < m_starts.size(); ++i)
+            {
+                size_t off = m_starts[i];
+                if(!kept(off))
+                    continue;
+                size_t start = code.size();
+                code.insert(
+                    code.end(),
+                    m_code.begin() + off,
+                    m_code.begin() + off + size(off)
+                    );
+                const char* operands = get_op_operands(op_at(off));
+                for(size_t n = 1; *operands != '\0'; ++operands, ++n)
+                {
+                    if(*operands == 'o' || *operands == 'd')
+                    {
+                        size_t target = m_code[off + n].get_int();
+                        code[start + n] = static_cast<int>(new_off[target]);
+                    }
+                }
+            }
+            m_code.swap(code);
+        }
+
+        codeblock_t& m_code;
+        vector<size_t> m_starts;
+        vector<size_t> m_index;
+        vector<bool> m_target;
+        vector<bool> m_removed;
+        vector<bool> m_live;
+    };
+}
+
+void dscript::optimize_codeblock(codeblock_t& code)
+{
+    peephole(code).optimize();
+}
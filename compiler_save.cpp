@@ -13,314 +13,1502 @@
 #include <iostream>
 #include <string>
 #include <cstring>
+#include <cstdio>
 #include <fstream>
+#include <sstream>
 #include <map>
+#include <set>
+#include <vector>
+#include <algorithm>
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Platform Include Files
+#ifdef _MSC_VER
+#include <iterator>
+#include <process.h>
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 ////////////////////////////////////////////////////////////////////////////////
 
 ////////////////////////////////////////////////////////////////////////////////
 // Boost Includes (http://www.boost.org)
-#include <boost/scoped_array.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
 ////////////////////////////////////////////////////////////////////////////////
 
+#ifdef DSCRIPT_ZLIB
+////////////////////////////////////////////////////////////////////////////////
+// zlib Include Files (http://www.zlib.net)
+#include <zlib.h>
+////////////////////////////////////////////////////////////////////////////////
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////
 // DScript Include Files
 #include "compiler.h"
 ////////////////////////////////////////////////////////////////////////////////
 
+// The .dsc format, version 2. Every field is little-endian and of a fixed
+// width, so a file loads in any build of DScript. Each section starts on
+// a 16 byte boundary, so a mapped file can be read in place.
+//
+//  header (64 bytes): the magic "DSCv", then 32 bit fields
+//      version             2
+//      header size         64
+//      code offset, code slot count
+//      string index offset, string count
+//      string data offset, string data size
+//      float offset, float count
+//      file size
+//      directory offset, function count
+//      (reserved, 0)
+//  code: a 64 bit slot per op_code and operand, the way get_op_operands()
+//      describes them. Op_codes, ints and frame slots are in the low 32
+//      bits, offsets take all 64. String and float operands are the index
+//      of the constant in their pool. Inline caches are 0.
+//  floats: the 64 bit IEEE 754 bits of each float
+//  directory: for each function declared at file scope, in the order
+//      they are declared in, the 32 bit index of its name in the string
+//      pool, the offsets of its op_decl_func and of its end, and 32
+//      reserved bits. load_compiled_lazy() only decodes the body of one
+//      when it is first called.
+//  string index: the 32 bit offset and length of each string in the
+//      string data
+//  string data: the strings, each followed by a '\0'
+//
+// Version 1 files, which start with "DSC\0", were written at the width of
+// the build that saved them, with the operands the op_codes had then.
+// They don't load; the script has to be compiled again. Version 2 files
+// written before there was a directory, which have no functions in it,
+// still do.
+//
+// A bundle (see save_bundle()) packs a number of scripts in one file,
+// with the constants they use pooled. It is laid out the same way.
+//
+//  header (96 bytes): the magic "DSCb", then 32 bit fields
+//      version             1
+//      header size         96
+//      script offset, script count
+//      bucket offset, bucket count
+//      string index offset, string count
+//      string data offset, string data size
+//      float offset, float count
+//      directory offset, function count
+//      code offset, code slot count
+//      block offset, block size (0 if the code isn't compressed)
+//      file size
+//      (reserved, 0)
+//  scripts: 32 bytes for each script: the index of its name in the
+//      string pool, the FNV-1a hash of its name, the next script in its
+//      bucket plus one (0 for none), its first slot in the code and how
+//      many it has, its first function in the directory and how many it
+//      has, and 32 reserved bits
+//  buckets: the first script plus one (0 for none) with a hash that is
+//      the bucket's index modulo the bucket count, a power of 2
+//  floats, string index, string data: as in a .dsc file, for every
+//      script
+//  directory: as in a .dsc file, with each script's offsets from its
+//      first slot
+//  blocks: with a block size, the 32 bit offset and size of each block
+//      of that many bytes of the code, deflated with zlib on its own
+//  code: the code of every script, as in a .dsc file, or its blocks
+
 using namespace std;
 
 namespace
 {
-    /// Read an element from a stream
-    template<typename TypeT>
-    void read_elem(istream& in,TypeT* data, size_t size = sizeof(TypeT))
-    {
-        if(in.eof())
-            throw std::runtime_error("Premature end of file.");
-        if(in.read(reinterpret_cast<char*>(data),size).fail())
-            throw std::runtime_error("Error reading data from file.");
+    using boost::uint32_t;
+    using boost::uint64_t;
+
+    const char dsc_v2_magic[4] = { 'D', 'S', 'C', 'v' };
+    const uint32_t dsc_version = 2;
+    const size_t header_size = 64;
+    const size_t section_align = 16;
+
+    // where each field of the header is
+    enum header_field
+    {
+        hdr_version = 4,
+        hdr_header_size = 8,
+        hdr_code_offset = 12,
+        hdr_code_count = 16,
+        hdr_string_index_offset = 20,
+        hdr_string_count = 24,
+        hdr_string_data_offset = 28,
+        hdr_string_data_size = 32,
+        hdr_float_offset = 36,
+        hdr_float_count = 40,
+        hdr_file_size = 44,
+        hdr_directory_offset = 48,
+        hdr_function_count = 52
+    };
+
+    const size_t directory_entry_size = 16;
+
+    const char bundle_magic[4] = { 'D', 'S', 'C', 'b' };
+    const uint32_t bundle_version = 1;
+    const size_t bundle_header_size = 96;
+    const size_t script_entry_size = 32;
+    const size_t bundle_block_size = 65536;
+
+    // where each field of the header of a bundle is
+    enum bundle_header_field
+    {
+        bhdr_version = 4,
+        bhdr_header_size = 8,
+        bhdr_script_offset = 12,
+        bhdr_script_count = 16,
+        bhdr_bucket_offset = 20,
+        bhdr_bucket_count = 24,
+        bhdr_string_index_offset = 28,
+        bhdr_string_count = 32,
+        bhdr_string_data_offset = 36,
+        bhdr_string_data_size = 40,
+        bhdr_float_offset = 44,
+        bhdr_float_count = 48,
+        bhdr_directory_offset = 52,
+        bhdr_function_count = 56,
+        bhdr_code_offset = 60,
+        bhdr_code_count = 64,
+        bhdr_block_offset = 68,
+        bhdr_block_size = 72,
+        bhdr_file_size = 76
+    };
+
+    uint32_t get_u32(const unsigned char* data)
+    {
+        return uint32_t(data[0]) | (uint32_t(data[1]) << 8) |
+            (uint32_t(data[2]) << 16) | (uint32_t(data[3]) << 24);
     }
-}
 
-namespace dscript {
+    uint64_t get_u64(const unsigned char* data)
+    {
+        return uint64_t(get_u32(data)) | (uint64_t(get_u32(data + 4)) << 32);
+    }
 
-codeblock_t load_compiled_file(const string& filename,string_table& strings,float_table& floats)
-{
-    // open up an istream
-    ifstream file(filename.c_str(),ios::binary);
+    void put_u32(unsigned char* data,uint32_t val)
+    {
+        for(size_t i = 0; i < 4; ++i, val >>= 8)
+            data[i] = static_cast<unsigned char>(val & 0xff);
+    }
 
-    if(!file)
-        throw std::runtime_error(filename + " could not be found.");
+    void put_u64(unsigned char* data,uint64_t val)
+    {
+        put_u32(data,static_cast<uint32_t>(val));
+        put_u32(data + 4,static_cast<uint32_t>(val >> 32));
+    }
+
+    size_t align_section(size_t offset)
+    {
+        return (offset + section_align - 1) / section_align * section_align;
+    }
+
+    /// The string and float constants written to a file, numbered in the
+    /// order they first appear in
+    class constant_pools
+    {
+    public:
+        constant_pools() : m_string_size(0) {}
 
-    // read in the dsc tag
-    char dsc_tag[4] = { '\0', };
-    read_elem(file,dsc_tag,4);
-    if(dsc_tag[3] != '\0')
-        throw std::runtime_error(filename + " is not a valid DSC file");
-    if(strcmp(dsc_tag,"DSC") != 0)
-        throw std::runtime_error(filename + " is not a valid DSC file");
-
-    // read the instruction count
-    size_t instr_count = 0;
-    read_elem(file,&instr_count);
-    // allocate a buffer for the instructions
-    boost::scoped_array<instruction> buffer(new instruction[instr_count]);
-
-    // read all the instructions
-    read_elem(file,buffer.get(),instr_count * sizeof(instruction));
-
-    // copy to a codeblock
-    codeblock_t code(buffer.get(),buffer.get() + instr_count);
-
-    // load the string table
-
-    // read how many
-    size_t count = 0;
-    read_elem(file,&count);
-    for(size_t i = 0; i < count; ++i)
-    {
-        // read the length of the string
-        size_t len = 0;
-        read_elem(file,&len);
-
-        // read the string
-        boost::scoped_array<char> buf(new char[len + 1]);
-        read_elem(file,buf.get(),len);
-        buf[len] = '\0';
-
-        // add it to the string table, and get the entry
-        string_table::entry ste = strings.insert(buf.get());
-
-        // now read how many offsets this string has
-        size_t offset_count = 0;
-        read_elem(file,&offset_count);
-        // read each offset and set it to the ste
-        for(size_t off = 0; off < offset_count; ++off)
-        {
-            // read the offset
-            size_t offset = 0;
-            read_elem(file,&offset);
-            // set the code at that offset to the ste
-            code[offset] = ste;
+        uint32_t add_string(dscript::string_table::entry ste)
+        {
+            // strings that only differ by case are different strings,
+            // even if they are the same name
+            string str(ste);
+            map<string,uint32_t>::iterator found = m_string_index.find(str);
+            if(found != m_string_index.end())
+                return found->second;
+            uint32_t index = static_cast<uint32_t>(m_strings.size());
+            m_string_index[str] = index;
+            m_strings.push_back(str);
+            m_string_size += str.size() + 1;
+            return index;
         }
+
+        uint32_t add_float(dscript::float_table::entry fte)
+        {
+            map<dscript::float_table::entry,uint32_t>::iterator found =
+                m_float_index.find(fte);
+            if(found != m_float_index.end())
+                return found->second;
+            uint32_t index = static_cast<uint32_t>(m_floats.size());
+            m_float_index[fte] = index;
+            m_floats.push_back(*fte);
+            return index;
+        }
+
+        const vector<string>& get_strings() const { return m_strings; }
+        size_t get_string_size() const { return m_string_size; }
+        const vector<double>& get_floats() const { return m_floats; }
+
+    private:
+        map<string,uint32_t> m_string_index;
+        vector<string> m_strings;
+        size_t m_string_size;
+        map<dscript::float_table::entry,uint32_t> m_float_index;
+        vector<double> m_floats;
+    };
+
+    /// A whole file, read only. Mapped where there is mmap(), read into
+    /// memory otherwise.
+    class mapped_file
+    {
+    public:
+        explicit mapped_file(const string& filename)
+            : m_data(0), m_size(0), m_open(false)
+        {
+#ifdef _MSC_VER
+            ifstream file(filename.c_str(),ios::binary);
+            if(!file)
+                return;
+            m_open = true;
+            m_buffer.assign(
+                istreambuf_iterator<char>(file),
+                istreambuf_iterator<char>()
+                );
+            m_size = m_buffer.size();
+            m_data = m_size != 0 ? &m_buffer[0] : 0;
+#else
+            int fd = open(filename.c_str(),O_RDONLY);
+            if(fd == -1)
+                return;
+            m_open = true;
+            struct stat info;
+            if(fstat(fd,&info) == 0 && info.st_size > 0)
+            {
+                void* mem = mmap(0,info.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+                if(mem != MAP_FAILED)
+                {
+                    m_data = static_cast<const char*>(mem);
+                    m_size = info.st_size;
+                }
+            }
+            close(fd);
+#endif
+        }
+
+        ~mapped_file()
+        {
+#ifndef _MSC_VER
+            if(m_data != 0)
+                munmap(const_cast<char*>(m_data),m_size);
+#endif
+        }
+
+        bool is_open() const { return m_open; }
+        const char* data() const { return m_data; }
+        size_t size() const { return m_size; }
+
+    private:
+        mapped_file(const mapped_file&);
+        mapped_file& operator = (const mapped_file&);
+
+        const char* m_data;
+        size_t m_size;
+        bool m_open;
+#ifdef _MSC_VER
+        vector<char> m_buffer;
+#endif
+    };
+
+    /// Where the sections of a version 2 file are, once they have been
+    /// checked to be in it
+    struct v2_layout
+    {
+        /// The error for a file that isn't what its header says
+        std::runtime_error corrupt() const
+        {
+            return std::runtime_error(name + " is corrupt");
+        }
+
+        string name;
+        const unsigned char* code;
+        size_t code_count;
+        const unsigned char* string_index;
+        size_t string_count;
+        const char* string_data;
+        size_t string_size;
+        const unsigned char* floats;
+        size_t float_count;
+        const unsigned char* directory;
+        size_t function_count;
+    };
+
+    /// Checks the header of a version 2 file held in memory. name is what
+    /// errors call it.
+    v2_layout read_layout(const char* data,size_t size,const string& name)
+    {
+        const unsigned char* file = reinterpret_cast<const unsigned char*>(data);
+        if(size < header_size || memcmp(data,dsc_v2_magic,4) != 0)
+            throw std::runtime_error(name + " is not a valid DSC file");
+        if(get_u32(file + hdr_version) != dsc_version)
+            throw std::runtime_error(name + " is from another version of DScript");
+
+        v2_layout layout;
+        layout.name = name;
+        if(
+            get_u32(file + hdr_header_size) != header_size ||
+            get_u32(file + hdr_file_size) != size
+            )
+            throw layout.corrupt();
+
+        // every section has to be in the file
+        size_t code_offset = get_u32(file + hdr_code_offset);
+        size_t index_offset = get_u32(file + hdr_string_index_offset);
+        size_t string_offset = get_u32(file + hdr_string_data_offset);
+        size_t float_offset = get_u32(file + hdr_float_offset);
+        size_t directory_offset = get_u32(file + hdr_directory_offset);
+        layout.code_count = get_u32(file + hdr_code_count);
+        layout.string_count = get_u32(file + hdr_string_count);
+        layout.string_size = get_u32(file + hdr_string_data_size);
+        layout.float_count = get_u32(file + hdr_float_count);
+        layout.function_count = get_u32(file + hdr_function_count);
+        if(
+            code_offset > size || layout.code_count > (size - code_offset) / 8 ||
+            index_offset > size || layout.string_count > (size - index_offset) / 8 ||
+            string_offset > size || layout.string_size > size - string_offset ||
+            float_offset > size || layout.float_count > (size - float_offset) / 8 ||
+            directory_offset > size ||
+            layout.function_count > (size - directory_offset) / directory_entry_size
+            )
+            throw layout.corrupt();
+
+        layout.code = file + code_offset;
+        layout.string_index = file + index_offset;
+        layout.string_data = data + string_offset;
+        layout.floats = file + float_offset;
+        layout.directory = file + directory_offset;
+        return layout;
     }
 
-    // load the float table
-    read_elem(file,&count);
-    for(size_t i = 0; i < count; ++i)
+    /// The constants of a version 2 file, each added to the tables the
+    /// first time the code uses it
+    class v2_constants
     {
-        // read the float
-        double d = 0.0;
-        read_elem(file,&d);
+    public:
+        explicit v2_constants(const v2_layout& layout)
+            : m_layout(layout),
+            m_strings(layout.string_count),
+            m_floats(layout.float_count)
+        {}
 
-        // add it to the float table and get the entry
-        float_table::entry fte = floats.insert(d);
+        dscript::string_table::entry get_string(
+            uint64_t index,
+            dscript::string_table& strings
+            )
+        {
+            if(index >= m_strings.size())
+                throw m_layout.corrupt();
+            dscript::string_table::entry& ste = m_strings[static_cast<size_t>(index)];
+            if(ste == 0)
+                ste = strings.insert(read_string(index));
+            return ste;
+        }
 
-        // now read how many offsets this float has
-        size_t offset_count = 0;
-        read_elem(file,&offset_count);
-        // read each offset and set it to the fte
-        for(size_t off = 0; off < offset_count; ++off)
+        /// Returns a string without adding it to a table
+        string read_string(uint64_t index) const
         {
-            // read the offset
-            size_t offset = 0;
-            read_elem(file,&offset);
-            // set the code at that offset to the fte
-            code[offset] = fte;
+            if(index >= m_strings.size())
+                throw m_layout.corrupt();
+            const unsigned char* entry = m_layout.string_index + index * 8;
+            size_t offset = get_u32(entry);
+            size_t length = get_u32(entry + 4);
+            if(offset > m_layout.string_size || length >= m_layout.string_size - offset)
+                throw m_layout.corrupt();
+            return string(m_layout.string_data + offset,length);
+        }
+
+        dscript::float_table::entry get_float(
+            uint64_t index,
+            dscript::float_table& floats
+            )
+        {
+            if(index >= m_floats.size())
+                throw m_layout.corrupt();
+            dscript::float_table::entry& fte = m_floats[static_cast<size_t>(index)];
+            if(fte == 0)
+            {
+                uint64_t bits = get_u64(m_layout.floats + index * 8);
+                double d;
+                memcpy(&d,&bits,sizeof(d));
+                fte = floats.insert(d);
+            }
+            return fte;
+        }
+
+        /// Marks the strings added so far, see string_table::mark()
+        void mark(dscript::string_table& strings) const
+        {
+            for(size_t i = 0; i < m_strings.size(); ++i)
+            {
+                if(m_strings[i] != 0)
+                    strings.mark(m_strings[i]);
+            }
+        }
+
+    private:
+        v2_layout m_layout;
+        vector<dscript::string_table::entry> m_strings;
+        vector<dscript::float_table::entry> m_floats;
+    };
+
+    /// Decodes the slots [from,to) of the code of a version 2 file onto
+    /// the end of code. relocate(offset,is_decl) turns an offset in the
+    /// file into one in code.
+    template<typename RelocateT>
+    void decode_code(
+        const v2_layout& layout,
+        size_t from,
+        size_t to,
+        v2_constants& constants,
+        dscript::string_table& strings,
+        dscript::float_table& floats,
+        const RelocateT& relocate,
+        dscript::codeblock_t& code
+        )
+    {
+        using namespace dscript;
+
+        if(from == to)
+            return;
+        size_t base = code.size();
+        code.resize(base + to - from);
+        instruction* out = &code[0] + base;
+        for(size_t i = from; i < to; )
+        {
+            uint32_t op_val = get_u32(layout.code + i * 8);
+            // an op_load_func only ever comes from load_compiled_lazy()
+            if(
+                op_val >= static_cast<uint32_t>(op_count) ||
+                op_val == static_cast<uint32_t>(op_load_func)
+                )
+                throw layout.corrupt();
+            op_code op = static_cast<op_code>(op_val);
+            out[i++ - from] = op;
+            const char* operands = get_op_operands(op);
+            for(; *operands != '\0'; ++operands, ++i)
+            {
+                if(i >= to)
+                    throw layout.corrupt();
+                uint64_t val = get_u64(layout.code + i * 8);
+                instruction& slot = out[i - from];
+                switch(*operands)
+                {
+                case 'n':
+                case 's':
+                    slot = constants.get_string(val,strings);
+                    break;
+                case 'f':
+                    slot = constants.get_float(val,floats);
+                    break;
+                case 'o':
+                    slot = relocate(val,false);
+                    break;
+                case 'd':
+                    slot = relocate(val,true);
+                    break;
+                case 'x':
+                    slot = size_t(0);
+                    break;
+                case 'c':
+                    {
+                        // the slot count, and the name of each slot
+                        size_t slot_count = static_cast<uint32_t>(val);
+                        if(slot_count > to - i - 1)
+                            throw layout.corrupt();
+                        slot = static_cast<int>(slot_count);
+                        for(size_t name = 0; name < slot_count; ++name)
+                        {
+                            ++i;
+                            out[i - from] = constants.get_string(
+                                get_u64(layout.code + i * 8),
+                                strings
+                                );
+                        }
+                    }
+                    break;
+                default:
+                    // ints and frame slots
+                    slot = static_cast<int>(static_cast<uint32_t>(val));
+                    break;
+                }
+            }
         }
     }
-    return code;
-}
 
-template<typename TypeT>
-void write_elem(ostream& out,const TypeT* data,size_t size = sizeof(TypeT))
-{
-    out.write(
-        reinterpret_cast<const char*>(data),
-        size
-        );
-    if(out.fail() | out.bad())
-        throw std::runtime_error("Could not write to file.");
-}
+    /// The offsets of a file decoded whole are the same in the codeblock
+    class whole_code
+    {
+    public:
+        explicit whole_code(const v2_layout& layout) : m_layout(layout) {}
 
-void save_codeblock(const string& filename,const codeblock_t& code)
-{
-    // oh, noes!
-    ofstream file(filename.c_str(),ios::binary);
-    if(!file)
-        throw std::runtime_error( filename + " could not be opened.");
+        size_t operator () (uint64_t val,bool) const
+        {
+            if(val > m_layout.code_count)
+                throw m_layout.corrupt();
+            return static_cast<size_t>(val);
+        }
 
-    // write out the dsc tag
-    write_elem(file,"DSC",4);
-    // write out the instruction count
-    size_t s = code.size();
-    write_elem(file,&s);
+    private:
+        const v2_layout& m_layout;
+    };
+
+    /// The offsets of a function decoded on its own, [decl,end) in the
+    /// file, are from its op_decl_func. None of the declarations outside
+    /// of it is the one an inline guard in it looks for.
+    class function_code
+    {
+    public:
+        function_code(const v2_layout& layout,size_t decl,size_t end)
+            : m_layout(layout), m_decl(decl), m_end(end)
+        {}
 
-    // this will hold the stringtable values
-    typedef map<string_table::entry,vector<size_t>,cmp_ste> file_s_table;
-    file_s_table s_table;
+        size_t operator () (uint64_t val,bool is_decl) const
+        {
+            if(val >= m_decl && val <= m_end)
+                return static_cast<size_t>(val) - m_decl;
+            if(!is_decl || val > m_layout.code_count)
+                throw m_layout.corrupt();
+            return m_end - m_decl;
+        }
 
-    // this will hold the float table values
-    typedef map<float_table::entry,vector<size_t> > file_f_table;
-    file_f_table f_table;
+    private:
+        const v2_layout& m_layout;
+        size_t m_decl;
+        size_t m_end;
+    };
 
+    /// How many slots the op_load_func that stands in for a body takes
+    const size_t load_func_size = 3;
 
-    // now, write out the instruction stream
-    for(size_t i = 0; i < code.size(); ++i)
+    /// The offsets of the file scope code of a file loaded lazily, which
+    /// has the body of each function replaced by an op_load_func
+    class file_scope_code
     {
-        // write the op code
-        int c = code[i].get_int();
-        write_elem(file,&c);
-
-        // op codes and such
-        switch(code[i].get_op_code())
-        {
-        case op_call_func:
-        case op_push_var:
-        case op_inc_var:
-        case op_dec_var:
-        case op_pop_param:
-        case op_assign_var:
-        case op_mul_asn_var:
-        case op_div_asn_var:
-        case op_mod_asn_var:
-        case op_add_asn_var:
-        case op_sub_asn_var:
-        case op_cat_asn_var:
-        case op_band_asn_var:
-        case op_bor_asn_var:
-        case op_bxor_asn_var:
-        case op_shl_asn_var:
-        case op_shr_asn_var:
-        case op_push_str:
+    public:
+        explicit file_scope_code(const v2_layout& layout) : m_layout(layout) {}
+
+        /// Replaces the body [from,to) of the next function in the file
+        void add_body(size_t from,size_t to)
+        {
+            size_t new_from = from;
+            if(!m_to.empty())
+                new_from = from - m_to.back() + m_new_to.back();
+            m_from.push_back(from);
+            m_to.push_back(to);
+            m_new_from.push_back(new_from);
+            m_new_to.push_back(new_from + load_func_size);
+        }
+
+        size_t operator () (uint64_t val,bool is_decl) const
+        {
+            if(val > m_layout.code_count)
+                throw m_layout.corrupt();
+            size_t off = static_cast<size_t>(val);
+            // how many bodies end at or before it
+            size_t after = upper_bound(m_to.begin(),m_to.end(),off) - m_to.begin();
+            if(after < m_from.size() && off > m_from[after])
             {
-                ++i;
-                // out a placeholder (4 0's)
-                size_t s = 0;
-                write_elem(file,&s);
-                // add it to the list of offsets for this entry
-                s_table[code[i].get_str()].push_back(i);
+                // only an inline guard looks into a body, for a function
+                // declared in it, and it won't find one at the
+                // op_load_func
+                if(!is_decl)
+                    throw m_layout.corrupt();
+                return m_new_from[after];
             }
-            break;
-        case op_push_float:
+            if(after == 0)
+                return off;
+            return off - m_to[after - 1] + m_new_to[after - 1];
+        }
+
+    private:
+        const v2_layout& m_layout;
+        vector<size_t> m_from;
+        vector<size_t> m_to;
+        vector<size_t> m_new_from;
+        vector<size_t> m_new_to;
+    };
+
+    /// Loads a version 2 file held in memory. name is what errors call
+    /// it.
+    dscript::codeblock_t load_v2(
+        const char* data,
+        size_t size,
+        const string& name,
+        dscript::string_table& strings,
+        dscript::float_table& floats
+        )
+    {
+        v2_layout layout = read_layout(data,size,name);
+        v2_constants constants(layout);
+        dscript::codeblock_t code;
+        decode_code(
+            layout,
+            0,
+            layout.code_count,
+            constants,
+            strings,
+            floats,
+            whole_code(layout),
+            code
+            );
+        return code;
+    }
+
+    /// The code of a version 2 file, or of a script in a bundle, loaded
+    /// by load_compiled_lazy()
+    class lazy_image : public dscript::compiled_image
+    {
+    public:
+        /// layout is where the code is, in memory storage keeps, and
+        /// constants are the constants it uses
+        lazy_image(
+            const v2_layout& layout,
+            const boost::shared_ptr<v2_constants>& constants,
+            const boost::shared_ptr<const void>& storage
+            )
+            : m_storage(storage), m_layout(layout), m_constants(constants)
+        {}
+
+        /// Returns the file scope code, with an op_load_func in place of
+        /// the body of each function in the directory
+        dscript::codeblock_t load(
+            dscript::string_table& strings,
+            dscript::float_table& floats
+            )
+        {
+            using namespace dscript;
+
+            // the directory has to agree with the code
+            file_scope_code relocate(m_layout);
+            size_t scope_end = 0;
+            for(size_t f = 0; f < m_layout.function_count; ++f)
             {
-                ++i;
-                // out a placeholder (4 0's)
-                size_t s = 0;
-                write_elem(file,&s);
-                // add this offset to the list for this float
-                f_table[code[i].get_flt()].push_back(i);
+                const unsigned char* entry =
+                    m_layout.directory + f * directory_entry_size;
+                function_range fn;
+                fn.decl = get_u32(entry + 4);
+                fn.end = get_u32(entry + 8);
+                if(
+                    fn.decl < scope_end || fn.end > m_layout.code_count ||
+                    fn.end < fn.decl + 4 ||
+                    get_u64(m_layout.code + fn.decl * 8) != op_decl_func ||
+                    get_u64(m_layout.code + (fn.decl + 1) * 8) != get_u32(entry) ||
+                    get_u64(m_layout.code + (fn.decl + 2) * 8) != fn.end
+                    )
+                    throw m_layout.corrupt();
+                size_t slot_count = get_u32(m_layout.code + (fn.decl + 3) * 8);
+                if(slot_count > fn.end - fn.decl - 4)
+                    throw m_layout.corrupt();
+                fn.body = fn.decl + 4 + slot_count;
+                m_directory.push_back(fn);
+                relocate.add_body(fn.body,fn.end);
+                scope_end = fn.end;
             }
-            break;
-        case op_push_int:
-        case op_jmp_false:
-        case op_jmp:
+
+            codeblock_t code;
+            size_t at = 0;
+            for(size_t f = 0; f < m_directory.size(); ++f)
             {
-                ++i;
-                // output the offset
-                int _i = code[i].get_int();
-                write_elem(file,&_i);
+                // the code up to the function, and its declaration
+                const function_range& fn = m_directory[f];
+                decode_code(m_layout,at,fn.body,*m_constants,strings,floats,relocate,code);
+                code.push_back(op_load_func);
+                code.push_back(static_cast<int>(f));
+                code.push_back(static_cast<const void*>(
+                    static_cast<compiled_image*>(this)
+                    ));
+                at = fn.end;
             }
-            break;
-        case op_decl_func:
+            decode_code(m_layout,at,m_layout.code_count,*m_constants,strings,floats,relocate,code);
+            return code;
+        }
+
+        dscript::codeblock_t& get_function(
+            size_t index,
+            dscript::string_table& strings,
+            dscript::float_table& floats
+            )
+        {
+            map<size_t,dscript::codeblock_t>::iterator found = m_decoded.find(index);
+            if(found != m_decoded.end())
+                return found->second;
+            if(index >= m_directory.size())
+                throw m_layout.corrupt();
+
+            // decoded on the side first, in case it turns out corrupt
+            const function_range& fn = m_directory[index];
+            dscript::codeblock_t code;
+            decode_code(
+                m_layout,
+                fn.decl,
+                fn.end,
+                *m_constants,
+                strings,
+                floats,
+                function_code(m_layout,fn.decl,fn.end),
+                code
+                );
+            dscript::codeblock_t& decoded = m_decoded[index];
+            decoded.swap(code);
+            return decoded;
+        }
+
+        size_t get_function_count() const { return m_directory.size(); }
+        size_t get_decoded_count() const { return m_decoded.size(); }
+
+        void mark_strings(dscript::string_table& strings) const
+        {
+            m_constants->mark(strings);
+        }
+
+    private:
+        /// Where a function in the directory is: its op_decl_func, its
+        /// body and its end
+        struct function_range
+        {
+            size_t decl;
+            size_t body;
+            size_t end;
+        };
+
+        boost::shared_ptr<const void> m_storage;
+        v2_layout m_layout;
+        boost::shared_ptr<v2_constants> m_constants;
+        vector<function_range> m_directory;
+        map<size_t,dscript::codeblock_t> m_decoded;
+    };
+
+    /// Loads code the way load_compiled_lazy() does, see lazy_image
+    dscript::codeblock_t load_lazy(
+        const v2_layout& layout,
+        const boost::shared_ptr<v2_constants>& constants,
+        const boost::shared_ptr<const void>& storage,
+        dscript::string_table& strings,
+        dscript::float_table& floats,
+        dscript::compiled_image_ptr& image
+        )
+    {
+        boost::shared_ptr<lazy_image> lazy(new lazy_image(layout,constants,storage));
+        dscript::codeblock_t code = lazy->load(strings,floats);
+        // without any function to decode later, the code isn't needed
+        // anymore
+        image.reset();
+        if(lazy->get_function_count() != 0)
+            image = lazy;
+        return code;
+    }
+
+    /// Encodes a codeblock in the 64 bit slots of a version 2 file, and
+    /// adds its constants to pools
+    vector<uint64_t> encode_code(
+        const dscript::codeblock_t& code,
+        constant_pools& pools
+        )
+    {
+        using namespace dscript;
+
+        vector<uint64_t> slots(code.size());
+        for(size_t i = 0; i < code.size(); )
+        {
+            if(code[i].get_op_code() == op_load_func)
             {
-                ++i;
-                // out a placeholder (4 0's)
-                size_t s = 0;
-                write_elem(file,&s);
-                // add it to the list of offsets for this entry
-                s_table[code[i].get_str()].push_back(i);
-
-                ++i;
-                // output the offset
-                int _i = code[i].get_int();
-                write_elem(file,&_i);
+                // the rest of the function is still in its compiled_image
+                throw std::runtime_error(
+                    "a lazily loaded codeblock can not be saved."
+                    );
+            }
+            slots[i] = static_cast<uint32_t>(code[i].get_op_code());
+            const char* operands = get_op_operands(code[i++].get_op_code());
+            for(; *operands != '\0'; ++operands, ++i)
+            {
+                switch(*operands)
+                {
+                case 'n':
+                case 's':
+                    slots[i] = pools.add_string(code[i].get_str());
+                    break;
+                case 'f':
+                    slots[i] = pools.add_float(code[i].get_flt());
+                    break;
+                case 'o':
+                case 'd':
+                    slots[i] = code[i].get_offset();
+                    break;
+                case 'x':
+                    // inline caches always start out empty
+                    slots[i] = 0;
+                    break;
+                case 'g':
+                    // global slots are only valid in the vmachine that
+                    // linked the codeblock
+                    throw std::runtime_error(
+                        "a linked codeblock can not be saved."
+                        );
+                case 'c':
+                    {
+                        // the slot count, and the name of each slot
+                        size_t slot_count = code[i].get_int();
+                        slots[i] = static_cast<uint32_t>(slot_count);
+                        for(size_t slot = 0; slot < slot_count; ++slot)
+                        {
+                            ++i;
+                            slots[i] = pools.add_string(code[i].get_str());
+                        }
+                    }
+                    break;
+                default:
+                    // ints and frame slots
+                    slots[i] = static_cast<uint32_t>(code[i].get_int());
+                    break;
+                }
             }
-            break;
-          default:
-            break; // NOP
         }
+        return slots;
     }
-    // codestream is written
-    // flush it
-    file.flush();
-
-    // now write the string table
-
-    // write out how many strings there are
-    size_t count = s_table.size();
-    write_elem(file,&count);
-
-    // now write out each string and it's offset
-    file_s_table::iterator str = s_table.begin();
-    file_s_table::iterator s_end = s_table.end();
-    for(; str != s_end; ++str)
-    {
-        string s = str->first;
-        vector<size_t>& offsets = str->second;
-        // write out the size of the string
-        size_t len = s.length();
-        write_elem(file,&len);
-        // write out the string itself
-        write_elem(
-            file,
-            s.c_str(),
-            len
-            );
 
-        // now write out how many offsets this string has
-        size_t count = offsets.size();
-        write_elem(file,&count);
+    /// Adds the functions declared at file scope in code, which slots
+    /// is the encoding of, to a directory for load_compiled_lazy()
+    void add_functions(
+        const dscript::codeblock_t& code,
+        const vector<uint64_t>& slots,
+        vector<uint32_t>& directory
+        )
+    {
+        using namespace dscript;
 
-        // now write out each offset
-        for(size_t i = 0; i < count; ++i)
+        size_t scope_end = 0;
+        for(size_t i = 0; i < code.size(); i += get_instr_size(code.begin() + i))
         {
-            size_t off = offsets[i];
-            write_elem(
-                file,
-                &off
-                );
+            if(i < scope_end || code[i].get_op_code() != op_decl_func)
+                continue;
+            scope_end = code[i + 2].get_offset();
+            directory.push_back(static_cast<uint32_t>(slots[i + 1]));
+            directory.push_back(static_cast<uint32_t>(i));
+            directory.push_back(static_cast<uint32_t>(scope_end));
+            directory.push_back(0);
         }
     }
-    // flush it
-    file.flush();
 
-    // now write the float table
+    /// Writes the constants in pools to the float, string index and
+    /// string data sections of a file
+    void write_pools(
+        unsigned char* file,
+        const constant_pools& pools,
+        size_t float_offset,
+        size_t index_offset,
+        size_t string_offset
+        )
+    {
+        const vector<double>& float_pool = pools.get_floats();
+        for(size_t i = 0; i < float_pool.size(); ++i)
+        {
+            uint64_t bits;
+            memcpy(&bits,&float_pool[i],sizeof(bits));
+            put_u64(file + float_offset + i * 8,bits);
+        }
+        const vector<string>& string_pool = pools.get_strings();
+        size_t string_at = 0;
+        for(size_t i = 0; i < string_pool.size(); ++i)
+        {
+            put_u32(file + index_offset + i * 8,string_at);
+            put_u32(file + index_offset + i * 8 + 4,string_pool[i].size());
+            memcpy(file + string_offset + string_at,string_pool[i].data(),string_pool[i].size());
+            string_at += string_pool[i].size() + 1;
+        }
+    }
 
-    // write out how many floats there are
-    count = f_table.size();
-    write_elem(file,&count);
+    /// Writes a whole file, for save_codeblock() and save_bundle(). The
+    /// data goes to a temporary file first, which then replaces the
+    /// file, so that no one ever loads half of it, and a file that is
+    /// mapped already (see load_compiled_lazy()) keeps its old contents.
+    void write_file(const string& filename,const string& data)
+    {
+        // each call writes a temporary file of its own, even when two
+        // contexts of a process save the same file
+        static size_t writes = 0;
+        ostringstream temp_name;
+#ifdef _MSC_VER
+        temp_name << filename << '.' << _getpid() << '.' << ++writes << ".tmp";
+#else
+        temp_name << filename << '.' << getpid() << '.' << ++writes << ".tmp";
+#endif
+        const string temp = temp_name.str();
+        {
+            ofstream file(temp.c_str(),ios::binary);
+            if(!file)
+                throw std::runtime_error( filename + " could not be opened.");
+            file.write(data.data(),data.size());
+            file.flush();
+            if(file.fail() | file.bad())
+            {
+                file.close();
+                remove(temp.c_str());
+                throw std::runtime_error("Could not write to file.");
+            }
+        }
+#ifdef _MSC_VER
+        bool replaced = MoveFileExA(
+            temp.c_str(),
+            filename.c_str(),
+            MOVEFILE_REPLACE_EXISTING
+            ) != 0;
+#else
+        bool replaced = rename(temp.c_str(),filename.c_str()) == 0;
+#endif
+        if(!replaced)
+        {
+            remove(temp.c_str());
+            throw std::runtime_error( filename + " could not be replaced.");
+        }
+    }
 
-    // now write out each float and it's offset
-    file_f_table::iterator f = f_table.begin();
-    file_f_table::iterator f_end = f_table.end();
-    for(; f != f_end; ++f)
+    /// FNV-1a of the name of a script in a bundle
+    uint32_t hash_name(const string& name)
     {
-        float_table::entry flt = f->first;
-        vector<size_t>& offsets = f->second;
+        uint32_t hash = 2166136261u;
+        for(size_t c = 0; c < name.size(); ++c)
+        {
+            hash ^= static_cast<unsigned char>(name[c]);
+            hash *= 16777619u;
+        }
+        return hash;
+    }
 
-        // write out the float itself
-        write_elem(
-                file,
-                flt
+#ifdef DSCRIPT_ZLIB
+    /// Deflates a block of the code of a bundle
+    string deflate_block(const unsigned char* data,size_t size)
+    {
+        uLongf packed_size = compressBound(size);
+        string packed(packed_size,'\0');
+        int result = compress2(
+            reinterpret_cast<Bytef*>(&packed[0]),
+            &packed_size,
+            data,
+            size,
+            Z_BEST_COMPRESSION
             );
+        if(result != Z_OK)
+            throw std::runtime_error("the code could not be compressed.");
+        packed.resize(packed_size);
+        return packed;
+    }
+#endif
+
+    /// A file written by save_bundle()
+    class bundle_file : public dscript::compiled_bundle
+    {
+    public:
+        explicit bundle_file(const string& filename)
+            : m_file(new mapped_file(filename)), m_cached_block(string::npos)
+        {
+            if(!m_file->is_open())
+                throw std::runtime_error(filename + " could not be found.");
+
+            const unsigned char* file =
+                reinterpret_cast<const unsigned char*>(m_file->data());
+            size_t size = m_file->size();
+            if(size < bundle_header_size || memcmp(file,bundle_magic,4) != 0)
+                throw std::runtime_error(filename + " is not a valid DScript bundle");
+            if(get_u32(file + bhdr_version) != bundle_version)
+                throw std::runtime_error(filename + " is from another version of DScript");
+
+            m_pools.name = filename;
+            if(
+                get_u32(file + bhdr_header_size) != bundle_header_size ||
+                get_u32(file + bhdr_file_size) != size
+                )
+                throw m_pools.corrupt();
 
-        // now write out how many offsets this float has
-        size_t count = offsets.size();
-        write_elem(file,&count);
+            // every section has to be in the file
+            size_t script_offset = get_u32(file + bhdr_script_offset);
+            size_t bucket_offset = get_u32(file + bhdr_bucket_offset);
+            size_t index_offset = get_u32(file + bhdr_string_index_offset);
+            size_t string_offset = get_u32(file + bhdr_string_data_offset);
+            size_t float_offset = get_u32(file + bhdr_float_offset);
+            size_t directory_offset = get_u32(file + bhdr_directory_offset);
+            size_t code_offset = get_u32(file + bhdr_code_offset);
+            size_t block_offset = get_u32(file + bhdr_block_offset);
+            m_script_count = get_u32(file + bhdr_script_count);
+            m_bucket_count = get_u32(file + bhdr_bucket_count);
+            m_pools.string_count = get_u32(file + bhdr_string_count);
+            m_pools.string_size = get_u32(file + bhdr_string_data_size);
+            m_pools.float_count = get_u32(file + bhdr_float_count);
+            m_pools.function_count = get_u32(file + bhdr_function_count);
+            m_code_count = get_u32(file + bhdr_code_count);
+            m_block_size = get_u32(file + bhdr_block_size);
+            if(
+                script_offset > size ||
+                m_script_count > (size - script_offset) / script_entry_size ||
+                bucket_offset > size || m_bucket_count > (size - bucket_offset) / 4 ||
+                m_bucket_count == 0 || (m_bucket_count & (m_bucket_count - 1)) != 0 ||
+                index_offset > size || m_pools.string_count > (size - index_offset) / 8 ||
+                string_offset > size || m_pools.string_size > size - string_offset ||
+                float_offset > size || m_pools.float_count > (size - float_offset) / 8 ||
+                directory_offset > size ||
+                m_pools.function_count > (size - directory_offset) / directory_entry_size ||
+                code_offset > size || block_offset > size
+                )
+                throw m_pools.corrupt();
+
+            if(m_block_size == 0)
+            {
+                if(m_code_count > (size - code_offset) / 8)
+                    throw m_pools.corrupt();
+                m_block_count = 0;
+            }
+            else
+            {
+#ifndef DSCRIPT_ZLIB
+                throw std::runtime_error(
+                    filename + " is compressed, which needs a build with "
+                    "DSCRIPT_ZLIB defined"
+                    );
+#endif
+                if(m_block_size % 8 != 0)
+                    throw m_pools.corrupt();
+                // zlib doesn't deflate anything to less than 1/1032 of
+                // its size
+                size_t block_slots = m_block_size / 8;
+                m_block_count = (m_code_count + block_slots - 1) / block_slots;
+                if(
+                    m_block_count > (size - block_offset) / 8 ||
+                    m_code_count / 1032 > size / 8
+                    )
+                    throw m_pools.corrupt();
+            }
+
+            m_scripts = file + script_offset;
+            m_buckets = file + bucket_offset;
+            m_code = file + code_offset;
+            m_blocks = file + block_offset;
+            m_pools.code = 0;
+            m_pools.code_count = 0;
+            m_pools.string_index = file + index_offset;
+            m_pools.string_data = m_file->data() + string_offset;
+            m_pools.floats = file + float_offset;
+            m_pools.directory = file + directory_offset;
+            m_constants.reset(new v2_constants(m_pools));
+        }
+
+        size_t get_script_count() const { return m_script_count; }
+
+        string get_script_name(size_t index) const
+        {
+            if(index >= m_script_count)
+                return string();
+            return m_constants->read_string(
+                get_u32(m_scripts + index * script_entry_size)
+                );
+        }
+
+        bool has_script(const string& name) const
+        {
+            return find_script(name) != string::npos;
+        }
+
+        dscript::codeblock_t load_script(
+            const string& name,
+            dscript::string_table& strings,
+            dscript::float_table& floats,
+            dscript::compiled_image_ptr& image
+            )
+        {
+            size_t index = find_script(name);
+            if(index == string::npos)
+                throw std::runtime_error(m_pools.name + " has no script " + name);
+
+            const unsigned char* script = m_scripts + index * script_entry_size;
+            size_t code_from = get_u32(script + 12);
+            size_t code_count = get_u32(script + 16);
+            size_t first_function = get_u32(script + 20);
+            size_t function_count = get_u32(script + 24);
+            if(
+                code_from > m_code_count || code_count > m_code_count - code_from ||
+                first_function > m_pools.function_count ||
+                function_count > m_pools.function_count - first_function
+                )
+                throw m_pools.corrupt();
+
+            v2_layout layout = m_pools;
+            layout.name = m_pools.name + ": " + name;
+            layout.code_count = code_count;
+            layout.directory = m_pools.directory + first_function * directory_entry_size;
+            layout.function_count = function_count;
+            boost::shared_ptr<const void> storage =
+                read_code(code_from,code_count,layout.code);
+            return load_lazy(layout,m_constants,storage,strings,floats,image);
+        }
+
+        void mark_strings(dscript::string_table& strings) const
+        {
+            m_constants->mark(strings);
+        }
+
+    private:
+        /// Returns the index of the script called name, or npos
+        size_t find_script(const string& name) const
+        {
+            uint32_t hash = hash_name(name);
+            size_t next = get_u32(m_buckets + (hash & (m_bucket_count - 1)) * 4);
+            // no chain is longer than that, unless the file is corrupt
+            for(size_t steps = 0; next != 0 && steps < m_script_count; ++steps)
+            {
+                if(next > m_script_count)
+                    throw m_pools.corrupt();
+                const unsigned char* script = m_scripts + (next - 1) * script_entry_size;
+                if(
+                    get_u32(script + 4) == hash &&
+                    m_constants->read_string(get_u32(script)) == name
+                    )
+                    return next - 1;
+                next = get_u32(script + 8);
+            }
+            return string::npos;
+        }
+
+        /// Points code at the count slots of code from the from'th, and
+        /// returns what keeps them in memory
+        boost::shared_ptr<const void> read_code(
+            size_t from,
+            size_t count,
+            const unsigned char*& code
+            )
+        {
+#ifdef DSCRIPT_ZLIB
+            if(m_block_size != 0)
+            {
+                // copied out of the blocks the code is in
+                boost::shared_ptr<vector<unsigned char> > buffer(
+                    new vector<unsigned char>(count * 8)
+                    );
+                size_t at = from * 8;
+                size_t end = (from + count) * 8;
+                while(at < end)
+                {
+                    size_t block = at / m_block_size;
+                    const vector<unsigned char>& data = inflate(block);
+                    size_t in_block = at - block * m_block_size;
+                    size_t bytes = min(end - at,data.size() - in_block);
+                    memcpy(&(*buffer)[at - from * 8],&data[in_block],bytes);
+                    at += bytes;
+                }
+                code = buffer->empty() ? 0 : &(*buffer)[0];
+                return buffer;
+            }
+#else
+            // only compressed code is copied
+            (void)count;
+#endif
+            code = m_code + from * 8;
+            return m_file;
+        }
 
-        // now write out each offset
-        for(size_t i = 0; i < count; ++i)
+#ifdef DSCRIPT_ZLIB
+        /// Returns a block of the code, inflated. The last one is kept,
+        /// since scripts packed next to each other often share one.
+        const vector<unsigned char>& inflate(size_t block)
         {
-            size_t off = offsets[i];
-            write_elem(
-                file,
-                &off
+            if(block == m_cached_block)
+                return m_cached_data;
+            if(block >= m_block_count)
+                throw m_pools.corrupt();
+            const unsigned char* entry = m_blocks + block * 8;
+            size_t offset = get_u32(entry);
+            size_t size = get_u32(entry + 4);
+            if(offset > m_file->size() || size > m_file->size() - offset)
+                throw m_pools.corrupt();
+
+            m_cached_block = string::npos;
+            size_t block_slots = m_block_size / 8;
+            uLongf unpacked = min(block_slots,m_code_count - block * block_slots) * 8;
+            m_cached_data.resize(unpacked);
+            int result = uncompress(
+                &m_cached_data[0],
+                &unpacked,
+                reinterpret_cast<const Bytef*>(m_file->data()) + offset,
+                size
                 );
+            if(result != Z_OK || unpacked != m_cached_data.size())
+                throw m_pools.corrupt();
+            m_cached_block = block;
+            return m_cached_data;
         }
+#endif
+
+        boost::shared_ptr<mapped_file> m_file;
+        // the constants and the directory of every script. The code of
+        // each is somewhere else.
+        v2_layout m_pools;
+        boost::shared_ptr<v2_constants> m_constants;
+        const unsigned char* m_scripts;
+        size_t m_script_count;
+        const unsigned char* m_buckets;
+        size_t m_bucket_count;
+        const unsigned char* m_code;
+        size_t m_code_count;
+        const unsigned char* m_blocks;
+        size_t m_block_size;
+        size_t m_block_count;
+        size_t m_cached_block;
+        vector<unsigned char> m_cached_data;
+    };
+}
+
+namespace dscript {
+
+codeblock_t load_compiled_file(const string& filename,string_table& strings,float_table& floats)
+{
+    mapped_file file(filename);
+    if(!file.is_open())
+        throw std::runtime_error(filename + " could not be found.");
+
+    if(file.size() >= 4 && memcmp(file.data(),"DSC\0",4) == 0)
+        throw std::runtime_error(filename + ": unsupported .dsc version");
+    return load_v2(file.data(),file.size(),filename,strings,floats);
+}
+
+codeblock_t load_compiled_lazy(
+    const string& filename,
+    string_table& strings,
+    float_table& floats,
+    compiled_image_ptr& image
+    )
+{
+    boost::shared_ptr<mapped_file> file(new mapped_file(filename));
+    if(!file->is_open())
+        throw std::runtime_error(filename + " could not be found.");
+
+    if(file->size() >= 4 && memcmp(file->data(),"DSC\0",4) == 0)
+        throw std::runtime_error(filename + ": unsupported .dsc version");
+    v2_layout layout = read_layout(file->data(),file->size(),filename);
+    boost::shared_ptr<v2_constants> constants(new v2_constants(layout));
+    return load_lazy(layout,constants,file,strings,floats,image);
+}
+
+codeblock_t load_compiled_data(
+    const char* data,
+    size_t size,
+    string_table& strings,
+    float_table& floats
+    )
+{
+    return load_v2(data,size,"compiled code",strings,floats);
+}
+
+string write_compiled_data(const codeblock_t& code)
+{
+    constant_pools pools;
+    vector<uint64_t> slots = encode_code(code,pools);
+    vector<uint32_t> directory;
+    add_functions(code,slots,directory);
+
+    const vector<string>& string_pool = pools.get_strings();
+    size_t string_size = pools.get_string_size();
+    const vector<double>& float_pool = pools.get_floats();
+
+    // lay the sections out
+    size_t code_offset = header_size;
+    size_t float_offset = align_section(code_offset + slots.size() * 8);
+    size_t directory_offset = align_section(float_offset + float_pool.size() * 8);
+    size_t index_offset = align_section(directory_offset + directory.size() * 4);
+    size_t string_offset = align_section(index_offset + string_pool.size() * 8);
+    size_t size = align_section(string_offset + string_size);
+
+    string out(size,'\0');
+    unsigned char* file = reinterpret_cast<unsigned char*>(&out[0]);
+    memcpy(file,dsc_v2_magic,4);
+    put_u32(file + hdr_version,dsc_version);
+    put_u32(file + hdr_header_size,header_size);
+    put_u32(file + hdr_code_offset,code_offset);
+    put_u32(file + hdr_code_count,slots.size());
+    put_u32(file + hdr_string_index_offset,index_offset);
+    put_u32(file + hdr_string_count,string_pool.size());
+    put_u32(file + hdr_string_data_offset,string_offset);
+    put_u32(file + hdr_string_data_size,string_size);
+    put_u32(file + hdr_float_offset,float_offset);
+    put_u32(file + hdr_float_count,float_pool.size());
+    put_u32(file + hdr_file_size,size);
+    put_u32(file + hdr_directory_offset,directory_offset);
+    put_u32(file + hdr_function_count,directory.size() * 4 / directory_entry_size);
+
+    for(size_t i = 0; i < slots.size(); ++i)
+        put_u64(file + code_offset + i * 8,slots[i]);
+    for(size_t i = 0; i < directory.size(); ++i)
+        put_u32(file + directory_offset + i * 4,directory[i]);
+    write_pools(file,pools,float_offset,index_offset,string_offset);
+    return out;
+}
+
+void save_codeblock(const string& filename,const codeblock_t& code)
+{
+    string data;
+    try
+    {
+        data = write_compiled_data(code);
+    }
+    catch(std::runtime_error& e)
+    {
+        throw std::runtime_error(filename + ": " + e.what());
     }
+    write_file(filename,data);
+}
+
+void save_bundle(
+    const string& filename,
+    const vector<string>& names,
+    const vector<codeblock_t>& code,
+    bool compress
+    )
+{
+    if(names.size() != code.size())
+        throw std::runtime_error(filename + ": every script needs a name.");
+#ifndef DSCRIPT_ZLIB
+    if(compress)
+    {
+        throw std::runtime_error(
+            filename + ": compressing a bundle needs a build with "
+            "DSCRIPT_ZLIB defined."
+            );
+    }
+#endif
+
+    // the code of every script one after another, with the constants
+    // they use pooled
+    constant_pools pools;
+    vector<uint64_t> slots;
+    vector<uint32_t> directory;
+    vector<uint32_t> scripts;
+    set<string> seen;
+    for(size_t i = 0; i < code.size(); ++i)
+    {
+        if(!seen.insert(names[i]).second)
+            throw std::runtime_error(filename + ": there are two scripts called " + names[i]);
+        vector<uint64_t> script_slots;
+        try
+        {
+            script_slots = encode_code(code[i],pools);
+        }
+        catch(std::runtime_error& e)
+        {
+            throw std::runtime_error(filename + ": " + names[i] + ": " + e.what());
+        }
+        size_t first_function = directory.size() / 4;
+        add_functions(code[i],script_slots,directory);
+
+        scripts.push_back(pools.add_string(names[i].c_str()));
+        scripts.push_back(hash_name(names[i]));
+        scripts.push_back(0);
+        scripts.push_back(static_cast<uint32_t>(slots.size()));
+        scripts.push_back(static_cast<uint32_t>(script_slots.size()));
+        scripts.push_back(static_cast<uint32_t>(first_function));
+        scripts.push_back(static_cast<uint32_t>(directory.size() / 4 - first_function));
+        scripts.push_back(0);
+        slots.insert(slots.end(),script_slots.begin(),script_slots.end());
+    }
+
+    // the name index. Each bucket chains its scripts in the order they
+    // were packed in.
+    size_t bucket_count = 1;
+    while(bucket_count < names.size())
+        bucket_count *= 2;
+    vector<uint32_t> buckets(bucket_count,0);
+    for(size_t i = names.size(); i-- > 0; )
+    {
+        uint32_t& bucket = buckets[scripts[i * 8 + 1] & (bucket_count - 1)];
+        scripts[i * 8 + 2] = bucket;
+        bucket = static_cast<uint32_t>(i + 1);
+    }
+
+    string code_data(slots.size() * 8,'\0');
+    unsigned char* code_bytes = reinterpret_cast<unsigned char*>(&code_data[0]);
+    for(size_t i = 0; i < slots.size(); ++i)
+        put_u64(code_bytes + i * 8,slots[i]);
+    size_t block_size = 0;
+    vector<string> blocks;
+#ifdef DSCRIPT_ZLIB
+    if(compress)
+    {
+        block_size = bundle_block_size;
+        for(size_t at = 0; at < code_data.size(); at += block_size)
+        {
+            size_t bytes = min(block_size,code_data.size() - at);
+            blocks.push_back(deflate_block(code_bytes + at,bytes));
+        }
+        code_data.clear();
+        for(size_t i = 0; i < blocks.size(); ++i)
+            code_data += blocks[i];
+    }
+#endif
+
+    const vector<string>& string_pool = pools.get_strings();
+    size_t string_size = pools.get_string_size();
+    const vector<double>& float_pool = pools.get_floats();
 
-    file.flush();
+    // lay the sections out
+    size_t script_offset = bundle_header_size;
+    size_t bucket_offset = align_section(script_offset + scripts.size() * 4);
+    size_t float_offset = align_section(bucket_offset + buckets.size() * 4);
+    size_t directory_offset = align_section(float_offset + float_pool.size() * 8);
+    size_t index_offset = align_section(directory_offset + directory.size() * 4);
+    size_t string_offset = align_section(index_offset + string_pool.size() * 8);
+    size_t block_offset = align_section(string_offset + string_size);
+    size_t code_offset = align_section(block_offset + blocks.size() * 8);
+    size_t size = align_section(code_offset + code_data.size());
+
+    string out(size,'\0');
+    unsigned char* file = reinterpret_cast<unsigned char*>(&out[0]);
+    memcpy(file,bundle_magic,4);
+    put_u32(file + bhdr_version,bundle_version);
+    put_u32(file + bhdr_header_size,bundle_header_size);
+    put_u32(file + bhdr_script_offset,script_offset);
+    put_u32(file + bhdr_script_count,names.size());
+    put_u32(file + bhdr_bucket_offset,bucket_offset);
+    put_u32(file + bhdr_bucket_count,bucket_count);
+    put_u32(file + bhdr_string_index_offset,index_offset);
+    put_u32(file + bhdr_string_count,string_pool.size());
+    put_u32(file + bhdr_string_data_offset,string_offset);
+    put_u32(file + bhdr_string_data_size,string_size);
+    put_u32(file + bhdr_float_offset,float_offset);
+    put_u32(file + bhdr_float_count,float_pool.size());
+    put_u32(file + bhdr_directory_offset,directory_offset);
+    put_u32(file + bhdr_function_count,directory.size() * 4 / directory_entry_size);
+    put_u32(file + bhdr_code_offset,code_offset);
+    put_u32(file + bhdr_code_count,slots.size());
+    put_u32(file + bhdr_block_offset,block_offset);
+    put_u32(file + bhdr_block_size,block_size);
+    put_u32(file + bhdr_file_size,size);
+
+    for(size_t i = 0; i < scripts.size(); ++i)
+        put_u32(file + script_offset + i * 4,scripts[i]);
+    for(size_t i = 0; i < buckets.size(); ++i)
+        put_u32(file + bucket_offset + i * 4,buckets[i]);
+    for(size_t i = 0; i < directory.size(); ++i)
+        put_u32(file + directory_offset + i * 4,directory[i]);
+    write_pools(file,pools,float_offset,index_offset,string_offset);
+    size_t block_at = code_offset;
+    for(size_t i = 0; i < blocks.size(); ++i)
+    {
+        put_u32(file + block_offset + i * 8,block_at);
+        put_u32(file + block_offset + i * 8 + 4,blocks[i].size());
+        block_at += blocks[i].size();
+    }
+    if(!code_data.empty())
+        memcpy(file + code_offset,code_data.data(),code_data.size());
+
+    write_file(filename,out);
+}
+
+compiled_bundle_ptr open_bundle(const string& filename)
+{
+    return compiled_bundle_ptr(new bundle_file(filename));
 }
 
 }
@@ -25,12 +25,14 @@
 ////////////////////////////////////////////////////////////////////////////////
 // Standard Library Includes
 #include <stack>
+#include <map>
 #include <fstream>
 ////////////////////////////////////////////////////////////////////////////////
 
 ////////////////////////////////////////////////////////////////////////////////
 // DScript Includes
-#include "compiler.h"
+#include "compiler_emit.h"
+#include "compiler_spirit.h"
 ////////////////////////////////////////////////////////////////////////////////
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -43,28 +45,6 @@ using namespace boost::spirit::classic;
 namespace dscript
 {
 
-/// This struct contains all the information that the compiler
-/// needs to convert a parse tree into a codeblock
-struct compile_context
-{
-    compile_context(
-        string_table& _strings,
-        float_table& _floats
-        ) : strings(_strings), floats(_floats)
-    {
-    }
-    string_table& strings;
-    float_table& floats;
-
-    size_t func_depth;
-    size_t loop_count;
-
-    stack< stack<size_t> > break_indices;
-    stack< stack<size_t> > continue_indices;
-
-    codeblock_t code; // get the count by calling size()
-};
-
 ////////////////////////////////////////////////////////////////////////////////
 // THE SPIRIT PARSER FOR DSCRIPT
 ////////////////////////////////////////////////////////////////////////////////
@@ -534,8 +514,43 @@ struct compile_error : public std::runtime_error
     TreeIterT node;
 };
 
+/// Gives every statically named %local under a node a frame slot, in
+/// the order they appear. Nested function declarations get their own frame.
 template<typename TreeIterT>
-void compile_func_call(const TreeIterT& iter, compile_context& ctx)
+void collect_locals(const TreeIterT& iter, compile_context& ctx)
+{
+    TreeIterT child = iter->children.begin();
+    TreeIterT end = iter->children.end();
+    for(; child != end; ++child)
+    {
+        parser_ids id = static_cast<parser_ids>(child->value.id().to_long());
+        if(id == func_decl_id)
+            continue;
+        if(id == lvar_id)
+        {
+            const typename TreeIterT::value_type& leaf =
+                get_first_leaf(*child);
+            string token(leaf.value.begin(),leaf.value.end());
+            string_table::entry ste = ctx.strings.insert(token);
+            if(ctx.locals->find(ste) == ctx.locals->end())
+            {
+                int slot = static_cast<int>(ctx.locals->size());
+                (*ctx.locals)[ste] = slot;
+            }
+        }
+        else
+            collect_locals(child,ctx);
+    }
+}
+
+/// Compiles a function call, with call_op being either op_call_func
+/// or op_call_load_ret
+template<typename TreeIterT>
+void compile_func_call(
+    const TreeIterT& iter,
+    compile_context& ctx,
+    op_code call_op = op_call_func
+    )
 {
     assert(iter->value.id() == func_call_id);
 
@@ -550,19 +565,26 @@ void compile_func_call(const TreeIterT& iter, compile_context& ctx)
         {
             assert(expr->value.id() == expr_id);
             // compile the expression
+            size_t start = ctx.code.size();
             compile_expr(expr,ctx);
             // and push it onto the param stop
             // (popping it from the runtime stack)
-            ctx.code.push_back(op_push_param);
+            emit_push_param(start,ctx);
         }
     }
     // first node is the identifier
     const typename TreeIterT::value_type& ident = get_first_leaf(*iter);
     assert(ident.value.id() == ident_id);
     // Call the function
-    ctx.code.push_back(op_call_func);
+    ctx.code.push_back(call_op);
     string name(ident.value.begin(),ident.value.end());
     ctx.code.push_back(ctx.strings.insert(name));
+    // the number of params pushed
+    int argc = static_cast<int>(iter->children.size()) - 1;
+    ctx.code.push_back(argc);
+    // room for the call site's inline cache
+    ctx.code.push_back(size_t(0));
+    ctx.code.push_back(size_t(0));
 }
 
 template<typename TreeIterT>
@@ -611,8 +633,11 @@ void compile_constant(const TreeIterT& iter, compile_context& ctx)
     };
 }
 
+/// Compiles the indexes of an array element, and returns how many there
+/// are. With array aliases, each one is appended to the variable name on
+/// top of the stack instead.
 template<typename TreeIterT>
-void compile_aidx(const TreeIterT& iter, compile_context& ctx)
+size_t compile_aidx(const TreeIterT& iter, compile_context& ctx)
 {
     assert(iter->value.id() == aidx_id);
     TreeIterT expr = iter->children.begin();
@@ -621,8 +646,23 @@ void compile_aidx(const TreeIterT& iter, compile_context& ctx)
     {
         compile_expr(expr,ctx);
         // push the cat_aidx op
-        ctx.code.push_back(op_cat_aidx_expr);
+        if(ctx.array_aliases)
+            ctx.code.push_back(op_cat_aidx_expr);
     }
+    return iter->children.size();
+}
+
+/// Compiles an increment or decrement of the array element var
+template<typename TreeIterT>
+void compile_elem_inc_dec(const TreeIterT& var, bool inc, compile_context& ctx)
+{
+    assert(var->value.id() == var_id && var->children.size() == 2);
+    const typename TreeIterT::value_type& leaf = get_first_leaf(*var);
+    string token(leaf.value.begin(),leaf.value.end());
+    size_t count = compile_aidx(var->children.begin() + 1,ctx);
+    emit_var_op(op_asn_elem,op_asn_elem_local,token,ctx);
+    ctx.code.push_back(static_cast<int>(count));
+    ctx.code.push_back(static_cast<int>(inc ? op_inc_var : op_dec_var));
 }
 
 template<typename TreeIterT>
@@ -635,8 +675,7 @@ void compile_var(const TreeIterT& iter, compile_context& ctx)
         typedef typename TreeIterT::value_type node_t;
         const node_t& leaf = get_first_leaf(*iter);
         string token(leaf.value.begin(),leaf.value.end());
-        ctx.code.push_back(op_push_var);
-        ctx.code.push_back(ctx.strings.insert(token));
+        emit_var_op(op_push_var,op_push_local,token,ctx);
     }
     else
     {
@@ -648,6 +687,14 @@ void compile_var(const TreeIterT& iter, compile_context& ctx)
         typedef typename TreeIterT::value_type node_t;
         const node_t& leaf = get_first_leaf(*child);
         string pref_token(leaf.value.begin(),leaf.value.end());
+        if(!ctx.array_aliases)
+        {
+            // push the indexes, then the element
+            size_t count = compile_aidx(child + 1,ctx);
+            emit_var_op(op_push_elem,op_push_elem_local,pref_token,ctx);
+            ctx.code.push_back(static_cast<int>(count));
+            return;
+        }
         // push the name of the variable as a string
         ctx.code.push_back(op_push_str);
         ctx.code.push_back(ctx.strings.insert(pref_token));
@@ -686,9 +733,8 @@ void compile_expr_atom(const TreeIterT& iter, compile_context& ctx)
         compile_expr(atom,ctx);
         break;
     case func_call_id:
-        compile_func_call(atom,ctx);
-        // load the return value to the top of the stack
-        ctx.code.push_back(op_load_ret);
+        // call, and load the return value to the top of the stack
+        compile_func_call(atom,ctx,op_call_load_ret);
         break;
     default:
         throw compile_error<TreeIterT>("Unknown expr_atom node",iter);
@@ -717,12 +763,16 @@ void compile_inc_dec_expr(const TreeIterT& iter, compile_context& ctx)
 
         compile_var(iter->children.begin(),ctx);
 
-        if(op_token[0] == '+') // increment
-            ctx.code.push_back(op_inc_var);
+        // an array element's indexes get evaluated again
+        if(
+            iter->children.begin()->children.size() > 1 &&
+            !ctx.array_aliases
+            )
+            compile_elem_inc_dec(iter->children.begin(),op_token[0] == '+',ctx);
+        else if(op_token[0] == '+') // increment
+            emit_var_op(op_inc_var,op_inc_local,var_token,ctx);
         else
-            ctx.code.push_back(op_dec_var);
-
-        ctx.code.push_back(ctx.strings.insert(var_token));
+            emit_var_op(op_dec_var,op_dec_local,var_token,ctx);
     }
     else
     {
@@ -736,11 +786,16 @@ void compile_inc_dec_expr(const TreeIterT& iter, compile_context& ctx)
         string op_token(op.value.begin(),op.value.end());
         string var_token(var.value.begin(),var.value.end());
 
-        if(op_token[0] == '+')
-            ctx.code.push_back(op_inc_var);
+        // an array element's indexes get evaluated again
+        if(
+            (iter->children.begin()+1)->children.size() > 1 &&
+            !ctx.array_aliases
+            )
+            compile_elem_inc_dec(iter->children.begin()+1,op_token[0] == '+',ctx);
+        else if(op_token[0] == '+')
+            emit_var_op(op_inc_var,op_inc_local,var_token,ctx);
         else // decrement
-            ctx.code.push_back(op_dec_var);
-        ctx.code.push_back(ctx.strings.insert(var_token));
+            emit_var_op(op_dec_var,op_dec_local,var_token,ctx);
 
         compile_var(iter->children.begin()+1,ctx);
     }
@@ -769,6 +824,7 @@ void compile_unary_expr(const TreeIterT& iter, compile_context& ctx)
             // first is op
             const node_t& op = get_first_leaf(*(iter->children.begin()));
             // second is the expr_atom
+            size_t start = ctx.code.size();
             compile_expr_atom(iter->children.begin() + 1,ctx);
             // perform the op
             switch(*(op.value.begin()))
@@ -777,13 +833,13 @@ void compile_unary_expr(const TreeIterT& iter, compile_context& ctx)
                 // no need to do anything, positive is default
                 break;
             case '-':
-                ctx.code.push_back(op_neg);
+                emit_unary(op_neg,start,ctx);
                 break;
             case '!':
-                ctx.code.push_back(op_log_not);
+                emit_unary(op_log_not,start,ctx);
                 break;
             case '~':
-                ctx.code.push_back(op_bit_not);
+                emit_unary(op_bit_not,start,ctx);
                 break;
             default:
                 throw compile_error<TreeIterT>("Unknown unary operator",iter);
@@ -812,6 +868,7 @@ void compile_mul_expr(const TreeIterT& iter, compile_context& ctx)
     TreeIterT sub_expr = iter->children.begin();
     TreeIterT end = iter->children.end();
     // compile the left sub_expr
+    size_t start = ctx.code.size();
     compile_unary_expr(sub_expr,ctx);
     for(++sub_expr;sub_expr != end;++sub_expr)
     {
@@ -819,18 +876,19 @@ void compile_mul_expr(const TreeIterT& iter, compile_context& ctx)
         const node_t& op = get_first_leaf(*sub_expr);
         ++sub_expr; // next sub_expr (skip op)
         // compile the next sub_expr
+        size_t rhs_start = ctx.code.size();
         compile_unary_expr(sub_expr,ctx);
         // perform the op
         switch(*(op.value.begin()))
         {
         case '*':
-            ctx.code.push_back(op_mul);
+            emit_binary(op_mul,start,rhs_start,ctx);
             break;
         case '/':
-            ctx.code.push_back(op_div);
+            emit_binary(op_div,start,rhs_start,ctx);
             break;
         case '%':
-            ctx.code.push_back(op_mod);
+            emit_binary(op_mod,start,rhs_start,ctx);
             break;
         default:
             throw compile_error<TreeIterT>("Unknown mul op",iter);
@@ -852,6 +910,7 @@ void compile_add_expr(const TreeIterT& iter, compile_context& ctx)
     TreeIterT sub_expr = iter->children.begin();
     TreeIterT end = iter->children.end();
     // compile the left sub_expr
+    size_t start = ctx.code.size();
     compile_mul_expr(sub_expr,ctx);
     for(++sub_expr;sub_expr != end;++sub_expr)
     {
@@ -859,18 +918,19 @@ void compile_add_expr(const TreeIterT& iter, compile_context& ctx)
         const node_t& op = get_first_leaf(*sub_expr);
         ++sub_expr; // next sub_expr (skip op)
         // compile the next sub_expr
+        size_t rhs_start = ctx.code.size();
         compile_mul_expr(sub_expr,ctx);
         // perform the op
         switch(*(op.value.begin()))
         {
         case '+': // ==
-            ctx.code.push_back(op_add);
+            emit_binary(op_add,start,rhs_start,ctx);
             break;
         case '-': // !=
-            ctx.code.push_back(op_sub);
+            emit_binary(op_sub,start,rhs_start,ctx);
             break;
         case '@':
-            ctx.code.push_back(op_cat);
+            emit_binary(op_cat,start,rhs_start,ctx);
             break;
         default:
             throw compile_error<TreeIterT>("Unknown add op",iter);
@@ -892,6 +952,7 @@ void compile_shift_expr(const TreeIterT& iter, compile_context& ctx)
     TreeIterT sub_expr = iter->children.begin();
     TreeIterT end = iter->children.end();
     // compile the left sub_expr
+    size_t start = ctx.code.size();
     compile_add_expr(sub_expr,ctx);
     for(++sub_expr;sub_expr != end;++sub_expr)
     {
@@ -899,15 +960,16 @@ void compile_shift_expr(const TreeIterT& iter, compile_context& ctx)
         const node_t& op = get_first_leaf(*sub_expr);
         ++sub_expr; // next sub_expr (skip op)
         // compile the next sub_expr
+        size_t rhs_start = ctx.code.size();
         compile_add_expr(sub_expr,ctx);
         // perform the op
         switch(*(op.value.begin()))
         {
         case '<': // ==
-            ctx.code.push_back(op_shl);
+            emit_binary(op_shl,start,rhs_start,ctx);
             break;
         case '>': // !=
-            ctx.code.push_back(op_shr);
+            emit_binary(op_shr,start,rhs_start,ctx);
             break;
         default:
             throw compile_error<TreeIterT>("Unknown shift op",iter);
@@ -929,6 +991,7 @@ void compile_compare_expr(const TreeIterT& iter, compile_context& ctx)
     TreeIterT sub_expr = iter->children.begin();
     TreeIterT end = iter->children.end();
     // compile the left sub_expr
+    size_t start = ctx.code.size();
     compile_shift_expr(sub_expr,ctx);
     for(++sub_expr;sub_expr != end;++sub_expr)
     {
@@ -936,6 +999,7 @@ void compile_compare_expr(const TreeIterT& iter, compile_context& ctx)
         const node_t& op = get_first_leaf(*sub_expr);
         ++sub_expr; // next sub_expr (skip op)
         // compile the next sub_expr
+        size_t rhs_start = ctx.code.size();
         compile_shift_expr(sub_expr,ctx);
         // perform the op
         string op_token(op.value.begin(),op.value.end());
@@ -943,15 +1007,15 @@ void compile_compare_expr(const TreeIterT& iter, compile_context& ctx)
         {
         case '<': // ==
             if(op_token.length() > 1 && op_token[1] == '=')
-                ctx.code.push_back(op_cmp_less_eq);
+                emit_binary(op_cmp_less_eq,start,rhs_start,ctx);
             else
-                ctx.code.push_back(op_cmp_less);
+                emit_binary(op_cmp_less,start,rhs_start,ctx);
             break;
         case '>': // !=
             if(op_token.length() > 1 && op_token[1] == '=')
-                ctx.code.push_back(op_cmp_grtr_eq);
+                emit_binary(op_cmp_grtr_eq,start,rhs_start,ctx);
             else
-                ctx.code.push_back(op_cmp_grtr);
+                emit_binary(op_cmp_grtr,start,rhs_start,ctx);
             break;
         default:
             throw compile_error<TreeIterT>("Unknown comparison op",iter);
@@ -973,6 +1037,7 @@ void compile_equality_expr(const TreeIterT& iter, compile_context& ctx)
     TreeIterT sub_expr = iter->children.begin();
     TreeIterT end = iter->children.end();
     // compile the left sub_expr
+    size_t start = ctx.code.size();
     compile_compare_expr(sub_expr,ctx);
     for(++sub_expr;sub_expr != end;++sub_expr)
     {
@@ -980,15 +1045,16 @@ void compile_equality_expr(const TreeIterT& iter, compile_context& ctx)
         const node_t& op = get_first_leaf(*sub_expr);
         ++sub_expr; // next sub_expr (skip op)
         // compile the next sub_expr
+        size_t rhs_start = ctx.code.size();
         compile_compare_expr(sub_expr,ctx);
         // perform the op
         switch(*(op.value.begin()))
         {
         case '=': // ==
-            ctx.code.push_back(op_eq);
+            emit_binary(op_eq,start,rhs_start,ctx);
             break;
         case '!': // !=
-            ctx.code.push_back(op_neq);
+            emit_binary(op_neq,start,rhs_start,ctx);
             break;
         default:
             throw compile_error<TreeIterT>("Unknown equality op",iter);
@@ -1010,6 +1076,7 @@ void compile_bitwise_expr(const TreeIterT& iter, compile_context& ctx)
     TreeIterT sub_expr = iter->children.begin();
     TreeIterT end = iter->children.end();
     // compile the left sub_expr
+    size_t start = ctx.code.size();
     compile_equality_expr(sub_expr,ctx);
     for(++sub_expr;sub_expr != end;++sub_expr)
     {
@@ -1017,18 +1084,19 @@ void compile_bitwise_expr(const TreeIterT& iter, compile_context& ctx)
         const node_t& op = get_first_leaf(*sub_expr);
         ++sub_expr; // next sub_expr (skip op)
         // compile the next sub_expr
+        size_t rhs_start = ctx.code.size();
         compile_equality_expr(sub_expr,ctx);
         // perform the op
         switch(*(op.value.begin()))
         {
         case '&': // ==
-            ctx.code.push_back(op_bit_and);
+            emit_binary(op_bit_and,start,rhs_start,ctx);
             break;
         case '|': // !=
-            ctx.code.push_back(op_bit_or);
+            emit_binary(op_bit_or,start,rhs_start,ctx);
             break;
         case '^':
-            ctx.code.push_back(op_bit_xor);
+            emit_binary(op_bit_xor,start,rhs_start,ctx);
             break;
         default:
             throw compile_error<TreeIterT>("Unknown bitwise op",iter);
@@ -1050,26 +1118,37 @@ void compile_expr(const TreeIterT& iter, compile_context& ctx)
     TreeIterT sub_expr = iter->children.begin();
     TreeIterT end = iter->children.end();
     // compile the left sub_expr
+    size_t start = ctx.code.size();
     compile_bitwise_expr(sub_expr,ctx);
+    // && and || short circuit. The left side, as 0 or 1, is the result
+    // if it decides it, and the right side isn't evaluated. Otherwise
+    // it is popped, and the right side (as 0 or 1) is the result.
     for(++sub_expr;sub_expr != end;++sub_expr)
     {
+        // after the first op, the left side is already 0 or 1
+        if(sub_expr == iter->children.begin() + 1)
+            emit_bool(start,ctx);
         // get the node representing the op
         const node_t& op = get_first_leaf(*sub_expr);
-        ++sub_expr; // next sub_expr (skip op)
-        // compile the next sub_expr
-        compile_bitwise_expr(sub_expr,ctx);
-        // perform the op
         switch(*(op.value.begin()))
         {
         case '&':
-            ctx.code.push_back(op_log_and);
+            ctx.code.push_back(op_jmp_false_peek);
             break;
         case '|':
-            ctx.code.push_back(op_log_or);
+            ctx.code.push_back(op_jmp_true_peek);
             break;
         default:
             throw compile_error<TreeIterT>("Unknown expr op",iter);
         }
+        size_t skip = ctx.code.size();
+        ctx.code.push_back(0); // resolved past the right side
+        ++sub_expr; // next sub_expr (skip op)
+        // compile the next sub_expr
+        size_t right_start = ctx.code.size();
+        compile_bitwise_expr(sub_expr,ctx);
+        emit_bool(right_start,ctx);
+        ctx.code[skip] = ctx.code.size();
     }
 }
 
@@ -1091,6 +1170,21 @@ void compile_func_decl(const TreeIterT& iter, compile_context& ctx)
 
     // ctx.instr_count += 3; // one for op, one for name, and one for instr_count
 
+    // every statically named %local gets a frame slot, parameters first.
+    // the slot count and the name of each slot follow the end offset
+    compile_context::slot_map locals;
+    compile_context::slot_map* outer_locals = ctx.locals;
+    ctx.locals = &locals;
+    collect_locals(iter,ctx);
+
+    vector<string_table::entry> slot_names(locals.size());
+    compile_context::slot_map::const_iterator local = locals.begin();
+    for(; local != locals.end(); ++local)
+        slot_names[local->second] = local->first;
+    ctx.code.push_back(static_cast<int>(slot_names.size()));
+    for(size_t i = 0; i < slot_names.size(); ++i)
+        ctx.code.push_back(slot_names[i]);
+
     TreeIterT arg = iter->children.begin() + 1;
     TreeIterT end = iter->children.end();
     for(; arg != end && (arg->value.id() != stmt_block_id); ++arg)
@@ -1100,8 +1194,7 @@ void compile_func_decl(const TreeIterT& iter, compile_context& ctx)
         // out << "op_pop_param " << string(leaf.value.begin(),leaf.value.end()) << endl;
         // ctx.instr_count += 2; // one for op, one for operand
         string arg_name(leaf.value.begin(),leaf.value.end());
-        ctx.code.push_back(op_pop_param);
-        ctx.code.push_back(ctx.strings.insert(arg_name));
+        emit_var_op(op_pop_param,op_pop_param_local,arg_name,ctx);
     }
     // we should have a stmt_block
     if(arg != end)
@@ -1118,6 +1211,8 @@ void compile_func_decl(const TreeIterT& iter, compile_context& ctx)
     // resolve now the offset of the end of the function
     ctx.code[resolve] = ctx.code.size();
 
+    ctx.locals = outer_locals;
+
     // remove a function depth
     --ctx.func_depth;
 }
@@ -1132,10 +1227,11 @@ void compile_return_stmt(const TreeIterT& iter, compile_context& ctx)
         assert(iter->children.size() == 2);
         TreeIterT expr = iter->children.begin() + 1;
         compile_expr(expr,ctx);
-        // store it in the return value register
-        ctx.code.push_back(op_store_ret);
+        // store it in the return value register, and return
+        ctx.code.push_back(op_return_value);
     }
-    ctx.code.push_back(op_return);
+    else
+        ctx.code.push_back(op_return);
 }
 
 template<typename TreeIterT>
@@ -1147,11 +1243,12 @@ void compile_inc_dec_stmt(const TreeIterT& iter, compile_context& ctx)
     string var_token(get_first_leaf(*var).value.begin(),get_first_leaf(*var).value.end());
     string op_token(get_first_leaf(*op).value.begin(),get_first_leaf(*op).value.end());
 
-    if(op_token[0] == '+')
-        ctx.code.push_back(op_inc_var);
+    if(var->children.size() > 1 && !ctx.array_aliases)
+        compile_elem_inc_dec(var,op_token[0] == '+',ctx);
+    else if(op_token[0] == '+')
+        emit_var_op(op_inc_var,op_inc_local,var_token,ctx);
     else
-        ctx.code.push_back(op_dec_var);
-    ctx.code.push_back(ctx.strings.insert(var_token));
+        emit_var_op(op_dec_var,op_dec_local,var_token,ctx);
 }
 
 template<typename TreeIterT>
@@ -1173,7 +1270,14 @@ void compile_assign_stmt(const TreeIterT& iter, compile_context& ctx)
                 get_first_leaf(*var).value.begin(),
                 get_first_leaf(*var).value.end()
             );
-        if(var->children.size() > 1)
+        bool is_elem = var->children.size() > 1;
+        size_t index_count = 0;
+        if(is_elem && !ctx.array_aliases)
+        {
+            // the element's indexes
+            index_count = compile_aidx(var->children.begin() + 1,ctx);
+        }
+        else if(is_elem)
         {
             // array index
             TreeIterT aidx = var->children.begin() + 1;
@@ -1194,58 +1298,79 @@ void compile_assign_stmt(const TreeIterT& iter, compile_context& ctx)
 
         // op_code
         op_code opcode = op_invalid;
-        bool do_var = var->children.size() == 1;
+        op_code slot_opcode = op_invalid;
+        bool do_var = !is_elem || !ctx.array_aliases;
 
         // only need to check the first char:
         switch(op_tok[0])
         {
         case '=':
             opcode = do_var ? op_assign_var : op_assign;
+            slot_opcode = op_assign_local;
             break;
         case '*':
             opcode = do_var ? op_mul_asn_var : op_mul_asn;
+            slot_opcode = op_mul_asn_local;
             break;
         case '/':
             opcode = do_var ? op_div_asn_var : op_div_asn;
+            slot_opcode = op_div_asn_local;
             break;
         case '%':
             opcode = do_var ? op_mod_asn_var : op_mod_asn;
+            slot_opcode = op_mod_asn_local;
             break;
         case '+':
             opcode = do_var ? op_add_asn_var : op_add_asn;
+            slot_opcode = op_add_asn_local;
             break;
         case '-':
             opcode = do_var ? op_sub_asn_var : op_sub_asn;
+            slot_opcode = op_sub_asn_local;
             break;
         case '@':
             opcode = do_var ? op_cat_asn_var : op_cat_asn;
+            slot_opcode = op_cat_asn_local;
             break;
         case '&':
             opcode = do_var ? op_band_asn_var : op_band_asn;
+            slot_opcode = op_band_asn_local;
             break;
         case '|':
             opcode = do_var ? op_bor_asn_var : op_bor_asn;
+            slot_opcode = op_bor_asn_local;
             break;
         case '^':
             opcode = do_var ? op_bxor_asn_var : op_bxor_asn;
+            slot_opcode = op_bxor_asn_local;
             break;
         case '<':
             opcode = do_var ? op_shl_asn_var : op_shl_asn;
+            slot_opcode = op_shl_asn_local;
             break;
         case '>':
             opcode = do_var ? op_shr_asn_var : op_shr_asn;
+            slot_opcode = op_shr_asn_local;
             break;
         default:
             throw compile_error<TreeIterT>("Unknown assignment operator",iter);
         }
 
         // add the appropriate opcode
-        ctx.code.push_back(opcode);
         // without the var, the top value on the stack
         // gets placed into the variable named by the value at (top - 1)
         // and both values get popped off the stack
-        if(do_var) // otherwise the variable is explicitly stated in the next instr
-            ctx.code.push_back(ctx.strings.insert(var_tok));
+        if(is_elem && do_var)
+        {
+            // the op_code to apply to the element is an operand
+            emit_var_op(op_asn_elem,op_asn_elem_local,var_tok,ctx);
+            ctx.code.push_back(static_cast<int>(index_count));
+            ctx.code.push_back(static_cast<int>(opcode));
+        }
+        else if(do_var) // otherwise the variable is explicitly stated in the next instr
+            emit_var_op(opcode,slot_opcode,var_tok,ctx);
+        else
+            ctx.code.push_back(opcode);
     }
     else // it's an inc_dec_stmt
         compile_inc_dec_stmt(iter->children.begin(),ctx);
@@ -1266,9 +1391,10 @@ void compile_if_stmt(const TreeIterT& iter, compile_context& ctx)
     TreeIterT expr = iter->children.begin();
 
     // compile the expression
+    size_t start = ctx.code.size();
     compile_expr(expr,ctx);
     // jmp if false
-    ctx.code.push_back(op_jmp_false);
+    emit_jmp_false(start,ctx);
     size_t end_if = ctx.code.size();
     ctx.code.push_back(0); // to be resolved later
 
@@ -1318,7 +1444,7 @@ void compile_while_stmt(const TreeIterT& iter, compile_context& ctx)
     TreeIterT expr = iter->children.begin();
     compile_expr(expr,ctx);
     // jump if false to end of loop
-    ctx.code.push_back(op_jmp_false);
+    emit_jmp_false(continue_index,ctx);
     // to break point
     ctx.break_indices.top().push(ctx.code.size());
     ctx.code.push_back(0); // resolve later
@@ -1424,7 +1550,7 @@ void compile_for_stmt(const TreeIterT& iter, compile_context& ctx)
         // compile the test expression
         compile_expr(child,ctx);
         // add the jump if false
-        ctx.code.push_back(op_jmp_false);
+        emit_jmp_false(test_expr_start,ctx);
         // this gets resolved to the break index
         ctx.break_indices.top().push(ctx.code.size());
         ctx.code.push_back(0); // to resolve later
@@ -1566,11 +1692,17 @@ void compile_parse_tree(const TreeNodeT& tree,compile_context& ctx)
     compile_stmt_list(iter,ctx);
 }
 
-// compile a string into a codeblock, using the passed string and float table
-codeblock_t compile(const string& code,string_table& strings,float_table& floats)
+// compile a string into a codeblock with the Spirit parser, using the
+// passed string and float table
+codeblock_t compile_spirit(
+    const string& code,
+    string_table& strings,
+    float_table& floats,
+    bool array_aliases
+    )
 {
     // Create a compile context
-    compile_context ctx(strings,floats);
+    compile_context ctx(strings,floats,array_aliases);
     // Attempt to parse the string
     typedef position_iterator<string::const_iterator> iter_t;
 
@@ -1615,6 +1747,19 @@ codeblock_t compile(const string& code,string_table& strings,float_table& floats
 		{
 			// Empty code. All comments or some such
 		}
+
+        // the statements stop at the first one that doesn't parse
+        parse_info<iter_t> rest = parse(info.stop,last,*skip);
+        if(rest.stop != last)
+        {
+            throw compiler_error(
+                "Parse Error",
+                code_position(
+                    rest.stop.get_position().line,
+                    rest.stop.get_position().column
+                    )
+            );
+        }
     }
     else
     {
@@ -1626,6 +1771,7 @@ codeblock_t compile(const string& code,string_table& strings,float_table& floats
                 )
         );
     }
+    optimize_compiled(ctx);
     return ctx.code;
 }
 
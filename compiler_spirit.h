@@ -0,0 +1,41 @@
+////////////////////////////////////////////////////////////////////////////////
+// DScript Scripting Language
+// Copyright (C) 2003 Bryan "daerid" Ross
+//
+// Permission to copy, use, modify, sell and distribute this software is
+// granted provided this copyright notice appears in all copies. This
+// software is provided "as is" without express or implied warranty, and
+// with no claim as to its suitability for any purpose.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __DSCRIPT_COMPILER_SPIRIT_H__
+#define __DSCRIPT_COMPILER_SPIRIT_H__
+
+////////////////////////////////////////////////////////////////////////////////
+// Standard Library Include Files
+#include <string>
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// DScript Include Files
+#include "compiler.h"
+////////////////////////////////////////////////////////////////////////////////
+
+// The original front end of the compiler, built on a Spirit parse tree.
+// It isn't part of the library; only parsecheck builds it, to check
+// compile() against it.
+
+namespace dscript
+{
+    /// Compiles the same way as compile(), but with the original front end
+    /// built on a Spirit parse tree instead of the hand-written parser.
+    /// Much slower; it is kept to check the two against each other.
+    codeblock_t compile_spirit(
+        const std::string& code,
+        string_table& strings,
+        float_table& floats,
+        bool array_aliases = false
+        );
+}
+
+#endif//__DSCRIPT_COMPILER_SPIRIT_H__
@@ -0,0 +1,694 @@
+////////////////////////////////////////////////////////////////////////////////
+// DScript Scripting Language
+// Copyright (C) 2003 Bryan "daerid" Ross
+//
+// Permission to copy, use, modify, sell and distribute this software is
+// granted provided this copyright notice appears in all copies. This
+// software is provided "as is" without express or implied warranty, and
+// with no claim as to its suitability for any purpose.
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Standard Library Include Files
+#include <map>
+#include <set>
+#include <vector>
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// DScript Include Files
+#include "compiler.h"
+#include "ir.h"
+////////////////////////////////////////////////////////////////////////////////
+
+using namespace std;
+using namespace dscript;
+
+namespace
+{
+    const size_t npos = ir_func::npos;
+
+    // functions with longer bodies are left as they are
+    const size_t max_func_size = 32768;
+
+    // how many times dead stores are looked for, as removing some can
+    // leave others dead
+    const size_t max_dse_passes = 8;
+
+    /// Makes an instruction on a frame slot
+    ir_instr make_slot_instr(ir_func& func,op_code op,int slot)
+    {
+        ir_instr instr(op);
+        instr.operands.push_back(slot);
+        func.set_uid(instr);
+        return instr;
+    }
+
+    /// Changes to make to the code of an ir_func, all at once: the
+    /// instructions to remove, the ones to replace with an op_push_local,
+    /// and the ones whose result is also to be kept in a frame slot
+    class ir_edits
+    {
+    public:
+        ir_edits(const ir_func& func)
+            : m_removed(func.blocks.size()),
+              m_push(func.blocks.size()),
+              m_save(func.blocks.size())
+        {
+            for(size_t b = 0; b < func.blocks.size(); ++b)
+            {
+                m_removed[b].resize(func.blocks[b].code.size(),false);
+                m_push[b].resize(func.blocks[b].code.size(),-1);
+                m_save[b].resize(func.blocks[b].code.size(),-1);
+            }
+        }
+
+        /// Replaces instruction n of block b, and the expression it
+        /// finishes, with a push of slot
+        void replace(const ir_func& func,size_t b,size_t n,int slot)
+        {
+            for(size_t i = func.blocks[b].code[n].first; i < n; ++i)
+                m_removed[b][i] = true;
+            m_push[b][n] = slot;
+        }
+
+        /// Removes instructions first to last of block b
+        void remove(size_t b,size_t first,size_t last)
+        {
+            for(size_t i = first; i <= last; ++i)
+                m_removed[b][i] = true;
+        }
+
+        /// Keeps the result of instruction n of block b in slot as well
+        void save(size_t b,size_t n,int slot)
+        {
+            m_save[b][n] = slot;
+        }
+
+        bool is_removed(size_t b,size_t n) const
+        {
+            return n < m_removed[b].size() && m_removed[b][n];
+        }
+
+        /// Makes the changes. Returns whether there were any.
+        bool apply(ir_func& func) const
+        {
+            bool changed = false;
+            for(size_t b = 0; b < func.blocks.size(); ++b)
+            {
+                vector<ir_instr>& code = func.blocks[b].code;
+                vector<ir_instr> edited;
+                for(size_t n = 0; n < code.size(); ++n)
+                {
+                    if(n >= m_removed[b].size())
+                    {
+                        // added since the edits were started
+                        edited.push_back(code[n]);
+                        continue;
+                    }
+                    if(m_removed[b][n])
+                    {
+                        changed = true;
+                        continue;
+                    }
+                    if(m_push[b][n] >= 0)
+                    {
+                        edited.push_back(make_slot_instr(func,op_push_local,m_push[b][n]));
+                        changed = true;
+                    }
+                    else
+                        edited.push_back(code[n]);
+                    if(m_save[b][n] >= 0)
+                    {
+                        edited.push_back(make_slot_instr(func,op_assign_local,m_save[b][n]));
+                        edited.push_back(make_slot_instr(func,op_push_local,m_save[b][n]));
+                        changed = true;
+                    }
+                }
+                code.swap(edited);
+            }
+            return changed;
+        }
+
+    private:
+        vector<vector<bool> > m_removed;
+        vector<vector<int> > m_push;
+        vector<vector<int> > m_save;
+    };
+
+    /// A natural loop: the blocks that can get back to the header without
+    /// going through it first, and the block in front of it, if it has one
+    struct ir_loop
+    {
+        size_t header;
+        size_t preheader;
+        vector<bool> body;
+        size_t size;
+    };
+
+    /// Finds the loops of func, the biggest first. Loops with the same
+    /// header are the same loop.
+    vector<ir_loop> find_loops(const ir_func& func,const set<size_t>& preheaders)
+    {
+        map<size_t,ir_loop> loops;
+        for(size_t i = 0; i < func.order.size(); ++i)
+        {
+            size_t latch = func.order[i];
+            const vector<size_t>& succs = func.blocks[latch].succs;
+            for(size_t s = 0; s < succs.size(); ++s)
+            {
+                size_t header = succs[s];
+                if(!func.dominates(header,latch))
+                    continue;
+                ir_loop& loop = loops[header];
+                if(loop.body.empty())
+                {
+                    loop.header = header;
+                    loop.body.resize(func.blocks.size(),false);
+                    loop.body[header] = true;
+                    loop.size = 1;
+                    loop.preheader = npos;
+                    if(header > 0 && preheaders.count(func.blocks[header - 1].uid) != 0)
+                        loop.preheader = header - 1;
+                }
+                // everything that gets to the latch without the header
+                vector<size_t> work(1,latch);
+                while(!work.empty())
+                {
+                    size_t b = work.back();
+                    work.pop_back();
+                    if(loop.body[b])
+                        continue;
+                    loop.body[b] = true;
+                    ++loop.size;
+                    const vector<size_t>& preds = func.blocks[b].preds;
+                    work.insert(work.end(),preds.begin(),preds.end());
+                }
+            }
+        }
+
+        vector<ir_loop> result;
+        for(map<size_t,ir_loop>::iterator loop = loops.begin(); loop != loops.end(); ++loop)
+            result.push_back(loop->second);
+        // biggest first, which puts outer loops before the ones in them
+        for(size_t i = 1; i < result.size(); ++i)
+        {
+            for(size_t j = i; j > 0 && result[j - 1].size < result[j].size; --j)
+                swap(result[j - 1],result[j]);
+        }
+        return result;
+    }
+
+    /// Puts an empty block in front of every loop header that can have
+    /// one, which the loop is entered through. Returns the uids of the
+    /// new blocks.
+    set<size_t> insert_preheaders(ir_func& func)
+    {
+        func.analyze();
+        vector<ir_loop> loops = find_loops(func,set<size_t>());
+
+        // from the last header back, so inserting a block doesn't move
+        // the headers still to do
+        map<size_t,const ir_loop*> headers;
+        for(size_t i = 0; i < loops.size(); ++i)
+            headers[loops[i].header] = &loops[i];
+
+        set<size_t> preheaders;
+        map<size_t,const ir_loop*>::reverse_iterator h = headers.rbegin();
+        for(; h != headers.rend(); ++h)
+        {
+            size_t header = h->first;
+            const ir_loop& loop = *h->second;
+            if(header == 0 || func.blocks[header].stack_in != 0)
+                continue;
+            // the block before has to fall through from outside the loop
+            if(loop.body[header - 1])
+                continue;
+            vector<size_t> outside;
+            const vector<size_t>& preds = func.blocks[header].preds;
+            for(size_t p = 0; p < preds.size(); ++p)
+            {
+                if(!loop.body[preds[p]])
+                    outside.push_back(preds[p]);
+            }
+
+            func.insert_block(header);
+            preheaders.insert(func.blocks[header].uid);
+            for(size_t p = 0; p < outside.size(); ++p)
+            {
+                size_t pred = outside[p] >= header ? outside[p] + 1 : outside[p];
+                vector<ir_instr>& code = func.blocks[pred].code;
+                if(!code.empty() && code.back().target == header + 1 &&
+                    get_op_operands(code.back().op)[0] == 'o')
+                    code.back().target = header;
+            }
+        }
+        return preheaders;
+    }
+
+    /// Returns whether val is computed the same every time around loop
+    bool is_invariant(const ir_func& func,ir_value val,const ir_loop& loop)
+    {
+        const ir_def& def = func.get_def(val);
+        if(def.op == ir_def::initial)
+            return true;
+        if(def.op < 0)
+            return !loop.body[func.get_def_block(val)];
+        if(def.lhs != 0 && !is_invariant(func,def.lhs,loop))
+            return false;
+        return def.rhs == 0 || is_invariant(func,def.rhs,loop);
+    }
+
+    /// Finds the slots that hold the values the op_push_locals of an
+    /// expression push, at the end of block b. Returns false if one of
+    /// the values isn't in any slot there.
+    bool find_leaves(
+        const ir_func& func,
+        const vector<ir_instr>& code,
+        size_t first,
+        size_t last,
+        size_t b,
+        vector<int>& slots
+        )
+    {
+        const vector<ir_value>& held = func.blocks[b].slots_out;
+        slots.assign(last - first + 1,-1);
+        for(size_t n = first; n <= last; ++n)
+        {
+            if(code[n].op != op_push_local)
+                continue;
+            int own = ir_func::get_slot(code[n]);
+            if(held[own] == code[n].result)
+                slots[n - first] = own;
+            for(size_t s = 0; s < held.size() && slots[n - first] < 0; ++s)
+            {
+                if(held[s] == code[n].result)
+                    slots[n - first] = static_cast<int>(s);
+            }
+            if(slots[n - first] < 0)
+                return false;
+        }
+        return true;
+    }
+
+    /// Loop invariant code motion: computes the expressions in a loop
+    /// that give the same value every time around once, in front of the
+    /// outermost loop they do so for, keeping the value in a new slot
+    void hoist_invariants(ir_func& func)
+    {
+        set<size_t> preheaders = insert_preheaders(func);
+        if(preheaders.empty())
+            return;
+        func.analyze();
+        vector<ir_loop> loops = find_loops(func,preheaders);
+
+        ir_edits edits(func);
+        map<pair<size_t,ir_value>,int> hoisted;
+        for(size_t b = 0; b < func.blocks.size(); ++b)
+        {
+            if(!func.blocks[b].reachable || preheaders.count(func.blocks[b].uid) != 0)
+                continue;
+            vector<const ir_loop*> in_loops;
+            for(size_t l = 0; l < loops.size(); ++l)
+            {
+                if(loops[l].body[b] && loops[l].preheader != npos)
+                    in_loops.push_back(&loops[l]);
+            }
+            if(in_loops.empty())
+                continue;
+
+            // from the end of the block back, so the biggest invariant
+            // expressions are found before the ones in them
+            const vector<ir_instr>& code = func.blocks[b].code;
+            for(size_t n = code.size(); n-- > 0; )
+            {
+                const ir_instr& instr = code[n];
+                if(!instr.safe || instr.first == n)
+                    continue;
+                for(size_t l = 0; l < in_loops.size(); ++l)
+                {
+                    const ir_loop& loop = *in_loops[l];
+                    vector<int> leaves;
+                    if(
+                        !is_invariant(func,instr.result,loop) ||
+                        !find_leaves(func,code,instr.first,n,loop.preheader,leaves)
+                        )
+                        continue;
+
+                    pair<size_t,ir_value> key(loop.preheader,instr.result);
+                    if(hoisted.find(key) == hoisted.end())
+                    {
+                        // compute it in front of the loop, from the slots
+                        // holding the same values there
+                        int slot = func.add_slot();
+                        vector<ir_instr>& pre = func.blocks[loop.preheader].code;
+                        for(size_t i = instr.first; i <= n; ++i)
+                        {
+                            ir_instr copy = code[i];
+                            func.set_uid(copy);
+                            if(leaves[i - instr.first] >= 0)
+                                copy.operands[0] = leaves[i - instr.first];
+                            pre.push_back(copy);
+                        }
+                        pre.push_back(make_slot_instr(func,op_assign_local,slot));
+                        hoisted[key] = slot;
+                    }
+                    edits.replace(func,b,n,hoisted[key]);
+                    n = instr.first;
+                    break;
+                }
+            }
+        }
+        edits.apply(func);
+    }
+
+    /// The dominator tree, as the blocks each block immediately dominates
+    vector<vector<size_t> > get_dom_tree(const ir_func& func)
+    {
+        vector<vector<size_t> > tree(func.blocks.size());
+        for(size_t i = 1; i < func.order.size(); ++i)
+        {
+            size_t b = func.order[i];
+            tree[func.blocks[b].idom].push_back(b);
+        }
+        return tree;
+    }
+
+    /// Common subexpression elimination, down the dominator tree
+    class cse_pass
+    {
+    public:
+        cse_pass(ir_func& func) : m_func(func), m_edits(func)
+        {
+            m_tree = get_dom_tree(func);
+            for(size_t b = 0; b < func.blocks.size(); ++b)
+            {
+                const vector<ir_instr>& code = func.blocks[b].code;
+                for(size_t n = 0; n < code.size(); ++n)
+                {
+                    if(code[n].pure && n - code[n].first >= 2)
+                        m_sites[code[n].result].push_back(make_pair(b,n));
+                }
+            }
+        }
+
+        void run()
+        {
+            walk(0,map<ir_value,int>());
+            m_edits.apply(m_func);
+        }
+
+    private:
+        /// Returns whether an expression computing val at instruction n
+        /// of block b is followed by another one it dominates
+        bool is_reused(ir_value val,size_t b,size_t n) const
+        {
+            const vector<pair<size_t,size_t> >& sites = m_sites.find(val)->second;
+            for(size_t i = 0; i < sites.size(); ++i)
+            {
+                size_t other = sites[i].first;
+                if(other == b ? sites[i].second > n : m_func.dominates(b,other))
+                    return true;
+            }
+            return false;
+        }
+
+        void walk(size_t b,map<ir_value,int> temps)
+        {
+            const ir_block& block = m_func.blocks[b];
+            for(size_t n = 0; n < block.code.size(); ++n)
+            {
+                const ir_instr& instr = block.code[n];
+                if(!instr.pure)
+                    continue;
+                const vector<ir_value>& slots = block.slots[n];
+                ir_value val = instr.result;
+                int home = m_func.get_home(val);
+                bool at_home =
+                    home >= 0 &&
+                    static_cast<size_t>(home) < slots.size() &&
+                    slots[home] == val;
+
+                if(instr.first == n)
+                {
+                    // copy propagation: read a copied value from where
+                    // it came from, which can leave the copy dead
+                    int slot = ir_func::get_slot(instr);
+                    if(instr.op == op_push_local && at_home && home != slot)
+                        m_edits.replace(m_func,b,n,home);
+                    continue;
+                }
+
+                // the value may be in a slot already
+                int held = at_home ? home : -1;
+                for(size_t s = 0; s < slots.size() && held < 0; ++s)
+                {
+                    if(slots[s] == val)
+                        held = static_cast<int>(s);
+                }
+                if(held < 0 && temps.find(val) != temps.end())
+                    held = temps[val];
+                if(held >= 0)
+                {
+                    m_edits.replace(m_func,b,n,held);
+                    continue;
+                }
+
+                // keep an expression computed again later in a new slot,
+                // unless it's stored in one already
+                bool outermost =
+                    instr.consumer == npos ||
+                    !block.code[instr.consumer].pure;
+                bool stored =
+                    instr.consumer != npos &&
+                    block.code[instr.consumer].op == op_assign_local;
+                if(
+                    n - instr.first >= 2 && outermost && !stored &&
+                    is_reused(val,b,n)
+                    )
+                {
+                    int slot = m_func.add_slot();
+                    m_edits.save(b,n,slot);
+                    temps[val] = slot;
+                }
+            }
+
+            for(size_t i = 0; i < m_tree[b].size(); ++i)
+                walk(m_tree[b][i],temps);
+        }
+
+        ir_func& m_func;
+        ir_edits m_edits;
+        vector<vector<size_t> > m_tree;
+        map<ir_value,vector<pair<size_t,size_t> > > m_sites;
+    };
+
+    /// Returns whether an instruction reads the frame slot it works on
+    bool reads_slot(op_code op)
+    {
+        return op != op_assign_local && op != op_pop_param_local;
+    }
+
+    /// Finds the slots live at the start of each block: the ones that
+    /// may be read before being assigned again
+    vector<vector<bool> > find_live_slots(const ir_func& func)
+    {
+        vector<vector<bool> > live_in(
+            func.blocks.size(),
+            vector<bool>(func.slot_count,false)
+            );
+        bool changed = true;
+        while(changed)
+        {
+            changed = false;
+            for(size_t i = func.order.size(); i-- > 0; )
+            {
+                size_t b = func.order[i];
+                const ir_block& block = func.blocks[b];
+                vector<bool> live(func.slot_count,false);
+                for(size_t s = 0; s < block.succs.size(); ++s)
+                {
+                    const vector<bool>& succ = live_in[block.succs[s]];
+                    for(size_t slot = 0; slot < live.size(); ++slot)
+                        live[slot] = live[slot] || succ[slot];
+                }
+                for(size_t n = block.code.size(); n-- > 0; )
+                {
+                    const ir_instr& instr = block.code[n];
+                    int slot = ir_func::get_slot(instr);
+                    if(is_slot_barrier(instr))
+                        live.assign(live.size(),true);
+                    else if(slot >= 0)
+                        live[slot] = reads_slot(instr.op);
+                }
+                if(live != live_in[b])
+                {
+                    live_in[b] = live;
+                    changed = true;
+                }
+            }
+        }
+        return live_in;
+    }
+
+    /// Dead store elimination: removes assignments to slots that are
+    /// never read afterwards, along with the expressions assigned when
+    /// they can't fail
+    void remove_dead_stores(ir_func& func)
+    {
+        for(size_t pass = 0; pass < max_dse_passes; ++pass)
+        {
+            func.analyze();
+            vector<vector<bool> > live_in = find_live_slots(func);
+            ir_edits edits(func);
+            for(size_t i = 0; i < func.order.size(); ++i)
+            {
+                size_t b = func.order[i];
+                const ir_block& block = func.blocks[b];
+                vector<bool> live(func.slot_count,false);
+                for(size_t s = 0; s < block.succs.size(); ++s)
+                {
+                    const vector<bool>& succ = live_in[block.succs[s]];
+                    for(size_t slot = 0; slot < live.size(); ++slot)
+                        live[slot] = live[slot] || succ[slot];
+                }
+                for(size_t n = block.code.size(); n-- > 0; )
+                {
+                    if(edits.is_removed(b,n))
+                        continue;
+                    const ir_instr& instr = block.code[n];
+                    int slot = ir_func::get_slot(instr);
+                    if(is_slot_barrier(instr))
+                    {
+                        live.assign(live.size(),true);
+                        continue;
+                    }
+                    if(slot < 0)
+                        continue;
+                    bool dead =
+                        !live[slot] &&
+                        instr.op != op_pop_param_local &&
+                        instr.op != op_push_local &&
+                        instr.op != op_param_local &&
+                        instr.op != op_push_elem_local &&
+                        instr.op != op_asn_elem_local;
+                    if(dead && instr.args.empty())
+                    {
+                        // op_inc_local or op_dec_local
+                        edits.remove(b,n,n);
+                        continue;
+                    }
+                    if(dead && n > 0)
+                    {
+                        // the value assigned, if it's an expression that
+                        // can go as well
+                        const ir_instr& value = block.code[n - 1];
+                        bool fails =
+                            instr.op != op_assign_local &&
+                            func.can_fail(
+                                instr.op == op_div_asn_local ? op_div :
+                                instr.op == op_mod_asn_local ? op_mod :
+                                op_add,
+                                block.slots[n][slot],
+                                instr.args[0]
+                                );
+                        if(value.consumer == n && value.safe && !fails)
+                        {
+                            edits.remove(b,value.first,n);
+                            continue;
+                        }
+                    }
+                    live[slot] = reads_slot(instr.op);
+                }
+            }
+            if(!edits.apply(func))
+                break;
+        }
+    }
+
+    /// Optimizes the body of a function
+    void optimize_func(ir_func& func)
+    {
+        hoist_invariants(func);
+        func.analyze();
+        cse_pass(func).run();
+        remove_dead_stores(func);
+    }
+}
+
+void dscript::optimize_functions(codeblock_t& code,string_table& strings)
+{
+    // where each instruction went, for the offsets in code left as is
+    vector<size_t> new_offsets(code.size() + 1,npos);
+    vector<size_t> remap;
+    codeblock_t out;
+    out.reserve(code.size());
+    string_table::entry temp_name = 0;
+
+    for(size_t off = 0; off < code.size(); )
+    {
+        size_t size = get_instr_size(code.begin() + off);
+        new_offsets[off] = out.size();
+        op_code op = code[off].get_op_code();
+
+        ir_func func;
+        if(op == op_decl_func)
+        {
+            size_t end = code[off + 2].get_int();
+            size_t body = off + size;
+            bool nested = false;
+            for(size_t i = body; i < end && !nested; i += get_instr_size(code.begin() + i))
+                nested = code[i].get_op_code() == op_decl_func;
+            if(!nested && end - body <= max_func_size && func.build(code,off))
+            {
+                size_t slot_count = code[off + 3].get_int();
+                optimize_func(func);
+
+                // the new slots have no names scripts can use
+                if(func.slot_count > slot_count && temp_name == 0)
+                    temp_name = strings.insert("%");
+                out.push_back(op_decl_func);
+                out.push_back(code[off + 1]);
+                size_t resolve = out.size();
+                out.push_back(0);
+                out.push_back(static_cast<int>(func.slot_count));
+                out.insert(out.end(),code.begin() + off + 4,code.begin() + body);
+                for(size_t slot = slot_count; slot < func.slot_count; ++slot)
+                    out.push_back(temp_name);
+                func.emit(out,out.size());
+                out[resolve] = out.size();
+                off = end;
+                continue;
+            }
+        }
+
+        const char* operands = get_op_operands(op);
+        out.push_back(code[off]);
+        for(size_t i = 1; i < size; ++i)
+        {
+            if(*operands == 'o')
+                remap.push_back(out.size());
+            out.push_back(code[off + i]);
+            if(*operands != '\0' && *operands != 'c')
+                ++operands;
+        }
+        off += size;
+    }
+    new_offsets[code.size()] = out.size();
+
+    for(size_t i = 0; i < remap.size(); ++i)
+        out[remap[i]] = new_offsets[out[remap[i]].get_offset()];
+
+    // declarations are never moved into an ir_func, so the offsets of
+    // them are all still old ones, wherever they are
+    for(size_t off = 0; off < out.size(); off += get_instr_size(out.begin() + off))
+    {
+        const char* operands = get_op_operands(out[off].get_op_code());
+        for(size_t i = 1; *operands != '\0'; ++operands, ++i)
+        {
+            if(*operands == 'd')
+                out[off + i] = new_offsets[out[off + i].get_offset()];
+        }
+    }
+    code.swap(out);
+}
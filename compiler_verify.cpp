@@ -0,0 +1,493 @@
+////////////////////////////////////////////////////////////////////////////////
+// DScript Scripting Language
+// Copyright (C) 2003 Bryan "daerid" Ross
+//
+// Permission to copy, use, modify, sell and distribute this software is
+// granted provided this copyright notice appears in all copies. This
+// software is provided "as is" without express or implied warranty, and
+// with no claim as to its suitability for any purpose.
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Standard Library Include Files
+#include <algorithm>
+#include <climits>
+#include <vector>
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// DScript Include Files
+#include "compiler.h"
+////////////////////////////////////////////////////////////////////////////////
+
+using namespace std;
+using namespace dscript;
+
+namespace
+{
+    /// Marks an offset no path through the code has reached yet
+    const size_t unreached = size_t(-1);
+
+    /// Returns whether op jumps to its offset operand
+    bool is_jump(op_code op)
+    {
+        switch(op)
+        {
+        case op_jmp:
+        case op_jmp_false:
+        case op_jmp_false_peek:
+        case op_jmp_true_peek:
+        case op_cmp_less_eq_jmp_false:
+        case op_cmp_less_jmp_false:
+        case op_cmp_grtr_eq_jmp_false:
+        case op_cmp_grtr_jmp_false:
+        case op_eq_jmp_false:
+        case op_neq_jmp_false:
+        case op_inline_guard:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    /// Returns whether op is one of the assignments an op_asn_elem does
+    bool is_elem_assignment(op_code op)
+    {
+        switch(op)
+        {
+        case op_assign_var:
+        case op_mul_asn_var:
+        case op_div_asn_var:
+        case op_mod_asn_var:
+        case op_add_asn_var:
+        case op_sub_asn_var:
+        case op_cat_asn_var:
+        case op_band_asn_var:
+        case op_bor_asn_var:
+        case op_bxor_asn_var:
+        case op_shl_asn_var:
+        case op_shr_asn_var:
+        case op_inc_var:
+        case op_dec_var:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    /// Returns how many values the instruction at instr pops off the
+    /// runtime stack, and how many it pushes after that. The *_peek
+    /// jumps are counted as not jumping.
+    void get_stack_effect(const instruction* instr,size_t& pops,size_t& pushes)
+    {
+        op_code op = instr->get_op_code();
+        pops = 0;
+        pushes = 0;
+        if(
+            (op >= op_mul && op <= op_log_or) ||
+            (op >= op_mul_ii && op <= op_neq_ff) ||
+            op == op_cat_aidx_expr
+            )
+        {
+            // binary ops
+            pops = 2;
+            pushes = 1;
+            return;
+        }
+        if(op >= op_assign && op <= op_shr_asn_var)
+        {
+            // the value, and the name of the variable unless the
+            // operand names it
+            pops = get_op_operands(op)[0] == '\0' ? 2 : 1;
+            return;
+        }
+        if(
+            (op >= op_assign_local && op <= op_shr_asn_local) ||
+            (op >= op_assign_global && op <= op_shr_asn_global)
+            )
+        {
+            pops = 1;
+            return;
+        }
+
+        switch(op)
+        {
+        case op_push_str:
+        case op_push_int:
+        case op_push_float:
+        case op_push_var:
+        case op_push_local:
+        case op_push_global:
+        case op_load_ret:
+        case op_call_load_ret:
+            pushes = 1;
+            break;
+        case op_push_var_value:
+        case op_neg:
+        case op_log_not:
+        case op_bit_not:
+        case op_bool:
+            pops = 1;
+            pushes = 1;
+            break;
+        case op_push_param:
+        case op_store_ret:
+        case op_return_value:
+        case op_jmp_false:
+        case op_jmp_false_peek:
+        case op_jmp_true_peek:
+            pops = 1;
+            break;
+        case op_cmp_less_eq_jmp_false:
+        case op_cmp_less_jmp_false:
+        case op_cmp_grtr_eq_jmp_false:
+        case op_cmp_grtr_jmp_false:
+        case op_eq_jmp_false:
+        case op_neq_jmp_false:
+            pops = 2;
+            break;
+        case op_push_elem:
+        case op_push_elem_local:
+        case op_push_elem_global:
+            pops = instr[2].get_int();
+            pushes = 1;
+            break;
+        case op_asn_elem:
+        case op_asn_elem_local:
+        case op_asn_elem_global:
+            {
+                // the value to assign, unless it increments or
+                // decrements, and the indexes
+                op_code asn_op = static_cast<op_code>(instr[3].get_int());
+                pops = instr[2].get_int();
+                if(asn_op != op_inc_var && asn_op != op_dec_var)
+                    ++pops;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    /// The code at file scope, or the body of a function
+    struct region
+    {
+        region(size_t f,size_t t,size_t locals,size_t d)
+            : from(f), to(t), local_count(locals), decl(d)
+        {}
+        size_t from;
+        size_t to;
+        size_t local_count;
+        // the function's op_decl_func, or unreached at file scope
+        size_t decl;
+    };
+
+    /// Verifies a codeblock one region at a time. The body of a function
+    /// is verified on its own; the code around it only sees its
+    /// op_decl_func, which goes on at the end of the body.
+    class verifier
+    {
+    public:
+        explicit verifier(codeblock_t& code)
+            : m_code(code),
+              m_start(code.size(),false),
+              m_depth(code.size(),unreached),
+              m_params(code.size(),0)
+        {}
+
+        size_t verify()
+        {
+            size_t file_depth = 0;
+            m_regions.push_back(region(0,m_code.size(),0,unreached));
+            while(!m_regions.empty())
+            {
+                region r = m_regions.back();
+                m_regions.pop_back();
+                find_instructions(r);
+                check_jumps(r);
+                size_t depth = find_depths(r);
+                if(r.decl == unreached)
+                    file_depth = depth;
+                else
+                    m_code[r.decl].set_profile(static_cast<unsigned int>(depth));
+            }
+            return file_depth;
+        }
+
+    private:
+        verify_error error(size_t off,const string& msg) const
+        {
+            return verify_error(msg,off);
+        }
+
+        /// Checks every instruction in r, and queues the body of each
+        /// function declared in it
+        void find_instructions(const region& r)
+        {
+            m_jumps.clear();
+            size_t off = r.from;
+            while(off < r.to)
+            {
+                // read as an int, since it may not be an op_code at all
+                int op_val = m_code[off].get_int();
+                if(op_val < 0 || op_val >= op_count)
+                    throw error(off,"Invalid op_code.");
+                op_code op = static_cast<op_code>(op_val);
+                m_start[off] = true;
+                size_t size = check_operands(off,r);
+                if(is_jump(op))
+                    m_jumps.push_back(off);
+
+                if(op == op_decl_func)
+                {
+                    int end = m_code[off + 2].get_int();
+                    if(end < 0 || size_t(end) < off + size || size_t(end) > r.to)
+                        throw error(off,"Function ends outside of its code.");
+                    m_regions.push_back(region(
+                        off + size,
+                        end,
+                        m_code[off + 3].get_int(),
+                        off
+                        ));
+                    off = end;
+                }
+                else
+                    off += size;
+            }
+        }
+
+        /// Checks the operands of the instruction at off, and returns
+        /// its size
+        size_t check_operands(size_t off,const region& r)
+        {
+            op_code op = m_code[off].get_op_code();
+            size_t i = off + 1;
+            for(const char* operands = get_op_operands(op); *operands != '\0'; ++operands, ++i)
+            {
+                if(i >= r.to)
+                    throw error(off,"Missing operand.");
+                const instruction& slot = m_code[i];
+                int val = slot.get_int();
+                switch(*operands)
+                {
+                case 'n':
+                case 's':
+                    if(slot.get_str() == 0)
+                        throw error(off,"Missing string.");
+                    break;
+                case 'f':
+                    if(slot.get_flt() == 0)
+                        throw error(off,"Missing float.");
+                    break;
+                case 'l':
+                    if(val < 0 || size_t(val) >= r.local_count)
+                        throw error(off,"Frame slot out of range.");
+                    break;
+                case 'g':
+                    // only vmachine::link() gives out global slots
+                    throw error(off,"Global slot in an unlinked codeblock.");
+                case 'd':
+                    if(val < 0 || size_t(val) > m_code.size())
+                        throw error(off,"Declaration out of range.");
+                    break;
+                case 'x':
+                    // op_load_func holds its compiled_image, every other
+                    // cache starts out empty
+                    if(op != op_load_func && slot.get_offset() != 0)
+                        throw error(off,"Inline cache not empty.");
+                    break;
+                case 'c':
+                    if(val < 0 || size_t(val) > r.to - i - 1)
+                        throw error(off,"Slot count out of range.");
+                    for(size_t name = 0; name < size_t(val); ++name)
+                    {
+                        if(m_code[++i].get_str() == 0)
+                            throw error(off,"Missing slot name.");
+                    }
+                    break;
+                default:
+                    // ints, and offsets, which are checked once every
+                    // instruction has been found
+                    break;
+                }
+            }
+
+            switch(op)
+            {
+            case op_call_func:
+            case op_call_load_ret:
+            case op_push_elem:
+            case op_push_elem_local:
+            case op_push_elem_global:
+                if(m_code[off + 2].get_int() < 0)
+                    throw error(off,"Negative count.");
+                break;
+            case op_asn_elem:
+            case op_asn_elem_local:
+            case op_asn_elem_global:
+                if(m_code[off + 2].get_int() < 0)
+                    throw error(off,"Negative count.");
+                if(!is_elem_assignment(static_cast<op_code>(m_code[off + 3].get_int())))
+                    throw error(off,"Invalid array element assignment.");
+                break;
+            default:
+                break;
+            }
+            return i - off;
+        }
+
+        /// Checks that every jump in r lands on one of its instructions,
+        /// or at its end
+        void check_jumps(const region& r) const
+        {
+            for(size_t i = 0; i < m_jumps.size(); ++i)
+            {
+                int target = m_code[m_jumps[i] + 1].get_int();
+                if(
+                    target < 0 ||
+                    size_t(target) < r.from ||
+                    size_t(target) > r.to ||
+                    (size_t(target) < r.to && !m_start[target])
+                    )
+                    throw error(m_jumps[i],"Jump to the middle of an instruction.");
+            }
+        }
+
+        /// Follows every path through r, working out how deep the
+        /// runtime stack, and the params pushed for a call, are at each
+        /// instruction. Returns the deepest the runtime stack gets.
+        size_t find_depths(const region& r)
+        {
+            size_t max_depth = 0;
+            vector<size_t> work;
+            if(r.from < r.to)
+            {
+                m_depth[r.from] = 0;
+                m_params[r.from] = 0;
+                work.push_back(r.from);
+            }
+            while(!work.empty())
+            {
+                size_t off = work.back();
+                work.pop_back();
+                const instruction* instr = &m_code[off];
+                op_code op = instr->get_op_code();
+                size_t next = off + get_instr_size(m_code.begin() + off);
+                size_t depth = m_depth[off];
+                size_t params = m_params[off];
+
+                size_t pops;
+                size_t pushes;
+                get_stack_effect(instr,pops,pushes);
+                if(pops > depth)
+                    throw error(off,"Runtime stack underflow.");
+                size_t new_depth = depth - pops + pushes;
+                max_depth = max(max_depth,new_depth);
+                if(max_depth > UINT_MAX)
+                    throw error(off,"Runtime stack too deep.");
+
+                switch(op)
+                {
+                case op_push_param:
+                case op_param_str:
+                case op_param_int:
+                case op_param_var:
+                case op_param_local:
+                case op_param_global:
+                    ++params;
+                    break;
+                case op_call_func:
+                case op_call_load_ret:
+                    {
+                        size_t argc = instr[2].get_int();
+                        if(argc > params)
+                            throw error(off,"Call with more params than were pushed.");
+                        params -= argc;
+                    }
+                    break;
+                case op_pop_param:
+                case op_pop_param_local:
+                    // past the params pushed here are the function's
+                    // own, if any are left
+                    if(params > 0)
+                        --params;
+                    break;
+                default:
+                    break;
+                }
+
+                switch(op)
+                {
+                case op_return:
+                case op_return_value:
+                case op_load_func:
+                    if(new_depth != 0)
+                        throw error(off,"Return with values left on the runtime stack.");
+                    break;
+                case op_jmp:
+                    flow(r,off,instr[1].get_int(),new_depth,params,work);
+                    break;
+                case op_decl_func:
+                    flow(r,off,instr[2].get_int(),new_depth,params,work);
+                    break;
+                case op_jmp_false_peek:
+                case op_jmp_true_peek:
+                    // the value is only popped if it doesn't jump
+                    flow(r,off,instr[1].get_int(),depth,params,work);
+                    flow(r,off,next,new_depth,params,work);
+                    break;
+                default:
+                    if(is_jump(op))
+                        flow(r,off,instr[1].get_int(),new_depth,params,work);
+                    flow(r,off,next,new_depth,params,work);
+                    break;
+                }
+            }
+            return max_depth;
+        }
+
+        /// Goes on from the instruction at off to target, with the given
+        /// depths
+        void flow(
+            const region& r,
+            size_t off,
+            size_t target,
+            size_t depth,
+            size_t params,
+            vector<size_t>& work
+            )
+        {
+            if(target == r.to)
+            {
+                // running off the end returns
+                if(depth != 0)
+                    throw error(off,"Return with values left on the runtime stack.");
+                return;
+            }
+            if(m_depth[target] == unreached)
+            {
+                m_depth[target] = depth;
+                m_params[target] = params;
+                work.push_back(target);
+            }
+            else if(m_depth[target] != depth || m_params[target] != params)
+                throw error(off,"Stack depths differ where paths join.");
+        }
+
+        codeblock_t& m_code;
+        // whether an instruction starts at each offset, and the depths
+        // there once a path has reached it
+        vector<bool> m_start;
+        vector<size_t> m_depth;
+        vector<size_t> m_params;
+        // the regions still to verify, and the jumps in the current one
+        vector<region> m_regions;
+        vector<size_t> m_jumps;
+    };
+}
+
+size_t dscript::verify_codeblock(codeblock_t& code)
+{
+    verifier v(code);
+    return v.verify();
+}
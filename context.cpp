@@ -19,6 +19,21 @@
 #include <fstream>
 ////////////////////////////////////////////////////////////////////////////////
 
+////////////////////////////////////////////////////////////////////////////////
+// Platform Includes
+#ifdef _MSC_VER
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <sys/types.h>
+#endif
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Boost Includes (http://www.boost.org)
+#include <boost/cstdint.hpp>
+////////////////////////////////////////////////////////////////////////////////
+
 ////////////////////////////////////////////////////////////////////////////////
 // DScript Includes
 #include "context.h"
@@ -28,7 +43,8 @@
 using namespace std;
 using namespace dscript;
 
-context::context() : log_out(0)
+context::context()
+    : eval_cache(256), log_out(0), array_aliases(false), next_collect(1024)
 {
 }
 
@@ -37,6 +53,26 @@ void context::enable_logging(ostream* out)
     log_out = out;
 }
 
+void context::enable_array_aliases()
+{
+    array_aliases = true;
+}
+
+void context::disable_array_aliases()
+{
+    array_aliases = false;
+}
+
+bool context::enable_jit()
+{
+    return runtime.enable_jit(true);
+}
+
+void context::disable_jit()
+{
+    runtime.enable_jit(false);
+}
+
 void context::disable_logging()
 {
     log_out = 0;
@@ -63,7 +99,8 @@ void context::link_function(
     host_function_t callback,
     int minargs,
     int maxargs,
-    const char* usage
+    const char* usage,
+    bool uses_locals
 )
 {
     string_table::entry ste = runtime.strings.insert(name);
@@ -76,22 +113,50 @@ void context::link_function(
             callback,
             minargs,
             maxargs,
-            usage
+            usage,
+            uses_locals
             );
 }
 
+void context::link_compiled(
+    const char* name,
+    compiled_func func,
+    unsigned int checksum
+)
+{
+    runtime.link_compiled(runtime.strings.insert(name),func,checksum);
+}
+
 value context::get_global(const string& name)
 {
     if(name.length() > 0 && name[0] == '$')
-        return runtime.globals[runtime.strings.insert(name)];
-    else
-        return value();
+    {
+        const value* var = runtime.find_var(name);
+        if(var != 0)
+            return *var;
+    }
+    return value();
 }
 
 void context::set_global(const string& name,const value& val)
 {
     if(name.length() > 0 && name[0] == '$')
-        runtime.globals[runtime.strings.insert(name)] = val;
+        runtime.m_globals[get_global_handle(name)] = val;
+}
+
+global_handle context::get_global_handle(const string& name)
+{
+    return runtime.get_global_slot(runtime.strings.insert(name));
+}
+
+value context::get_global(global_handle handle)
+{
+    return runtime.m_globals[handle];
+}
+
+void context::set_global(global_handle handle,const value& val)
+{
+    runtime.m_globals[handle] = val;
 }
 
 value context::get_local(const string& name)
@@ -102,15 +167,11 @@ value context::get_local(const string& name)
         name[0] == '%'
         )
     {
-        return
-            runtime.m_callstack.top()[
-                runtime.strings.insert(
-                    name
-                    )
-            ];
+        const value* var = runtime.find_var(name);
+        if(var != 0)
+            return *var;
     }
-    else
-        return value();
+    return value();
 
 }
 
@@ -122,11 +183,7 @@ void context::set_local(const string& name, const value& val)
         name[0] == '%'
         )
     {
-            runtime.m_callstack.top()[
-                runtime.strings.insert(
-                    name
-                    )
-            ] = val;
+        runtime.get_named_var(name) = val;
     }
 }
 
@@ -139,12 +196,9 @@ value context::call(const string& func)
 value context::call(const string& func,const args_t& args)
 {
     runtime.m_return_val.clear();
-    runtime.m_param_stack.clear();
 
-    func_table::entry* e =
-        runtime.functions.find(
-            runtime.strings.insert(func)
-            );
+    string_table::symbol sym = runtime.strings.find_symbol(func);
+    func_table::entry* e = sym != 0 ? runtime.functions.find(sym) : 0;
 
     if(e == 0)
         log_msg(func + ": function not found");
@@ -153,13 +207,11 @@ value context::call(const string& func,const args_t& args)
     else
     {
         // copy the args to the param stack (backwards)!
-        runtime.m_param_stack.assign(
-            args.begin(),
-            args.end()
-            );
-        reverse(
-            runtime.m_param_stack.begin(),
-            runtime.m_param_stack.end()
+        // anything already there belongs to a caller
+        runtime.m_param_stack.insert(
+            runtime.m_param_stack.end(),
+            args.rbegin(),
+            args.rend()
             );
 
         // run the script function
@@ -167,12 +219,143 @@ value context::call(const string& func,const args_t& args)
             e->begin,
             e->end,
             e->start,
-            *this
+            *this,
+            e,
+            args.size()
             );
+        check_strings();
     }
     return runtime.m_return_val;
 }
 
+void context::set_max_call_depth(size_t depth)
+{
+    runtime.m_max_call_depth = depth;
+}
+
+namespace
+{
+    /// Marks every string a codeblock refers to
+    void mark_code(const codeblock_t& codeblock,string_table& strings)
+    {
+        for(size_t off = 0; off < codeblock.size(); ++off)
+        {
+            op_code op = codeblock[off].get_op_code();
+            const char* operands = get_op_operands(op);
+            for(; *operands != '\0'; ++operands)
+            {
+                ++off;
+                switch(*operands)
+                {
+                case 'n':
+                case 's':
+                    strings.mark(codeblock[off].get_str());
+                    break;
+                case 'c':
+                    {
+                        size_t slot_count = codeblock[off].get_int();
+                        for(size_t slot = 0; slot < slot_count; ++slot)
+                            strings.mark(codeblock[++off].get_str());
+                    }
+                    break;
+                }
+            }
+        }
+    }
+}
+
+size_t context::collect_strings()
+{
+    // the frames of a running script hold names too
+    if(!runtime.m_callstack.empty())
+        return 0;
+
+    map<string,codeblock_t>::const_iterator code = codeblocks.begin();
+    for(; code != codeblocks.end(); ++code)
+        mark_code(code->second,runtime.strings);
+    code_cache::const_iterator cached = eval_cache.begin();
+    for(; cached != eval_cache.end(); ++cached)
+        mark_code(*cached->code,runtime.strings);
+    for(size_t i = 0; i < retained_code.size(); ++i)
+        mark_code(*retained_code[i],runtime.strings);
+    for(size_t i = 0; i < bundles.size(); ++i)
+        bundles[i]->mark_strings(runtime.strings);
+    map<string,compiled_image_ptr>::const_iterator image = images.begin();
+    for(; image != images.end(); ++image)
+    {
+        if(image->second)
+            image->second->mark_strings(runtime.strings);
+    }
+
+    const vmachine::global_map& globals = runtime.m_global_names;
+    for(size_t slot = 0; slot < globals.slot_count(); ++slot)
+    {
+        if(globals.get_key(slot) != 0)
+            runtime.strings.mark_symbol(globals.get_key(slot));
+    }
+
+    const symbol_map<vmachine::compiled_version>& compiled =
+        runtime.m_compiled;
+    for(size_t slot = 0; slot < compiled.slot_count(); ++slot)
+    {
+        if(compiled.get_key(slot) != 0)
+            runtime.strings.mark_symbol(compiled.get_key(slot));
+    }
+
+    runtime.functions.mark_names(runtime.strings);
+    return runtime.strings.sweep();
+}
+
+string_stats context::get_string_stats() const
+{
+    string_stats stats;
+    stats.size = runtime.strings.size();
+    stats.collections = runtime.strings.get_collections();
+    stats.reclaimed = runtime.strings.get_reclaimed();
+    return stats;
+}
+
+void context::set_eval_cache_size(size_t entries)
+{
+    vector<codeblock_ptr> evicted;
+    eval_cache.set_max_entries(entries,evicted);
+    release_code(evicted);
+}
+
+void context::release_code(const vector<codeblock_ptr>& evicted)
+{
+    // a script that is running can't lose its code, nor can the
+    // functions defined in it. Otherwise, code nothing uses is freed
+    // once the last codeblock_ptr to it goes.
+    bool running = !runtime.m_callstack.empty();
+    if(!running)
+    {
+        vector<codeblock_ptr> still_used;
+        for(size_t i = 0; i < retained_code.size(); ++i)
+        {
+            if(runtime.functions.refers_to(*retained_code[i]))
+                still_used.push_back(retained_code[i]);
+        }
+        retained_code.swap(still_used);
+    }
+    for(size_t i = 0; i < evicted.size(); ++i)
+    {
+        if(running || runtime.functions.refers_to(*evicted[i]))
+            retained_code.push_back(evicted[i]);
+    }
+}
+
+void context::check_strings()
+{
+    if(
+        runtime.strings.size() < next_collect ||
+        !runtime.m_callstack.empty()
+        )
+        return;
+    collect_strings();
+    next_collect = max<size_t>(1024,runtime.strings.size() * 2);
+}
+
 void dump_asm(const codeblock_t& codeblock,ostream& out)
 {
     // dump the op_name
@@ -185,88 +368,69 @@ void dump_asm(const codeblock_t& codeblock,ostream& out)
         // output the integer val
         unsigned int v = codeblock[off].get_int();
         out << '('<< v << ") " << get_op_name(op) << endl;
-        switch(codeblock[off].get_op_code())
+
+        // one line for each operand
+        const char* operands = get_op_operands(op);
+        for(; *operands != '\0'; ++operands)
         {
-        case op_call_func:
-        case op_push_var:
-        case op_inc_var:
-        case op_dec_var:
-        case op_pop_param:
-        case op_assign_var:
-        case op_mul_asn_var:
-        case op_div_asn_var:
-        case op_mod_asn_var:
-        case op_add_asn_var:
-        case op_sub_asn_var:
-        case op_cat_asn_var:
-        case op_band_asn_var:
-        case op_bor_asn_var:
-        case op_bxor_asn_var:
-        case op_shl_asn_var:
-        case op_shr_asn_var:
-            {
-                ++off;
-                // output the offset
-                out << setw(5) << setfill('0') << off << ':';
-                // out the string
-                out << codeblock[off].get_str() << endl;
-            }
-            break;
-        case op_push_str:
+            ++off;
+            // output the offset
+            out << setw(5) << setfill('0') << off << ':';
+            const instruction& operand = codeblock[off];
+            switch(*operands)
             {
-                ++off;
-                // output the offset
-                out << setw(5) << setfill('0') << off << ':';
+            case 'n':
+                // out the name
+                out << operand.get_str();
+                break;
+            case 's':
                 // output the escaped string
-                out << '"' << escape(codeblock[off].get_str()) << '"' << endl;
-            }
-            break;
-        case op_push_float:
-            {
-                ++off;
-                // output the offset
-                out << setw(5) << setfill('0') << off << ':';
-                // output the float value
-                out << *(codeblock[off].get_flt()) << endl;
-            }
-            break;
-        case op_push_int:
-            {
-                ++off;
-                // output the offset
-                out << setw(5) << setfill('0') << off << ':';
+                out << '"' << escape(operand.get_str()) << '"';
+                break;
+            case 'i':
                 // out the int value
-                out << codeblock[off].get_int() << endl;
-            }
-            break;
-        case op_jmp_false:
-        case op_jmp:
-            {
-                ++off;
-                // output the offset
-                out << setw(5) << setfill('0') << off << ':';
+                out << operand.get_int();
+                break;
+            case 'f':
+                // output the float value
+                out << *(operand.get_flt());
+                break;
+            case 'o':
                 // out the jump to offset
-                out << codeblock[off].get_offset() << endl;
+                out << operand.get_offset();
+                break;
+            case 'd':
+                // out the offset of the function declaration
+                out << operand.get_offset();
+                break;
+            case 'l':
+                // out the frame slot
+                out << '#' << operand.get_int();
+                break;
+            case 'g':
+                // out the global slot
+                out << "$#" << operand.get_int();
+                break;
+            case 'x':
+                // inline cache
+                out << "<cache>";
+                break;
+            case 'c':
+                {
+                    // out the frame slot count, and the name of each slot
+                    size_t slot_count = operand.get_int();
+                    out << slot_count;
+                    for(size_t slot = 0; slot < slot_count; ++slot)
+                    {
+                        ++off;
+                        out << endl;
+                        out << setw(5) << setfill('0') << off << ':';
+                        out << '#' << slot << ' ' << codeblock[off].get_str();
+                    }
+                }
+                break;
             }
-            break;
-        case op_decl_func:
-            {
-                ++off;
-                // output the offset
-                out << setw(5) << setfill('0') << off << ':';
-                // out the function name
-                out << codeblock[off].get_str() << endl;
-
-                ++off;
-                // output the offset
-                out << setw(5) << setfill('0') << off << ':';
-                // out the function end offset
-                out << codeblock[off].get_offset() << endl;
-            }
-            break;
-          default:
-            // Nop
-            break;
+            out << endl;
         }
      }
 }
@@ -277,7 +441,8 @@ void context::dump_code(std::ostream& out,const std::string& code)
     {
         string_table strings;
         float_table floats;
-        codeblock_t codeblock = dscript::compile(code,strings,floats);
+        codeblock_t codeblock =
+            dscript::compile(code,strings,floats,array_aliases);
         dump_asm(codeblock,out);
     }
     catch(compiler_error& ce)
@@ -313,14 +478,39 @@ bool context::eval(const std::string& code)
 {
     try
     {
-        codeblock_t& codeblock = codeblocks[code];
-        codeblock = dscript::compile(code,runtime.strings,runtime.floats);
-        runtime.execute(
-            codeblock.begin(),
-            codeblock.end(),
-            codeblock.begin(),
-            *this
-            );
+        // held here too, since evaluating another string while it runs
+        // can evict it
+        codeblock_ptr codeblock = eval_cache.find(code,array_aliases);
+        vector<codeblock_ptr> evicted;
+        if(!codeblock)
+        {
+            codeblock.reset(new codeblock_t(dscript::compile(
+                code,
+                runtime.strings,
+                runtime.floats,
+                array_aliases
+                )));
+            runtime.link(*codeblock);
+            eval_cache.insert(code,array_aliases,codeblock,evicted);
+        }
+        // released only once it has run, since the code the cache
+        // doesn't keep has to be kept if it declared functions
+        try
+        {
+            runtime.execute(
+                codeblock->begin(),
+                codeblock->end(),
+                codeblock->begin(),
+                *this
+                );
+        }
+        catch(...)
+        {
+            release_code(evicted);
+            throw;
+        }
+        release_code(evicted);
+        check_strings();
         return true;
     }
     catch(compiler_error& ce)
@@ -336,6 +526,102 @@ bool context::eval(const std::string& code)
     }
 }
 
+namespace
+{
+    /// 64 bit FNV-1a of a script, and of everything else that decides
+    /// what it compiles to
+    boost::uint64_t hash_script(const string& source,bool array_aliases)
+    {
+        boost::uint64_t hash = 14695981039346656037ULL;
+        for(size_t c = 0; c < source.size(); ++c)
+        {
+            hash ^= static_cast<unsigned char>(source[c]);
+            hash *= 1099511628211ULL;
+        }
+        hash ^= array_aliases ? 1 : 0;
+        hash *= 1099511628211ULL;
+        for(unsigned int b = 0; b < 4; ++b)
+        {
+            hash ^= (compiler_version >> (b * 8)) & 0xff;
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    /// The file the compile cache in dir keeps the code of a script in
+    string get_cache_file(
+        const string& dir,
+        const string& source,
+        bool array_aliases
+        )
+    {
+        stringstream name;
+        name << dir << '/' << hex << setw(16) << setfill('0')
+            << hash_script(source,array_aliases) << ".dsc";
+        return name.str();
+    }
+}
+
+void context::enable_compile_cache(const std::string& dir)
+{
+    // fails harmlessly if it exists already
+#ifdef _MSC_VER
+    _mkdir(dir.c_str());
+#else
+    mkdir(dir.c_str(),0777);
+#endif
+    compile_cache = dir;
+}
+
+void context::disable_compile_cache()
+{
+    compile_cache.clear();
+}
+
+bool context::load_cached(
+    const std::string& source,
+    codeblock_t& code,
+    compiled_image_ptr& image
+)
+{
+    try
+    {
+        compiled_image_ptr cached_image;
+        codeblock_t cached = load_compiled_lazy(
+            get_cache_file(compile_cache,source,array_aliases),
+            runtime.strings,
+            runtime.floats,
+            cached_image
+            );
+        runtime.link(cached);
+        code.swap(cached);
+        image = cached_image;
+        return true;
+    }
+    catch(std::runtime_error&)
+    {
+        // not cached yet, or saved in a format this version can't load,
+        // or damaged; any of which means compiling it again
+        return false;
+    }
+}
+
+void context::save_cached(const std::string& source,const codeblock_t& code)
+{
+    try
+    {
+        save_codeblock(
+            get_cache_file(compile_cache,source,array_aliases),
+            code
+            );
+    }
+    catch(std::runtime_error& e)
+    {
+        // the script still runs, it's only compiled again next time
+        log_msg(e.what());
+    }
+}
+
 bool context::exec(const std::string& file)
 {
     ifstream infile(file.c_str());
@@ -353,13 +639,30 @@ bool context::exec(const std::string& file)
     try
     {
         codeblock_t& codeblock = codeblocks[file];
-        codeblock = dscript::compile(code_str,runtime.strings,runtime.floats);
+        if(
+            compile_cache.empty() ||
+            !load_cached(code_str,codeblock,images[file])
+            )
+        {
+            codeblock = dscript::compile(
+                code_str,
+                runtime.strings,
+                runtime.floats,
+                array_aliases
+                );
+            // saved before it is linked, which makes it specific to
+            // this runtime
+            if(!compile_cache.empty())
+                save_cached(code_str,codeblock);
+            runtime.link(codeblock);
+        }
         runtime.execute(
             codeblock.begin(),
             codeblock.end(),
             codeblock.begin(),
             *this
             );
+        check_strings();
         return true;
     }
     catch(compiler_error& ce)
@@ -378,24 +681,70 @@ bool context::exec(const std::string& file)
 bool context::exec_compiled(const std::string& file)
 {
     string comp_file = file + ".dsc";
-    ifstream infile(comp_file.c_str());
-    if(!infile)
-    {
-        log_msg(file + " could not be opened.");
-        return false;
-    }
     try
     {
+        compiled_bundle_ptr bundle;
+        for(size_t i = 0; i < bundles.size() && !bundle; ++i)
+        {
+            if(bundles[i]->has_script(file))
+                bundle = bundles[i];
+        }
+        if(!bundle && !compile_cache.empty())
+        {
+            ifstream source(file.c_str());
+            if(source)
+                return exec(file);
+        }
+        if(!bundle)
+        {
+            ifstream infile(comp_file.c_str());
+            if(!infile)
+            {
+                log_msg(file + " could not be opened.");
+                return false;
+            }
+        }
+
         codeblock_t& code = codeblocks[file];
-        code = load_compiled_file(comp_file,runtime.strings,runtime.floats);
+        if(bundle)
+        {
+            code = bundle->load_script(
+                file,
+                runtime.strings,
+                runtime.floats,
+                images[file]
+                );
+        }
+        else
+        {
+            code = load_compiled_lazy(
+                comp_file,
+                runtime.strings,
+                runtime.floats,
+                images[file]
+                );
+        }
+        runtime.link(code);
         runtime.execute(
             code.begin(),
             code.end(),
             code.begin(),
             *this
             );
+        check_strings();
         return true;
     }
+    catch(verify_error& ve)
+    {
+        if(log_out != 0)
+        {
+            stringstream msg;
+            msg << "Verify Error: " << ve.what() << endl;
+            msg << "At: " << file << ":" << ve.offset << endl;
+            log_msg(msg.str());
+        }
+        return false;
+    }
     catch(std::runtime_error& e)
     {
         if(log_out != 0)
@@ -404,6 +753,20 @@ bool context::exec_compiled(const std::string& file)
     }
 }
 
+bool context::add_bundle(const std::string& file)
+{
+    try
+    {
+        bundles.push_back(open_bundle(file));
+        return true;
+    }
+    catch(std::runtime_error& e)
+    {
+        log_msg(e.what());
+        return false;
+    }
+}
+
 bool context::compile(const std::string& file)
 {
     ifstream infile(file.c_str());
@@ -422,7 +785,12 @@ bool context::compile(const std::string& file)
     {
         save_codeblock(
             file + ".dsc",
-            dscript::compile(code_str,runtime.strings,runtime.floats)
+            dscript::compile(
+                code_str,
+                runtime.strings,
+                runtime.floats,
+                array_aliases
+                )
             );
         return true;
     }
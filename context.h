@@ -16,6 +16,7 @@
 #include <string>
 #include <iostream>
 #include <map>
+#include <vector>
 ////////////////////////////////////////////////////////////////////////////////
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -23,10 +24,21 @@
 #include "value.h"
 #include "functions.h"
 #include "vmachine.h"
+#include "codecache.h"
+#include "compiler.h"
 ////////////////////////////////////////////////////////////////////////////////
 
 namespace dscript
 {
+    /// How big a context's string table is, and how much has been
+    /// reclaimed from it, see context::collect_strings()
+    struct string_stats
+    {
+        size_t size;
+        size_t collections;
+        size_t reclaimed;
+    };
+
     /// Encapsulates an entire runtime environment
     /// for executing DScript scripts
     class context
@@ -36,37 +48,133 @@ namespace dscript
         void enable_logging(std::ostream* out);
         void disable_logging();
         void log_msg(const std::string& message);
+
+        /// Compiles $a[1] as the variable $a_1, instead of an element of
+        /// the array $a, for scripts written for older versions of
+        /// DScript. Only affects scripts compiled afterwards.
+        void enable_array_aliases();
+        void disable_array_aliases();
         void set_return(const value& val);
+
+        /// Compiles script functions to native code once they have been
+        /// called often enough (see jit.h). Returns false if this build
+        /// has no JIT, which is the case unless DSCRIPT_JIT is defined.
+        bool enable_jit();
+        void disable_jit();
         
+        /// Links a host function, which scripts call by name. Passing
+        /// uses_locals false promises that it never gets or sets the
+        /// %locals of the script function calling it (see get_local()),
+        /// which lets the script functions that call it run inline (see
+        /// inline_functions() in compiler.h).
         void link_function(const char* name,host_function_t callback);
         void link_function(
             const char* name,
             host_function_t callback,
             int minargs,
             int maxargs,
-            const char* usage
+            const char* usage,
+            bool uses_locals = true
             );
 
+        /// Runs the script function name with the C++ version
+        /// dscript2cpp wrote for it, once it is defined, as long as its
+        /// code still has the checksum dscript2cpp saw. The link_ function
+        /// dscript2cpp writes calls this for every function it compiled.
+        void link_compiled(
+            const char* name,
+            compiled_func func,
+            unsigned int checksum
+            );
+
+        /// Compiles and runs a string of code. The code compiled for the
+        /// most recently evaluated strings is kept, so evaluating one of
+        /// them again only runs it.
         bool eval(const std::string& code);
+
+        /// Changes how many strings eval() keeps the code of (256 by
+        /// default), 0 to compile every time
+        void set_eval_cache_size(size_t entries);
         bool exec(const std::string& file);
         bool exec_compiled(const std::string& file);
+
+        /// Keeps the code exec() compiles in the directory dir, which is
+        /// created if it doesn't exist, under a hash of the source and
+        /// compiler_version. A script whose source hasn't changed since
+        /// is loaded from there instead of being compiled again.
+        /// exec_compiled() runs a script it has the source of this way as
+        /// well, so that it never runs a .dsc older than the source.
+        void enable_compile_cache(const std::string& dir);
+        void disable_compile_cache();
+
+        /// Adds the scripts in a bundle written by save_bundle() (see
+        /// compiler.h). exec_compiled() runs a script the bundles have
+        /// from the first one added with it, instead of its .dsc file.
+        bool add_bundle(const std::string& file);
         bool compile(const std::string& file);
         
         value call(const std::string& func);
         value call(const std::string& func,const args_t& args);
 
+        /// Limits how deeply script functions may call each other.
+        /// A call past the limit is a runtime error.
+        void set_max_call_depth(size_t depth);
+
         value get_local(const std::string& name);
         void set_local(const std::string& name,const value& val);
 
         value get_global(const std::string& name);
         void set_global(const std::string& name,const value& val);
 
+        /// Returns a handle to a global variable, which can be used to get
+        /// and set it without looking it up by name. Handles stay valid for
+        /// the lifetime of the context.
+        global_handle get_global_handle(const std::string& name);
+        value get_global(global_handle handle);
+        void set_global(global_handle handle,const value& val);
+
+        /// Removes the strings nothing refers to anymore from the string
+        /// table, and returns how many there were. This happens by itself
+        /// every time the table doubles in size, but only while no
+        /// script is running, which is also the only time this works.
+        size_t collect_strings();
+        string_stats get_string_stats() const;
+
         void dump_code(std::ostream& out,const std::string& code);
         void dump_file(std::ostream& out,const std::string& file);
     private:
+        /// Collects the string table if it has grown enough
+        void check_strings();
+
+        /// Keeps the codeblocks the eval cache evicted that are still in
+        /// use, and frees the ones kept before that no longer are
+        void release_code(const std::vector<codeblock_ptr>& evicted);
+
+        /// Loads and links the code the compile cache has for source.
+        /// Returns false if it has none that can be run.
+        bool load_cached(
+            const std::string& source,
+            codeblock_t& code,
+            compiled_image_ptr& image
+            );
+
+        /// Saves the code compiled for source to the compile cache
+        void save_cached(const std::string& source,const codeblock_t& code);
+
         vmachine runtime;
         std::map<std::string,codeblock_t> codeblocks;
+        // the compiled files exec_compiled() has loaded, which the
+        // functions declared in them are decoded from when first called
+        std::map<std::string,compiled_image_ptr> images;
+        std::vector<compiled_bundle_ptr> bundles;
+        code_cache eval_cache;
+        // evicted code that functions are defined in, or that is running
+        std::vector<codeblock_ptr> retained_code;
         std::ostream* log_out;
+        bool array_aliases;
+        // the directory exec() caches compiled code in, empty if none
+        std::string compile_cache;
+        size_t next_collect;
     };
 }
 
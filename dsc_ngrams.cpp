@@ -0,0 +1,145 @@
+////////////////////////////////////////////////////////////////////////////////
+// DScript Scripting Language
+// Copyright (C) 2003 Bryan "daerid" Ross
+//
+// Permission to copy, use, modify, sell and distribute this software is
+// granted provided this copyright notice appears in all copies. This
+// software is provided "as is" without express or implied warranty, and
+// with no claim as to its suitability for any purpose.
+////////////////////////////////////////////////////////////////////////////////
+
+// dsc_ngrams: counts the most frequent op_code sequences in a set of
+// compiled (.dsc) files, to find candidates for superinstructions.
+//
+// usage: dsc_ngrams [-n max_length] [-top count] file.dsc...
+//
+// Sequences never cross a jump target, since the vmachine could not
+// enter a fused op_code in the middle.
+
+////////////////////////////////////////////////////////////////////////////////
+// Standard Library Includes
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// DScript Includes
+#include "compiler.h"
+////////////////////////////////////////////////////////////////////////////////
+
+using namespace std;
+using namespace dscript;
+
+namespace
+{
+    typedef vector<op_code> sequence_t;
+    typedef map<sequence_t,size_t> ngram_map;
+
+    /// Counts every sequence of 2 to max_length op_codes in code
+    void count_ngrams(const codeblock_t& code,size_t max_length,ngram_map& counts)
+    {
+        // find the op_codes, and everything that's jumped to
+        vector<size_t> ops;
+        set<size_t> targets;
+        for(size_t off = 0; off < code.size(); off += get_instr_size(code.begin() + off))
+        {
+            if(
+                code[off].get_op_code() >= op_count ||
+                off + get_instr_size(code.begin() + off) > code.size()
+                )
+                throw std::runtime_error("bad op_code in codeblock");
+            ops.push_back(off);
+            const char* operands = get_op_operands(code[off].get_op_code());
+            for(size_t i = 1; *operands != '\0'; ++operands, ++i)
+            {
+                if(*operands == 'o')
+                    targets.insert(code[off + i].get_int());
+            }
+        }
+
+        for(size_t first = 0; first < ops.size(); ++first)
+        {
+            sequence_t seq(1,code[ops[first]].get_op_code());
+            for(size_t i = first + 1; i < ops.size() && seq.size() < max_length; ++i)
+            {
+                if(targets.count(ops[i]) != 0)
+                    break;
+                seq.push_back(code[ops[i]].get_op_code());
+                ++counts[seq];
+            }
+        }
+    }
+
+    bool by_count(
+        const pair<sequence_t,size_t>& lhs,
+        const pair<sequence_t,size_t>& rhs
+        )
+    {
+        return lhs.second > rhs.second;
+    }
+}
+
+int main(int argc,char* argv[])
+{
+    size_t max_length = 4;
+    size_t top = 30;
+    vector<string> files;
+    for(int i = 1; i < argc; ++i)
+    {
+        if(strcmp(argv[i],"-n") == 0 && i + 1 < argc)
+            max_length = atoi(argv[++i]);
+        else if(strcmp(argv[i],"-top") == 0 && i + 1 < argc)
+            top = atoi(argv[++i]);
+        else
+            files.push_back(argv[i]);
+    }
+    if(files.empty())
+    {
+        cerr << "usage: dsc_ngrams [-n max_length] [-top count] file.dsc..."
+            << endl;
+        return 1;
+    }
+
+    ngram_map counts;
+    for(size_t i = 0; i < files.size(); ++i)
+    {
+        try
+        {
+            string_table strings;
+            float_table floats;
+            codeblock_t code = load_compiled_file(files[i],strings,floats);
+            count_ngrams(code,max_length,counts);
+        }
+        catch(std::runtime_error& e)
+        {
+            cerr << files[i] << ": " << e.what() << endl;
+        }
+    }
+
+    // most frequent first
+    vector<pair<sequence_t,size_t> > sorted(counts.begin(),counts.end());
+    stable_sort(sorted.begin(),sorted.end(),by_count);
+    if(sorted.size() > top)
+        sorted.resize(top);
+
+    for(size_t i = 0; i < sorted.size(); ++i)
+    {
+        cout << sorted[i].second << '\t';
+        const sequence_t& seq = sorted[i].first;
+        for(size_t op = 0; op < seq.size(); ++op)
+        {
+            if(op != 0)
+                cout << " ; ";
+            cout << get_op_name(seq[op]);
+        }
+        cout << endl;
+    }
+    return 0;
+}
@@ -0,0 +1,125 @@
+////////////////////////////////////////////////////////////////////////////////
+// DScript Scripting Language
+// Copyright (C) 2003 Bryan "daerid" Ross
+//
+// Permission to copy, use, modify, sell and distribute this software is
+// granted provided this copyright notice appears in all copies. This
+// software is provided "as is" without express or implied warranty, and
+// with no claim as to its suitability for any purpose.
+////////////////////////////////////////////////////////////////////////////////
+
+// dscbundle: packs compiled scripts into one bundle (see save_bundle() in
+// compiler.h), that context::add_bundle() can run them from.
+//
+// usage: dscbundle [-a] [-z] -o bundle.dsb script...
+//
+// A script is either a source, which is compiled (with array aliases
+// with -a), or a .dsc file context::compile() saved. Either way it is
+// packed under the name context::exec_compiled() is given for it, which
+// is the name of the source. -z deflates the code of the scripts, which
+// needs a build with DSCRIPT_ZLIB defined.
+
+////////////////////////////////////////////////////////////////////////////////
+// Standard Library Includes
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// DScript Includes
+#include "compiler.h"
+////////////////////////////////////////////////////////////////////////////////
+
+using namespace std;
+using namespace dscript;
+
+namespace
+{
+    bool ends_with(const string& str,const string& end)
+    {
+        return str.size() >= end.size() &&
+            str.compare(str.size() - end.size(),end.size(),end) == 0;
+    }
+
+    /// Compiles a script, or loads it if it is compiled already, and
+    /// returns the name it is packed under
+    string load_script(
+        const string& filename,
+        bool array_aliases,
+        string_table& strings,
+        float_table& floats,
+        codeblock_t& code
+        )
+    {
+        if(ends_with(filename,".dsc"))
+        {
+            code = load_compiled_file(filename,strings,floats);
+            return filename.substr(0,filename.size() - 4);
+        }
+
+        ifstream file(filename.c_str(),ios::in | ios::binary);
+        if(!file)
+            throw std::runtime_error(filename + " could not be opened.");
+        string source(
+            (istreambuf_iterator<char>(file)),
+            istreambuf_iterator<char>()
+            );
+        try
+        {
+            code = compile(source,strings,floats,array_aliases);
+        }
+        catch(compiler_error& e)
+        {
+            cerr << filename << ':' << e.pos.line << ':' << e.pos.col << ": "
+                << e.what() << endl;
+            throw std::runtime_error(filename + " could not be compiled.");
+        }
+        return filename;
+    }
+}
+
+int main(int argc,char* argv[])
+{
+    bool array_aliases = false;
+    bool compress = false;
+    string out;
+    vector<string> files;
+    for(int i = 1; i < argc; ++i)
+    {
+        if(strcmp(argv[i],"-a") == 0)
+            array_aliases = true;
+        else if(strcmp(argv[i],"-z") == 0)
+            compress = true;
+        else if(strcmp(argv[i],"-o") == 0 && i + 1 < argc)
+            out = argv[++i];
+        else
+            files.push_back(argv[i]);
+    }
+    if(out.empty() || files.empty())
+    {
+        cerr << "usage: dscbundle [-a] [-z] -o bundle.dsb script..." << endl;
+        return 1;
+    }
+
+    try
+    {
+        string_table strings;
+        float_table floats;
+        vector<string> names(files.size());
+        vector<codeblock_t> code(files.size());
+        for(size_t i = 0; i < files.size(); ++i)
+            names[i] = load_script(files[i],array_aliases,strings,floats,code[i]);
+        save_bundle(out,names,code,compress);
+    }
+    catch(std::runtime_error& e)
+    {
+        cerr << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,393 @@
+////////////////////////////////////////////////////////////////////////////////
+// DScript Scripting Language
+// Copyright (C) 2003 Bryan "daerid" Ross
+//
+// Permission to copy, use, modify, sell and distribute this software is
+// granted provided this copyright notice appears in all copies. This
+// software is provided "as is" without express or implied warranty, and
+// with no claim as to its suitability for any purpose.
+////////////////////////////////////////////////////////////////////////////////
+
+// dscript2cpp: writes the script functions of a script (or compiled .dsc
+// file) out as C++, to be built into the host.
+//
+// usage: dscript2cpp [-a] [-o out.cpp] [-name link_func] file
+//
+// -a compiles the script with array aliases (see context), and -name
+// names the function that links the compiled functions into a context,
+// link_<file name> by default. The host runs the script as usual after
+// calling it, and every script function the script defines then runs as
+// C++ instead of being interpreted (see native.h). A function whose code
+// differs from what dscript2cpp saw, because the script has changed since,
+// is still interpreted.
+//
+// Op_codes are translated one by one against the vmachine's runtime stack
+// and frame slots, ints and floats being handled inline. Anything else
+// runs through the vmachine, and the few op_codes only the interpreter
+// can run hand the rest of the call back to it.
+
+////////////////////////////////////////////////////////////////////////////////
+// Standard Library Includes
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// DScript Includes
+#include "compiler.h"
+#include "functions.h"
+////////////////////////////////////////////////////////////////////////////////
+
+using namespace std;
+using namespace dscript;
+
+namespace
+{
+    /// A script function found in a codeblock
+    struct script_func
+    {
+        string name;
+        string cpp_name;
+        size_t start;
+        size_t end;
+        size_t local_count;
+    };
+
+    /// Turns name into something that can be part of a C++ identifier
+    string sanitize(const string& name)
+    {
+        string result;
+        for(size_t i = 0; i < name.length(); ++i)
+        {
+            unsigned char ch = name[i];
+            result += isalnum(ch) ? static_cast<char>(ch) : '_';
+        }
+        return result;
+    }
+
+    /// Finds the script functions declared in code
+    vector<script_func> find_funcs(const codeblock_t& code)
+    {
+        vector<script_func> funcs;
+        for(size_t off = 0; off < code.size(); off += get_instr_size(code.begin() + off))
+        {
+            op_code op = code[off].get_op_code();
+            if(op >= op_count || off + get_instr_size(code.begin() + off) > code.size())
+                throw std::runtime_error("bad op_code in codeblock");
+            if(op != op_decl_func)
+                continue;
+
+            script_func func;
+            func.name = code[off + 1].get_str();
+            func.end = code[off + 2].get_int();
+            func.local_count = code[off + 3].get_int();
+            func.start = off + 4 + func.local_count;
+            if(func.end < func.start || func.end > code.size())
+                throw std::runtime_error("bad function in codeblock");
+            stringstream cpp_name;
+            cpp_name << 'f' << funcs.size() << '_' << sanitize(func.name);
+            func.cpp_name = cpp_name.str();
+            funcs.push_back(func);
+        }
+        return funcs;
+    }
+
+    /// Returns the comparison op_code a compare and jump op_code does
+    op_code get_compare_op(op_code op)
+    {
+        switch(op)
+        {
+        case op_cmp_less_eq_jmp_false:  return op_cmp_less_eq;
+        case op_cmp_less_jmp_false:     return op_cmp_less;
+        case op_cmp_grtr_eq_jmp_false:  return op_cmp_grtr_eq;
+        case op_cmp_grtr_jmp_false:     return op_cmp_grtr;
+        case op_eq_jmp_false:           return op_eq;
+        case op_neq_jmp_false:          return op_neq;
+        default:                        return op_invalid;
+        }
+    }
+
+    /// Returns the binary op_code a compound assignment to a frame slot
+    /// does, for the ones native_frame::assign_local() can do
+    op_code get_assign_op(op_code op)
+    {
+        switch(op)
+        {
+        case op_add_asn_local:  return op_add;
+        case op_sub_asn_local:  return op_sub;
+        case op_mul_asn_local:  return op_mul;
+        default:                return op_invalid;
+        }
+    }
+
+    /// Writes the C++ version of func
+    void write_func(
+        const codeblock_t& code,
+        const script_func& func,
+        ostream& out
+        )
+    {
+        // jumps are relative to the start of the function, and may only
+        // go as far as its end
+        set<size_t> targets;
+        for(size_t off = func.start; off < func.end; off += get_instr_size(code.begin() + off))
+        {
+            // ops left to the interpreter jump by themselves
+            op_code op = code[off].get_op_code();
+            if(is_interpreter_only(op))
+                continue;
+            const char* operands = get_op_operands(op);
+            for(size_t i = 1; *operands != '\0'; ++operands, ++i)
+            {
+                if(*operands != 'o')
+                    continue;
+                size_t target = code[off + i].get_int();
+                if(target < func.start || target > func.end)
+                    throw std::runtime_error(func.name + ": jump out of function");
+                targets.insert(target - func.start);
+            }
+        }
+
+        out << "// " << func.name << endl;
+        out << "const instruction* " << func.cpp_name << "(native_frame& f)" << endl;
+        out << '{' << endl;
+        bool falls_through = true;
+        for(size_t off = func.start; off < func.end; off += get_instr_size(code.begin() + off))
+        {
+            size_t rel = off - func.start;
+            if(targets.count(rel) != 0)
+                out << 'L' << rel << ':' << endl;
+
+            op_code op = code[off].get_op_code();
+            instr_iter operand = code.begin() + off + 1;
+            stringstream line;
+            op_code generic = get_unquickened_op(op);
+            if(is_interpreter_only(op))
+                line << "return f.code + " << rel << ';';
+            else if(get_compare_op(op) != op_invalid)
+            {
+                line << "if(f.compare_jumps(" << get_op_name(get_compare_op(op))
+                    << ',' << rel << ")) goto L"
+                    << operand->get_int() - func.start << ';';
+            }
+            else if(get_assign_op(op) != op_invalid)
+            {
+                line << "f.assign_local(" << get_op_name(get_assign_op(op))
+                    << ',' << operand->get_int() << ',' << rel << ");";
+            }
+            else switch(generic)
+            {
+            case op_push_int:
+                line << "f.stack.push(value(" << operand->get_int() << "));";
+                break;
+            case op_push_float:
+                line << "f.stack.push(value(*f.code[" << rel + 1
+                    << "].get_flt()));";
+                break;
+            case op_push_local:
+                line << "f.stack.push(f.locals[" << operand->get_int() << "]);";
+                break;
+            case op_assign_local:
+                line << "f.locals[" << operand->get_int()
+                    << "] = f.stack.top(); f.stack.pop();";
+                break;
+            case op_inc_local:
+            case op_dec_local:
+                line << "f.locals[" << operand->get_int()
+                    << "].set_type(value::type_int); "
+                    << (generic == op_inc_local ? "++" : "--")
+                    << "f.locals[" << operand->get_int() << "].intval;";
+                break;
+            case op_add:
+            case op_sub:
+            case op_mul:
+            case op_div:
+                line << "f.binary(" << get_op_name(generic) << ',' << rel << ");";
+                break;
+            case op_cmp_less_eq:
+            case op_cmp_less:
+            case op_cmp_grtr_eq:
+            case op_cmp_grtr:
+            case op_eq:
+            case op_neq:
+                line << "f.compare(" << get_op_name(generic) << ',' << rel << ");";
+                break;
+            case op_jmp_false:
+                line << "if(f.jump_false(" << rel << ")) goto L"
+                    << operand->get_int() - func.start << ';';
+                break;
+            case op_jmp_false_peek:
+            case op_jmp_true_peek:
+                line << "if(f.jump_peek("
+                    << (generic == op_jmp_true_peek ? "true" : "false")
+                    << ',' << rel << ")) goto L"
+                    << operand->get_int() - func.start << ';';
+                break;
+            case op_jmp:
+                line << "goto L" << operand->get_int() - func.start << ';';
+                break;
+            case op_inline_guard:
+                line << "if(f.run_op(" << rel << ")) goto L"
+                    << operand->get_int() - func.start << ';';
+                break;
+            case op_return:
+                line << "return f.end;";
+                break;
+            case op_return_value:
+                line << "f.run_op(" << rel << "); return f.end;";
+                break;
+            default:
+                line << "f.run_op(" << rel << ");";
+                break;
+            }
+            out << "    " << line.str() << " // " << get_op_name(op) << endl;
+            falls_through =
+                !is_interpreter_only(op) &&
+                generic != op_jmp &&
+                generic != op_return &&
+                generic != op_return_value;
+        }
+        if(targets.count(func.end - func.start) != 0)
+        {
+            out << 'L' << func.end - func.start << ':' << endl;
+            falls_through = true;
+        }
+        if(falls_through)
+            out << "    return f.end;" << endl;
+        out << '}' << endl << endl;
+    }
+
+    /// Writes the C++ version of every script function in code, and
+    /// link_name() to link them
+    void write_cpp(
+        const codeblock_t& code,
+        const string& file,
+        const string& link_name,
+        ostream& out
+        )
+    {
+        vector<script_func> funcs = find_funcs(code);
+
+        out << "// Generated by dscript2cpp from " << file
+            << ", do not edit." << endl << endl;
+        out << "#include \"native.h\"" << endl << endl;
+        out << "using namespace dscript;" << endl << endl;
+        out << "namespace" << endl << '{' << endl;
+        for(size_t i = 0; i < funcs.size(); ++i)
+            write_func(code,funcs[i],out);
+        out << '}' << endl << endl;
+
+        out << "void " << link_name << "(context& ctx)" << endl;
+        out << '{' << endl;
+        for(size_t i = 0; i < funcs.size(); ++i)
+        {
+            unsigned int checksum = get_func_checksum(
+                code.begin(),
+                code.begin() + funcs[i].start,
+                code.begin() + funcs[i].end,
+                funcs[i].local_count
+                );
+            out << "    ctx.link_compiled(\"" << escape(funcs[i].name) << "\","
+                << funcs[i].cpp_name << ',' << checksum << "u);" << endl;
+        }
+        out << '}' << endl;
+    }
+
+    /// Compiles a script, or loads a .dsc file
+    codeblock_t load(
+        const string& file,
+        string_table& strings,
+        float_table& floats,
+        bool array_aliases
+        )
+    {
+        if(file.length() > 4 && file.substr(file.length() - 4) == ".dsc")
+            return load_compiled_file(file,strings,floats);
+
+        ifstream infile(file.c_str());
+        if(!infile)
+            throw std::runtime_error("could not be opened");
+        infile >> noskipws;
+        string code_str(
+            (istream_iterator<char>(infile)),
+            istream_iterator<char>()
+            );
+        try
+        {
+            return compile(code_str,strings,floats,array_aliases);
+        }
+        catch(compiler_error& ce)
+        {
+            stringstream msg;
+            msg << ce.pos.line << ':' << ce.pos.col << ": " << ce.what();
+            throw std::runtime_error(msg.str());
+        }
+    }
+
+    /// The default name of the link function for file
+    string get_link_name(const string& file)
+    {
+        string name = file.substr(file.find_last_of("/\\") + 1);
+        name = name.substr(0,name.find('.'));
+        return "link_" + sanitize(name);
+    }
+}
+
+int main(int argc,char* argv[])
+{
+    bool array_aliases = false;
+    string out_file;
+    string link_name;
+    string file;
+    for(int i = 1; i < argc; ++i)
+    {
+        if(strcmp(argv[i],"-a") == 0)
+            array_aliases = true;
+        else if(strcmp(argv[i],"-o") == 0 && i + 1 < argc)
+            out_file = argv[++i];
+        else if(strcmp(argv[i],"-name") == 0 && i + 1 < argc)
+            link_name = argv[++i];
+        else
+            file = argv[i];
+    }
+    if(file.empty())
+    {
+        cerr << "usage: dscript2cpp [-a] [-o out.cpp] [-name link_func] file"
+            << endl;
+        return 1;
+    }
+    if(link_name.empty())
+        link_name = get_link_name(file);
+
+    try
+    {
+        string_table strings;
+        float_table floats;
+        codeblock_t code = load(file,strings,floats,array_aliases);
+
+        stringstream cpp;
+        write_cpp(code,file,link_name,cpp);
+        if(out_file.empty())
+            cout << cpp.str();
+        else
+        {
+            ofstream out(out_file.c_str());
+            if(!(out << cpp.str()))
+                throw std::runtime_error("could not write " + out_file);
+        }
+    }
+    catch(std::runtime_error& e)
+    {
+        cerr << file << ": " << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -16,13 +16,62 @@
 using namespace std;
 using namespace dscript;
 
+namespace
+{
+    inline void hash_int(unsigned int& hash,int val)
+    {
+        // FNV-1a, a byte at a time
+        for(int byte = 0; byte < 4; ++byte)
+        {
+            hash ^= (static_cast<unsigned int>(val) >> (byte * 8)) & 0xff;
+            hash *= 16777619u;
+        }
+    }
+}
+
+unsigned int dscript::get_func_checksum(
+    instr_iter begin,
+    instr_iter start,
+    instr_iter end,
+    size_t local_count
+    )
+{
+    unsigned int hash = 2166136261u;
+    hash_int(hash,static_cast<int>(local_count));
+    for(instr_iter instr = start; instr < end; instr += get_instr_size(instr))
+    {
+        op_code op = get_unquickened_op(instr->get_op_code());
+        if(get_var_op(op) != op_invalid)
+            op = get_var_op(op);
+        hash_int(hash,op);
+        // compiled code leaves these to the interpreter
+        if(is_interpreter_only(op))
+            continue;
+
+        const char* operands = get_op_operands(op);
+        for(size_t i = 1; *operands != '\0'; ++operands, ++i)
+        {
+            if(*operands == 'i' || *operands == 'l')
+                hash_int(hash,instr[i].get_int());
+            else if(*operands == 'o')
+            {
+                // jumps count from the start of the function, so it
+                // can be anywhere in its codeblock
+                hash_int(hash,instr[i].get_int() - int(start - begin));
+            }
+        }
+    }
+    return hash;
+}
+
 func_table::entry* func_table::find(string_table::entry name)
 {
-    func_map::iterator found = functions.find(name);
-    if(found == functions.end())
-        return 0;
-    else
-        return &(found->second);
+    return functions.find(string_table::get_symbol(name));
+}
+
+func_table::entry* func_table::find(string_table::symbol name)
+{
+    return functions.find(name);
 }
 
 void func_table::add_script_func
@@ -30,14 +79,26 @@ void func_table::add_script_func
     string_table::entry name,
     instr_iter begin,
     instr_iter start,
-    instr_iter end
+    instr_iter end,
+    size_t local_count,
+    instr_iter local_names,
+    size_t max_stack
 )
 {
-    entry& e = functions[name];
+    entry& e = functions[string_table::get_symbol(name)];
+    retire_native(e);
     e.begin = begin;
     e.start = start;
     e.end = end;
+    e.local_count = local_count;
+    e.local_names = local_names;
+    e.max_stack = max_stack;
+    e.call_count = 0;
+    e.native = 0;
+    e.compiled = 0;
+    ++generation;
     e.is_host = false;
+    e.uses_locals = false;
     e.name = name;
 }
 
@@ -56,17 +117,26 @@ void func_table::add_host_func
     host_function_t callback,
     int minargs,
     int maxargs,
-    const char* usage
+    const char* usage,
+    bool uses_locals
 )
 {
-    entry& e = functions[name];
+    entry& e = functions[string_table::get_symbol(name)];
+    retire_native(e);
     e.is_host = true;
+    e.uses_locals = uses_locals;
     e.name = name;
+    e.local_count = 0;
+    e.max_stack = 0;
+    e.call_count = 0;
+    e.native = 0;
+    e.compiled = 0;
     e.host_func = callback;
     e.min_args = minargs;
     e.max_args = maxargs;
     if(usage != 0)
         e.usage_string = usage;
+    ++generation;
 }
 
 void func_table::remove_host_func(
@@ -74,10 +144,49 @@ void func_table::remove_host_func(
     )
 {
     // ok, find it
-    func_map::iterator f = functions.find(name);
-    if(f != functions.end())
+    string_table::symbol sym = string_table::get_symbol(name);
+    entry* e = functions.find(sym);
+    if(e != 0 && e->is_host)
     {
-        if(f->second.is_host)
-            functions.erase(f);
+        functions.erase(sym);
+        ++generation;
     }
-}
\ No newline at end of file
+}
+
+void func_table::mark_names(string_table& strings) const
+{
+    for(size_t slot = 0; slot < functions.slot_count(); ++slot)
+    {
+        if(functions.get_key(slot) != 0)
+            strings.mark(functions.get_value(slot).name);
+    }
+}
+
+bool func_table::refers_to(const codeblock_t& code) const
+{
+    if(code.empty())
+        return false;
+    const instruction* first = &code.front();
+    const instruction* last = first + code.size();
+    for(size_t slot = 0; slot < functions.slot_count(); ++slot)
+    {
+        if(functions.get_key(slot) == 0)
+            continue;
+        const entry& e = functions.get_value(slot);
+        if(!e.is_host && &*e.start >= first && &*e.start < last)
+            return true;
+    }
+    return false;
+}
+
+void func_table::take_retired_native(vector<const void*>& retired)
+{
+    retired.insert(retired.end(),retired_native.begin(),retired_native.end());
+    retired_native.clear();
+}
+
+void func_table::retire_native(const entry& e)
+{
+    if(e.native != 0)
+        retired_native.push_back(e.native);
+}
@@ -34,6 +34,26 @@ namespace dscript
         class context& ctx
         );
 
+    class native_frame;
+
+    /// A script function compiled to C++ by dscript2cpp. Runs the
+    /// function in frame, and returns the instruction the interpreter
+    /// carries on from (see native.h).
+    typedef const instruction* (*compiled_func)(native_frame& frame);
+
+    /// Returns a checksum of a script function's code, which begins at
+    /// start in the codeblock at begin. Only what compiled_funcs depend
+    /// on counts: the op_codes, int constants, jumps and frame slots,
+    /// but not the names, strings and floats they read from the code
+    /// as they run. Op_codes the vmachine rewrites count the same as
+    /// the ones they were rewritten from.
+    unsigned int get_func_checksum(
+        instr_iter begin,
+        instr_iter start,
+        instr_iter end,
+        size_t local_count
+        );
+
     /// Maintains a List of all currently defined functions
     class func_table
     {
@@ -45,26 +65,47 @@ namespace dscript
             instr_iter begin;
             instr_iter start;
             instr_iter end;
+            size_t local_count;
+            instr_iter local_names;
+            // how deep a script function takes the runtime stack (see
+            // verify_codeblock)
+            size_t max_stack;
             host_function_t host_func;
+            // whether a host function may get or set the %locals of the
+            // script function calling it (see context::link_function)
+            bool uses_locals;
             int min_args;
             int max_args;
             std::string usage_string;
+            // how often a script function has been called, and its
+            // native code once the JIT has compiled it (see jit.h)
+            mutable size_t call_count;
+            mutable const void* native;
+            // its C++ version, if dscript2cpp compiled it
+            compiled_func compiled;
         };
     private:
-        typedef std::map<
-            string_table::entry,
-            func_table::entry,
-            cmp_ste
-        > func_map;
+        typedef symbol_map<func_table::entry> func_map;
     public:
+        func_table() : generation(1) {}
+
+        entry* find(string_table::entry name);
+        entry* find(string_table::symbol name);
 
-        entry* find(string_table::entry name);        
+        /// Changes every time a function is added, redefined or removed,
+        /// so anything that remembers the result of find() can tell
+        /// when it has gone stale. Adding a function can move the others,
+        /// too.
+        size_t get_generation() const { return generation; }
  
         void add_script_func(
             string_table::entry name,
             instr_iter begin,
             instr_iter start,
-            instr_iter end
+            instr_iter end,
+            size_t local_count,
+            instr_iter local_names,
+            size_t max_stack
             );
 
         void add_host_func(
@@ -77,14 +118,32 @@ namespace dscript
             host_function_t callback,
             int minargs,
             int maxargs,
-            const char* usage
+            const char* usage,
+            bool uses_locals = true
             );
 
         void remove_host_func(
             string_table::entry name
             );
+
+        /// Marks the name of every function, see string_table::mark()
+        void mark_names(string_table& strings) const;
+
+        /// Returns whether a script function defined now has its code in
+        /// code, which can't be freed until it is redefined
+        bool refers_to(const codeblock_t& code) const;
+
+        /// Moves the native code of the functions redefined since the
+        /// last call into retired, for the JIT to free once none of it
+        /// is running
+        void take_retired_native(std::vector<const void*>& retired);
     private:
+        /// Keeps the native code of e, which is being redefined
+        void retire_native(const entry& e);
+
         func_map functions;
+        size_t generation;
+        std::vector<const void*> retired_native;
     };
 }
 
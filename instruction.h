@@ -28,32 +28,68 @@ namespace dscript
     class instruction
     {
     public:
-        instruction() { data.opcode = op_invalid; }
+        // the unused bytes of each slot are zeroed, so that a codeblock
+        // always has the same binary image
+        instruction() { data.offset = 0; data.op.opcode = op_invalid; }
         instruction(const instruction& other) { data = other.data; }
-        instruction(op_code op) { data.opcode = op; }
+        instruction(op_code op) { data.offset = 0; data.op.opcode = op; }
         instruction(string_table::entry ste) { data.strval = ste; }
         instruction(float_table::entry fte) { data.fltval = fte; }
-        instruction(int i) { data.intval = i; }
+        instruction(int i) { data.offset = 0; data.intval = i; }
         instruction(size_t off) { data.offset = off; }
+        instruction(const void* ptr) { data.offset = 0; data.ptr = ptr; }
 
-        op_code get_op_code() const { return data.opcode; }
+        op_code get_op_code() const { return data.op.opcode; }
         string_table::entry get_str() const { return data.strval; }
         float_table::entry get_flt() const { return data.fltval; }
         int get_int() const { return data.intval; }
         size_t get_offset() const { return data.offset; }
+        const void* get_ptr() const { return data.ptr; }
+
+        /// Replaces the op_code, keeping the profile
+        void set_op_code(op_code op) { data.op.opcode = op; }
+
+        /// The runtime profile of an op_code slot, kept by the vmachine
+        /// in the slot's spare bits. Always 0 in freshly compiled code.
+        /// An op_decl_func's is how deep the function takes the runtime
+        /// stack instead, once the codeblock has been verified (see
+        /// verify_codeblock).
+        unsigned int get_profile() const { return data.op.profile; }
+        void set_profile(unsigned int profile) { data.op.profile = profile; }
 
     private:
-        union {
+        struct op_data
+        {
             op_code opcode;
+            unsigned int profile;
+        };
+
+        union {
+            op_data op;
             string_table::entry strval;
             float_table::entry fltval;
             int intval;
             size_t offset;
+            const void* ptr;
         } data;
     };
 
     typedef std::vector<instruction> codeblock_t;
     typedef codeblock_t::const_iterator instr_iter;
+
+    /// Returns the number of slots taken up by the instruction at instr,
+    /// the op_code and all of its operands included
+    inline size_t get_instr_size(instr_iter instr)
+    {
+        const char* operands = get_op_operands(instr->get_op_code());
+        size_t size = 1;
+        for(; *operands != '\0'; ++operands, ++size)
+        {
+            if(*operands == 'c')
+                size += (instr + size)->get_int();
+        }
+        return size;
+    }
 }
 
 #endif//__DSCRIPT_INSTRUCTION_H__
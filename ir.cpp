@@ -0,0 +1,859 @@
+////////////////////////////////////////////////////////////////////////////////
+// DScript Scripting Language
+// Copyright (C) 2003 Bryan "daerid" Ross
+//
+// Permission to copy, use, modify, sell and distribute this software is
+// granted provided this copyright notice appears in all copies. This
+// software is provided "as is" without express or implied warranty, and
+// with no claim as to its suitability for any purpose.
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Standard Library Includes
+#include <algorithm>
+#include <set>
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// DScript Includes
+#include "ir.h"
+////////////////////////////////////////////////////////////////////////////////
+
+using namespace std;
+using namespace dscript;
+
+namespace
+{
+    // how many times the slot values of every block may be worked out
+    // before analyze() gives up on them settling
+    const size_t max_ssa_passes = 64;
+
+    /// Returns whether op jumps
+    bool is_jump(op_code op)
+    {
+        const char* operands = get_op_operands(op);
+        return operands[0] == 'o' && op != op_decl_func;
+    }
+
+    /// Returns whether control never goes past op to the next instruction
+    bool is_terminator(op_code op)
+    {
+        return op == op_jmp || op == op_return || op == op_return_value;
+    }
+
+    /// Returns the binary op_code a compound assignment to a frame slot
+    /// does, or op_invalid
+    op_code get_binary_op(op_code op)
+    {
+        switch(op)
+        {
+        case op_mul_asn_local:  return op_mul;
+        case op_div_asn_local:  return op_div;
+        case op_mod_asn_local:  return op_mod;
+        case op_add_asn_local:  return op_add;
+        case op_sub_asn_local:  return op_sub;
+        case op_cat_asn_local:  return op_cat;
+        case op_band_asn_local: return op_bit_and;
+        case op_bor_asn_local:  return op_bit_or;
+        case op_bxor_asn_local: return op_bit_xor;
+        case op_shl_asn_local:  return op_shl;
+        case op_shr_asn_local:  return op_shr;
+        default:                return op_invalid;
+        }
+    }
+
+    /// Returns whether op takes two values off the runtime stack and
+    /// pushes one computed from them
+    bool is_binary_op(op_code op)
+    {
+        switch(op)
+        {
+        case op_cat_aidx_expr:
+        case op_mul:
+        case op_div:
+        case op_mod:
+        case op_add:
+        case op_sub:
+        case op_cat:
+        case op_shl:
+        case op_shr:
+        case op_cmp_less_eq:
+        case op_cmp_less:
+        case op_cmp_grtr_eq:
+        case op_cmp_grtr:
+        case op_eq:
+        case op_neq:
+        case op_bit_and:
+        case op_bit_or:
+        case op_bit_xor:
+        case op_log_and:
+        case op_log_or:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    /// Returns whether op replaces the top of the runtime stack with a
+    /// value computed from it
+    bool is_unary_op(op_code op)
+    {
+        return op == op_neg || op == op_log_not || op == op_bit_not || op == op_bool;
+    }
+
+    /// Returns the type of what a pure op_code computes
+    ir_type get_result_type(op_code op,ir_type lhs,ir_type rhs)
+    {
+        switch(op)
+        {
+        case op_add:
+        case op_sub:
+        case op_mul:
+        case op_div:
+            // like the compound assignments: ints stay ints, anything
+            // else is worked out as a float
+            if(lhs == ir_int && rhs == ir_int)
+                return ir_int;
+            if(
+                lhs == ir_flt || lhs == ir_str ||
+                rhs == ir_flt || rhs == ir_str
+                )
+                return ir_flt;
+            return ir_unknown;
+        case op_cat:
+        case op_cat_aidx_expr:
+            return ir_str;
+        default:
+            return ir_int;
+        }
+    }
+}
+
+const size_t ir_func::npos;
+
+bool dscript::is_pure_op(op_code op)
+{
+    switch(op)
+    {
+    case op_push_int:
+    case op_push_float:
+    case op_push_str:
+    case op_push_local:
+        return true;
+    default:
+        return is_binary_op(op) || is_unary_op(op);
+    }
+}
+
+bool dscript::is_slot_barrier(const ir_instr& instr)
+{
+    switch(instr.op)
+    {
+    case op_call_func:
+    case op_call_load_ret:
+    case op_push_var_value:
+    case op_assign:
+    case op_mul_asn:
+    case op_div_asn:
+    case op_mod_asn:
+    case op_add_asn:
+    case op_sub_asn:
+    case op_cat_asn:
+    case op_band_asn:
+    case op_bor_asn:
+    case op_bxor_asn:
+    case op_shl_asn:
+    case op_shr_asn:
+        return true;
+    default:
+        break;
+    }
+    // a named variable is a $global if its name says so, and otherwise
+    // may be a %local looked up by name
+    if(get_op_operands(instr.op)[0] != 'n' || instr.op == op_decl_func)
+        return false;
+    string_table::entry name = instr.operands[0].get_str();
+    return name[0] != '$';
+}
+
+bool dscript::get_stack_effect(const ir_instr& instr,size_t& pops,size_t& pushes)
+{
+    pops = 0;
+    pushes = 0;
+    op_code op = instr.op;
+    if(is_binary_op(op))
+    {
+        pops = 2;
+        pushes = 1;
+        return true;
+    }
+    if(is_unary_op(op))
+    {
+        pops = 1;
+        pushes = 1;
+        return true;
+    }
+    switch(op)
+    {
+    case op_push_str:
+    case op_push_int:
+    case op_push_float:
+    case op_push_var:
+    case op_push_local:
+    case op_push_global:
+    case op_load_ret:
+    case op_call_load_ret:
+        pushes = 1;
+        return true;
+    case op_push_var_value:
+        pops = 1;
+        pushes = 1;
+        return true;
+    case op_call_func:
+    case op_inc_var:
+    case op_dec_var:
+    case op_inc_local:
+    case op_dec_local:
+    case op_inc_global:
+    case op_dec_global:
+    case op_pop_param:
+    case op_pop_param_local:
+    case op_param_str:
+    case op_param_int:
+    case op_param_var:
+    case op_param_local:
+    case op_param_global:
+    case op_return:
+    case op_jmp:
+    case op_inline_guard:
+        return true;
+    case op_push_param:
+    case op_store_ret:
+    case op_return_value:
+    case op_jmp_false:
+    case op_jmp_false_peek:
+    case op_jmp_true_peek:
+    case op_assign_var:
+    case op_assign_local:
+    case op_assign_global:
+    case op_mul_asn_var: case op_mul_asn_local: case op_mul_asn_global:
+    case op_div_asn_var: case op_div_asn_local: case op_div_asn_global:
+    case op_mod_asn_var: case op_mod_asn_local: case op_mod_asn_global:
+    case op_add_asn_var: case op_add_asn_local: case op_add_asn_global:
+    case op_sub_asn_var: case op_sub_asn_local: case op_sub_asn_global:
+    case op_cat_asn_var: case op_cat_asn_local: case op_cat_asn_global:
+    case op_band_asn_var: case op_band_asn_local: case op_band_asn_global:
+    case op_bor_asn_var: case op_bor_asn_local: case op_bor_asn_global:
+    case op_bxor_asn_var: case op_bxor_asn_local: case op_bxor_asn_global:
+    case op_shl_asn_var: case op_shl_asn_local: case op_shl_asn_global:
+    case op_shr_asn_var: case op_shr_asn_local: case op_shr_asn_global:
+        pops = 1;
+        return true;
+    case op_assign:
+    case op_mul_asn:
+    case op_div_asn:
+    case op_mod_asn:
+    case op_add_asn:
+    case op_sub_asn:
+    case op_cat_asn:
+    case op_band_asn:
+    case op_bor_asn:
+    case op_bxor_asn:
+    case op_shl_asn:
+    case op_shr_asn:
+    case op_cmp_less_eq_jmp_false:
+    case op_cmp_less_jmp_false:
+    case op_cmp_grtr_eq_jmp_false:
+    case op_cmp_grtr_jmp_false:
+    case op_eq_jmp_false:
+    case op_neq_jmp_false:
+        pops = 2;
+        return true;
+    case op_push_elem:
+    case op_push_elem_local:
+    case op_push_elem_global:
+        pops = instr.operands[1].get_int();
+        pushes = 1;
+        return true;
+    case op_asn_elem:
+    case op_asn_elem_local:
+    case op_asn_elem_global:
+        {
+            // the value assigned comes first, unless the element is
+            // incremented or decremented
+            op_code asn_op = static_cast<op_code>(instr.operands[2].get_int());
+            pops = instr.operands[1].get_int();
+            if(asn_op != op_inc_var && asn_op != op_dec_var)
+                ++pops;
+        }
+        return true;
+    default:
+        return false;
+    }
+}
+
+int ir_func::get_slot(const ir_instr& instr)
+{
+    if(get_op_operands(instr.op)[0] != 'l')
+        return -1;
+    return instr.operands[0].get_int();
+}
+
+bool ir_func::build(const codeblock_t& code,size_t decl)
+{
+    size_t end = code[decl + 2].get_int();
+    slot_count = code[decl + 3].get_int();
+    size_t start = decl + 4 + slot_count;
+    if(end < start || end > code.size())
+        return false;
+
+    // the instructions, and where each starts
+    vector<ir_instr> instrs;
+    vector<size_t> offsets;
+    set<size_t> leaders;
+    leaders.insert(start);
+    for(size_t off = start; off < end; )
+    {
+        op_code op = code[off].get_op_code();
+        if(op < 0 || op >= op_count)
+            return false;
+        size_t size = get_instr_size(code.begin() + off);
+        if(off + size > end)
+            return false;
+
+        ir_instr instr(op);
+        instr.operands.assign(code.begin() + off + 1,code.begin() + off + size);
+        size_t pops;
+        size_t pushes;
+        if(op == op_decl_func || !get_stack_effect(instr,pops,pushes))
+            return false;
+        if(is_jump(op))
+        {
+            size_t target = instr.operands[0].get_int();
+            if(target < start || target > end)
+                return false;
+            leaders.insert(target);
+            instr.target = target;
+        }
+        if(is_jump(op) || is_terminator(op))
+            leaders.insert(off + size);
+        offsets.push_back(off);
+        instrs.push_back(instr);
+        off += size;
+    }
+
+    // a block starts at each leader, and the empty last one at the end
+    leaders.insert(end);
+    vector<size_t> starts(leaders.begin(),leaders.end());
+    blocks.assign(starts.size(),ir_block());
+    size_t instr_index = 0;
+    for(size_t b = 0; b < starts.size(); ++b)
+    {
+        blocks[b].uid = m_next_uid++;
+        for(; instr_index < instrs.size() && offsets[instr_index] < starts[b]; ++instr_index)
+            ;
+        if(instr_index < instrs.size() && offsets[instr_index] != starts[b])
+            return false; // a jump into the middle of an instruction
+        size_t next = b + 1 < starts.size() ? starts[b + 1] : end;
+        for(; instr_index < instrs.size() && offsets[instr_index] < next; ++instr_index)
+        {
+            ir_instr& instr = instrs[instr_index];
+            instr.uid = m_next_uid++;
+            if(is_jump(instr.op))
+            {
+                instr.target = lower_bound(
+                    starts.begin(),
+                    starts.end(),
+                    instr.target
+                    ) - starts.begin();
+            }
+            blocks[b].code.push_back(instr);
+        }
+    }
+
+    // the entry block is one nothing jumps to
+    insert_block(0);
+
+    // work out the depth of the runtime stack at the start of each
+    // block. Blocks nothing reaches are left empty.
+    find_blocks();
+    vector<bool> known(blocks.size(),false);
+    known[0] = true;
+    for(size_t i = 0; i < order.size(); ++i)
+    {
+        size_t b = order[i];
+        ir_block& block = blocks[b];
+        size_t depth = block.stack_in;
+        size_t jump_depth = depth;
+        for(size_t n = 0; n < block.code.size(); ++n)
+        {
+            const ir_instr& instr = block.code[n];
+            size_t pops;
+            size_t pushes;
+            get_stack_effect(instr,pops,pushes);
+            if(depth < pops)
+                return false;
+            // a peek jump leaves the value it tests on the stack when it
+            // jumps
+            jump_depth = depth;
+            depth += pushes - pops;
+            if(instr.op != op_jmp_false_peek && instr.op != op_jmp_true_peek)
+                jump_depth = depth;
+        }
+        for(size_t s = 0; s < block.succs.size(); ++s)
+        {
+            size_t succ = block.succs[s];
+            size_t succ_depth = succ == b + 1 && s == 0 &&
+                (block.code.empty() || !is_terminator(block.code.back().op)) ?
+                depth : jump_depth;
+            if(known[succ] && blocks[succ].stack_in != succ_depth)
+                return false;
+            blocks[succ].stack_in = succ_depth;
+            known[succ] = true;
+        }
+    }
+    for(size_t b = 0; b < blocks.size(); ++b)
+    {
+        if(!blocks[b].reachable)
+            blocks[b].code.clear();
+    }
+    return true;
+}
+
+void ir_func::find_blocks()
+{
+    for(size_t b = 0; b < blocks.size(); ++b)
+    {
+        ir_block& block = blocks[b];
+        block.succs.clear();
+        block.preds.clear();
+        block.reachable = false;
+        bool falls = b + 1 < blocks.size();
+        if(!block.code.empty())
+        {
+            const ir_instr& last = block.code.back();
+            falls = falls && !is_terminator(last.op);
+            if(falls)
+                block.succs.push_back(b + 1);
+            if(is_jump(last.op) && (!falls || last.target != b + 1))
+                block.succs.push_back(last.target);
+        }
+        else if(falls)
+            block.succs.push_back(b + 1);
+    }
+
+    // depth first from the entry, for the reverse post order
+    order.clear();
+    vector<size_t> stack;
+    vector<size_t> next_succ(blocks.size(),0);
+    stack.push_back(0);
+    blocks[0].reachable = true;
+    while(!stack.empty())
+    {
+        size_t b = stack.back();
+        if(next_succ[b] < blocks[b].succs.size())
+        {
+            size_t succ = blocks[b].succs[next_succ[b]++];
+            if(!blocks[succ].reachable)
+            {
+                blocks[succ].reachable = true;
+                stack.push_back(succ);
+            }
+        }
+        else
+        {
+            order.push_back(b);
+            stack.pop_back();
+        }
+    }
+    reverse(order.begin(),order.end());
+
+    m_rpo_index.assign(blocks.size(),npos);
+    for(size_t i = 0; i < order.size(); ++i)
+    {
+        size_t b = order[i];
+        m_rpo_index[b] = i;
+        for(size_t s = 0; s < blocks[b].succs.size(); ++s)
+            blocks[blocks[b].succs[s]].preds.push_back(b);
+    }
+}
+
+void ir_func::find_dominators()
+{
+    // Cooper, Harvey and Kennedy's "A Simple, Fast Dominance Algorithm"
+    for(size_t b = 0; b < blocks.size(); ++b)
+        blocks[b].idom = npos;
+    blocks[0].idom = 0;
+    bool changed = true;
+    while(changed)
+    {
+        changed = false;
+        for(size_t i = 1; i < order.size(); ++i)
+        {
+            ir_block& block = blocks[order[i]];
+            size_t idom = npos;
+            for(size_t p = 0; p < block.preds.size(); ++p)
+            {
+                size_t pred = block.preds[p];
+                if(blocks[pred].idom == npos)
+                    continue;
+                if(idom == npos)
+                {
+                    idom = pred;
+                    continue;
+                }
+                size_t a = pred;
+                size_t b = idom;
+                while(a != b)
+                {
+                    while(m_rpo_index[a] > m_rpo_index[b])
+                        a = blocks[a].idom;
+                    while(m_rpo_index[b] > m_rpo_index[a])
+                        b = blocks[b].idom;
+                }
+                idom = a;
+            }
+            if(block.idom != idom)
+            {
+                block.idom = idom;
+                changed = true;
+            }
+        }
+    }
+}
+
+bool ir_func::dominates(size_t a,size_t b) const
+{
+    if(!blocks[a].reachable || !blocks[b].reachable)
+        return false;
+    for(;;)
+    {
+        if(a == b)
+            return true;
+        if(b == 0)
+            return false;
+        b = blocks[b].idom;
+    }
+}
+
+ir_value ir_func::get_value(const ir_def& def,size_t block)
+{
+    if(m_defs.empty())
+    {
+        // ir_value 0 is no value
+        m_defs.push_back(ir_def());
+        m_types.push_back(ir_unknown);
+        m_def_blocks.push_back(npos);
+        m_homes.push_back(-1);
+    }
+
+    map<ir_def,ir_value>::iterator found = m_values.find(def);
+    if(found != m_values.end())
+    {
+        if(def.op < 0)
+            m_def_blocks[found->second] = block;
+        return found->second;
+    }
+
+    ir_value val = m_defs.size();
+    m_values[def] = val;
+    m_defs.push_back(def);
+    m_def_blocks.push_back(def.op < 0 ? block : npos);
+    m_homes.push_back(-1);
+    switch(def.op)
+    {
+    case op_push_int:
+        m_types.push_back(ir_int);
+        break;
+    case op_push_float:
+        m_types.push_back(ir_flt);
+        break;
+    case op_push_str:
+        m_types.push_back(ir_str);
+        break;
+    default:
+        if(def.op < 0)
+            m_types.push_back(ir_unknown);
+        else
+        {
+            m_types.push_back(get_result_type(
+                static_cast<op_code>(def.op),
+                m_types[def.lhs],
+                m_types[def.rhs]
+                ));
+        }
+        break;
+    }
+    return val;
+}
+
+bool ir_func::can_fail(op_code op,ir_value lhs,ir_value rhs) const
+{
+    if(op != op_div && op != op_mod)
+        return false;
+    // an int divided by 0 is an error, and by -1 can overflow
+    const ir_def& divisor = m_defs[rhs];
+    if(divisor.op == op_push_int)
+    {
+        int val = instruction(divisor.operand).get_int();
+        return val == 0 || val == -1;
+    }
+    // other than that, a division is done on floats unless both sides
+    // are ints
+    if(op == op_div)
+    {
+        ir_type lhs_type = m_types[lhs];
+        ir_type rhs_type = m_types[rhs];
+        return !(
+            lhs_type == ir_flt || lhs_type == ir_str ||
+            rhs_type == ir_flt || rhs_type == ir_str
+            );
+    }
+    return true;
+}
+
+bool ir_func::run_block(size_t b,vector<ir_value>& slots)
+{
+    ir_block& block = blocks[b];
+    vector<ir_value> stack;
+    for(size_t i = 0; i < block.stack_in; ++i)
+        stack.push_back(get_value(ir_def(ir_def::stack,block.uid,i),b));
+
+    block.slots.resize(block.code.size());
+    for(size_t n = 0; n < block.code.size(); ++n)
+    {
+        ir_instr& instr = block.code[n];
+        block.slots[n] = slots;
+
+        size_t pops;
+        size_t pushes;
+        get_stack_effect(instr,pops,pushes);
+        instr.args.assign(stack.end() - pops,stack.end());
+        stack.resize(stack.size() - pops);
+
+        int slot = get_slot(instr);
+        instr.result = 0;
+        if(pushes != 0)
+        {
+            if(instr.op == op_push_local)
+                instr.result = slots[slot];
+            else if(
+                instr.op == op_push_int ||
+                instr.op == op_push_float ||
+                instr.op == op_push_str
+                )
+            {
+                instr.result = get_value(
+                    ir_def(instr.op,instr.operands[0].get_offset()),
+                    b
+                    );
+            }
+            else if(is_pure_op(instr.op))
+            {
+                instr.result = get_value(
+                    ir_def(
+                        instr.op,
+                        0,
+                        instr.args[0],
+                        instr.args.size() > 1 ? instr.args[1] : 0
+                        ),
+                    b
+                    );
+            }
+            else
+                instr.result = get_value(ir_def(ir_def::opaque,instr.uid),b);
+            stack.push_back(instr.result);
+        }
+
+        instr.slot_out = 0;
+        if(slot >= 0 && instr.op != op_push_local && instr.op != op_param_local &&
+            instr.op != op_push_elem_local)
+        {
+            ir_value val;
+            op_code binary = get_binary_op(instr.op);
+            if(instr.op == op_assign_local)
+                val = instr.args[0];
+            else if(instr.op == op_inc_local || instr.op == op_dec_local)
+                val = get_value(ir_def(instr.op,0,slots[slot]),b);
+            else if(binary != op_invalid)
+                val = get_value(ir_def(binary,0,slots[slot],instr.args[0]),b);
+            else
+                val = get_value(ir_def(ir_def::opaque,instr.uid),b);
+            slots[slot] = val;
+            instr.slot_out = val;
+            if(m_homes[val] < 0)
+                m_homes[val] = slot;
+        }
+        else if(is_slot_barrier(instr))
+        {
+            for(size_t s = 0; s < slots.size(); ++s)
+            {
+                slots[s] = get_value(ir_def(ir_def::clobber,instr.uid,s),b);
+                if(m_homes[slots[s]] < 0)
+                    m_homes[slots[s]] = static_cast<int>(s);
+            }
+        }
+    }
+
+    bool changed = block.slots_out != slots;
+    block.slots_out = slots;
+    return changed;
+}
+
+void ir_func::find_exprs(ir_block& block)
+{
+    // the instruction that pushed each value on the stack, or npos for
+    // the ones already there when the block is entered
+    vector<size_t> stack(block.stack_in,npos);
+    for(size_t n = 0; n < block.code.size(); ++n)
+    {
+        ir_instr& instr = block.code[n];
+        size_t pops = instr.args.size();
+        vector<size_t> producers(stack.end() - pops,stack.end());
+        stack.resize(stack.size() - pops);
+
+        instr.first = n;
+        instr.consumer = npos;
+        instr.pure = is_pure_op(instr.op);
+        instr.safe = !can_fail(
+            instr.op,
+            pops > 0 ? instr.args[0] : 0,
+            pops > 1 ? instr.args[1] : 0
+            );
+        // first..n is pure if its args come one after the other, each
+        // computed by a pure expression, right before n
+        size_t next = n;
+        for(size_t i = pops; i-- > 0; )
+        {
+            size_t producer = producers[i];
+            if(producer == npos || producer + 1 != next || !block.code[producer].pure)
+            {
+                instr.pure = false;
+                break;
+            }
+            instr.safe = instr.safe && block.code[producer].safe;
+            next = block.code[producer].first;
+        }
+        if(instr.pure)
+            instr.first = next;
+        instr.safe = instr.safe && instr.pure;
+        for(size_t i = 0; i < pops; ++i)
+        {
+            if(producers[i] != npos)
+                block.code[producers[i]].consumer = n;
+        }
+
+        if(instr.result != 0)
+            stack.push_back(n);
+    }
+}
+
+void ir_func::analyze()
+{
+    find_blocks();
+    find_dominators();
+
+    // the value of every slot at the start and end of every block. A
+    // block starts with the value its predecessors agree on for a slot,
+    // or a phi if they don't. Blocks are run until the values settle.
+    vector<bool> done(blocks.size(),false);
+    for(size_t pass = 0; pass < max_ssa_passes; ++pass)
+    {
+        bool changed = false;
+        for(size_t i = 0; i < order.size(); ++i)
+        {
+            size_t b = order[i];
+            ir_block& block = blocks[b];
+            vector<ir_value> slots(slot_count);
+            for(size_t s = 0; s < slot_count; ++s)
+            {
+                if(b == 0)
+                {
+                    slots[s] = get_value(ir_def(ir_def::initial,0,s),0);
+                    if(m_homes[slots[s]] < 0)
+                        m_homes[slots[s]] = static_cast<int>(s);
+                    continue;
+                }
+                ir_value phi = get_value(ir_def(ir_def::phi,block.uid,s),b);
+                if(m_homes[phi] < 0)
+                    m_homes[phi] = static_cast<int>(s);
+                ir_value agreed = 0;
+                bool agree = true;
+                for(size_t p = 0; p < block.preds.size(); ++p)
+                {
+                    size_t pred = block.preds[p];
+                    if(!done[pred] || blocks[pred].slots_out.size() <= s)
+                        continue;
+                    ir_value val = blocks[pred].slots_out[s];
+                    if(val == phi || val == agreed)
+                        continue;
+                    if(agreed != 0)
+                        agree = false;
+                    agreed = val;
+                }
+                slots[s] = agree && agreed != 0 ? agreed : phi;
+            }
+            if(run_block(b,slots))
+                changed = true;
+            done[b] = true;
+        }
+        if(!changed)
+            break;
+    }
+
+    for(size_t b = 0; b < blocks.size(); ++b)
+    {
+        if(blocks[b].reachable)
+            find_exprs(blocks[b]);
+    }
+}
+
+void ir_func::insert_block(size_t index)
+{
+    for(size_t b = 0; b < blocks.size(); ++b)
+    {
+        vector<ir_instr>& code = blocks[b].code;
+        for(size_t n = 0; n < code.size(); ++n)
+        {
+            if(is_jump(code[n].op) && code[n].target >= index)
+                ++code[n].target;
+        }
+    }
+    ir_block block;
+    block.uid = m_next_uid++;
+    block.stack_in = blocks[index].stack_in;
+    blocks.insert(blocks.begin() + index,block);
+}
+
+void ir_func::emit(codeblock_t& out,size_t base) const
+{
+    vector<size_t> starts(blocks.size());
+    size_t off = base;
+    for(size_t b = 0; b < blocks.size(); ++b)
+    {
+        starts[b] = off;
+        for(size_t n = 0; n < blocks[b].code.size(); ++n)
+            off += 1 + blocks[b].code[n].operands.size();
+    }
+
+    for(size_t b = 0; b < blocks.size(); ++b)
+    {
+        const vector<ir_instr>& code = blocks[b].code;
+        for(size_t n = 0; n < code.size(); ++n)
+        {
+            // a jump's target comes first, and is all that changes
+            out.push_back(code[n].op);
+            size_t copied = 0;
+            if(is_jump(code[n].op))
+            {
+                out.push_back(starts[code[n].target]);
+                copied = 1;
+            }
+            out.insert(
+                out.end(),
+                code[n].operands.begin() + copied,
+                code[n].operands.end()
+                );
+        }
+    }
+}
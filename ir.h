@@ -0,0 +1,238 @@
+////////////////////////////////////////////////////////////////////////////////
+// DScript Scripting Language
+// Copyright (C) 2003 Bryan "daerid" Ross
+//
+// Permission to copy, use, modify, sell and distribute this software is
+// granted provided this copyright notice appears in all copies. This
+// software is provided "as is" without express or implied warranty, and
+// with no claim as to its suitability for any purpose.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __DSCRIPT_IR_H__
+#define __DSCRIPT_IR_H__
+
+////////////////////////////////////////////////////////////////////////////////
+// Standard Library Includes
+#include <map>
+#include <vector>
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// DScript Includes
+#include "instruction.h"
+////////////////////////////////////////////////////////////////////////////////
+
+namespace dscript
+{
+    /// A value in an ir_func, in SSA form: it is computed in one place, and
+    /// a frame slot assigned in several places holds a different ir_value
+    /// after each. Values are numbered by what computes them, so two pure
+    /// op_codes applied to the same ir_values give the same ir_value. 0 is
+    /// no value.
+    typedef size_t ir_value;
+
+    /// What is known at compile time of the type of an ir_value
+    enum ir_type
+    {
+        ir_unknown,
+        ir_int,
+        ir_flt,
+        ir_str
+    };
+
+    /// How an ir_value is computed. op is a pure op_code applied to lhs
+    /// (and rhs), a constant (op_push_int etc, with the constant in
+    /// operand), or one of the ir_def::kind values for a value only known
+    /// at runtime.
+    struct ir_def
+    {
+        enum kind
+        {
+            // the value of slot lhs when the function is entered
+            initial = -2,
+            // the value of slot lhs when block operand is entered, from
+            // whichever block it was entered from
+            phi = -3,
+            // the value of slot lhs after instruction operand, which can
+            // change any frame slot
+            clobber = -4,
+            // what instruction operand pushes, or stores in its slot
+            opaque = -5,
+            // the value lhs deep in the runtime stack when block operand
+            // is entered
+            stack = -6
+        };
+
+        ir_def(int o = 0,size_t opnd = 0,ir_value l = 0,ir_value r = 0)
+            : op(o), operand(opnd), lhs(l), rhs(r)
+        {}
+
+        bool operator<(const ir_def& other) const
+        {
+            if(op != other.op)
+                return op < other.op;
+            if(operand != other.operand)
+                return operand < other.operand;
+            if(lhs != other.lhs)
+                return lhs < other.lhs;
+            return rhs < other.rhs;
+        }
+
+        int op;
+        size_t operand;
+        ir_value lhs;
+        ir_value rhs;
+    };
+
+    /// An instruction of an ir_func: an op_code and its operands, as in a
+    /// codeblock
+    struct ir_instr
+    {
+        ir_instr(op_code o = op_invalid)
+            : op(o), target(0), uid(0), result(0), slot_out(0),
+              first(0), consumer(0), pure(false), safe(false)
+        {}
+
+        op_code op;
+        // the operands that follow the op_code in a codeblock. The target
+        // of a jump is kept as the index of its block instead.
+        std::vector<instruction> operands;
+        size_t target;
+        // identifies the instruction for as long as the ir_func exists
+        size_t uid;
+
+        // worked out by ir_func::analyze(): the values popped off the
+        // runtime stack (the deepest first), the value pushed, and the
+        // value of the frame slot the instruction assigns, if it does
+        std::vector<ir_value> args;
+        ir_value result;
+        ir_value slot_out;
+        // the instructions first up to this one compute result, and
+        // nothing else, if pure. safe if they can't fail either. consumer
+        // is the instruction that pops result, or npos.
+        size_t first;
+        size_t consumer;
+        bool pure;
+        bool safe;
+    };
+
+    /// A basic block of an ir_func
+    struct ir_block
+    {
+        ir_block() : stack_in(0), idom(0), reachable(false), uid(0) {}
+
+        std::vector<ir_instr> code;
+        // the blocks control goes to next, the next block in the layout
+        // first if control can fall through to it, and the ones it can
+        // come from
+        std::vector<size_t> succs;
+        std::vector<size_t> preds;
+        // the depth of the runtime stack on entry
+        size_t stack_in;
+
+        // worked out by ir_func::analyze(): the value of each frame slot
+        // before each instruction, and at the end of the block
+        std::vector<std::vector<ir_value> > slots;
+        std::vector<ir_value> slots_out;
+        size_t idom;
+        bool reachable;
+        size_t uid;
+    };
+
+    /// The body of a script function as basic blocks in SSA form, built
+    /// from its compiled code and turned back into code once optimized
+    /// (see compiler_ssa.cpp). The blocks are kept in the order the code
+    /// is laid out, so a block falls through to the next one, and the
+    /// last block is always an empty one at the end of the function.
+    class ir_func
+    {
+    public:
+        static const size_t npos = size_t(-1);
+
+        ir_func() : slot_count(0), m_next_uid(1) {}
+
+        /// Builds the IR of the function declared at decl in code. Returns
+        /// false if its body uses something the IR doesn't handle, like a
+        /// nested function declaration.
+        bool build(const codeblock_t& code,size_t decl);
+
+        /// Works out everything ir_instr and ir_block keep about the
+        /// values in the function. This has to be done again after the
+        /// code is changed.
+        void analyze();
+
+        /// Writes out the code of the body. Jump offsets are counted from
+        /// base.
+        void emit(codeblock_t& out,size_t base) const;
+
+        /// Inserts an empty block before block index, which falls through
+        /// to it. Jumps to index are left alone.
+        void insert_block(size_t index);
+
+        /// Gives the function another frame slot. Returns its index.
+        int add_slot() { return static_cast<int>(slot_count++); }
+
+        /// Gives instr a new uid, for an instruction added to the function
+        void set_uid(ir_instr& instr) { instr.uid = m_next_uid++; }
+
+        /// Returns whether block a dominates block b
+        bool dominates(size_t a,size_t b) const;
+
+        const ir_def& get_def(ir_value val) const { return m_defs[val]; }
+        ir_type get_type(ir_value val) const { return m_types[val]; }
+
+        /// Returns the block a runtime value was computed in, for the
+        /// ir_values that aren't constants or pure op_codes
+        size_t get_def_block(ir_value val) const { return m_def_blocks[val]; }
+
+        /// Returns the first frame slot an ir_value was stored in
+        int get_home(ir_value val) const { return m_homes[val]; }
+
+        /// Returns whether a pure op_code, or the compound assignment
+        /// doing it, can fail when applied to lhs and rhs
+        bool can_fail(op_code op,ir_value lhs,ir_value rhs) const;
+
+        /// Returns the frame slot a slot op_code works on, or -1
+        static int get_slot(const ir_instr& instr);
+
+        std::vector<ir_block> blocks;
+        // the blocks in reverse post order
+        std::vector<size_t> order;
+        size_t slot_count;
+
+    private:
+        ir_value get_value(const ir_def& def,size_t block);
+        void find_blocks();
+        void find_dominators();
+        bool run_block(size_t b,std::vector<ir_value>& slots);
+        void find_exprs(ir_block& block);
+
+        std::map<ir_def,ir_value> m_values;
+        std::vector<ir_def> m_defs;
+        std::vector<ir_type> m_types;
+        std::vector<size_t> m_def_blocks;
+        std::vector<int> m_homes;
+        std::vector<size_t> m_rpo_index;
+        size_t m_next_uid;
+    };
+
+    /// Returns whether an op_code computes a value from what it pops and
+    /// its operands alone, without doing anything else
+    bool is_pure_op(op_code op);
+
+    /// Returns whether op stops any frame slot from being known across
+    /// it: host calls, and accesses to variables by a name that may be a
+    /// %local, can read and change any of them
+    bool is_slot_barrier(const ir_instr& instr);
+
+    /// Returns the number of values an instruction pops off the runtime
+    /// stack, and pushes, when it doesn't jump. Returns false for an
+    /// op_code the IR doesn't handle.
+    bool get_stack_effect(
+        const ir_instr& instr,
+        size_t& pops,
+        size_t& pushes
+        );
+}
+
+#endif//__DSCRIPT_IR_H__
@@ -0,0 +1,1034 @@
+////////////////////////////////////////////////////////////////////////////////
+// DScript Scripting Language
+// Copyright (C) 2003 Bryan "daerid" Ross
+//
+// Permission to copy, use, modify, sell and distribute this software is
+// granted provided this copyright notice appears in all copies. This
+// software is provided "as is" without express or implied warranty, and
+// with no claim as to its suitability for any purpose.
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// DScript Includes
+#include "jit.h"
+#include "vmachine.h"
+////////////////////////////////////////////////////////////////////////////////
+
+#ifdef DSCRIPT_HAS_JIT
+
+////////////////////////////////////////////////////////////////////////////////
+// Standard Library Includes
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <vector>
+#include <sys/mman.h>
+#include <unistd.h>
+////////////////////////////////////////////////////////////////////////////////
+
+using namespace std;
+using namespace dscript;
+
+namespace
+{
+    // the x86-64 registers the JIT uses, numbered the way they are encoded
+    enum reg_t
+    {
+        rax = 0,
+        rcx = 1,
+        rdx = 2,
+        rbx = 3,
+        rsp = 4,
+        rsi = 6,
+        rdi = 7,
+        r12 = 12,
+        r13 = 13,
+        r14 = 14,
+        r15 = 15
+    };
+
+    // the sse registers
+    enum xmm_t
+    {
+        xmm0 = 0
+    };
+
+    // the condition codes of jcc and setcc
+    enum cond_t
+    {
+        cc_ae = 0x3,
+        cc_e = 0x4,
+        cc_ne = 0x5,
+        cc_a = 0x7,
+        cc_p = 0xa,
+        cc_np = 0xb,
+        cc_l = 0xc,
+        cc_ge = 0xd,
+        cc_le = 0xe,
+        cc_g = 0xf
+    };
+
+    /// A memory operand, [base + disp]
+    struct mem_t
+    {
+        mem_t(int b,int d) : base(b), disp(d) {}
+        mem_t offset(int off) const { return mem_t(base,disp + off); }
+        int base;
+        int disp;
+    };
+
+    /// Writes x86-64 machine code. Only knows the few instruction forms
+    /// the translator needs. Jumps go to labels, which are patched once
+    /// all of the code has been written.
+    class assembler
+    {
+    public:
+        int new_label()
+        {
+            m_labels.push_back(-1);
+            return static_cast<int>(m_labels.size()) - 1;
+        }
+        void bind(int label) { m_labels[label] = m_code.size(); }
+
+        /// An op_code with a register and a memory operand. An opcode
+        /// above 0xff is a two byte one, prefix is 0 for none.
+        void op_mem(
+            unsigned int prefix,
+            bool wide,
+            unsigned int opcode,
+            int reg,
+            const mem_t& mem
+            )
+        {
+            if(prefix != 0)
+                byte(prefix);
+            rex(wide,reg,mem.base);
+            opcode_bytes(opcode);
+            // always a 32 bit displacement, r12 needs a sib byte
+            byte(0x80 | ((reg & 7) << 3) | (mem.base & 7));
+            if((mem.base & 7) == rsp)
+                byte(0x24);
+            dword(mem.disp);
+        }
+
+        /// An op_code with two register operands
+        void op_reg(bool wide,unsigned int opcode,int reg,int rm)
+        {
+            rex(wide,reg,rm);
+            opcode_bytes(opcode);
+            byte(0xc0 | ((reg & 7) << 3) | (rm & 7));
+        }
+
+        void mov_imm(int reg,size_t imm)
+        {
+            rex(true,0,reg);
+            byte(0xb8 + (reg & 7));
+            qword(imm);
+        }
+        void mov(int dst,int src) { op_reg(true,0x89,src,dst); }
+        void load(int reg,const mem_t& mem) { op_mem(0,true,0x8b,reg,mem); }
+        void store(const mem_t& mem,int reg) { op_mem(0,true,0x89,reg,mem); }
+        void load32(int reg,const mem_t& mem) { op_mem(0,false,0x8b,reg,mem); }
+        void store32(const mem_t& mem,int reg) { op_mem(0,false,0x89,reg,mem); }
+        void store32_imm(const mem_t& mem,int imm)
+        {
+            op_mem(0,false,0xc7,0,mem);
+            dword(imm);
+        }
+        void cmp32_imm(const mem_t& mem,int imm)
+        {
+            op_mem(0,false,0x81,7,mem);
+            dword(imm);
+        }
+        void cmp_imm(const mem_t& mem,int imm)
+        {
+            op_mem(0,true,0x81,7,mem);
+            dword(imm);
+        }
+        void cmp32_reg_imm(int reg,int imm)
+        {
+            op_reg(false,0x81,7,reg);
+            dword(imm);
+        }
+        void add_imm(int reg,int imm)
+        {
+            op_reg(true,0x81,0,reg);
+            dword(imm);
+        }
+        void sub_imm(int reg,int imm)
+        {
+            op_reg(true,0x81,5,reg);
+            dword(imm);
+        }
+        void test32(int reg) { op_reg(false,0x85,reg,reg); }
+        void zero32(int reg) { op_reg(false,0x31,reg,reg); }
+        void setcc(cond_t cc,int reg) { op_reg(false,0x0f90 + cc,0,reg); }
+        void movzx8(int reg) { op_reg(false,0x0fb6,reg,reg); }
+        void cdq() { byte(0x99); }
+        void idiv32(int reg) { op_reg(false,0xf7,7,reg); }
+        void call(int reg) { op_reg(false,0xff,2,reg); }
+        void ret() { byte(0xc3); }
+
+        void push(int reg)
+        {
+            if(reg & 8)
+                byte(0x41);
+            byte(0x50 + (reg & 7));
+        }
+        void pop(int reg)
+        {
+            if(reg & 8)
+                byte(0x41);
+            byte(0x58 + (reg & 7));
+        }
+
+        void jmp(int label)
+        {
+            byte(0xe9);
+            fixup(label);
+        }
+        void jcc(cond_t cc,int label)
+        {
+            byte(0x0f);
+            byte(0x80 + cc);
+            fixup(label);
+        }
+
+        /// Patches the jumps, and returns the code
+        const vector<unsigned char>& finish()
+        {
+            for(size_t i = 0; i < m_fixups.size(); ++i)
+            {
+                size_t at = m_fixups[i].first;
+                int rel = static_cast<int>(
+                    m_labels[m_fixups[i].second] - (at + 4)
+                    );
+                memcpy(&m_code[at],&rel,4);
+            }
+            return m_code;
+        }
+
+    private:
+        void byte(unsigned int b)
+        {
+            m_code.push_back(static_cast<unsigned char>(b));
+        }
+        void dword(int d)
+        {
+            unsigned char bytes[4];
+            memcpy(bytes,&d,4);
+            m_code.insert(m_code.end(),bytes,bytes + 4);
+        }
+        void qword(size_t q)
+        {
+            unsigned char bytes[8];
+            memcpy(bytes,&q,8);
+            m_code.insert(m_code.end(),bytes,bytes + 8);
+        }
+        void opcode_bytes(unsigned int opcode)
+        {
+            if(opcode > 0xff)
+                byte(opcode >> 8);
+            byte(opcode & 0xff);
+        }
+        void rex(bool wide,int reg,int rm)
+        {
+            unsigned int prefix = 0x40;
+            if(wide)
+                prefix |= 8;
+            if(reg & 8)
+                prefix |= 4;
+            if(rm & 8)
+                prefix |= 1;
+            if(prefix != 0x40)
+                byte(prefix);
+        }
+        void fixup(int label)
+        {
+            m_fixups.push_back(make_pair(m_code.size(),label));
+            dword(0);
+        }
+
+        vector<unsigned char> m_code;
+        vector<size_t> m_labels;
+        vector<pair<size_t,int> > m_fixups;
+    };
+
+    // The sse op_codes of the float fast paths
+    const unsigned int sse_load = 0x0f10;
+    const unsigned int sse_store = 0x0f11;
+    const unsigned int sse_add = 0x0f58;
+    const unsigned int sse_mul = 0x0f59;
+    const unsigned int sse_sub = 0x0f5c;
+    const unsigned int sse_div = 0x0f5e;
+
+    /// Translates the code of one script function.
+    ///
+    /// The native code keeps the vmachine in rbx, the context in r15,
+    /// the frame slots in r12, the runtime stack in r13 and its m_end
+    /// in r14. m_end is written back before anything that looks at the
+    /// stack from C++, and read again afterwards.
+    class translator
+    {
+    public:
+        translator(
+            const func_table::entry& func,
+            value_stack& stack,
+            const void* run_op,
+            const void* get_locals
+            )
+            : m_func(func),
+              m_base(&*func.begin),
+              m_stack(reinterpret_cast<size_t>(&stack)),
+              m_run_op(reinterpret_cast<size_t>(run_op)),
+              m_get_locals(reinterpret_cast<size_t>(get_locals))
+        {
+            value val;
+            const char* addr = reinterpret_cast<const char*>(&val);
+            m_type = reinterpret_cast<const char*>(&val.type) - addr;
+            m_data = reinterpret_cast<const char*>(&val.intval) - addr;
+            addr = reinterpret_cast<const char*>(&stack);
+            m_end = reinterpret_cast<const char*>(&stack.m_end) - addr;
+            m_limit = reinterpret_cast<const char*>(&stack.m_limit) - addr;
+        }
+
+        /// Returns false if the function can't be translated
+        bool translate();
+
+        const vector<unsigned char>& get_code() { return m_asm.finish(); }
+
+    private:
+        size_t offset_of(instr_iter instr) const { return instr - m_func.begin; }
+
+        /// Returns the label of the instruction at off, or -1 if off
+        /// isn't the start of an instruction of the function
+        int label_at(size_t off) const
+        {
+            if(off < m_start || off > m_stop)
+                return -1;
+            return m_labels[off - m_start];
+        }
+
+        // the values on the runtime stack, 0 being the top, and the
+        // frame slots
+        mem_t stack(int depth) const
+        {
+            return mem_t(r14,-static_cast<int>(sizeof(value)) * (depth + 1));
+        }
+        mem_t local(int slot) const
+        {
+            return mem_t(r12,static_cast<int>(sizeof(value)) * slot);
+        }
+        mem_t type(const mem_t& val) const { return val.offset(m_type); }
+        mem_t data(const mem_t& val) const { return val.offset(m_data); }
+
+        void emit_prologue();
+        void emit_exit(const instruction* instr);
+        void emit_op(size_t off);
+        void emit_call(const instruction* instr,bool call_op);
+        void emit_push_guard(int slow);
+        void emit_number_guard(const mem_t& val,int fail);
+        void emit_arith(op_code op,const mem_t& lhs,int slow);
+        void emit_compare(op_code op,int slow);
+
+        assembler m_asm;
+        const func_table::entry& m_func;
+        const instruction* m_base;
+        size_t m_stack;
+        size_t m_run_op;
+        size_t m_get_locals;
+        int m_type;
+        int m_data;
+        int m_end;
+        int m_limit;
+
+        // the function's code is [m_start,m_stop), each instruction
+        // boundary of it has a label, the others are -1
+        size_t m_start;
+        size_t m_stop;
+        vector<int> m_labels;
+        int m_error;
+        int m_epilogue;
+    };
+
+    bool translator::translate()
+    {
+        if(sizeof(value) != 16 || sizeof(value::ty) != 4)
+            return false;
+
+        // find the instruction boundaries, and make sure every op_code is
+        // a valid one
+        m_start = offset_of(m_func.start);
+        m_stop = offset_of(m_func.end);
+        m_labels.assign(m_stop - m_start + 1,-1);
+        instr_iter instr = m_func.start;
+        while(instr < m_func.end)
+        {
+            op_code op = instr->get_op_code();
+            if(op < 0 || op >= op_count)
+                return false;
+            m_labels[offset_of(instr) - m_start] = m_asm.new_label();
+            instr += get_instr_size(instr);
+        }
+        if(instr != m_func.end)
+            return false;
+        m_labels.back() = m_asm.new_label();
+        m_error = m_asm.new_label();
+        m_epilogue = m_asm.new_label();
+
+        // every jump has to land on an instruction of the function
+        for(instr = m_func.start; instr < m_func.end; instr += get_instr_size(instr))
+        {
+            const char* operands = get_op_operands(instr->get_op_code());
+            for(size_t i = 0; operands[i] != '\0'; ++i)
+            {
+                if(operands[i] == 'o' && label_at(instr[i + 1].get_int()) < 0)
+                    return false;
+            }
+        }
+
+        emit_prologue();
+        for(instr = m_func.start; instr < m_func.end; instr += get_instr_size(instr))
+            emit_op(offset_of(instr));
+
+        // running off the end returns
+        m_asm.bind(m_labels.back());
+        emit_exit(m_base + m_stop);
+
+        m_asm.bind(m_error);
+        m_asm.zero32(rax);
+        m_asm.bind(m_epilogue);
+        m_asm.pop(r15);
+        m_asm.pop(r14);
+        m_asm.pop(r13);
+        m_asm.pop(r12);
+        m_asm.pop(rbx);
+        m_asm.ret();
+        return true;
+    }
+
+    void translator::emit_prologue()
+    {
+        // five pushes leave the stack aligned for calls
+        m_asm.push(rbx);
+        m_asm.push(r12);
+        m_asm.push(r13);
+        m_asm.push(r14);
+        m_asm.push(r15);
+        m_asm.mov(rbx,rdi);
+        m_asm.mov(r15,rsi);
+        m_asm.mov(r12,rdx);
+        m_asm.mov_imm(r13,m_stack);
+        m_asm.load(r14,mem_t(r13,m_end));
+    }
+
+    void translator::emit_exit(const instruction* instr)
+    {
+        // hand instr back to the interpreter
+        m_asm.store(mem_t(r13,m_end),r14);
+        m_asm.mov_imm(rax,reinterpret_cast<size_t>(instr));
+        m_asm.jmp(m_epilogue);
+    }
+
+    void translator::emit_call(const instruction* instr,bool call_op)
+    {
+        m_asm.store(mem_t(r13,m_end),r14);
+        m_asm.mov(rdi,rbx);
+        m_asm.mov(rsi,r15);
+        m_asm.mov_imm(rdx,reinterpret_cast<size_t>(instr));
+        m_asm.mov_imm(rax,m_run_op);
+        m_asm.call(rax);
+        m_asm.cmp32_reg_imm(rax,-1);
+        m_asm.jcc(cc_e,m_error);
+        m_asm.load(r14,mem_t(r13,m_end));
+        if(call_op)
+        {
+            // the call may have moved the frame slots
+            m_asm.mov(rdi,rbx);
+            m_asm.mov_imm(rax,m_get_locals);
+            m_asm.call(rax);
+            m_asm.mov(r12,rax);
+        }
+    }
+
+    void translator::emit_push_guard(int slow)
+    {
+        // the stack has to have room for one more, which the vmachine
+        // reserved when it entered the frame unless it checks the stack
+        // (see value_stack)
+#ifdef DSCRIPT_CHECKED_STACK
+        m_asm.op_mem(0,true,0x3b,r14,mem_t(r13,m_limit));
+        m_asm.jcc(cc_ae,slow);
+#endif
+    }
+
+    void translator::emit_number_guard(const mem_t& val,int fail)
+    {
+        int ok = m_asm.new_label();
+        m_asm.cmp32_imm(type(val),value::type_int);
+        m_asm.jcc(cc_e,ok);
+        m_asm.cmp32_imm(type(val),value::type_flt);
+        m_asm.jcc(cc_ne,fail);
+        m_asm.bind(ok);
+    }
+
+    void translator::emit_arith(op_code op,const mem_t& lhs,int slow)
+    {
+        // lhs op= the top of the stack, for two ints or two floats,
+        // then pop the top
+        mem_t rhs = stack(0);
+        int floats = m_asm.new_label();
+        int done = m_asm.new_label();
+
+        m_asm.cmp32_imm(type(rhs),value::type_int);
+        m_asm.jcc(cc_ne,floats);
+        m_asm.cmp32_imm(type(lhs),value::type_int);
+        m_asm.jcc(cc_ne,slow);
+        if(op == op_div || op == op_mod)
+        {
+            // leave division by 0, and INT_MIN / -1, to the vmachine
+            m_asm.load32(rcx,data(rhs));
+            m_asm.test32(rcx);
+            m_asm.jcc(cc_e,slow);
+            m_asm.cmp32_reg_imm(rcx,-1);
+            m_asm.jcc(cc_e,slow);
+            m_asm.load32(rax,data(lhs));
+            m_asm.cdq();
+            m_asm.idiv32(rcx);
+            m_asm.store32(data(lhs),op == op_div ? rax : rdx);
+        }
+        else
+        {
+            m_asm.load32(rax,data(lhs));
+            if(op == op_add)
+                m_asm.op_mem(0,false,0x03,rax,data(rhs));
+            else if(op == op_sub)
+                m_asm.op_mem(0,false,0x2b,rax,data(rhs));
+            else
+                m_asm.op_mem(0,false,0x0faf,rax,data(rhs));
+            m_asm.store32(data(lhs),rax);
+        }
+        m_asm.jmp(done);
+
+        m_asm.bind(floats);
+        if(op == op_mod)
+            m_asm.jmp(slow);
+        else
+        {
+            m_asm.cmp32_imm(type(rhs),value::type_flt);
+            m_asm.jcc(cc_ne,slow);
+            m_asm.cmp32_imm(type(lhs),value::type_flt);
+            m_asm.jcc(cc_ne,slow);
+            unsigned int sse_op =
+                op == op_add ? sse_add :
+                op == op_sub ? sse_sub :
+                op == op_mul ? sse_mul : sse_div;
+            m_asm.op_mem(0xf2,false,sse_load,xmm0,data(lhs));
+            m_asm.op_mem(0xf2,false,sse_op,xmm0,data(rhs));
+            m_asm.op_mem(0xf2,false,sse_store,xmm0,data(lhs));
+        }
+
+        m_asm.bind(done);
+        m_asm.sub_imm(r14,sizeof(value));
+    }
+
+    void translator::emit_compare(op_code op,int slow)
+    {
+        // leaves the result of comparing the two values on top of the
+        // stack in eax, for two ints or two floats
+        mem_t lhs = stack(1);
+        mem_t rhs = stack(0);
+        int floats = m_asm.new_label();
+        int done = m_asm.new_label();
+
+        cond_t int_cc;
+        cond_t flt_cc;
+        bool swap = false;
+        switch(op)
+        {
+        case op_cmp_less_eq:
+            int_cc = cc_le;
+            flt_cc = cc_ae;
+            swap = true;
+            break;
+        case op_cmp_less:
+            int_cc = cc_l;
+            flt_cc = cc_a;
+            swap = true;
+            break;
+        case op_cmp_grtr_eq:
+            int_cc = cc_ge;
+            flt_cc = cc_ae;
+            break;
+        case op_cmp_grtr:
+            int_cc = cc_g;
+            flt_cc = cc_a;
+            break;
+        case op_eq:
+            int_cc = flt_cc = cc_e;
+            break;
+        default:
+            int_cc = flt_cc = cc_ne;
+            break;
+        }
+
+        m_asm.cmp32_imm(type(rhs),value::type_int);
+        m_asm.jcc(cc_ne,floats);
+        m_asm.cmp32_imm(type(lhs),value::type_int);
+        m_asm.jcc(cc_ne,slow);
+        m_asm.load32(rax,data(lhs));
+        m_asm.op_mem(0,false,0x3b,rax,data(rhs));
+        m_asm.setcc(int_cc,rax);
+        m_asm.jmp(done);
+
+        // ucomisd sets the flags like an unsigned compare, and sets pf
+        // too if either is NaN, which only == and != have to look at
+        m_asm.bind(floats);
+        m_asm.cmp32_imm(type(rhs),value::type_flt);
+        m_asm.jcc(cc_ne,slow);
+        m_asm.cmp32_imm(type(lhs),value::type_flt);
+        m_asm.jcc(cc_ne,slow);
+        m_asm.op_mem(0xf2,false,sse_load,xmm0,data(swap ? rhs : lhs));
+        m_asm.op_mem(0x66,false,0x0f2e,xmm0,data(swap ? lhs : rhs));
+        m_asm.setcc(flt_cc,rax);
+        if(op == op_eq)
+        {
+            m_asm.setcc(cc_np,rcx);
+            m_asm.op_reg(false,0x20,rcx,rax);
+        }
+        else if(op == op_neq)
+        {
+            m_asm.setcc(cc_p,rcx);
+            m_asm.op_reg(false,0x08,rcx,rax);
+        }
+
+        m_asm.bind(done);
+        m_asm.movzx8(rax);
+    }
+
+    /// Returns the generic form of a quickened or fused op_code
+    op_code get_generic_op(op_code op)
+    {
+        switch(op)
+        {
+        case op_mul_ii: case op_mul_ff: case op_mul_asn_local:
+            return op_mul;
+        case op_div_ii: case op_div_ff:
+            return op_div;
+        case op_add_ii: case op_add_ff: case op_add_asn_local:
+            return op_add;
+        case op_sub_ii: case op_sub_ff: case op_sub_asn_local:
+            return op_sub;
+        case op_cmp_less_eq_ii: case op_cmp_less_eq_ff:
+        case op_cmp_less_eq_jmp_false:
+            return op_cmp_less_eq;
+        case op_cmp_less_ii: case op_cmp_less_ff:
+        case op_cmp_less_jmp_false:
+            return op_cmp_less;
+        case op_cmp_grtr_eq_ii: case op_cmp_grtr_eq_ff:
+        case op_cmp_grtr_eq_jmp_false:
+            return op_cmp_grtr_eq;
+        case op_cmp_grtr_ii: case op_cmp_grtr_ff:
+        case op_cmp_grtr_jmp_false:
+            return op_cmp_grtr;
+        case op_eq_ii: case op_eq_ff: case op_eq_jmp_false:
+            return op_eq;
+        case op_neq_ii: case op_neq_ff: case op_neq_jmp_false:
+            return op_neq;
+        default:
+            return op;
+        }
+    }
+
+    void translator::emit_op(size_t off)
+    {
+        const instruction* instr = m_base + off;
+        op_code op = instr->get_op_code();
+        m_asm.bind(m_labels[off - m_start]);
+
+        if(is_interpreter_only(op))
+        {
+            emit_exit(instr);
+            return;
+        }
+
+        int slow = m_asm.new_label();
+        int done = m_asm.new_label();
+        switch(op)
+        {
+        case op_jmp:
+            m_asm.jmp(label_at(instr[1].get_int()));
+            return;
+
+        case op_return:
+            emit_exit(m_base + m_stop);
+            return;
+
+        case op_return_value:
+            // the vmachine stores the return value
+            emit_call(instr,false);
+            emit_exit(m_base + m_stop);
+            return;
+
+        case op_call_func:
+        case op_call_load_ret:
+            emit_call(instr,true);
+            return;
+
+        case op_push_int:
+            emit_push_guard(slow);
+            m_asm.store32_imm(type(mem_t(r14,0)),value::type_int);
+            m_asm.store32_imm(data(mem_t(r14,0)),instr[1].get_int());
+            m_asm.add_imm(r14,sizeof(value));
+            m_asm.jmp(done);
+            break;
+
+        case op_push_float:
+            {
+                size_t bits;
+                memcpy(&bits,instr[1].get_flt(),sizeof(bits));
+                emit_push_guard(slow);
+                m_asm.store32_imm(type(mem_t(r14,0)),value::type_flt);
+                m_asm.mov_imm(rax,bits);
+                m_asm.store(data(mem_t(r14,0)),rax);
+                m_asm.add_imm(r14,sizeof(value));
+                m_asm.jmp(done);
+            }
+            break;
+
+        case op_push_local:
+            {
+                // only numbers can be copied without touching a refcount
+                mem_t var = local(instr[1].get_int());
+                emit_number_guard(var,slow);
+                emit_push_guard(slow);
+                m_asm.op_mem(0xf3,false,0x0f6f,xmm0,var);
+                m_asm.op_mem(0xf3,false,0x0f7f,xmm0,mem_t(r14,0));
+                m_asm.add_imm(r14,sizeof(value));
+                m_asm.jmp(done);
+            }
+            break;
+
+        case op_assign_local:
+            {
+                // a number can replace a number or an empty string
+                mem_t var = local(instr[1].get_int());
+                int ok = m_asm.new_label();
+                emit_number_guard(stack(0),slow);
+                m_asm.cmp32_imm(type(var),value::type_int);
+                m_asm.jcc(cc_e,ok);
+                m_asm.cmp32_imm(type(var),value::type_flt);
+                m_asm.jcc(cc_e,ok);
+                m_asm.cmp32_imm(type(var),value::type_str);
+                m_asm.jcc(cc_ne,slow);
+                m_asm.cmp_imm(data(var),0);
+                m_asm.jcc(cc_ne,slow);
+                m_asm.bind(ok);
+                m_asm.op_mem(0xf3,false,0x0f6f,xmm0,stack(0));
+                m_asm.op_mem(0xf3,false,0x0f7f,xmm0,var);
+                m_asm.sub_imm(r14,sizeof(value));
+                m_asm.jmp(done);
+            }
+            break;
+
+        case op_inc_local:
+        case op_dec_local:
+            {
+                mem_t var = local(instr[1].get_int());
+                m_asm.cmp32_imm(type(var),value::type_int);
+                m_asm.jcc(cc_ne,slow);
+                m_asm.op_mem(0,false,0xff,op == op_inc_local ? 0 : 1,data(var));
+                m_asm.jmp(done);
+            }
+            break;
+
+        case op_mul: case op_mul_ii: case op_mul_ff:
+        case op_div: case op_div_ii: case op_div_ff:
+        case op_add: case op_add_ii: case op_add_ff:
+        case op_sub: case op_sub_ii: case op_sub_ff:
+        case op_mod:
+            emit_arith(get_generic_op(op),stack(1),slow);
+            m_asm.jmp(done);
+            break;
+
+        case op_mul_asn_local:
+        case op_add_asn_local:
+        case op_sub_asn_local:
+            emit_arith(get_generic_op(op),local(instr[1].get_int()),slow);
+            m_asm.jmp(done);
+            break;
+
+        case op_cmp_less_eq: case op_cmp_less_eq_ii: case op_cmp_less_eq_ff:
+        case op_cmp_less: case op_cmp_less_ii: case op_cmp_less_ff:
+        case op_cmp_grtr_eq: case op_cmp_grtr_eq_ii: case op_cmp_grtr_eq_ff:
+        case op_cmp_grtr: case op_cmp_grtr_ii: case op_cmp_grtr_ff:
+        case op_eq: case op_eq_ii: case op_eq_ff:
+        case op_neq: case op_neq_ii: case op_neq_ff:
+            emit_compare(get_generic_op(op),slow);
+            m_asm.store32_imm(type(stack(1)),value::type_int);
+            m_asm.store32(data(stack(1)),rax);
+            m_asm.sub_imm(r14,sizeof(value));
+            m_asm.jmp(done);
+            break;
+
+        case op_cmp_less_eq_jmp_false:
+        case op_cmp_less_jmp_false:
+        case op_cmp_grtr_eq_jmp_false:
+        case op_cmp_grtr_jmp_false:
+        case op_eq_jmp_false:
+        case op_neq_jmp_false:
+            {
+                int target = label_at(instr[1].get_int());
+                emit_compare(get_generic_op(op),slow);
+                m_asm.sub_imm(r14,2 * sizeof(value));
+                m_asm.test32(rax);
+                m_asm.jcc(cc_e,target);
+                m_asm.jmp(done);
+
+                // the vmachine pops, and says whether to jump
+                m_asm.bind(slow);
+                emit_call(instr,false);
+                m_asm.test32(rax);
+                m_asm.jcc(cc_ne,target);
+                m_asm.bind(done);
+            }
+            return;
+
+        case op_inline_guard:
+            // the vmachine says whether to jump to the call
+            emit_call(instr,false);
+            m_asm.test32(rax);
+            m_asm.jcc(cc_ne,label_at(instr[1].get_int()));
+            return;
+
+        case op_jmp_false:
+        case op_jmp_false_peek:
+        case op_jmp_true_peek:
+            {
+                int target = label_at(instr[1].get_int());
+                m_asm.cmp32_imm(type(stack(0)),value::type_int);
+                m_asm.jcc(cc_ne,slow);
+                m_asm.load32(rax,data(stack(0)));
+                if(op == op_jmp_false)
+                {
+                    m_asm.sub_imm(r14,sizeof(value));
+                    m_asm.test32(rax);
+                    m_asm.jcc(cc_e,target);
+                }
+                else
+                {
+                    // the peek jumps pop only if they don't jump
+                    m_asm.test32(rax);
+                    m_asm.jcc(op == op_jmp_false_peek ? cc_e : cc_ne,target);
+                    m_asm.sub_imm(r14,sizeof(value));
+                }
+                m_asm.jmp(done);
+
+                m_asm.bind(slow);
+                emit_call(instr,false);
+                m_asm.test32(rax);
+                m_asm.jcc(cc_ne,target);
+                m_asm.bind(done);
+            }
+            return;
+
+        case op_bool:
+            m_asm.cmp32_imm(type(stack(0)),value::type_int);
+            m_asm.jcc(cc_ne,slow);
+            m_asm.load32(rax,data(stack(0)));
+            m_asm.test32(rax);
+            m_asm.setcc(cc_ne,rax);
+            m_asm.movzx8(rax);
+            m_asm.store32(data(stack(0)),rax);
+            m_asm.jmp(done);
+            break;
+
+        default:
+            // everything else is done by the vmachine
+            emit_call(instr,false);
+            return;
+        }
+
+        m_asm.bind(slow);
+        emit_call(instr,false);
+        m_asm.bind(done);
+    }
+}
+
+namespace
+{
+    // compiled functions are packed into chunks of at least this many
+    // bytes, each function starting on a code_align boundary
+    const size_t chunk_bytes = 64 * 1024;
+    const size_t code_align = 16;
+
+    /// Adds the region [offset,offset + size) to the free regions of a
+    /// chunk, joined with the free regions on either side of it
+    void free_region(map<size_t,size_t>& free,size_t offset,size_t size)
+    {
+        map<size_t,size_t>::iterator next = free.lower_bound(offset);
+        if(next != free.end() && offset + size == next->first)
+        {
+            size += next->second;
+            free.erase(next++);
+        }
+        if(next != free.begin())
+        {
+            map<size_t,size_t>::iterator prev = next;
+            --prev;
+            if(prev->first + prev->second == offset)
+            {
+                prev->second += size;
+                return;
+            }
+        }
+        free.insert(next,make_pair(offset,size));
+    }
+}
+
+jit::~jit()
+{
+    for(size_t i = 0; i < m_chunks.size(); ++i)
+        munmap(m_chunks[i].base,m_chunks[i].size);
+}
+
+bool jit::available()
+{
+    return true;
+}
+
+int jit::run_op(vmachine* vm,context* ctx,const instruction* instr)
+{
+    return vm->jit_op(*ctx,instr);
+}
+
+value* jit::get_locals(vmachine* vm)
+{
+    return vm->native_locals();
+}
+
+native_code jit::compile(const func_table::entry& func,vmachine& vm)
+{
+    translator trans(
+        func,
+        vm.m_runtime_stack,
+        reinterpret_cast<const void*>(&jit::run_op),
+        reinterpret_cast<const void*>(&jit::get_locals)
+        );
+    if(!trans.translate())
+        return 0;
+    return reinterpret_cast<native_code>(write_code(trans.get_code()));
+}
+
+void jit::release(native_code code)
+{
+    map<const void*,size_t>::iterator found =
+        m_sizes.find(reinterpret_cast<const void*>(code));
+    if(found == m_sizes.end())
+        return;
+    const char* mem = static_cast<const char*>(found->first);
+    for(size_t c = 0; c < m_chunks.size(); ++c)
+    {
+        chunk& ch = m_chunks[c];
+        if(mem < ch.base || mem >= ch.base + ch.size)
+            continue;
+        free_region(ch.free,mem - ch.base,found->second);
+        // a chunk nothing uses anymore is unmapped, unless it's the
+        // only one
+        if(
+            m_chunks.size() > 1 &&
+            ch.free.size() == 1 &&
+            ch.free.begin()->second == ch.size
+            )
+        {
+            munmap(ch.base,ch.size);
+            m_chunks.erase(m_chunks.begin() + c);
+        }
+        break;
+    }
+    m_sizes.erase(found);
+}
+
+void* jit::write_code(const vector<unsigned char>& code)
+{
+    size_t size = (code.size() + code_align - 1) / code_align * code_align;
+    size_t page = sysconf(_SC_PAGESIZE);
+
+    // the first free region with room for it
+    size_t c = 0;
+    map<size_t,size_t>::iterator region;
+    for(; c < m_chunks.size(); ++c)
+    {
+        region = m_chunks[c].free.begin();
+        while(region != m_chunks[c].free.end() && region->second < size)
+            ++region;
+        if(region != m_chunks[c].free.end())
+            break;
+    }
+    if(c == m_chunks.size())
+    {
+        chunk fresh;
+        fresh.size = (max(size,chunk_bytes) + page - 1) / page * page;
+        void* mem = mmap(
+            0,
+            fresh.size,
+            PROT_READ | PROT_EXEC,
+            MAP_PRIVATE | MAP_ANONYMOUS,
+            -1,
+            0
+            );
+        if(mem == MAP_FAILED)
+            return 0;
+        fresh.base = static_cast<char*>(mem);
+        fresh.free[0] = fresh.size;
+        m_chunks.push_back(fresh);
+        region = m_chunks.back().free.begin();
+    }
+    chunk& ch = m_chunks[c];
+    size_t offset = region->first;
+    if(region->second > size)
+        ch.free[offset + size] = region->second - size;
+    ch.free.erase(region);
+
+    // the pages the code goes in are only writable while it is written,
+    // which is never while the functions sharing them run
+    char* first = ch.base + offset / page * page;
+    char* last = ch.base + (offset + size + page - 1) / page * page;
+    if(mprotect(first,last - first,PROT_READ | PROT_WRITE) != 0)
+    {
+        free_region(ch.free,offset,size);
+        return 0;
+    }
+    memcpy(ch.base + offset,&code[0],code.size());
+    if(mprotect(first,last - first,PROT_READ | PROT_EXEC) != 0)
+    {
+        free_region(ch.free,offset,size);
+        return 0;
+    }
+    m_sizes[ch.base + offset] = size;
+    return ch.base + offset;
+}
+
+#else
+
+using namespace dscript;
+
+jit::~jit()
+{
+}
+
+bool jit::available()
+{
+    return false;
+}
+
+native_code jit::compile(const func_table::entry&,vmachine&)
+{
+    return 0;
+}
+
+void jit::release(native_code)
+{
+}
+
+#endif
@@ -0,0 +1,108 @@
+////////////////////////////////////////////////////////////////////////////////
+// DScript Scripting Language
+// Copyright (C) 2003 Bryan "daerid" Ross
+//
+// Permission to copy, use, modify, sell and distribute this software is
+// granted provided this copyright notice appears in all copies. This
+// software is provided "as is" without express or implied warranty, and
+// with no claim as to its suitability for any purpose.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __DSCRIPT_JIT_H__
+#define __DSCRIPT_JIT_H__
+
+////////////////////////////////////////////////////////////////////////////////
+// Standard Library Includes
+#include <cstddef>
+#include <map>
+#include <vector>
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// DScript Includes
+#include "functions.h"
+////////////////////////////////////////////////////////////////////////////////
+
+// The JIT is only built when DSCRIPT_JIT is defined, and only knows how
+// to write x86-64 code for systems with mmap()
+#if defined(DSCRIPT_JIT) && defined(__x86_64__) && defined(__unix__)
+#define DSCRIPT_HAS_JIT
+#endif
+
+namespace dscript
+{
+    class vmachine;
+
+    /// The native code of a script function. Runs the function in the
+    /// frame on top of the vmachine's call stack, and returns the
+    /// instruction the interpreter has to carry on from: the end of the
+    /// function's code once it returns, or the first op_code the native
+    /// code couldn't handle. Returns 0 if a runtime error happened.
+    typedef const instruction* (*native_code)(
+        vmachine* vm,
+        class context* ctx,
+        value* locals
+        );
+
+    /// A baseline JIT for script functions. Each op_code of a function is
+    /// translated to x86-64 code on its own, using the same runtime stack,
+    /// frame slots and globals as the interpreter. Simple op_codes are
+    /// done inline for ints and floats, anything else calls back into
+    /// the vmachine (see vmachine::jit_op()). An op_code the JIT knows
+    /// nothing about hands the rest of the call back to the interpreter.
+    ///
+    /// The code of every function is packed into chunks of mapped pages
+    /// shared with the others, and lives until release() is called for
+    /// it, once the function is redefined.
+    class jit
+    {
+    public:
+        jit() {}
+        ~jit();
+
+        /// Returns whether this build has a JIT
+        static bool available();
+
+        /// Translates a script function for vm. Returns 0 if the function
+        /// can't be compiled.
+        native_code compile(const func_table::entry& func,vmachine& vm);
+
+        /// Frees code compile() returned, for another function to reuse.
+        /// It must not be running anymore.
+        void release(native_code code);
+
+    private:
+        // what native code calls to run an op_code through the vmachine,
+        // and to reload the frame slots after a call (see translator in
+        // jit.cpp)
+        static int run_op(
+            vmachine* vm,
+            class context* ctx,
+            const instruction* instr
+            );
+        static value* get_locals(vmachine* vm);
+
+        // pages mapped to hold compiled functions, and the regions of
+        // them that are free, by offset
+        struct chunk
+        {
+            char* base;
+            size_t size;
+            std::map<size_t,size_t> free;
+        };
+
+        /// Writes code to a free region of a chunk, mapping a new chunk if
+        /// none has room. Returns 0 if it can't be mapped.
+        void* write_code(const std::vector<unsigned char>& code);
+
+        std::vector<chunk> m_chunks;
+        // the size of the region each compiled function has
+        std::map<const void*,size_t> m_sizes;
+
+        // not copyable
+        jit(const jit&);
+        jit& operator = (const jit&);
+    };
+}
+
+#endif//__DSCRIPT_JIT_H__
@@ -0,0 +1,381 @@
+////////////////////////////////////////////////////////////////////////////////
+// DScript Scripting Language
+// Copyright (C) 2003 Bryan "daerid" Ross
+//
+// Permission to copy, use, modify, sell and distribute this software is
+// granted provided this copyright notice appears in all copies. This
+// software is provided "as is" without express or implied warranty, and
+// with no claim as to its suitability for any purpose.
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// Standard Library Include Files
+#include <cfloat>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// DScript Include Files
+#include "lexer.h"
+////////////////////////////////////////////////////////////////////////////////
+
+using namespace std;
+using namespace dscript;
+
+namespace
+{
+    // The character classes of the C locale, which Spirit used
+
+    bool is_space(char ch)
+    {
+        return ch == ' ' || (ch >= '\t' && ch <= '\r');
+    }
+
+    bool is_alpha(char ch)
+    {
+        return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z');
+    }
+
+    bool is_digit(char ch)
+    {
+        return ch >= '0' && ch <= '9';
+    }
+
+    bool is_odigit(char ch)
+    {
+        return ch >= '0' && ch <= '7';
+    }
+
+    /// Returns the value of a hex digit, or -1
+    int get_xdigit(char ch)
+    {
+        if(is_digit(ch))
+            return ch - '0';
+        if(ch >= 'a' && ch <= 'f')
+            return ch - 'a' + 10;
+        if(ch >= 'A' && ch <= 'F')
+            return ch - 'A' + 10;
+        return -1;
+    }
+
+    bool is_ident_char(char ch)
+    {
+        return is_alpha(ch) || is_digit(ch) || ch == '_' || ch == ':';
+    }
+
+    /// Reads the digits of an int from pos, with an optional sign. Returns
+    /// the end of it, or 0 if there are no digits or it doesn't fit.
+    const char* scan_int(const char* pos,const char* end,long long& val)
+    {
+        bool neg = false;
+        if(pos != end && (*pos == '+' || *pos == '-'))
+        {
+            neg = *pos == '-';
+            ++pos;
+        }
+        if(pos == end || !is_digit(*pos))
+            return 0;
+        long long limit = neg ? -static_cast<long long>(INT_MIN) : INT_MAX;
+        val = 0;
+        for(; pos != end && is_digit(*pos); ++pos)
+        {
+            val = val * 10 + (*pos - '0');
+            if(val > limit)
+                return 0;
+        }
+        if(neg)
+            val = -val;
+        return pos;
+    }
+}
+
+lexer::lexer(const char* begin,const char* end)
+    : m_begin(begin), m_end(end), m_pos(begin), m_furthest(begin)
+{
+}
+
+void lexer::skip()
+{
+    for(;;)
+    {
+        while(m_pos != m_end && is_space(*m_pos))
+            ++m_pos;
+        if(m_end - m_pos < 2 || m_pos[0] != '/' || m_pos[1] != '/')
+            return;
+        // up to the end of the line
+        m_pos += 2;
+        while(m_pos != m_end && *m_pos != '\n' && *m_pos != '\r')
+            ++m_pos;
+    }
+}
+
+bool lexer::at_end()
+{
+    position save = m_pos;
+    skip();
+    bool end = m_pos == m_end;
+    m_pos = save;
+    return end;
+}
+
+lexer::position lexer::start()
+{
+    skip();
+    return m_pos;
+}
+
+bool lexer::fail(position pos)
+{
+    if(pos > m_furthest)
+        m_furthest = pos;
+    return false;
+}
+
+bool lexer::match(char ch)
+{
+    position save = m_pos;
+    position pos = start();
+    if(pos != m_end && *pos == ch)
+    {
+        m_pos = pos + 1;
+        return true;
+    }
+    m_pos = save;
+    return fail(pos);
+}
+
+bool lexer::match(const char* str)
+{
+    position save = m_pos;
+    position pos = start();
+    size_t length = strlen(str);
+    if(static_cast<size_t>(m_end - pos) >= length && memcmp(pos,str,length) == 0)
+    {
+        m_pos = pos + length;
+        return true;
+    }
+    m_pos = save;
+    return fail(pos);
+}
+
+bool lexer::match_ident(string& token)
+{
+    position save = m_pos;
+    position pos = start();
+    if(pos == m_end || !is_alpha(*pos))
+    {
+        m_pos = save;
+        return fail(pos);
+    }
+    position end = pos + 1;
+    while(end != m_end && is_ident_char(*end))
+        ++end;
+    token.assign(pos,end);
+    m_pos = end;
+    return true;
+}
+
+bool lexer::match_var(string& token)
+{
+    position save = m_pos;
+    position pos = start();
+    if(
+        m_end - pos < 2 ||
+        (*pos != '$' && *pos != '%') ||
+        !is_alpha(pos[1])
+        )
+    {
+        m_pos = save;
+        return fail(pos);
+    }
+    position end = pos + 2;
+    while(end != m_end && is_ident_char(*end))
+        ++end;
+    token.assign(pos,end);
+    m_pos = end;
+    return true;
+}
+
+bool lexer::match_str(string& token)
+{
+    position save = m_pos;
+    position pos = start();
+    position end = pos;
+    if(end == m_end || *end != '"')
+    {
+        m_pos = save;
+        return fail(pos);
+    }
+    for(++end; end != m_end && *end != '"'; )
+    {
+        if(*end != '\\')
+        {
+            ++end;
+            continue;
+        }
+        // the escapes Spirit's c_escape_ch_p takes
+        ++end;
+        if(end == m_end)
+            break;
+        if(is_odigit(*end))
+        {
+            // up to 3 octal digits, or only the first if they don't fit
+            // in a char
+            position digit = end;
+            int val = 0;
+            for(; digit != m_end && digit - end < 3 && is_odigit(*digit); ++digit)
+            {
+                val = val * 8 + (*digit - '0');
+                if(val > CHAR_MAX)
+                    break;
+            }
+            end = val > CHAR_MAX ? end + 1 : digit;
+        }
+        else if(*end == 'x' || *end == 'X')
+        {
+            // 1 or 2 hex digits, that have to fit in a char
+            position digit = end + 1;
+            int val = 0;
+            for(; digit != m_end && digit - end < 3 && get_xdigit(*digit) != -1; ++digit)
+            {
+                val = val * 16 + get_xdigit(*digit);
+                if(val > CHAR_MAX)
+                    break;
+            }
+            if(digit == end + 1 || val > CHAR_MAX)
+            {
+                end = m_end;
+                break;
+            }
+            end = digit;
+        }
+        else
+            ++end;
+    }
+    if(end == m_end)
+    {
+        m_pos = save;
+        return fail(pos);
+    }
+    ++end;
+    token.assign(pos,end);
+    m_pos = end;
+    return true;
+}
+
+bool lexer::match_float(double& val)
+{
+    // Spirit's strict_real_p: an optional sign, digits with a '.' in or
+    // around them, and an optional exponent. Without the '.', the exponent
+    // has to be there.
+    position save = m_pos;
+    position pos = start();
+    position end = pos;
+    if(end != m_end && (*end == '+' || *end == '-'))
+        ++end;
+    position digits = end;
+    while(end != m_end && is_digit(*end))
+        ++end;
+    bool got_number = end != digits;
+    bool exponent = false;
+    bool ok = true;
+    if(end != m_end && *end == '.')
+    {
+        ++end;
+        position frac = end;
+        while(end != m_end && is_digit(*end))
+            ++end;
+        ok = got_number || end != frac;
+        exponent = ok && end != m_end && (*end == 'e' || *end == 'E');
+    }
+    else
+    {
+        exponent = got_number && end != m_end && (*end == 'e' || *end == 'E');
+        ok = exponent;
+    }
+    if(exponent)
+    {
+        long long exp;
+        end = scan_int(end + 1,m_end,exp);
+        ok = end != 0;
+    }
+    if(!ok)
+    {
+        m_pos = save;
+        return fail(pos);
+    }
+    // the way stringstream >> double converted it, which clamps what
+    // doesn't fit
+    string token(pos,end);
+    val = strtod(token.c_str(),0);
+    if(val == HUGE_VAL)
+        val = DBL_MAX;
+    else if(val == -HUGE_VAL)
+        val = -DBL_MAX;
+    m_pos = end;
+    return true;
+}
+
+bool lexer::match_int(int& val)
+{
+    position save = m_pos;
+    position pos = start();
+    if(
+        m_end - pos > 2 && pos[0] == '0' && pos[1] == 'x' &&
+        get_xdigit(pos[2]) != -1
+        )
+    {
+        // 1 to 8 hex digits. Like stringstream >> int did, the ones too
+        // big for an int become INT_MAX.
+        position end = pos + 2;
+        unsigned long hex = 0;
+        for(; end != m_end && end - pos < 10 && get_xdigit(*end) != -1; ++end)
+            hex = hex * 16 + get_xdigit(*end);
+        val = hex > static_cast<unsigned long>(INT_MAX) ? INT_MAX : static_cast<int>(hex);
+        m_pos = end;
+        return true;
+    }
+    long long dec;
+    position end = scan_int(pos,m_end,dec);
+    if(end == 0)
+    {
+        m_pos = save;
+        return fail(pos);
+    }
+    val = static_cast<int>(dec);
+    m_pos = end;
+    return true;
+}
+
+code_position lexer::get_position(position pos) const
+{
+    int line = 1;
+    int col = 1;
+    for(position ch = m_begin; ch != pos; ++ch)
+    {
+        switch(*ch)
+        {
+        case '\n':
+            ++line;
+            col = 1;
+            break;
+        case '\r':
+            // \r\n is a single line break
+            if(ch + 1 == m_end || ch[1] != '\n')
+            {
+                ++line;
+                col = 1;
+            }
+            break;
+        case '\t':
+            col += 4 - (col - 1) % 4;
+            break;
+        default:
+            ++col;
+        }
+    }
+    return code_position(line,col);
+}
@@ -0,0 +1,95 @@
+////////////////////////////////////////////////////////////////////////////////
+// DScript Scripting Language
+// Copyright (C) 2003 Bryan "daerid" Ross
+//
+// Permission to copy, use, modify, sell and distribute this software is
+// granted provided this copyright notice appears in all copies. This
+// software is provided "as is" without express or implied warranty, and
+// with no claim as to its suitability for any purpose.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __DSCRIPT_LEXER_H__
+#define __DSCRIPT_LEXER_H__
+
+////////////////////////////////////////////////////////////////////////////////
+// Standard Library Include Files
+#include <string>
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// DScript Include Files
+#include "compiler.h"
+////////////////////////////////////////////////////////////////////////////////
+
+namespace dscript
+{
+    /// The tokenizer of the compiler. Rather than splitting the whole
+    /// source up front, it matches the token the parser asks for at the
+    /// current position, after skipping white space and // comments. A
+    /// token that doesn't match leaves the position where it was, so the
+    /// parser can back up and try something else, the way the Spirit
+    /// grammar does. Keywords are matched as plain strings, like Spirit's
+    /// str_p, so "elseif" is "else" followed by "if".
+    class lexer
+    {
+    public:
+        typedef const char* position;
+
+        lexer(const char* begin,const char* end);
+
+        position tell() const { return m_pos; }
+        void seek(position pos) { m_pos = pos; }
+
+        /// Skips white space and comments
+        void skip();
+
+        /// Returns whether there is nothing but white space and comments
+        /// left
+        bool at_end();
+
+        /// Matches a single character
+        bool match(char ch);
+
+        /// Matches a string of characters, such as a keyword or an
+        /// operator
+        bool match(const char* str);
+
+        /// Matches an identifier: a letter, then letters, digits, '_'
+        /// and ':'
+        bool match_ident(std::string& token);
+
+        /// Matches a $global or a %local variable name
+        bool match_var(std::string& token);
+
+        /// Matches a string constant, quotes and escapes included
+        bool match_str(std::string& token);
+
+        /// Matches a float constant, which has a '.' or an exponent
+        bool match_float(double& val);
+
+        /// Matches a decimal or 0x hex int constant
+        bool match_int(int& val);
+
+        /// The furthest position a token was expected at, and didn't
+        /// match. A parse error is reported here.
+        position furthest() const { return m_furthest; }
+
+        /// Returns the line and column of a position, counted the way
+        /// Spirit's position_iterator does
+        code_position get_position(position pos) const;
+
+    private:
+        /// Skips to the next token, and returns where it starts
+        position start();
+
+        /// Records that a token starting at pos didn't match
+        bool fail(position pos);
+
+        const char* m_begin;
+        const char* m_end;
+        position m_pos;
+        position m_furthest;
+    };
+}
+
+#endif//__DSCRIPT_LEXER_H__
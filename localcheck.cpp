@@ -0,0 +1,109 @@
+////////////////////////////////////////////////////////////////////////////////
+// DScript Scripting Language
+// Copyright (C) 2003 Bryan "daerid" Ross
+//
+// Permission to copy, use, modify, sell and distribute this software is
+// granted provided this copyright notice appears in all copies. This
+// software is provided "as is" without express or implied warranty, and
+// with no claim as to its suitability for any purpose.
+////////////////////////////////////////////////////////////////////////////////
+
+// localcheck: runs scripts with host functions that read and write the
+// %locals of the script function calling them, and checks they see that
+// function's own %locals wherever the compiler puts its code (see
+// inline_functions() in compiler.h).
+//
+// usage: localcheck script.ds...
+//
+// A script calls check(value,expected,what) for everything it checks.
+// getloc(name) returns the %local called name, and setloc(name,value)
+// sets it. Exits with 1 if any check fails, or any script doesn't run.
+//
+// It also checks that the functions declared by code that eval() doesn't
+// keep (see set_eval_cache_size()) can still be called after it returns.
+
+////////////////////////////////////////////////////////////////////////////////
+// Standard Library Includes
+#include <iostream>
+#include <string>
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// DScript Includes
+#include "dscript.h"
+#include "stdlib.h"
+////////////////////////////////////////////////////////////////////////////////
+
+#define ARGS const dscript::args_t& args,dscript::context& ctx
+
+using namespace std;
+using namespace dscript;
+
+namespace
+{
+    size_t failed = 0;
+
+    void getloc(ARGS)
+    {
+        ctx.set_return(ctx.get_local(args[0].to_str()));
+    }
+
+    void setloc(ARGS)
+    {
+        ctx.set_local(args[0].to_str(),args[1]);
+    }
+
+    void check(ARGS)
+    {
+        if(args[0].to_str() == args[1].to_str())
+            return;
+        cout << args[2].to_str() << ": got \"" << args[0].to_str()
+            << "\", expected \"" << args[1].to_str() << '"' << endl;
+        ++failed;
+    }
+}
+
+int main(int argc,char* argv[])
+{
+    if(argc < 2)
+    {
+        cerr << "usage: localcheck script.ds..." << endl;
+        return 1;
+    }
+
+    for(int i = 1; i < argc; ++i)
+    {
+        context ctx;
+        ctx.enable_logging(&cout);
+        link_stdlib(ctx);
+        ctx.link_function("getloc",getloc,1,1,"getloc(name)");
+        ctx.link_function("setloc",setloc,2,2,"setloc(name,value)");
+        ctx.link_function("check",check,3,3,"check(value,expected,what)");
+        if(!ctx.exec(argv[i]))
+            ++failed;
+    }
+
+    // a function declared by code eval() doesn't keep keeps that code
+    {
+        context ctx;
+        ctx.enable_logging(&cout);
+        ctx.set_eval_cache_size(0);
+        ctx.eval("function from_eval() { %x = 4; return %x; }");
+        for(int i = 0; i < 16; ++i)
+            ctx.eval("$filler = \"overwrites freed code\";");
+        ctx.eval("$from_eval = from_eval();");
+        if(ctx.get_global("$from_eval").to_str() != "4")
+        {
+            cout << "a function declared by uncached eval(): got \""
+                << ctx.get_global("$from_eval").to_str()
+                << "\", expected \"4\"" << endl;
+            ++failed;
+        }
+    }
+    if(failed != 0)
+    {
+        cout << failed << " checks failed" << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,199 @@
+////////////////////////////////////////////////////////////////////////////////
+// DScript Scripting Language
+// Copyright (C) 2003 Bryan "daerid" Ross
+//
+// Permission to copy, use, modify, sell and distribute this software is
+// granted provided this copyright notice appears in all copies. This
+// software is provided "as is" without express or implied warranty, and
+// with no claim as to its suitability for any purpose.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __DSCRIPT_NATIVE_H__
+#define __DSCRIPT_NATIVE_H__
+
+////////////////////////////////////////////////////////////////////////////////
+// DScript Includes
+#include "vmachine.h"
+#include "context.h"
+////////////////////////////////////////////////////////////////////////////////
+
+namespace dscript
+{
+    /// What a compiled_func written by dscript2cpp runs against: the code
+    /// of its script function, the function's frame slots and the runtime
+    /// stack. Offsets are counted from the first op_code of the function,
+    /// so the same C++ works wherever the function ends up in its
+    /// codeblock.
+    ///
+    /// The helpers below do the common cases of an op_code inline, for
+    /// ints and floats, and anything else through run_op(), which runs
+    /// the op_code at the given offset the way the interpreter would.
+    class native_frame
+    {
+    public:
+        native_frame(
+            vmachine& vm,
+            context& ctx,
+            const instruction* start,
+            const instruction* stop
+            );
+
+        // the function's code, and where it ends
+        const instruction* const code;
+        const instruction* const end;
+
+        // the frame slots, which move when a function is called
+        value* locals;
+        value_stack& stack;
+
+        /// Runs the op_code at code + off through the vmachine. Returns
+        /// whether it jumps, for the jump op_codes.
+        bool run_op(size_t off);
+
+        /// op_add, op_sub, op_mul or op_div, at off
+        void binary(op_code op,size_t off)
+        {
+            value& lhs = stack.m_end[-2];
+            const value& rhs = stack.m_end[-1];
+            if(lhs.type == value::type_int && rhs.type == value::type_int)
+            {
+                if(op == op_div && rhs.intval == 0)
+                    run_op(off);
+                else
+                {
+                    lhs.intval = arith(op,lhs.intval,rhs.intval);
+                    --stack.m_end;
+                }
+            }
+            else if(
+                lhs.type == value::type_flt &&
+                rhs.type == value::type_flt
+                )
+            {
+                lhs.fltval = arith(op,lhs.fltval,rhs.fltval);
+                --stack.m_end;
+            }
+            else
+                run_op(off);
+        }
+
+        /// op_add_asn_local, op_sub_asn_local or op_mul_asn_local (given
+        /// as op_add, op_sub or op_mul), on slot, at off
+        void assign_local(op_code op,int slot,size_t off)
+        {
+            value& var = locals[slot];
+            const value& val = stack.m_end[-1];
+            if(var.type == value::type_int && val.type == value::type_int)
+            {
+                var.intval = arith(op,var.intval,val.intval);
+                --stack.m_end;
+            }
+            else if(
+                var.type == value::type_flt &&
+                val.type == value::type_flt
+                )
+            {
+                var.fltval = arith(op,var.fltval,val.fltval);
+                --stack.m_end;
+            }
+            else
+                run_op(off);
+        }
+
+        /// A comparison op_code (given as op_cmp_less etc), at off
+        void compare(op_code op,size_t off)
+        {
+            value& lhs = stack.m_end[-2];
+            const value& rhs = stack.m_end[-1];
+            if(lhs.type == value::type_int && rhs.type == value::type_int)
+            {
+                lhs.intval = test(op,lhs.intval,rhs.intval);
+                --stack.m_end;
+            }
+            else if(
+                lhs.type == value::type_flt &&
+                rhs.type == value::type_flt
+                )
+            {
+                lhs = static_cast<int>(test(op,lhs.fltval,rhs.fltval));
+                --stack.m_end;
+            }
+            else
+                run_op(off);
+        }
+
+        /// A comparison + op_jmp_false op_code (given as op_cmp_less etc),
+        /// at off. Returns whether it jumps.
+        bool compare_jumps(op_code op,size_t off)
+        {
+            const value& lhs = stack.m_end[-2];
+            const value& rhs = stack.m_end[-1];
+            if(lhs.type == value::type_int && rhs.type == value::type_int)
+            {
+                stack.m_end -= 2;
+                return !test(op,lhs.intval,rhs.intval);
+            }
+            if(lhs.type == value::type_flt && rhs.type == value::type_flt)
+            {
+                stack.m_end -= 2;
+                return !test(op,lhs.fltval,rhs.fltval);
+            }
+            return run_op(off);
+        }
+
+        /// op_jmp_false at off. Returns whether it jumps.
+        bool jump_false(size_t off)
+        {
+            const value& top = stack.m_end[-1];
+            if(top.type != value::type_int)
+                return run_op(off);
+            --stack.m_end;
+            return top.intval == 0;
+        }
+
+        /// op_jmp_false_peek (if_true is false) or op_jmp_true_peek at
+        /// off. Returns whether it jumps.
+        bool jump_peek(bool if_true,size_t off)
+        {
+            const value& top = stack.m_end[-1];
+            if(top.type != value::type_int)
+                return run_op(off);
+            if((top.intval != 0) == if_true)
+                return true;
+            --stack.m_end;
+            return false;
+        }
+
+    private:
+        template<typename T>
+        static T arith(op_code op,T lhs,T rhs)
+        {
+            switch(op)
+            {
+            case op_add: return lhs + rhs;
+            case op_sub: return lhs - rhs;
+            case op_mul: return lhs * rhs;
+            default:     return lhs / rhs;
+            }
+        }
+
+        template<typename T>
+        static bool test(op_code op,T lhs,T rhs)
+        {
+            switch(op)
+            {
+            case op_cmp_less_eq: return lhs <= rhs;
+            case op_cmp_less:    return lhs < rhs;
+            case op_cmp_grtr_eq: return lhs >= rhs;
+            case op_cmp_grtr:    return lhs > rhs;
+            case op_eq:          return lhs == rhs;
+            default:             return lhs != rhs;
+            }
+        }
+
+        vmachine& m_vm;
+        context& m_ctx;
+    };
+}
+
+#endif//__DSCRIPT_NATIVE_H__
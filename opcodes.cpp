@@ -8,6 +8,11 @@
 // with no claim as to its suitability for any purpose.
 ////////////////////////////////////////////////////////////////////////////////
 
+////////////////////////////////////////////////////////////////////////////////
+// Boost Includes (http://www.boost.org)
+#include <boost/static_assert.hpp>
+////////////////////////////////////////////////////////////////////////////////
+
 ////////////////////////////////////////////////////////////////////////////////
 // DScript Includes
 #include "opcodes.h"
@@ -80,10 +85,340 @@ const char* g_op_names[] =
     "op_shr_asn",
     "op_shr_asn_var",
     "op_jmp_false",
-    "op_jmp"
+    "op_jmp",
+    "op_push_local",
+    "op_pop_param_local",
+    "op_inc_local",
+    "op_dec_local",
+    "op_assign_local",
+    "op_mul_asn_local",
+    "op_div_asn_local",
+    "op_mod_asn_local",
+    "op_add_asn_local",
+    "op_sub_asn_local",
+    "op_cat_asn_local",
+    "op_band_asn_local",
+    "op_bor_asn_local",
+    "op_bxor_asn_local",
+    "op_shl_asn_local",
+    "op_shr_asn_local",
+    "op_push_global",
+    "op_inc_global",
+    "op_dec_global",
+    "op_assign_global",
+    "op_mul_asn_global",
+    "op_div_asn_global",
+    "op_mod_asn_global",
+    "op_add_asn_global",
+    "op_sub_asn_global",
+    "op_cat_asn_global",
+    "op_band_asn_global",
+    "op_bor_asn_global",
+    "op_bxor_asn_global",
+    "op_shl_asn_global",
+    "op_shr_asn_global",
+    "op_mul_ii",
+    "op_mul_ff",
+    "op_div_ii",
+    "op_div_ff",
+    "op_add_ii",
+    "op_add_ff",
+    "op_sub_ii",
+    "op_sub_ff",
+    "op_cmp_less_eq_ii",
+    "op_cmp_less_eq_ff",
+    "op_cmp_less_ii",
+    "op_cmp_less_ff",
+    "op_cmp_grtr_eq_ii",
+    "op_cmp_grtr_eq_ff",
+    "op_cmp_grtr_ii",
+    "op_cmp_grtr_ff",
+    "op_eq_ii",
+    "op_eq_ff",
+    "op_neq_ii",
+    "op_neq_ff",
+    "op_param_str",
+    "op_param_int",
+    "op_param_var",
+    "op_param_local",
+    "op_param_global",
+    "op_call_load_ret",
+    "op_return_value",
+    "op_cmp_less_eq_jmp_false",
+    "op_cmp_less_jmp_false",
+    "op_cmp_grtr_eq_jmp_false",
+    "op_cmp_grtr_jmp_false",
+    "op_eq_jmp_false",
+    "op_neq_jmp_false",
+    "op_bool",
+    "op_jmp_false_peek",
+    "op_jmp_true_peek",
+    "op_push_elem",
+    "op_push_elem_local",
+    "op_push_elem_global",
+    "op_asn_elem",
+    "op_asn_elem_local",
+    "op_asn_elem_global",
+    "op_inline_guard",
+    "op_load_func"
 };
 
+// operand array (see get_op_operands)
+const char* g_op_operands[] =
+{
+    "",     // op_push_param
+    "nixx", // op_call_func
+    "s",    // op_push_str
+    "i",    // op_push_int
+    "f",    // op_push_float
+    "",     // op_cat_aidx_expr
+    "n",    // op_push_var
+    "",     // op_push_var_value
+    "",     // op_load_ret
+    "n",    // op_inc_var
+    "n",    // op_dec_var
+    "",     // op_neg
+    "",     // op_log_not
+    "",     // op_bit_not
+    "",     // op_mul
+    "",     // op_div
+    "",     // op_mod
+    "",     // op_add
+    "",     // op_sub
+    "",     // op_cat
+    "",     // op_shl
+    "",     // op_shr
+    "",     // op_cmp_less_eq
+    "",     // op_cmp_less
+    "",     // op_cmp_grtr_eq
+    "",     // op_cmp_grtr
+    "",     // op_eq
+    "",     // op_neq
+    "",     // op_bit_and
+    "",     // op_bit_or
+    "",     // op_bit_xor
+    "",     // op_log_and
+    "",     // op_log_or
+    "noc",  // op_decl_func
+    "n",    // op_pop_param
+    "",     // op_return
+    "",     // op_store_ret
+    "",     // op_assign
+    "n",    // op_assign_var
+    "",     // op_mul_asn
+    "n",    // op_mul_asn_var
+    "",     // op_div_asn
+    "n",    // op_div_asn_var
+    "",     // op_mod_asn
+    "n",    // op_mod_asn_var
+    "",     // op_add_asn
+    "n",    // op_add_asn_var
+    "",     // op_sub_asn
+    "n",    // op_sub_asn_var
+    "",     // op_cat_asn
+    "n",    // op_cat_asn_var
+    "",     // op_band_asn
+    "n",    // op_band_asn_var
+    "",     // op_bor_asn
+    "n",    // op_bor_asn_var
+    "",     // op_bxor_asn
+    "n",    // op_bxor_asn_var
+    "",     // op_shl_asn
+    "n",    // op_shl_asn_var
+    "",     // op_shr_asn
+    "n",    // op_shr_asn_var
+    "o",    // op_jmp_false
+    "o",    // op_jmp
+    "l",    // op_push_local
+    "l",    // op_pop_param_local
+    "l",    // op_inc_local
+    "l",    // op_dec_local
+    "l",    // op_assign_local
+    "l",    // op_mul_asn_local
+    "l",    // op_div_asn_local
+    "l",    // op_mod_asn_local
+    "l",    // op_add_asn_local
+    "l",    // op_sub_asn_local
+    "l",    // op_cat_asn_local
+    "l",    // op_band_asn_local
+    "l",    // op_bor_asn_local
+    "l",    // op_bxor_asn_local
+    "l",    // op_shl_asn_local
+    "l",    // op_shr_asn_local
+    "g",    // op_push_global
+    "g",    // op_inc_global
+    "g",    // op_dec_global
+    "g",    // op_assign_global
+    "g",    // op_mul_asn_global
+    "g",    // op_div_asn_global
+    "g",    // op_mod_asn_global
+    "g",    // op_add_asn_global
+    "g",    // op_sub_asn_global
+    "g",    // op_cat_asn_global
+    "g",    // op_band_asn_global
+    "g",    // op_bor_asn_global
+    "g",    // op_bxor_asn_global
+    "g",    // op_shl_asn_global
+    "g",    // op_shr_asn_global
+    "",     // op_mul_ii
+    "",     // op_mul_ff
+    "",     // op_div_ii
+    "",     // op_div_ff
+    "",     // op_add_ii
+    "",     // op_add_ff
+    "",     // op_sub_ii
+    "",     // op_sub_ff
+    "",     // op_cmp_less_eq_ii
+    "",     // op_cmp_less_eq_ff
+    "",     // op_cmp_less_ii
+    "",     // op_cmp_less_ff
+    "",     // op_cmp_grtr_eq_ii
+    "",     // op_cmp_grtr_eq_ff
+    "",     // op_cmp_grtr_ii
+    "",     // op_cmp_grtr_ff
+    "",     // op_eq_ii
+    "",     // op_eq_ff
+    "",     // op_neq_ii
+    "",     // op_neq_ff
+    "s",    // op_param_str
+    "i",    // op_param_int
+    "n",    // op_param_var
+    "l",    // op_param_local
+    "g",    // op_param_global
+    "nixx", // op_call_load_ret
+    "",     // op_return_value
+    "o",    // op_cmp_less_eq_jmp_false
+    "o",    // op_cmp_less_jmp_false
+    "o",    // op_cmp_grtr_eq_jmp_false
+    "o",    // op_cmp_grtr_jmp_false
+    "o",    // op_eq_jmp_false
+    "o",    // op_neq_jmp_false
+    "",     // op_bool
+    "o",    // op_jmp_false_peek
+    "o",    // op_jmp_true_peek
+    "ni",   // op_push_elem
+    "li",   // op_push_elem_local
+    "gi",   // op_push_elem_global
+    "nii",  // op_asn_elem
+    "lii",  // op_asn_elem_local
+    "gii",  // op_asn_elem_global
+    "odnxx", // op_inline_guard
+    "ix"    // op_load_func
+};
+
+BOOST_STATIC_ASSERT(sizeof(g_op_names) / sizeof(g_op_names[0]) == op_count);
+BOOST_STATIC_ASSERT(
+    sizeof(g_op_operands) / sizeof(g_op_operands[0]) == op_count
+    );
+
 const char* dscript::get_op_name(op_code op)
 {
     return g_op_names[op];
+}
+
+const char* dscript::get_op_operands(op_code op)
+{
+    return g_op_operands[op];
+}
+
+op_code dscript::get_global_op(op_code op)
+{
+    switch(op)
+    {
+    case op_push_var:       return op_push_global;
+    case op_param_var:      return op_param_global;
+    case op_push_elem:      return op_push_elem_global;
+    case op_asn_elem:       return op_asn_elem_global;
+    case op_inc_var:        return op_inc_global;
+    case op_dec_var:        return op_dec_global;
+    case op_assign_var:     return op_assign_global;
+    case op_mul_asn_var:    return op_mul_asn_global;
+    case op_div_asn_var:    return op_div_asn_global;
+    case op_mod_asn_var:    return op_mod_asn_global;
+    case op_add_asn_var:    return op_add_asn_global;
+    case op_sub_asn_var:    return op_sub_asn_global;
+    case op_cat_asn_var:    return op_cat_asn_global;
+    case op_band_asn_var:   return op_band_asn_global;
+    case op_bor_asn_var:    return op_bor_asn_global;
+    case op_bxor_asn_var:   return op_bxor_asn_global;
+    case op_shl_asn_var:    return op_shl_asn_global;
+    case op_shr_asn_var:    return op_shr_asn_global;
+    default:                return op_invalid;
+    }
+}
+
+op_code dscript::get_var_op(op_code op)
+{
+    switch(op)
+    {
+    case op_push_global:        return op_push_var;
+    case op_param_global:       return op_param_var;
+    case op_push_elem_global:   return op_push_elem;
+    case op_asn_elem_global:    return op_asn_elem;
+    case op_inc_global:         return op_inc_var;
+    case op_dec_global:         return op_dec_var;
+    case op_assign_global:      return op_assign_var;
+    case op_mul_asn_global:     return op_mul_asn_var;
+    case op_div_asn_global:     return op_div_asn_var;
+    case op_mod_asn_global:     return op_mod_asn_var;
+    case op_add_asn_global:     return op_add_asn_var;
+    case op_sub_asn_global:     return op_sub_asn_var;
+    case op_cat_asn_global:     return op_cat_asn_var;
+    case op_band_asn_global:    return op_band_asn_var;
+    case op_bor_asn_global:     return op_bor_asn_var;
+    case op_bxor_asn_global:    return op_bxor_asn_var;
+    case op_shl_asn_global:     return op_shl_asn_var;
+    case op_shr_asn_global:     return op_shr_asn_var;
+    default:                    return op_invalid;
+    }
+}
+
+op_code dscript::get_unquickened_op(op_code op)
+{
+    switch(op)
+    {
+    case op_mul_ii: case op_mul_ff:                 return op_mul;
+    case op_div_ii: case op_div_ff:                 return op_div;
+    case op_add_ii: case op_add_ff:                 return op_add;
+    case op_sub_ii: case op_sub_ff:                 return op_sub;
+    case op_cmp_less_eq_ii: case op_cmp_less_eq_ff: return op_cmp_less_eq;
+    case op_cmp_less_ii: case op_cmp_less_ff:       return op_cmp_less;
+    case op_cmp_grtr_eq_ii: case op_cmp_grtr_eq_ff: return op_cmp_grtr_eq;
+    case op_cmp_grtr_ii: case op_cmp_grtr_ff:       return op_cmp_grtr;
+    case op_eq_ii: case op_eq_ff:                   return op_eq;
+    case op_neq_ii: case op_neq_ff:                 return op_neq;
+    default:                                        return op;
+    }
+}
+
+bool dscript::is_interpreter_only(op_code op)
+{
+    switch(op)
+    {
+    case op_cat_aidx_expr:
+    case op_push_var_value:
+    case op_decl_func:
+    case op_assign:
+    case op_mul_asn:
+    case op_div_asn:
+    case op_mod_asn:
+    case op_add_asn:
+    case op_sub_asn:
+    case op_cat_asn:
+    case op_band_asn:
+    case op_bor_asn:
+    case op_bxor_asn:
+    case op_shl_asn:
+    case op_shr_asn:
+    case op_push_elem:
+    case op_push_elem_local:
+    case op_push_elem_global:
+    case op_asn_elem:
+    case op_asn_elem_local:
+    case op_asn_elem_global:
+    case op_load_func:
+        return true;
+    default:
+        return false;
+    }
 }
\ No newline at end of file
@@ -79,6 +79,109 @@ namespace dscript
         op_shr_asn_var,
         op_jmp_false,
         op_jmp,
+        // frame slot indexed %locals
+        op_push_local,
+        op_pop_param_local,
+        op_inc_local,
+        op_dec_local,
+        op_assign_local,
+        op_mul_asn_local,
+        op_div_asn_local,
+        op_mod_asn_local,
+        op_add_asn_local,
+        op_sub_asn_local,
+        op_cat_asn_local,
+        op_band_asn_local,
+        op_bor_asn_local,
+        op_bxor_asn_local,
+        op_shl_asn_local,
+        op_shr_asn_local,
+        // global slot indexed $globals (see vmachine::link)
+        op_push_global,
+        op_inc_global,
+        op_dec_global,
+        op_assign_global,
+        op_mul_asn_global,
+        op_div_asn_global,
+        op_mod_asn_global,
+        op_add_asn_global,
+        op_sub_asn_global,
+        op_cat_asn_global,
+        op_band_asn_global,
+        op_bor_asn_global,
+        op_bxor_asn_global,
+        op_shl_asn_global,
+        op_shr_asn_global,
+        // quickened forms of the generic binary ops, for two ints (_ii)
+        // or two floats (_ff). The vmachine rewrites to these at runtime
+        // only, they are never compiled or saved
+        op_mul_ii,
+        op_mul_ff,
+        op_div_ii,
+        op_div_ff,
+        op_add_ii,
+        op_add_ff,
+        op_sub_ii,
+        op_sub_ff,
+        op_cmp_less_eq_ii,
+        op_cmp_less_eq_ff,
+        op_cmp_less_ii,
+        op_cmp_less_ff,
+        op_cmp_grtr_eq_ii,
+        op_cmp_grtr_eq_ff,
+        op_cmp_grtr_ii,
+        op_cmp_grtr_ff,
+        op_eq_ii,
+        op_eq_ff,
+        op_neq_ii,
+        op_neq_ff,
+        // superinstructions, for the most frequent op_code sequences
+        // (see dsc_ngrams). op_param_* push a value straight onto the
+        // param stack, op_call_load_ret is op_call_func + op_load_ret,
+        // op_return_value is op_store_ret + op_return, and the
+        // *_jmp_false ops are a comparison + op_jmp_false
+        op_param_str,
+        op_param_int,
+        op_param_var,
+        op_param_local,
+        op_param_global,
+        op_call_load_ret,
+        op_return_value,
+        op_cmp_less_eq_jmp_false,
+        op_cmp_less_jmp_false,
+        op_cmp_grtr_eq_jmp_false,
+        op_cmp_grtr_jmp_false,
+        op_eq_jmp_false,
+        op_neq_jmp_false,
+        // short circuit && and ||. op_bool turns the top of the stack
+        // into 0 or 1, and the *_peek jumps test the top of the stack
+        // without popping it, popping it only if they don't jump
+        op_bool,
+        op_jmp_false_peek,
+        op_jmp_true_peek,
+        // array elements. The indexes are on the stack, first one
+        // deepest, and the operands are the array variable and the
+        // number of indexes. op_asn_elem* also take the named variable
+        // form of the assignment to do (op_assign_var, op_add_asn_var,
+        // op_inc_var etc), and pop the value to assign first
+        op_push_elem,
+        op_push_elem_local,
+        op_push_elem_global,
+        op_asn_elem,
+        op_asn_elem_local,
+        op_asn_elem_global,
+        // the start of a script function compiled inline at a call site
+        // (see compiler_inline.cpp). Jumps to the call it stands for
+        // unless the function is still the one declared at its 'd'
+        // operand, and calls no host function that may use its %locals,
+        // the operands being where to jump, that declaration, the
+        // function's name and an inline cache
+        op_inline_guard,
+        // the body of a function loaded from a compiled file that hasn't
+        // been decoded yet (see load_compiled_lazy). Decodes it, and runs
+        // it from there. The operands are the function's place in the
+        // file's directory and the compiled_image it is in.
+        op_load_func,
         // num of op_codes
         op_count,
         // debugging
@@ -87,6 +190,37 @@ namespace dscript
 
     /// Returns the string name an op_code
     const char* get_op_name(op_code op);
+
+    /// Returns the operands that follow an op_code in a codeblock,
+    /// one character per operand:
+    ///     n   string_table::entry naming a variable or function
+    ///     s   string_table::entry holding a string constant
+    ///     i   int constant
+    ///     f   float_table::entry
+    ///     o   offset into the codeblock
+    ///     d   offset of an op_decl_func in the codeblock
+    ///     l   frame slot
+    ///     g   global slot
+    ///     c   slot count, followed by the name of each slot
+    ///     x   inline cache, only meaningful at runtime
+    const char* get_op_operands(op_code op);
+
+    /// Returns the global slot form of an op_code that works on a named
+    /// variable, or op_invalid if there is none (see vmachine::link)
+    op_code get_global_op(op_code op);
+
+    /// Returns the named variable form of a global slot op_code, or
+    /// op_invalid if op isn't one
+    op_code get_var_op(op_code op);
+
+    /// Returns the generic form of a quickened (_ii or _ff) op_code,
+    /// or op itself if it isn't one
+    op_code get_unquickened_op(op_code op);
+
+    /// Returns whether only the interpreter can run an op_code. Native
+    /// code (see jit.h and native.h) hands the rest of a call back to
+    /// the interpreter when it gets to one of these.
+    bool is_interpreter_only(op_code op);
 }
 
 #endif//__DSCRIPT_OPCODES_H__
\ No newline at end of file
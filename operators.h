@@ -0,0 +1,203 @@
+////////////////////////////////////////////////////////////////////////////////
+// DScript Scripting Language
+// Copyright (C) 2003 Bryan "daerid" Ross
+//
+// Permission to copy, use, modify, sell and distribute this software is
+// granted provided this copyright notice appears in all copies. This
+// software is provided "as is" without express or implied warranty, and
+// with no claim as to its suitability for any purpose.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __DSCRIPT_OPERATORS_H__
+#define __DSCRIPT_OPERATORS_H__
+
+////////////////////////////////////////////////////////////////////////////////
+// Standard Library Includes
+#include <stdexcept>
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// DScript Includes
+#include "opcodes.h"
+#include "value.h"
+////////////////////////////////////////////////////////////////////////////////
+
+// What the operators of the language do to values, shared by the vmachine
+// and the compiler's constant folding (see compiler_emit.cpp), so that both
+// promote the same way.
+namespace dscript
+{
+    // The compound assignment operators. Each one is shared by the named,
+    // the computed name and the frame slot forms of its op_code.
+
+    inline void mul_asn(value& var,const value& val)
+    {
+        if(var.type == value::type_int && val.type == value::type_int)
+            var.intval *= val.intval;
+        else
+        {
+            var.set_type(value::type_flt);
+            var.fltval *= val.to_flt();
+        }
+    }
+
+    inline void div_asn(value& var,const value& val)
+    {
+        if(var.type == value::type_int && val.type == value::type_int)
+        {
+            // check divide by zero error
+            if(val.intval == 0)
+                throw std::runtime_error("Divide by zero encountered.");
+            var.intval /= val.intval;
+        }
+        else
+        {
+            var.set_type(value::type_flt);
+            var.fltval /= val.to_flt();
+        }
+    }
+
+    inline void mod_asn(value& var,const value& val)
+    {
+        // must be an int type
+        var.set_type(value::type_int);
+        var.intval %= val.to_int();
+    }
+
+    inline void add_asn(value& var,const value& val)
+    {
+        if(var.type == value::type_int && val.type == value::type_int)
+            var.intval += val.intval;
+        else
+        {
+            var.set_type(value::type_flt);
+            var.fltval += val.to_flt();
+        }
+    }
+
+    inline void sub_asn(value& var,const value& val)
+    {
+        if(var.type == value::type_int && val.type == value::type_int)
+            var.intval -= val.intval;
+        else
+        {
+            var.set_type(value::type_flt);
+            var.fltval -= val.to_flt();
+        }
+    }
+
+    inline void cat_asn(value& var,const value& val)
+    {
+        var.cat(val);
+    }
+
+    inline void band_asn(value& var,const value& val)
+    {
+        var.set_type(value::type_int);
+        var.intval &= val.to_int();
+    }
+
+    inline void bor_asn(value& var,const value& val)
+    {
+        var.set_type(value::type_int);
+        var.intval |= val.to_int();
+    }
+
+    inline void bxor_asn(value& var,const value& val)
+    {
+        var.set_type(value::type_int);
+        var.intval ^= val.to_int();
+    }
+
+    inline void shl_asn(value& var,const value& val)
+    {
+        var.set_type(value::type_int);
+        var.intval <<= val.to_int();
+    }
+
+    inline void shr_asn(value& var,const value& val)
+    {
+        var.set_type(value::type_int);
+        var.intval >>= val.to_int();
+    }
+
+    typedef void (*asn_func)(value& var,const value& val);
+
+    /// Returns the compound assignment that does the work of a binary op,
+    /// or of any form of a compound assignment, or 0 if there is none
+    inline asn_func get_asn_func(op_code op)
+    {
+        switch(op)
+        {
+        case op_mul: case op_mul_ii: case op_mul_ff:
+        case op_mul_asn_var: case op_mul_asn_local: case op_mul_asn_global:
+            return mul_asn;
+        case op_div: case op_div_ii: case op_div_ff:
+        case op_div_asn_var: case op_div_asn_local: case op_div_asn_global:
+            return div_asn;
+        case op_mod:
+        case op_mod_asn_var: case op_mod_asn_local: case op_mod_asn_global:
+            return mod_asn;
+        case op_add: case op_add_ii: case op_add_ff:
+        case op_add_asn_var: case op_add_asn_local: case op_add_asn_global:
+            return add_asn;
+        case op_sub: case op_sub_ii: case op_sub_ff:
+        case op_sub_asn_var: case op_sub_asn_local: case op_sub_asn_global:
+            return sub_asn;
+        case op_cat:
+        case op_cat_asn_var: case op_cat_asn_local: case op_cat_asn_global:
+            return cat_asn;
+        case op_bit_and:
+        case op_band_asn_var: case op_band_asn_local: case op_band_asn_global:
+            return band_asn;
+        case op_bit_or:
+        case op_bor_asn_var: case op_bor_asn_local: case op_bor_asn_global:
+            return bor_asn;
+        case op_bit_xor:
+        case op_bxor_asn_var: case op_bxor_asn_local: case op_bxor_asn_global:
+            return bxor_asn;
+        case op_shl:
+        case op_shl_asn_var: case op_shl_asn_local: case op_shl_asn_global:
+            return shl_asn;
+        case op_shr:
+        case op_shr_asn_var: case op_shr_asn_local: case op_shr_asn_global:
+            return shr_asn;
+        default:
+            return 0;
+        }
+    }
+
+    template<typename T>
+    inline bool compare(op_code op,T lhs,T rhs)
+    {
+        switch(op)
+        {
+        case op_cmp_less_eq: case op_cmp_less_eq_ii: case op_cmp_less_eq_ff:
+        case op_cmp_less_eq_jmp_false:
+            return lhs <= rhs;
+        case op_cmp_less: case op_cmp_less_ii: case op_cmp_less_ff:
+        case op_cmp_less_jmp_false:
+            return lhs < rhs;
+        case op_cmp_grtr_eq: case op_cmp_grtr_eq_ii: case op_cmp_grtr_eq_ff:
+        case op_cmp_grtr_eq_jmp_false:
+            return lhs >= rhs;
+        case op_cmp_grtr: case op_cmp_grtr_ii: case op_cmp_grtr_ff:
+        case op_cmp_grtr_jmp_false:
+            return lhs > rhs;
+        case op_eq: case op_eq_ii: case op_eq_ff: case op_eq_jmp_false:
+            return lhs == rhs;
+        default:
+            return lhs != rhs;
+        }
+    }
+
+    /// Compares two values the way the comparison ops do
+    inline bool compare(op_code op,const value& lhs,const value& rhs)
+    {
+        if(lhs.type == value::type_int && rhs.type == value::type_int)
+            return compare(op,lhs.intval,rhs.intval);
+        return compare(op,lhs.to_flt(),rhs.to_flt());
+    }
+}
+
+#endif//__DSCRIPT_OPERATORS_H__
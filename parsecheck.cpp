@@ -0,0 +1,253 @@
+////////////////////////////////////////////////////////////////////////////////
+// DScript Scripting Language
+// Copyright (C) 2003 Bryan "daerid" Ross
+//
+// Permission to copy, use, modify, sell and distribute this software is
+// granted provided this copyright notice appears in all copies. This
+// software is provided "as is" without express or implied warranty, and
+// with no claim as to its suitability for any purpose.
+////////////////////////////////////////////////////////////////////////////////
+
+// parsecheck: compiles scripts with both front ends of the compiler, the
+// hand-written parser of compile() and the Spirit parse tree of
+// compile_spirit(), and checks that they emit the same code and report
+// the same errors.
+//
+// usage: parsecheck [-a] [-t] script.ds...
+//
+// -a compiles with array aliases, and -t prints how long each front end
+// took. Exits with 1 if any script differs.
+//
+// Both report a script that doesn't parse as a "Parse Error", but the
+// Spirit one at the start of the first statement that didn't parse, and
+// compile() at the furthest token it tried, which is in that statement.
+// So compile() has to report it at the same place as the Spirit one, or
+// after it. Any other error has to be reported at the same place.
+
+////////////////////////////////////////////////////////////////////////////////
+// Standard Library Includes
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// DScript Includes
+#include "compiler.h"
+#include "compiler_spirit.h"
+////////////////////////////////////////////////////////////////////////////////
+
+using namespace std;
+using namespace dscript;
+
+namespace
+{
+    typedef codeblock_t (*compile_fn)(
+        const string&,
+        string_table&,
+        float_table&,
+        bool
+        );
+
+    /// What one front end made of a script
+    struct result
+    {
+        result() : failed(false), pos(0,0), seconds(0) {}
+        codeblock_t code;
+        bool failed;
+        string error;
+        code_position pos;
+        double seconds;
+    };
+
+    void compile_with(
+        compile_fn compile_script,
+        const string& source,
+        bool array_aliases,
+        string_table& strings,
+        float_table& floats,
+        result& res
+        )
+    {
+        clock_t start = clock();
+        try
+        {
+            res.code = compile_script(source,strings,floats,array_aliases);
+        }
+        catch(compiler_error& e)
+        {
+            res.failed = true;
+            res.error = e.what();
+            res.pos = e.pos;
+        }
+        res.seconds = double(clock() - start) / CLOCKS_PER_SEC;
+    }
+
+    /// Returns whether the error compile() reported is where the one the
+    /// Spirit front end reported says it should be
+    bool same_place(const result& parsed,const result& spirit)
+    {
+        if(parsed.error == "Parse Error")
+        {
+            return
+                parsed.pos.line > spirit.pos.line ||
+                (parsed.pos.line == spirit.pos.line && parsed.pos.col >= spirit.pos.col);
+        }
+        return parsed.pos.line == spirit.pos.line && parsed.pos.col == spirit.pos.col;
+    }
+
+    string describe_error(const result& res)
+    {
+        ostringstream out;
+        out << res.error << " at " << res.pos.line << ':' << res.pos.col;
+        return out.str();
+    }
+
+    /// Returns the offset of the first instruction that differs, or
+    /// npos. String and float operands are compared by value, since the
+    /// two codeblocks have tables of their own.
+    size_t find_difference(const codeblock_t& lhs,const codeblock_t& rhs)
+    {
+        size_t off = 0;
+        for(; off < lhs.size() && off < rhs.size(); off += get_instr_size(lhs.begin() + off))
+        {
+            if(lhs[off].get_op_code() != rhs[off].get_op_code())
+                return off;
+            const char* operands = get_op_operands(lhs[off].get_op_code());
+            for(size_t i = off + 1; *operands != '\0'; ++operands, ++i)
+            {
+                if(i >= lhs.size() || i >= rhs.size())
+                    return off;
+                switch(*operands)
+                {
+                case 'n':
+                case 's':
+                    if(strcmp(lhs[i].get_str(),rhs[i].get_str()) != 0)
+                        return off;
+                    break;
+                case 'f':
+                    if(*lhs[i].get_flt() != *rhs[i].get_flt())
+                        return off;
+                    break;
+                case 'c':
+                    {
+                        if(lhs[i].get_int() != rhs[i].get_int())
+                            return off;
+                        size_t slot_count = lhs[i].get_int();
+                        for(size_t slot = 0; slot < slot_count; ++slot)
+                        {
+                            ++i;
+                            if(
+                                i >= lhs.size() || i >= rhs.size() ||
+                                strcmp(lhs[i].get_str(),rhs[i].get_str()) != 0
+                                )
+                                return off;
+                        }
+                    }
+                    break;
+                default:
+                    if(lhs[i].get_offset() != rhs[i].get_offset())
+                        return off;
+                    break;
+                }
+            }
+        }
+        if(lhs.size() != rhs.size())
+            return off;
+        return string::npos;
+    }
+
+    /// Compiles a script with both front ends, and returns whether they
+    /// agree
+    bool check_script(const string& filename,bool array_aliases,bool timing)
+    {
+        ifstream file(filename.c_str(),ios::in | ios::binary);
+        if(!file)
+        {
+            cerr << filename << ": can't open file" << endl;
+            return false;
+        }
+        string source(
+            (istreambuf_iterator<char>(file)),
+            istreambuf_iterator<char>()
+            );
+
+        string_table strings, spirit_strings;
+        float_table floats, spirit_floats;
+        result parsed, spirit;
+        compile_with(compile,source,array_aliases,strings,floats,parsed);
+        compile_with(compile_spirit,source,array_aliases,spirit_strings,spirit_floats,spirit);
+
+        if(timing)
+        {
+            cout << filename << ": " << parsed.seconds << "s, Spirit "
+                << spirit.seconds << 's' << endl;
+        }
+
+        if(parsed.failed || spirit.failed)
+        {
+            if(
+                parsed.failed && spirit.failed &&
+                parsed.error == spirit.error &&
+                same_place(parsed,spirit)
+                )
+                return true;
+            cout << filename << ": compile() "
+                << (parsed.failed ? describe_error(parsed) : string("succeeded"))
+                << ", compile_spirit() "
+                << (spirit.failed ? describe_error(spirit) : string("succeeded"))
+                << endl;
+            return false;
+        }
+
+        size_t off = find_difference(parsed.code,spirit.code);
+        if(off == string::npos)
+            return true;
+        cout << filename << ": the code differs at offset " << off << ": "
+            << (off < parsed.code.size() ? get_op_name(parsed.code[off].get_op_code()) : "end")
+            << ", Spirit "
+            << (off < spirit.code.size() ? get_op_name(spirit.code[off].get_op_code()) : "end")
+            << endl;
+        return false;
+    }
+}
+
+int main(int argc,char* argv[])
+{
+    bool array_aliases = false;
+    bool timing = false;
+    vector<string> files;
+    for(int i = 1; i < argc; ++i)
+    {
+        if(strcmp(argv[i],"-a") == 0)
+            array_aliases = true;
+        else if(strcmp(argv[i],"-t") == 0)
+            timing = true;
+        else
+            files.push_back(argv[i]);
+    }
+    if(files.empty())
+    {
+        cerr << "usage: parsecheck [-a] [-t] script.ds..." << endl;
+        return 1;
+    }
+
+    size_t differ = 0;
+    for(size_t i = 0; i < files.size(); ++i)
+    {
+        if(!check_script(files[i],array_aliases,timing))
+            ++differ;
+    }
+    if(differ != 0)
+    {
+        cout << differ << " of " << files.size() << " scripts differ" << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -287,6 +287,9 @@ namespace stdlib
         case dscript::value::type_str:
             ctx.set_return("string");
             break;
+        case dscript::value::type_array:
+            ctx.set_return("array");
+            break;
         default:
             ctx.set_return("unknown");
             break;
@@ -301,31 +304,31 @@ namespace
         ctx.link_function(
             "strcmp",
             &dscript::stdlib::strcmp,
-            2,2,"(%str1,%str2)"
+            2,2,"(%str1,%str2)",false
             );
 
         ctx.link_function(
             "stricmp",
             &dscript::stdlib::stricmp,
-            2,2,"(%str1,%str2)"
+            2,2,"(%str1,%str2)",false
             );
 
         ctx.link_function(
             "strncmp",
             &dscript::stdlib::strncmp,
-            3,3,"(%str1,%str2,%count)"
+            3,3,"(%str1,%str2,%count)",false
             );
 
         ctx.link_function(
             "strnicmp",
             &dscript::stdlib::strnicmp,
-            3,3,"(%str1,%str2,%count)"
+            3,3,"(%str1,%str2,%count)",false
             );
 
         ctx.link_function(
             "substr",
             &dscript::stdlib::substr,
-            2,3,"(%str,%start[,%length])"
+            2,3,"(%str,%start[,%length])",false
             );
     }
 
@@ -334,49 +337,49 @@ namespace
         ctx.link_function(
             "sqrt",
             &dscript::stdlib::sqrt,
-            1,1,"(%num)"
+            1,1,"(%num)",false
             );
 
         ctx.link_function(
             "sin",
             &dscript::stdlib::sin,
-            1,1,"(%num)"
+            1,1,"(%num)",false
             );
 
         ctx.link_function(
             "cos",
             &dscript::stdlib::cos,
-            1,1,"(%num)"
+            1,1,"(%num)",false
             );
 
         ctx.link_function(
             "tan",
             &dscript::stdlib::tan,
-            1,1,"(%num)"
+            1,1,"(%num)",false
             );
 
         ctx.link_function(
             "asin",
             &dscript::stdlib::asin,
-            1,1,"(%num)"
+            1,1,"(%num)",false
             );
 
         ctx.link_function(
             "acos",
             &dscript::stdlib::acos,
-            1,1,"(%num)"
+            1,1,"(%num)",false
             );
 
         ctx.link_function(
             "atan",
             &dscript::stdlib::atan,
-            1,1,"(%num)"
+            1,1,"(%num)",false
             );
 
         ctx.link_function(
             "pow",
             &dscript::stdlib::pow,
-            2,2,"(%num,%exp)"
+            2,2,"(%num,%exp)",false
             );
 
 
@@ -387,42 +390,44 @@ namespace
     {
         ctx.link_function(
             "print",
-            &dscript::stdlib::print
+            &dscript::stdlib::print,
+            -1,-1,0,false
             );
 
         ctx.link_function(
             "readln",
-            &dscript::stdlib::readln
+            &dscript::stdlib::readln,
+            -1,-1,0,false
             );
 
         ctx.link_function(
             "fopen",
             &dscript::stdlib::fopen,
-            2,2,"(%filename,%mode)"
+            2,2,"(%filename,%mode)",false
             );
 
         ctx.link_function(
             "fclose",
             &dscript::stdlib::fclose,
-            1,1,"(%filehandle)"
+            1,1,"(%filehandle)",false
             );
 
         ctx.link_function(
             "fgets",
             &dscript::stdlib::fgets,
-            2,2,"(%filehandle,%maxlength)"
+            2,2,"(%filehandle,%maxlength)",false
             );
 
         ctx.link_function(
             "fputs",
             &dscript::stdlib::fgets,
-            2,2,"(%filehandle,%value)"
+            2,2,"(%filehandle,%value)",false
             );
 
         ctx.link_function(
             "feof",
             &dscript::stdlib::feof,
-            1,1,"(%filehandle)"
+            1,1,"(%filehandle)",false
             );
 
     }
@@ -432,7 +437,7 @@ namespace
         ctx.link_function(
             "gettype",
             &dscript::stdlib::gettype,
-            1,1,"(%val)"
+            1,1,"(%val)",false
             );
     }
 }
@@ -8,6 +8,12 @@
 // with no claim as to its suitability for any purpose.
 ////////////////////////////////////////////////////////////////////////////////
 
+////////////////////////////////////////////////////////////////////////////////
+// Standard Library Includes
+#include <cctype>
+#include <cstring>
+////////////////////////////////////////////////////////////////////////////////
+
 ////////////////////////////////////////////////////////////////////////////////
 // DScript Includes
 #include "stringtable.h"
@@ -16,22 +22,242 @@
 using namespace std;
 using namespace dscript;
 
+namespace
+{
+    /// FNV-1a
+    size_t hash_chars(const char* chars,size_t length)
+    {
+        size_t hash = 2166136261u;
+        for(size_t c = 0; c < length; ++c)
+        {
+            hash ^= static_cast<unsigned char>(chars[c]);
+            hash *= 16777619u;
+        }
+        return hash;
+    }
+
+    /// Returns str in lower case, the form symbols are kept in
+    string fold(const string& str)
+    {
+        string folded(str);
+        for(size_t c = 0; c < folded.size(); ++c)
+            folded[c] = static_cast<char>(
+                tolower(static_cast<unsigned char>(folded[c]))
+                );
+        return folded;
+    }
+
+    /// Returns the smallest table size that keeps the load under 1/2
+    size_t table_size(size_t count)
+    {
+        size_t size = 16;
+        while(size < count * 2)
+            size *= 2;
+        return size;
+    }
+}
+
+string_table::string_table()
+    : m_count(0), m_symbols(1), m_collections(0), m_reclaimed(0)
+{
+    // symbol 0 means no symbol, so it is never used
+}
+
+string_table::~string_table()
+{
+    for(size_t slot = 0; slot < m_nodes.size(); ++slot)
+        ::operator delete(m_nodes[slot]);
+}
+
+size_t string_table::find_slot(const char* chars,size_t hash) const
+{
+    // linear probing, the table size is always a power of 2
+    size_t mask = m_nodes.size() - 1;
+    size_t slot = hash & mask;
+    while(m_nodes[slot] != 0)
+    {
+        const node* n = m_nodes[slot];
+        if(n->hash == hash && strcmp(n->chars,chars) == 0)
+            break;
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+size_t string_table::find_symbol_slot(const string& folded,size_t hash) const
+{
+    size_t mask = m_symbol_index.size() - 1;
+    size_t slot = hash & mask;
+    while(m_symbol_index[slot] != 0)
+    {
+        const symbol_info& info = m_symbols[m_symbol_index[slot]];
+        if(info.hash == hash && info.name == folded)
+            break;
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
 string_table::entry string_table::insert(const string& val)
 {
-    typedef set<string>::const_iterator iter_t;
-    typedef pair<iter_t,bool> ret_t;
-    ret_t r = m_strings.insert(val);
-    return r.first->c_str();
+    size_t hash = hash_chars(val.data(),val.size());
+    if(m_count != 0)
+    {
+        node* found = m_nodes[find_slot(val.c_str(),hash)];
+        if(found != 0)
+            return found->chars;
+    }
+    if((m_count + 1) * 4 > m_nodes.size() * 3)
+        rehash(table_size(m_count + 1));
+
+    // every spelling of a name shares one symbol
+    string folded = fold(val);
+    size_t sym_hash = hash_chars(folded.data(),folded.size());
+    symbol sym = 0;
+    if(!m_symbol_index.empty())
+        sym = m_symbol_index[find_symbol_slot(folded,sym_hash)];
+    if(sym == 0)
+        sym = add_symbol(folded,sym_hash);
+
+    void* mem = ::operator new(offsetof(node,chars) + val.size() + 1);
+    node* n = static_cast<node*>(mem);
+    n->hash = hash;
+    n->sym = sym;
+    n->marked = false;
+    memcpy(n->chars,val.c_str(),val.size() + 1);
+    m_nodes[find_slot(n->chars,hash)] = n;
+    ++m_count;
+    return n->chars;
 }
 
 string_table::entry string_table::find(const string& val)
 {
-    typedef set<string>::const_iterator c_iter;
-    c_iter found = m_strings.find(val);
-    if(found == m_strings.end())
+    if(m_count == 0)
+        return 0;
+    size_t hash = hash_chars(val.data(),val.size());
+    node* found = m_nodes[find_slot(val.c_str(),hash)];
+    return found != 0 ? found->chars : 0;
+}
+
+string_table::symbol string_table::find_symbol(const string& name) const
+{
+    if(m_symbol_index.empty())
         return 0;
+    string folded = fold(name);
+    size_t hash = hash_chars(folded.data(),folded.size());
+    return m_symbol_index[find_symbol_slot(folded,hash)];
+}
+
+string_table::symbol string_table::add_symbol(const string& folded,size_t hash)
+{
+    size_t used = m_symbols.size() - 1 - m_free_symbols.size();
+    if((used + 1) * 4 > m_symbol_index.size() * 3)
+        rehash_symbols(table_size(used + 1));
+
+    symbol sym;
+    if(m_free_symbols.empty())
+    {
+        sym = static_cast<symbol>(m_symbols.size());
+        m_symbols.push_back(symbol_info());
+    }
     else
-        return found->c_str();
+    {
+        sym = m_free_symbols.back();
+        m_free_symbols.pop_back();
+    }
+    symbol_info& info = m_symbols[sym];
+    info.name = folded;
+    info.hash = hash;
+    info.used = true;
+    m_symbol_index[find_symbol_slot(folded,hash)] = sym;
+    return sym;
+}
+
+void string_table::rehash(size_t size)
+{
+    vector<node*> old(size,0);
+    old.swap(m_nodes);
+    size_t mask = size - 1;
+    for(size_t i = 0; i < old.size(); ++i)
+    {
+        if(old[i] == 0)
+            continue;
+        size_t slot = old[i]->hash & mask;
+        while(m_nodes[slot] != 0)
+            slot = (slot + 1) & mask;
+        m_nodes[slot] = old[i];
+    }
+}
+
+void string_table::rehash_symbols(size_t size)
+{
+    m_symbol_index.assign(size,0);
+    size_t mask = size - 1;
+    for(symbol sym = 1; sym < m_symbols.size(); ++sym)
+    {
+        if(!m_symbols[sym].used)
+            continue;
+        size_t slot = m_symbols[sym].hash & mask;
+        while(m_symbol_index[slot] != 0)
+            slot = (slot + 1) & mask;
+        m_symbol_index[slot] = sym;
+    }
+}
+
+void string_table::mark(entry e)
+{
+    node* n = get_node(e);
+    n->marked = true;
+    mark_symbol(n->sym);
+}
+
+void string_table::mark_symbol(symbol sym)
+{
+    if(m_marked_symbols.size() <= sym)
+        m_marked_symbols.resize(m_symbols.size(),false);
+    m_marked_symbols[sym] = true;
+}
+
+size_t string_table::sweep()
+{
+    size_t reclaimed = 0;
+    for(size_t slot = 0; slot < m_nodes.size(); ++slot)
+    {
+        node* n = m_nodes[slot];
+        if(n == 0)
+            continue;
+        if(n->marked)
+            n->marked = false;
+        else
+        {
+            ::operator delete(n);
+            m_nodes[slot] = 0;
+            ++reclaimed;
+        }
+    }
+    m_count -= reclaimed;
+    // removing entries breaks up the probe sequences
+    rehash(table_size(m_count));
+
+    // a symbol lives as long as it's marked
+    m_marked_symbols.resize(m_symbols.size(),false);
+    for(symbol sym = 1; sym < m_symbols.size(); ++sym)
+    {
+        symbol_info& info = m_symbols[sym];
+        if(info.used && !m_marked_symbols[sym])
+        {
+            info.used = false;
+            string().swap(info.name);
+            m_free_symbols.push_back(sym);
+        }
+    }
+    m_marked_symbols.clear();
+    size_t used = m_symbols.size() - 1 - m_free_symbols.size();
+    rehash_symbols(table_size(used));
+
+    ++m_collections;
+    m_reclaimed += reclaimed;
+    return reclaimed;
 }
 
 string dscript::escape(const string& str)
@@ -13,8 +13,9 @@
 
 ////////////////////////////////////////////////////////////////////////////////
 // Standard Library Includes
+#include <cstddef>
 #include <string>
-#include <set>
+#include <vector>
 ////////////////////////////////////////////////////////////////////////////////
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -27,14 +28,105 @@
 namespace dscript
 {
     /// Maintains a list of strings in use by the runtime
+    ///
+    /// Every entry also has a symbol: a small integer that is the same
+    /// for all entries that only differ by case, so names can be compared
+    /// and hashed without looking at their characters.
+    ///
+    /// Strings that nothing refers to anymore (such as the names of
+    /// variables created at runtime, after they go out of scope) can be
+    /// reclaimed by a collection: mark() every entry and symbol still in
+    /// use, then sweep() the rest away.
     class string_table
     {
     public:
         typedef const char* entry;
+
+        /// Identifies a name regardless of case. Symbols start at 1, and
+        /// are reused once swept away.
+        typedef unsigned int symbol;
+
+        string_table();
+        ~string_table();
+
         entry insert(const std::string& val);
         entry find(const std::string& val);
+
+        /// Returns the symbol of an entry of any string_table
+        static symbol get_symbol(entry e) { return get_node(e)->sym; }
+
+        /// Returns the symbol of the entries equal to name (ignoring
+        /// case), or 0 if there are none
+        symbol find_symbol(const std::string& name) const;
+
+        /// Keeps an entry (and its symbol) through the next sweep()
+        void mark(entry e);
+
+        /// Keeps a symbol through the next sweep(), even if none of its
+        /// entries are marked
+        void mark_symbol(symbol sym);
+
+        /// Removes every entry and symbol not marked since the last
+        /// sweep(), and returns how many entries there were. Any entry
+        /// that wasn't marked is invalid afterwards.
+        size_t sweep();
+
+        /// The number of strings in the table
+        size_t size() const { return m_count; }
+
+        /// The number of sweeps so far
+        size_t get_collections() const { return m_collections; }
+
+        /// The number of strings removed by all sweeps so far
+        size_t get_reclaimed() const { return m_reclaimed; }
     private:
-        std::set<std::string> m_strings;
+        // an entry is the chars of one of these
+        struct node
+        {
+            size_t hash;
+            symbol sym;
+            bool marked;
+            char chars[1];
+        };
+
+        // a symbol, and the hash of its case folded name
+        struct symbol_info
+        {
+            symbol_info() : hash(0), used(false) {}
+            std::string name;
+            size_t hash;
+            bool used;
+        };
+
+        static node* get_node(entry e)
+        {
+            return reinterpret_cast<node*>(
+                const_cast<char*>(e) - offsetof(node,chars)
+                );
+        }
+
+        size_t find_slot(const char* chars,size_t hash) const;
+        size_t find_symbol_slot(const std::string& folded,size_t hash) const;
+        symbol add_symbol(const std::string& folded,size_t hash);
+        void rehash(size_t size);
+        void rehash_symbols(size_t size);
+
+        // the entries, open addressed by hash
+        std::vector<node*> m_nodes;
+        size_t m_count;
+
+        // the symbols by number, and open addressed by hash
+        std::vector<symbol_info> m_symbols;
+        std::vector<symbol> m_symbol_index;
+        std::vector<symbol> m_free_symbols;
+        std::vector<bool> m_marked_symbols;
+
+        size_t m_collections;
+        size_t m_reclaimed;
+
+        // not copyable
+        string_table(const string_table&);
+        string_table& operator = (const string_table&);
     };
 
     /// Used to compare two string_table::entries
@@ -52,6 +144,20 @@ namespace dscript
         }
     };
 
+    /// Used to check two string_table::entries for equality
+    inline bool equal_ste(string_table::entry left,string_table::entry right)
+    {
+        if(left == right)
+            return true;
+#ifdef _MSC_VER
+        return _stricmp(left,right) == 0;
+#endif
+
+#ifdef __GNUC__
+        return strcasecmp(left, right) == 0;
+#endif
+    }
+
     std::string escape(const std::string& str);
     std::string unescape(const std::string& str);
 }
@@ -0,0 +1,148 @@
+////////////////////////////////////////////////////////////////////////////////
+// DScript Scripting Language
+// Copyright (C) 2003 Bryan "daerid" Ross
+//
+// Permission to copy, use, modify, sell and distribute this software is
+// granted provided this copyright notice appears in all copies. This
+// software is provided "as is" without express or implied warranty, and
+// with no claim as to its suitability for any purpose.
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef __DSCRIPT_SYMBOLMAP_H__
+#define __DSCRIPT_SYMBOLMAP_H__
+
+////////////////////////////////////////////////////////////////////////////////
+// Standard Library Includes
+#include <vector>
+////////////////////////////////////////////////////////////////////////////////
+
+////////////////////////////////////////////////////////////////////////////////
+// DScript Includes
+#include "stringtable.h"
+////////////////////////////////////////////////////////////////////////////////
+
+namespace dscript
+{
+    /// A hash table keyed by string_table::symbol, so looking up a name
+    /// takes a probe and an integer compare.
+    ///
+    /// Adding a key can move every value, so references and pointers to
+    /// values are only good until the next key is added.
+    template<typename T>
+    class symbol_map
+    {
+    public:
+        typedef string_table::symbol symbol;
+
+        symbol_map() : m_count(0) {}
+
+        /// Returns the value of key, or 0 if there is none
+        T* find(symbol key)
+        {
+            if(m_count == 0)
+                return 0;
+            slot_t& slot = m_slots[find_slot(key)];
+            return slot.key != 0 ? &slot.val : 0;
+        }
+        const T* find(symbol key) const
+        {
+            return const_cast<symbol_map*>(this)->find(key);
+        }
+
+        /// Returns the value of key, adding a default one if needed
+        T& operator[](symbol key)
+        {
+            if(m_count != 0)
+            {
+                slot_t& slot = m_slots[find_slot(key)];
+                if(slot.key != 0)
+                    return slot.val;
+            }
+            // keep the load factor under 3/4
+            if((m_count + 1) * 4 > m_slots.size() * 3)
+                grow();
+            slot_t& slot = m_slots[find_slot(key)];
+            slot.key = key;
+            ++m_count;
+            return slot.val;
+        }
+
+        /// Removes key, returns whether it was there
+        bool erase(symbol key)
+        {
+            if(m_count == 0)
+                return false;
+            size_t mask = m_slots.size() - 1;
+            size_t hole = find_slot(key);
+            if(m_slots[hole].key == 0)
+                return false;
+
+            // move back anything that probed past the hole, so that
+            // lookups never stop short of it
+            size_t next = (hole + 1) & mask;
+            while(m_slots[next].key != 0)
+            {
+                size_t home = hash(m_slots[next].key) & mask;
+                if(((next - home) & mask) >= ((next - hole) & mask))
+                {
+                    m_slots[hole] = m_slots[next];
+                    hole = next;
+                }
+                next = (next + 1) & mask;
+            }
+            m_slots[hole] = slot_t();
+            --m_count;
+            return true;
+        }
+
+        size_t size() const { return m_count; }
+        bool empty() const { return m_count == 0; }
+
+        /// The keys and values are visited by slot, from 0 to
+        /// slot_count(). Empty slots have a key of 0.
+        size_t slot_count() const { return m_slots.size(); }
+        symbol get_key(size_t slot) const { return m_slots[slot].key; }
+        T& get_value(size_t slot) { return m_slots[slot].val; }
+        const T& get_value(size_t slot) const { return m_slots[slot].val; }
+
+    private:
+        struct slot_t
+        {
+            slot_t() : key(0), val() {}
+            symbol key;
+            T val;
+        };
+
+        static size_t hash(symbol key)
+        {
+            // symbols are dense, so spread them over the table
+            return key * 2654435761u;
+        }
+
+        size_t find_slot(symbol key) const
+        {
+            // linear probing, the table size is always a power of 2
+            size_t mask = m_slots.size() - 1;
+            size_t slot = hash(key) & mask;
+            while(m_slots[slot].key != 0 && m_slots[slot].key != key)
+                slot = (slot + 1) & mask;
+            return slot;
+        }
+
+        void grow()
+        {
+            std::vector<slot_t> old(m_slots.empty() ? 8 : m_slots.size() * 2);
+            old.swap(m_slots);
+            for(size_t i = 0; i < old.size(); ++i)
+            {
+                if(old[i].key != 0)
+                    m_slots[find_slot(old[i].key)] = old[i];
+            }
+        }
+
+        std::vector<slot_t> m_slots;
+        size_t m_count;
+    };
+}
+
+#endif//__DSCRIPT_SYMBOLMAP_H__
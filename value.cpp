@@ -10,66 +10,80 @@
 
 ////////////////////////////////////////////////////////////////////////////////
 // Standard Library Includes
+#include <cstring>
 #include <sstream>
 ////////////////////////////////////////////////////////////////////////////////
 
 ////////////////////////////////////////////////////////////////////////////////
 // DScript Includes
 #include "value.h"
+#include "array.h"
 ////////////////////////////////////////////////////////////////////////////////
 
 using namespace std;
 using namespace dscript;
 
-value::value() 
-    : strval(""), intval(0), fltval(0), type(type_str)
+namespace
 {
-}
+    /// Allocates a buffer with room for at least capacity characters,
+    /// holding a copy of the first length characters of chars
+    str_buffer* alloc_buffer(const char* chars,size_t length,size_t capacity)
+    {
+        void* mem = ::operator new(sizeof(str_buffer) + capacity);
+        str_buffer* buf = static_cast<str_buffer*>(mem);
+        buf->refs = 1;
+        buf->length = length;
+        buf->capacity = capacity;
+        memcpy(buf->chars,chars,length);
+        buf->chars[length] = '\0';
+        return buf;
+    }
 
-value::value(int i) 
-    : intval(i), type(type_int) 
-{
+    str_buffer* make_buffer(const char* chars,size_t length)
+    {
+        // the empty string doesn't need a buffer
+        if(length == 0)
+            return 0;
+        return alloc_buffer(chars,length,length);
+    }
 }
 
-value::value(double d)
- : fltval(d), type(type_flt)
+void value::free_buffer(str_buffer* buf)
 {
+    ::operator delete(buf);
 }
 
 value::value(const string& s)
- : strval(s), type(type_str)
+ : type(type_str), strbuf(make_buffer(s.data(),s.size()))
 {
 }
 
 value::value(string_table::entry s)
- : strval(s), type(type_str)
-{
-}
-
-value::value(const value& other)
-     : type(other.type), 
-     strval(other.strval), 
-     intval(other.intval), 
-     fltval(other.fltval)
+ : type(type_str), strbuf(make_buffer(s,strlen(s)))
 {
 }
 
 value& value::operator = (const string& s)
 {
+    str_buffer* buf = make_buffer(s.data(),s.size());
+    release();
     type = type_str;
-    strval = s;
+    strbuf = buf;
     return *this;
 }
 
 value& value::operator = (string_table::entry s)
 {
+    str_buffer* buf = make_buffer(s,strlen(s));
+    release();
     type = type_str;
-    strval = s;
+    strbuf = buf;
     return *this;
 }
 
 value& value::operator = (int i)
 {
+    release();
     type = type_int;
     intval = i;
     return *this;
@@ -77,20 +91,12 @@ value& value::operator = (int i)
 
 value& value::operator = (double d)
 {
+    release();
     type = type_flt;
     fltval = d;
     return *this;
 }
 
-value& value::operator =(const value& other)
-{
-    type = other.type;
-    intval = other.intval;
-    strval = other.strval;
-    fltval = other.fltval;
-    return *this;
-}
-
 string value::to_str() const 
 {
     switch(type)
@@ -109,8 +115,11 @@ string value::to_str() const
             return s.str();
         }
         break;
+    case type_array:
+        // arrays have no scalar value
+        return string();
     default:
-        return strval;
+        return string(str_begin(),str_length());
     }
 }
 
@@ -122,7 +131,7 @@ int value::to_int() const
         {
             int i = 0;
             stringstream s;
-            s << strval;
+            s.write(str_begin(),str_length());
             s >> i;
             return i;
         }
@@ -130,6 +139,8 @@ int value::to_int() const
     case type_flt:
         return (int)fltval;
         break;
+    case type_array:
+        return 0;
     default:
         return intval;
     }
@@ -143,7 +154,7 @@ double value::to_flt() const
         {
             double d = 0.0;
             stringstream s;
-            s << strval;
+            s.write(str_begin(),str_length());
             s >> d;
             return d;
         }
@@ -151,6 +162,8 @@ double value::to_flt() const
     case type_int:
         return (double)intval;
         break;
+    case type_array:
+        return 0.0;
     default:
         return fltval;
     }
@@ -158,17 +171,50 @@ double value::to_flt() const
 
 void value::set_type(value::ty new_type)
 {
+    if(new_type == type)
+        return;
     switch(new_type)
     {
     case type_str:
-        strval = to_str();
+        *this = to_str();
         break;
     case type_int:
-        intval = to_int();
+        *this = to_int();
         break;
     case type_flt:
-        fltval = to_flt();
+        *this = to_flt();
+        break;
+    case type_array:
+        make_unique_array(*this);
         break;
     }
-    type = new_type;
+}
+
+void value::cat(const value& val)
+{
+    set_type(type_str);
+    if(val.type != type_str)
+    {
+        cat(val.to_str());
+        return;
+    }
+    size_t add = val.str_length();
+    if(add == 0)
+        return;
+    size_t length = str_length();
+    if(strbuf != 0 && strbuf->refs == 1 && length + add <= strbuf->capacity)
+    {
+        // nobody else can see the buffer, so it can grow in place
+        memcpy(strbuf->chars + length,val.str_begin(),add);
+        strbuf->length = length + add;
+        strbuf->chars[length + add] = '\0';
+        return;
+    }
+    // leave room to grow, so repeated concatenation stays linear
+    str_buffer* buf = alloc_buffer(str_begin(),length,(length + add) * 2);
+    memcpy(buf->chars + length,val.str_begin(),add);
+    buf->length = length + add;
+    buf->chars[length + add] = '\0';
+    release();
+    strbuf = buf;
 }
@@ -13,36 +13,67 @@
 
 ////////////////////////////////////////////////////////////////////////////////
 // Standard Library Includes
+#include <cstddef>
 #include <string>
-#include <map>
+#include <ostream>
 ////////////////////////////////////////////////////////////////////////////////
 
 ////////////////////////////////////////////////////////////////////////////////
 // DScript Includes
 #include "instruction.h"
+#include "symbolmap.h"
 ////////////////////////////////////////////////////////////////////////////////
 
 namespace dscript
 {
+    /// The characters of a string value. Buffers are shared between
+    /// values by reference count, and never change once shared.
+    struct str_buffer
+    {
+        size_t refs;
+        size_t length;
+        size_t capacity;
+        char chars[1];
+    };
+
+    class array_data;
+
     /// This is the actual value data type that DScript works with.
+    /// It is a type tag plus one word of data, so copies never allocate:
+    /// a string value just shares its buffer, and an array its elements
+    /// (see array.h). The empty string has no buffer at all.
     struct value
     {
         enum ty
         {
             type_str,
             type_int,
-            type_flt        
+            type_flt,
+            type_array
         };
         ty type;
 
-        value();
-        value(int i);
-        value(double d);
+        value() : type(type_str), strbuf(0) {}
+        value(int i) : type(type_int), intval(i) {}
+        value(double d) : type(type_flt), fltval(d) {}
         value(const std::string& s);
         value(string_table::entry s);
 
-        value(const value& other);
-        value& operator = (const value& other);
+        value(const value& other) : type(other.type)
+        {
+            copy_data(other);
+        }
+        value& operator = (const value& other)
+        {
+            if(this != &other)
+            {
+                release();
+                type = other.type;
+                copy_data(other);
+            }
+            return *this;
+        }
+        ~value() { release(); }
 
         value& operator = (const std::string& s);
         value& operator = (string_table::entry s);
@@ -54,14 +85,58 @@ namespace dscript
         double to_flt() const;
 
         void set_type(ty new_type);
-        void clear() { strval = ""; intval = 0; fltval = 0.0; type = type_str; }
+        void clear() { release(); type = type_str; strbuf = 0; }
+
+        /// Converts the value to a string and appends val to it
+        void cat(const value& val);
+
+        /// The characters of a string value
+        const char* str_begin() const
+        {
+            return strbuf != 0 ? strbuf->chars : "";
+        }
+        size_t str_length() const
+        {
+            return strbuf != 0 ? strbuf->length : 0;
+        }
+
+        union
+        {
+            int intval;
+            double fltval;
+            str_buffer* strbuf;
+            array_data* arrval;
+        };
 
-        std::string strval;
-        int intval;
-        double fltval;
+    private:
+        // copies other's data, which must be of the same type
+        void copy_data(const value& other)
+        {
+            if(type == type_flt)
+                fltval = other.fltval;
+            else
+            {
+                // ints fit in the pointer
+                strbuf = other.strbuf;
+                if(type == type_str && strbuf != 0)
+                    ++strbuf->refs;
+                else if(type == type_array)
+                    retain_array(arrval);
+            }
+        }
+        void release()
+        {
+            if(type == type_str && strbuf != 0 && --strbuf->refs == 0)
+                free_buffer(strbuf);
+            else if(type == type_array)
+                release_array(arrval);
+        }
+        static void free_buffer(str_buffer* buf);
+        static void retain_array(array_data* arr);
+        static void release_array(array_data* arr);
     };
 
-    typedef std::map<string_table::entry,value,cmp_ste> dictionary_t;
+    typedef symbol_map<value> dictionary_t;
 }
 
 inline std::ostream& operator << (std::ostream& out, const dscript::value& v)
@@ -69,7 +144,7 @@ inline std::ostream& operator << (std::ostream& out, const dscript::value& v)
     switch(v.type)
     {
     case dscript::value::type_str:
-        out << v.strval;
+        out.write(v.str_begin(),static_cast<std::streamsize>(v.str_length()));
         break;
     case dscript::value::type_int:
         out << v.intval;
@@ -77,6 +152,8 @@ inline std::ostream& operator << (std::ostream& out, const dscript::value& v)
     case dscript::value::type_flt:
         out << v.fltval;
         break;
+    case dscript::value::type_array:
+        break;
     }
     return out;
 }
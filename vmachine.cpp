@@ -15,35 +15,730 @@
 #include <stdexcept>
 ////////////////////////////////////////////////////////////////////////////////
 
+////////////////////////////////////////////////////////////////////////////////
+// Boost Includes (http://www.boost.org)
+#include <boost/static_assert.hpp>
+////////////////////////////////////////////////////////////////////////////////
+
 ////////////////////////////////////////////////////////////////////////////////
 // DScript Includes
 #include "vmachine.h"
 #include "context.h"
+#include "array.h"
+#include "compiler.h"
+#include "jit.h"
+#include "native.h"
+#include "operators.h"
 ////////////////////////////////////////////////////////////////////////////////
 
 using namespace std;
 using namespace dscript;
 
+////////////////////////////////////////////////////////////////////////////////
+// Dispatch
+//
+// With GCC (and Clang) the op_code handlers are threaded together using
+// labels-as-values: every handler ends in its own indirect jump to the next
+// handler, instead of going back through a single switch. The threaded
+// form trusts the codeblock to contain only valid op_codes. Define
+// DSCRIPT_SWITCH_DISPATCH to force the portable switch loop.
+#if defined(__GNUC__) && !defined(DSCRIPT_SWITCH_DISPATCH)
+#define DSCRIPT_THREADED_DISPATCH
+#endif
+
+#ifdef DSCRIPT_THREADED_DISPATCH
+#define VM_CASE(op) L_##op:
+#define VM_NEXT \
+    do { \
+        if(instr == end) goto vm_return; \
+        goto *dispatch_table[instr->get_op_code()]; \
+    } while(0)
+#else
+#define VM_CASE(op) case op:
+#define VM_NEXT continue
+#endif
+
+// The body of a quickened binary op. Guards that both operands are of
+// type ty, and deopts back to the generic op if not. Otherwise runs store
+// with lhs and rhs holding the operands (read from member as ctype), and
+// newtop being the result.
+#define VM_QUICK_BINARY(ctype,ty,member,generic,store) \
+    { \
+        value& top = m_runtime_stack.top(); \
+        if(top.type == value::ty) \
+        { \
+            ctype rhs = top.member; \
+            m_runtime_stack.pop(); \
+            value& newtop = m_runtime_stack.top(); \
+            if(newtop.type == value::ty) \
+            { \
+                ctype lhs = newtop.member; \
+                store; \
+                ++instr; \
+                VM_NEXT; \
+            } \
+            m_runtime_stack.push(rhs); \
+        } \
+        deopt(instr,generic); \
+    } \
+    VM_NEXT
+
+// The body of a comparison fused with op_jmp_false. Compares the two
+// values on top of the stack like the generic comparison ops do, and
+// jumps to the offset operand if the comparison is false.
+#define VM_CMP_JMP_FALSE(cmp) \
+    { \
+        value top = m_runtime_stack.top(); \
+        m_runtime_stack.pop(); \
+        value& newtop = m_runtime_stack.top(); \
+        bool result; \
+        if(top.type == value::type_int && newtop.type == value::type_int) \
+            result = newtop.intval cmp top.intval; \
+        else \
+            result = newtop.to_flt() cmp top.to_flt(); \
+        m_runtime_stack.pop(); \
+        ++instr; \
+        if(result) \
+            ++instr; \
+        else \
+            instr = begin + instr->get_int(); \
+    } \
+    VM_NEXT
+
+// (re)loads the codeblock and the slots of the frame on top of the call
+// stack. Needed whenever a frame is entered or left, and after anything
+// that may have grown m_locals
+#define VM_LOAD_FRAME \
+    do { \
+        call_frame& top = m_callstack.top(); \
+        begin = top.begin; \
+        end = top.end; \
+        locals = top.local_count ? &m_locals[top.base] : 0; \
+    } while(0)
+////////////////////////////////////////////////////////////////////////////////
+
+namespace
+{
+    // Quickening. Each generic binary op profiles the types of its
+    // operands in its op_code slot (see instruction::get_profile). After
+    // seeing two ints, or two floats, quicken_after times in a row, the
+    // op is rewritten to its _ii or _ff form. Those only check the types
+    // of their operands, and deopt back to the generic op when they
+    // don't match. An op that has deopted max_deopts times stays generic.
+    //
+    // The profile holds the last operand_kind seen in its low byte, how
+    // many times in a row it was seen in the next, and the number of
+    // deopts above those.
+
+    enum operand_kind
+    {
+        kind_mixed,
+        kind_ii,
+        kind_ff
+    };
+
+    const unsigned int quicken_after = 8;
+    const unsigned int max_deopts = 4;
+
+    inline void quicken(
+        instr_iter instr,
+        const value& lhs,
+        const value& rhs,
+        op_code op_ii,
+        op_code op_ff
+        )
+    {
+        instruction& op = const_cast<instruction&>(*instr);
+        unsigned int profile = op.get_profile();
+        unsigned int deopts = profile >> 16;
+        if(deopts >= max_deopts)
+            return;
+
+        operand_kind kind = kind_mixed;
+        if(lhs.type == value::type_int && rhs.type == value::type_int)
+            kind = kind_ii;
+        else if(lhs.type == value::type_flt && rhs.type == value::type_flt)
+            kind = kind_ff;
+
+        unsigned int hits = 0;
+        if(kind != kind_mixed)
+        {
+            if((profile & 0xff) == unsigned(kind))
+                hits = ((profile >> 8) & 0xff) + 1;
+            else
+                hits = 1;
+            if(hits >= quicken_after)
+            {
+                op.set_op_code(kind == kind_ii ? op_ii : op_ff);
+                hits = 0;
+            }
+        }
+        op.set_profile((deopts << 16) | (hits << 8) | kind);
+    }
+
+    inline void deopt(instr_iter instr,op_code generic)
+    {
+        instruction& op = const_cast<instruction&>(*instr);
+        unsigned int deopts = (op.get_profile() >> 16) + 1;
+        op.set_op_code(generic);
+        op.set_profile(deopts << 16);
+    }
+
+    /// Does the assignment named by op, the named variable form of an
+    /// assignment op_code, to an array element
+    void assign_elem(value& elem,op_code op,const value& val)
+    {
+        switch(op)
+        {
+        case op_assign_var:     elem = val;             break;
+        case op_mul_asn_var:    mul_asn(elem,val);      break;
+        case op_div_asn_var:    div_asn(elem,val);      break;
+        case op_mod_asn_var:    mod_asn(elem,val);      break;
+        case op_add_asn_var:    add_asn(elem,val);      break;
+        case op_sub_asn_var:    sub_asn(elem,val);      break;
+        case op_cat_asn_var:    cat_asn(elem,val);      break;
+        case op_band_asn_var:   band_asn(elem,val);     break;
+        case op_bor_asn_var:    bor_asn(elem,val);      break;
+        case op_bxor_asn_var:   bxor_asn(elem,val);     break;
+        case op_shl_asn_var:    shl_asn(elem,val);      break;
+        case op_shr_asn_var:    shr_asn(elem,val);      break;
+        case op_inc_var:
+            elem.set_type(value::type_int);
+            ++(elem.intval);
+            break;
+        case op_dec_var:
+            elem.set_type(value::type_int);
+            --(elem.intval);
+            break;
+        default:
+            throw runtime_error("Invalid array element assignment.");
+        }
+    }
+
+    inline int div_ii(int lhs,int rhs)
+    {
+        // check divide by zero error
+        if(rhs == 0)
+            throw runtime_error("Divide by zero encountered.");
+        return lhs / rhs;
+    }
+}
+
+void vmachine::pop_indexes(size_t count)
+{
+    m_indexes.resize(count);
+    for(size_t i = count; i-- > 0; )
+    {
+        m_indexes[i] = m_runtime_stack.top();
+        m_runtime_stack.pop();
+    }
+}
+
+const value* vmachine::find_elem(const value& var)
+{
+    const value* elem = &var;
+    for(size_t i = 0; i < m_indexes.size(); ++i)
+    {
+        if(elem->type != value::type_array)
+            return 0;
+        elem = elem->arrval->find(m_indexes[i]);
+        if(elem == 0)
+            return 0;
+    }
+    return elem;
+}
+
+value& vmachine::get_elem(value& var)
+{
+    value* elem = &var;
+    for(size_t i = 0; i < m_indexes.size(); ++i)
+        elem = &make_unique_array(*elem).get(m_indexes[i]);
+    return *elem;
+}
+
+vmachine::vmachine()
+    : m_max_call_depth(10000), m_file_stack(0), m_jit(0), m_jit_enabled(false),
+      m_jit_depth(0)
+{
+}
+
+vmachine::~vmachine()
+{
+    delete m_jit;
+}
+
+bool vmachine::enable_jit(bool enable)
+{
+    if(!jit::available())
+        return false;
+    // the jit owns the native code of every function compiled so far,
+    // so it stays around once made
+    if(enable && m_jit == 0)
+        m_jit = new jit;
+    m_jit_enabled = enable;
+    return true;
+}
+
+void vmachine::link(codeblock_t& code)
+{
+    m_file_stack = max(m_file_stack,verify_codeblock(code));
+
+    size_t off = 0;
+    while(off < code.size())
+    {
+        size_t size = get_instr_size(code.begin() + off);
+        op_code global_op = get_global_op(code[off].get_op_code());
+        if(global_op != op_invalid)
+        {
+            string_table::entry name = code[off + 1].get_str();
+            if(name[0] == '$')
+            {
+                code[off] = global_op;
+                code[off + 1] = static_cast<int>(get_global_slot(name));
+            }
+        }
+        off += size;
+    }
+}
+
+size_t vmachine::get_global_slot(string_table::entry name)
+{
+    string_table::symbol sym = string_table::get_symbol(name);
+    const size_t* found = m_global_names.find(sym);
+    if(found != 0)
+        return *found;
+
+    // first time this global has been seen, give it a slot
+    size_t slot = m_globals.size();
+    m_globals.push_back(value());
+    m_global_names[sym] = slot;
+    return slot;
+}
+
+value* vmachine::find_local(string_table::symbol name)
+{
+    call_frame& frame = m_callstack.top();
+    instr_iter slot_name = frame.local_names;
+    for(size_t i = 0; i < frame.local_count; ++i, ++slot_name)
+    {
+        if(string_table::get_symbol(slot_name->get_str()) == name)
+            return &m_locals[frame.base + i];
+    }
+    return 0;
+}
+
+value& vmachine::get_var(string_table::entry name)
+{
+    if(name[0] == '$')
+        return m_globals[get_global_slot(name)];
+
+    // slots first, then anything created by name at runtime
+    string_table::symbol sym = string_table::get_symbol(name);
+    value* local = find_local(sym);
+    if(local != 0)
+        return *local;
+    return m_callstack.top().dynamic[sym];
+}
+
+value* vmachine::find_var(const string& name)
+{
+    // a name the string table has never seen can't name a variable
+    string_table::symbol sym = strings.find_symbol(name);
+    if(sym == 0)
+        return 0;
+
+    if(name[0] == '$')
+    {
+        const size_t* found = m_global_names.find(sym);
+        if(found == 0)
+            return 0;
+        return &m_globals[*found];
+    }
+
+    value* local = find_local(sym);
+    if(local != 0)
+        return local;
+    return m_callstack.top().dynamic.find(sym);
+}
+
+value& vmachine::get_named_var(const value& name)
+{
+    // only a new variable's name needs to go in the string table
+    string str = name.to_str();
+    value* var = find_var(str);
+    if(var != 0)
+        return *var;
+    return get_var(strings.insert(str));
+}
+
+void vmachine::push_frame(
+                          instr_iter begin,
+                          instr_iter end,
+                          instr_iter return_to,
+                          const func_table::entry* func,
+                          size_t argc
+                          )
+{
+    if(m_callstack.size() >= m_max_call_depth)
+        throw runtime_error("Maximum call depth exceeded.");
+
+    m_callstack.push(call_frame());
+    call_frame& frame = m_callstack.top();
+    frame.begin = begin;
+    frame.end = end;
+    frame.return_to = return_to;
+    frame.base = m_locals.size();
+    frame.param_base = m_param_stack.size() - argc;
+    if(func != 0)
+    {
+        frame.local_count = func->local_count;
+        frame.local_names = func->local_names;
+        m_locals.resize(frame.base + func->local_count);
+    }
+    // the frame's pushes don't check for room
+    m_runtime_stack.reserve(func != 0 ? func->max_stack : m_file_stack);
+}
+
+void vmachine::pop_frame()
+{
+    call_frame& frame = m_callstack.top();
+    m_locals.resize(frame.base);
+    m_param_stack.resize(frame.param_base);
+    m_callstack.pop();
+}
+
+func_table::entry* vmachine::find_func(const instruction* instr)
+{
+    // the call site caches the entry the name resolved to, along with
+    // the func_table generation it was resolved in
+    instruction& cached_func = const_cast<instruction&>(instr[3]);
+    instruction& cached_gen = const_cast<instruction&>(instr[4]);
+    if(cached_gen.get_offset() == functions.get_generation())
+        return static_cast<func_table::entry*>(
+            const_cast<void*>(cached_func.get_ptr())
+            );
+
+    func_table::entry* e = functions.find(instr[1].get_str());
+    cached_func = instruction(static_cast<const void*>(e));
+    cached_gen = instruction(functions.get_generation());
+    return e;
+}
+
+bool vmachine::is_inlined(const instruction* instr)
+{
+    // the guard caches whether the function was the one compiled inline,
+    // along with the func_table generation that was worked out in
+    instruction& cached_gen = const_cast<instruction&>(instr[4]);
+    instruction& cached_inlined = const_cast<instruction&>(instr[5]);
+    if(cached_gen.get_offset() == functions.get_generation())
+        return cached_inlined.get_int() != 0;
+
+    // it's the same function if it was declared at the same place in
+    // the same codeblock
+    const call_frame& frame = m_callstack.top();
+    const func_table::entry* e = functions.find(instr[3].get_str());
+    bool inlined =
+        e != 0 &&
+        !e->is_host &&
+        e->begin == frame.begin &&
+        e->start - e->local_count - 4 == frame.begin + instr[2].get_int();
+
+    // a host function called from the inlined code would see the %locals
+    // of this frame, not the function's, so one that may use them has to
+    // be called from a frame of the function's own. The inlined code
+    // runs from after the guard up to the call it stands for.
+    instr_iter body = frame.begin + (instr - &*frame.begin) + 6;
+    instr_iter call = frame.begin + instr[1].get_int();
+    for(; inlined && body < call; body += get_instr_size(body))
+    {
+        op_code op = body->get_op_code();
+        if(op != op_call_func && op != op_call_load_ret)
+            continue;
+        const func_table::entry* callee = functions.find(body[1].get_str());
+        inlined = callee == 0 || !callee->is_host || !callee->uses_locals;
+    }
+    cached_inlined = instruction(static_cast<int>(inlined));
+    cached_gen = instruction(functions.get_generation());
+    return inlined;
+}
+
+instr_iter vmachine::load_func(const instruction* instr)
+{
+    compiled_image* image = static_cast<compiled_image*>(
+        const_cast<void*>(instr[2].get_ptr())
+        );
+    codeblock_t& code = image->get_function(instr[1].get_int(),strings,floats);
+    link(code);
+
+    // starts with the function's op_decl_func, like any other
+    string_table::entry name = code[1].get_str();
+    size_t local_count = code[3].get_int();
+    instr_iter code_begin = code.begin();
+    instr_iter local_names = code_begin + 4;
+    instr_iter start = local_names + local_count;
+    size_t max_stack = code[0].get_profile();
+
+    // unless it has been declared again since, the function is the
+    // decoded code from now on
+    func_table::entry* e = functions.find(name);
+    if(e != 0 && !e->is_host && &*e->start == instr)
+    {
+        functions.add_script_func(
+            name,
+            code_begin,
+            start,
+            code.end(),
+            local_count,
+            local_names,
+            max_stack
+            );
+        if(!m_compiled.empty())
+            bind_compiled(*functions.find(name));
+    }
+
+    call_frame& top = m_callstack.top();
+    top.begin = code_begin;
+    top.end = code.end();
+    top.local_names = local_names;
+    m_runtime_stack.reserve(max_stack);
+    return start;
+}
+
+bool vmachine::call_host(
+                         const func_table::entry* e,
+                         string_table::entry name,
+                         size_t argc,
+                         context& ctx
+                         )
+{
+    if(e == 0)
+    {
+        m_return_val.set_type(value::type_int);
+        m_return_val.intval = 0;
+        ctx.log_msg("function \"" + string(name) + "\" not found");
+        m_param_stack.resize(m_param_stack.size() - argc);
+        return true;
+    }
+    if(!e->is_host)
+        return false;
+
+    // validate min/max args
+    if(e->min_args != -1)
+    {
+        if(argc < size_t(e->min_args))
+            ctx.log_msg("Usage: " + (e->name + e->usage_string));
+    }
+    if(e->max_args != -1)
+    {
+        if(argc > size_t(e->max_args))
+            ctx.log_msg("Usage: " + (e->name + e->usage_string));
+    }
+
+    // take this call's params off the param stack,
+    // gotta reverse the args
+    args_t args(m_param_stack.end() - argc,m_param_stack.end());
+    m_param_stack.resize(m_param_stack.size() - argc);
+    reverse(args.begin(),args.end());
+    // call it!
+    (*(e->host_func))(args,ctx);
+    return true;
+}
+
 void vmachine::execute(
                        instr_iter begin,
                        instr_iter end,
                        instr_iter instr,
-                       context& ctx
+                       context& ctx,
+                       const func_table::entry* func,
+                       size_t argc
                        )
 {
-    // push a new stack frame
-    m_callstack.push(dictionary_t());
-
-    // the current stack frame
-    dictionary_t& stack_frame = m_callstack.top();
+    size_t entry_depth = m_callstack.size();
+    push_frame(begin,end,end,func,argc);
+    try
+    {
+        if(func != 0 && func->compiled != 0)
+            instr = enter_compiled(*func,ctx);
+#ifdef DSCRIPT_HAS_JIT
+        else if(func != 0 && m_jit_enabled)
+            instr = enter_native(*func,instr,ctx);
+#endif
+        run(instr,ctx,entry_depth);
+    }
+    catch(...)
+    {
+        // drop the frames the error left behind
+        while(m_callstack.size() > entry_depth)
+            pop_frame();
+        throw;
+    }
+}
 
-    while(instr != end)
+void vmachine::run(instr_iter instr,context& ctx,size_t entry_depth)
+{
+    // the registers of the current frame, see VM_LOAD_FRAME
+    instr_iter begin;
+    instr_iter end;
+    value* locals;
+    VM_LOAD_FRAME;
+
+#ifdef DSCRIPT_THREADED_DISPATCH
+    // one label per op_code, in the same order as the op_code enum
+    static const void* const dispatch_table[] =
+    {
+        &&L_op_push_param,
+        &&L_op_call_func,
+        &&L_op_push_str,
+        &&L_op_push_int,
+        &&L_op_push_float,
+        &&L_op_cat_aidx_expr,
+        &&L_op_push_var,
+        &&L_op_push_var_value,
+        &&L_op_load_ret,
+        &&L_op_inc_var,
+        &&L_op_dec_var,
+        &&L_op_neg,
+        &&L_op_log_not,
+        &&L_op_bit_not,
+        &&L_op_mul,
+        &&L_op_div,
+        &&L_op_mod,
+        &&L_op_add,
+        &&L_op_sub,
+        &&L_op_cat,
+        &&L_op_shl,
+        &&L_op_shr,
+        &&L_op_cmp_less_eq,
+        &&L_op_cmp_less,
+        &&L_op_cmp_grtr_eq,
+        &&L_op_cmp_grtr,
+        &&L_op_eq,
+        &&L_op_neq,
+        &&L_op_bit_and,
+        &&L_op_bit_or,
+        &&L_op_bit_xor,
+        &&L_op_log_and,
+        &&L_op_log_or,
+        &&L_op_decl_func,
+        &&L_op_pop_param,
+        &&L_op_return,
+        &&L_op_store_ret,
+        &&L_op_assign,
+        &&L_op_assign_var,
+        &&L_op_mul_asn,
+        &&L_op_mul_asn_var,
+        &&L_op_div_asn,
+        &&L_op_div_asn_var,
+        &&L_op_mod_asn,
+        &&L_op_mod_asn_var,
+        &&L_op_add_asn,
+        &&L_op_add_asn_var,
+        &&L_op_sub_asn,
+        &&L_op_sub_asn_var,
+        &&L_op_cat_asn,
+        &&L_op_cat_asn_var,
+        &&L_op_band_asn,
+        &&L_op_band_asn_var,
+        &&L_op_bor_asn,
+        &&L_op_bor_asn_var,
+        &&L_op_bxor_asn,
+        &&L_op_bxor_asn_var,
+        &&L_op_shl_asn,
+        &&L_op_shl_asn_var,
+        &&L_op_shr_asn,
+        &&L_op_shr_asn_var,
+        &&L_op_jmp_false,
+        &&L_op_jmp,
+        &&L_op_push_local,
+        &&L_op_pop_param_local,
+        &&L_op_inc_local,
+        &&L_op_dec_local,
+        &&L_op_assign_local,
+        &&L_op_mul_asn_local,
+        &&L_op_div_asn_local,
+        &&L_op_mod_asn_local,
+        &&L_op_add_asn_local,
+        &&L_op_sub_asn_local,
+        &&L_op_cat_asn_local,
+        &&L_op_band_asn_local,
+        &&L_op_bor_asn_local,
+        &&L_op_bxor_asn_local,
+        &&L_op_shl_asn_local,
+        &&L_op_shr_asn_local,
+        &&L_op_push_global,
+        &&L_op_inc_global,
+        &&L_op_dec_global,
+        &&L_op_assign_global,
+        &&L_op_mul_asn_global,
+        &&L_op_div_asn_global,
+        &&L_op_mod_asn_global,
+        &&L_op_add_asn_global,
+        &&L_op_sub_asn_global,
+        &&L_op_cat_asn_global,
+        &&L_op_band_asn_global,
+        &&L_op_bor_asn_global,
+        &&L_op_bxor_asn_global,
+        &&L_op_shl_asn_global,
+        &&L_op_shr_asn_global,
+        &&L_op_mul_ii,
+        &&L_op_mul_ff,
+        &&L_op_div_ii,
+        &&L_op_div_ff,
+        &&L_op_add_ii,
+        &&L_op_add_ff,
+        &&L_op_sub_ii,
+        &&L_op_sub_ff,
+        &&L_op_cmp_less_eq_ii,
+        &&L_op_cmp_less_eq_ff,
+        &&L_op_cmp_less_ii,
+        &&L_op_cmp_less_ff,
+        &&L_op_cmp_grtr_eq_ii,
+        &&L_op_cmp_grtr_eq_ff,
+        &&L_op_cmp_grtr_ii,
+        &&L_op_cmp_grtr_ff,
+        &&L_op_eq_ii,
+        &&L_op_eq_ff,
+        &&L_op_neq_ii,
+        &&L_op_neq_ff,
+        &&L_op_param_str,
+        &&L_op_param_int,
+        &&L_op_param_var,
+        &&L_op_param_local,
+        &&L_op_param_global,
+        &&L_op_call_load_ret,
+        &&L_op_return_value,
+        &&L_op_cmp_less_eq_jmp_false,
+        &&L_op_cmp_less_jmp_false,
+        &&L_op_cmp_grtr_eq_jmp_false,
+        &&L_op_cmp_grtr_jmp_false,
+        &&L_op_eq_jmp_false,
+        &&L_op_neq_jmp_false,
+        &&L_op_bool,
+        &&L_op_jmp_false_peek,
+        &&L_op_jmp_true_peek,
+        &&L_op_push_elem,
+        &&L_op_push_elem_local,
+        &&L_op_push_elem_global,
+        &&L_op_asn_elem,
+        &&L_op_asn_elem_local,
+        &&L_op_asn_elem_global,
+        &&L_op_inline_guard,
+        &&L_op_load_func
+    };
+    BOOST_STATIC_ASSERT(
+        sizeof(dispatch_table) / sizeof(dispatch_table[0]) == op_count
+        );
+
+    VM_NEXT;
+#else
+    for(;;)
     {
-        op_code o = instr->get_op_code();
-        bool returned = false;
-        switch(o)
+        if(instr == end)
+            goto vm_return;
+        switch(instr->get_op_code())
         {
-        case op_push_param:
+#endif
+        VM_CASE(op_push_param)
             {
                 // push the top of the stack as a parameter
                 // then pop the top of the runtime stack
@@ -51,85 +746,73 @@ void vmachine::execute(
                 m_runtime_stack.pop();
                 ++instr;
             }
-	        break;
+            VM_NEXT;
 
-        case op_call_func:
+        VM_CASE(op_call_func)
+        VM_CASE(op_call_load_ret)
             // get a reference to the func_table entry
             {
-                // get the name of the function
-                ++instr;
-                string_table::entry name = instr->get_str();
+                // op_call_load_ret also pushes the return value
+                bool load_ret = instr->get_op_code() == op_call_load_ret;
+                // get the name of the function,
+                // and the number of params pushed for it
+                string_table::entry name = instr[1].get_str();
+                size_t argc = instr[2].get_int();
                 // Clear the return value (in case of error)
                 m_return_val.clear();
                 // get a reference to the function
-                func_table::entry* e = functions.find(name);
-                if(e == 0)
-                {
-                    m_return_val.set_type(value::type_int);
-                    m_return_val.intval = 0;
-                    ctx.log_msg("function \"" + string(name) + "\" not found");
-                    m_param_stack.clear();
-                }
-                else if(e->is_host)
+                func_table::entry* e = find_func(&*instr);
+                instr += 4;
+                if(call_host(e,name,argc,ctx))
                 {
-                    // validate min/max args
-                    if(e->min_args != -1)
-                    {
-                        if(m_param_stack.size() < size_t(e->min_args))
-                            ctx.log_msg("Usage: " + (e->name + e->usage_string));
-                    }
-                    if(e->max_args != -1)
-                    {
-                        if(m_param_stack.size() > size_t(e->max_args))
-                            ctx.log_msg("Usage: " + (e->name + e->usage_string));
-                    }
-
-                    // host function
-                    // gotta reverse the args
-                    reverse(m_param_stack.begin(),m_param_stack.end());
-                    // call it!
-                    (*(e->host_func))(m_param_stack,ctx);
-                    // clear the param frame
-                    m_param_stack.clear();
+                    // the host may call back into the
+                    // vmachine, which can grow m_locals
+                    VM_LOAD_FRAME;
                 }
                 else
                 {
-                    // script function
-                    execute(
-                        e->begin,
-                        e->end,
-                        e->start,
-                        ctx
-                        );
-                    // clear the param frame
-                    m_param_stack.clear();
+                    // script function. Enter a new frame that
+                    // returns to the instruction after this one
+                    push_frame(e->begin,e->end,instr + 1,e,argc);
+                    m_callstack.top().load_ret = load_ret;
+                    instr = e->start;
+                    if(e->compiled != 0)
+                        instr = enter_compiled(*e,ctx);
+#ifdef DSCRIPT_HAS_JIT
+                    else if(m_jit_enabled)
+                        instr = enter_native(*e,instr,ctx);
+#endif
+                    VM_LOAD_FRAME;
+                    VM_NEXT;
                 }
+                if(load_ret)
+                    m_runtime_stack.push(m_return_val);
                 ++instr;
             }
-	        break;
+            VM_NEXT;
 
-        case op_push_str:
+        VM_CASE(op_push_str)
             // push the named string
             ++instr;
             m_runtime_stack.push(instr->get_str());
             ++instr;
-	        break;
+            VM_NEXT;
 
-        case op_push_int:
+        VM_CASE(op_push_int)
             // push the int
             ++instr;
             m_runtime_stack.push(instr->get_int());
             ++instr;
-	        break;
+            VM_NEXT;
 
-        case op_push_float:
+        VM_CASE(op_push_float)
             // push a float
             ++instr;
             m_runtime_stack.push(*(instr->get_flt()));
             ++instr;
-	        break;
+            VM_NEXT;
 
-        case op_cat_aidx_expr:
+        VM_CASE(op_cat_aidx_expr)
             // cat the two values on top with a '_'
             {
                 value tocat = m_runtime_stack.top();
@@ -139,93 +822,92 @@ void vmachine::execute(
                     m_runtime_stack.top().to_str() + '_' + tocat.to_str();
                 ++instr;
             }
-	        break;
+            VM_NEXT;
 
-        case op_push_var:
+        VM_CASE(op_push_var)
             {
                 ++instr;
-                string_table::entry ste = instr->get_str();
-                dictionary_t& dict = (ste[0]=='$') ? globals : stack_frame;
-                m_runtime_stack.push(dict[instr->get_str()]);
+                m_runtime_stack.push(get_var(instr->get_str()));
                 ++instr;
             }
-	        break;
+            VM_NEXT;
 
-        case op_push_var_value:
+        VM_CASE(op_push_var_value)
             // replace the top of the stack with the value of
             // the variable named by the top of the stack
             {
-                string_table::entry ste =
-                    strings.insert(m_runtime_stack.top().to_str());
-                dictionary_t& dict = (ste[0]=='$') ? globals : stack_frame;
-                m_runtime_stack.top() = dict[ste];
+                // reading a variable that doesn't exist doesn't create it
+                const value* var = find_var(m_runtime_stack.top().to_str());
+                if(var != 0)
+                    m_runtime_stack.top() = *var;
+                else
+                    m_runtime_stack.top().clear();
                 ++instr;
             }
-            break;
+            VM_NEXT;
 
-        case op_load_ret:
+        VM_CASE(op_load_ret)
             {
                 // push the value in the return
                 // register onto the top of the stack
                 m_runtime_stack.push(m_return_val);
                 ++instr;
             }
-	        break;
+            VM_NEXT;
 
-        case op_inc_var:
+        VM_CASE(op_inc_var)
             // increment the variable named by one
             {
                 ++instr;
-                string_table::entry ste = instr->get_str();
-                dictionary_t& dict = (ste[0]=='$') ? globals : stack_frame;
-                dict[ste].set_type(value::type_int);
-                ++(dict[ste].intval);
+                value& var = get_var(instr->get_str());
+                var.set_type(value::type_int);
+                ++(var.intval);
                 ++instr;
             }
-            break;
+            VM_NEXT;
 
-        case op_dec_var:
+        VM_CASE(op_dec_var)
             // decrement the variable named by one
             {
                 ++instr;
-                string_table::entry ste = instr->get_str();
-                dictionary_t& dict = (ste[0]=='$') ? globals : stack_frame;
-                dict[ste].set_type(value::type_int);
-                --(dict[ste].intval);
+                value& var = get_var(instr->get_str());
+                var.set_type(value::type_int);
+                --(var.intval);
                 ++instr;
             }
-	        break;
+            VM_NEXT;
 
-        case op_neg:
+        VM_CASE(op_neg)
             // negate the top of the stack
             // promote to int
             m_runtime_stack.top().set_type(value::type_int);
             m_runtime_stack.top().intval =  -(m_runtime_stack.top().intval);
             ++instr;
-	        break;
+            VM_NEXT;
 
-        case op_log_not:
+        VM_CASE(op_log_not)
             // logical not the top of the stack
             // promote to int
             m_runtime_stack.top().set_type(value::type_int);
             m_runtime_stack.top().intval =  !(m_runtime_stack.top().intval);
             ++instr;
-	        break;
+            VM_NEXT;
 
-        case op_bit_not:
+        VM_CASE(op_bit_not)
             // binary not the top of the stack
             // promote to int
             m_runtime_stack.top().set_type(value::type_int);
             m_runtime_stack.top().intval =  ~(m_runtime_stack.top().intval);
             ++instr;
-	        break;
+            VM_NEXT;
 
-        case op_mul:
+        VM_CASE(op_mul)
             {
                 // grab the top one
                 value top = m_runtime_stack.top();
                 m_runtime_stack.pop();
                 value& newtop = m_runtime_stack.top();
+                quicken(instr,newtop,top,op_mul_ii,op_mul_ff);
                 // multiply the new top by the popped top
                 // check types (keep int if both are int, otherwise go to flt)
                 if(
@@ -240,14 +922,15 @@ void vmachine::execute(
                 }
                 ++instr;
             }
-	        break;
+            VM_NEXT;
 
-        case op_div:
+        VM_CASE(op_div)
             {
                 // grab the top one
                 value top = m_runtime_stack.top();
                 m_runtime_stack.pop();
                 value& newtop = m_runtime_stack.top();
+                quicken(instr,newtop,top,op_div_ii,op_div_ff);
                 // divide the new top by the popped top
                 // check types (keep int if both are int, otherwise go to flt)
                 if(
@@ -267,9 +950,9 @@ void vmachine::execute(
                 }
                 ++instr;
             }
-	        break;
+            VM_NEXT;
 
-        case op_mod:
+        VM_CASE(op_mod)
             {
                 // grab the top one
                 value top = m_runtime_stack.top();
@@ -281,14 +964,15 @@ void vmachine::execute(
                 newtop.intval %= top.to_int();
                 ++instr;
             }
-	        break;
+            VM_NEXT;
 
-        case op_add:
+        VM_CASE(op_add)
             {
                 // grab the top one
                 value top = m_runtime_stack.top();
                 m_runtime_stack.pop();
                 value& newtop = m_runtime_stack.top();
+                quicken(instr,newtop,top,op_add_ii,op_add_ff);
                 // add the new top to the popped top
                 // check types (keep int if both are int, otherwise go to flt)
                 if(
@@ -303,14 +987,15 @@ void vmachine::execute(
                 }
                 ++instr;
             }
-	        break;
+            VM_NEXT;
 
-        case op_sub:
+        VM_CASE(op_sub)
             {
                 // grab the top one
                 value top = m_runtime_stack.top();
                 m_runtime_stack.pop();
                 value& newtop = m_runtime_stack.top();
+                quicken(instr,newtop,top,op_sub_ii,op_sub_ff);
                 // subtract the popped top from the new top
                 // check types (keep int if both are int, otherwise go to flt)
                 if(
@@ -325,9 +1010,9 @@ void vmachine::execute(
                 }
                 ++instr;
             }
-	        break;
+            VM_NEXT;
 
-        case op_cat:
+        VM_CASE(op_cat)
             {
                 // grab the top one
                 value top = m_runtime_stack.top();
@@ -335,13 +1020,12 @@ void vmachine::execute(
                 value& newtop = m_runtime_stack.top();
                 // concat the two top values together
                 // check types (keep int if both are int, otherwise go to flt)
-                newtop.set_type(value::type_str);
-                newtop.strval.append(top.to_str());
+                newtop.cat(top);
                 ++instr;
             }
-	        break;
+            VM_NEXT;
 
-        case op_shl:
+        VM_CASE(op_shl)
             {
                 // grab the top one
                 value top = m_runtime_stack.top();
@@ -353,9 +1037,9 @@ void vmachine::execute(
                 newtop.intval <<= top.to_int();
                 ++instr;
             }
-	        break;
+            VM_NEXT;
 
-        case op_shr:
+        VM_CASE(op_shr)
             {
                 // grab the top one
                 value top = m_runtime_stack.top();
@@ -367,14 +1051,15 @@ void vmachine::execute(
                 newtop.intval >>= top.to_int();
                 ++instr;
             }
-	        break;
+            VM_NEXT;
 
-        case op_cmp_less_eq:
+        VM_CASE(op_cmp_less_eq)
             {
                 // grab the top one
                 value top = m_runtime_stack.top();
                 m_runtime_stack.pop();
                 value& newtop = m_runtime_stack.top();
+                quicken(instr,newtop,top,op_cmp_less_eq_ii,op_cmp_less_eq_ff);
                 // check types (keep int if both are int, otherwise go to flt)
                 if(
                     top.type == value::type_int &&
@@ -384,19 +1069,19 @@ void vmachine::execute(
                 else
                 {
                     // bypass the conversion process
-                    newtop.intval = newtop.to_flt() <= top.to_flt();
-                    newtop.type = value::type_int;
+                    newtop = static_cast<int>(newtop.to_flt() <= top.to_flt());
                 }
                 ++instr;
             }
-	        break;
+            VM_NEXT;
 
-        case op_cmp_less:
+        VM_CASE(op_cmp_less)
             {
                 // grab the top one
                 value top = m_runtime_stack.top();
                 m_runtime_stack.pop();
                 value& newtop = m_runtime_stack.top();
+                quicken(instr,newtop,top,op_cmp_less_ii,op_cmp_less_ff);
                 // check types (keep int if both are int, otherwise go to flt)
                 if(
                     top.type == value::type_int &&
@@ -406,19 +1091,19 @@ void vmachine::execute(
                 else
                 {
                     // bypass the conversion process
-                    newtop.intval = newtop.to_flt() < top.to_flt();
-                    newtop.type = value::type_int;
+                    newtop = static_cast<int>(newtop.to_flt() < top.to_flt());
                 }
                 ++instr;
             }
-	        break;
+            VM_NEXT;
 
-        case op_cmp_grtr_eq:
+        VM_CASE(op_cmp_grtr_eq)
             {
                 // grab the top one
                 value top = m_runtime_stack.top();
                 m_runtime_stack.pop();
                 value& newtop = m_runtime_stack.top();
+                quicken(instr,newtop,top,op_cmp_grtr_eq_ii,op_cmp_grtr_eq_ff);
                 // check types (keep int if both are int, otherwise go to flt)
                 if(
                     top.type == value::type_int &&
@@ -428,19 +1113,19 @@ void vmachine::execute(
                 else
                 {
                     // bypass the conversion process
-                    newtop.intval = newtop.to_flt() >= top.to_flt();
-                    newtop.type = value::type_int;
+                    newtop = static_cast<int>(newtop.to_flt() >= top.to_flt());
                 }
                 ++instr;
             }
-	        break;
+            VM_NEXT;
 
-        case op_cmp_grtr:
+        VM_CASE(op_cmp_grtr)
             {
                 // grab the top one
                 value top = m_runtime_stack.top();
                 m_runtime_stack.pop();
                 value& newtop = m_runtime_stack.top();
+                quicken(instr,newtop,top,op_cmp_grtr_ii,op_cmp_grtr_ff);
                 // check types (keep int if both are int, otherwise go to flt)
                 if(
                     top.type == value::type_int &&
@@ -450,19 +1135,19 @@ void vmachine::execute(
                 else
                 {
                     // bypass the conversion process
-                    newtop.intval = newtop.to_flt() > top.to_flt();
-                    newtop.type = value::type_int;
+                    newtop = static_cast<int>(newtop.to_flt() > top.to_flt());
                 }
                 ++instr;
             }
-	        break;
+            VM_NEXT;
 
-        case op_eq:
+        VM_CASE(op_eq)
             {
                 // grab the top one
                 value top = m_runtime_stack.top();
                 m_runtime_stack.pop();
                 value& newtop = m_runtime_stack.top();
+                quicken(instr,newtop,top,op_eq_ii,op_eq_ff);
                 // check types (keep int if both are int, otherwise go to flt)
                 if(
                     top.type == value::type_int &&
@@ -472,19 +1157,19 @@ void vmachine::execute(
                 else
                 {
                     // bypass the conversion process
-                    newtop.intval = newtop.to_flt() == top.to_flt();
-                    newtop.type = value::type_int;
+                    newtop = static_cast<int>(newtop.to_flt() == top.to_flt());
                 }
                 ++instr;
             }
-	        break;
+            VM_NEXT;
 
-        case op_neq:
+        VM_CASE(op_neq)
             {
                 // grab the top one
                 value top = m_runtime_stack.top();
                 m_runtime_stack.pop();
                 value& newtop = m_runtime_stack.top();
+                quicken(instr,newtop,top,op_neq_ii,op_neq_ff);
                 // check types (keep int if both are int, otherwise go to flt)
                 if(
                     top.type == value::type_int &&
@@ -494,14 +1179,13 @@ void vmachine::execute(
                 else
                 {
                     // bypass the conversion process
-                    newtop.intval = newtop.to_flt() != top.to_flt();
-                    newtop.type = value::type_int;
+                    newtop = static_cast<int>(newtop.to_flt() != top.to_flt());
                 }
                 ++instr;
             }
-	        break;
+            VM_NEXT;
 
-        case op_bit_and:
+        VM_CASE(op_bit_and)
             {
                 // grab the top one
                 value top = m_runtime_stack.top();
@@ -512,9 +1196,9 @@ void vmachine::execute(
                 newtop.intval &= top.to_int();
                 ++instr;
             }
-	        break;
+            VM_NEXT;
 
-        case op_bit_or:
+        VM_CASE(op_bit_or)
             {
                 // grab the top one
                 value top = m_runtime_stack.top();
@@ -525,9 +1209,9 @@ void vmachine::execute(
                 newtop.intval |= top.to_int();
                 ++instr;
             }
-	        break;
+            VM_NEXT;
 
-        case op_bit_xor:
+        VM_CASE(op_bit_xor)
             {
                 // grab the top one
                 value top = m_runtime_stack.top();
@@ -538,9 +1222,9 @@ void vmachine::execute(
                 newtop.intval ^= top.to_int();
                 ++instr;
             }
-	        break;
+            VM_NEXT;
 
-        case op_log_and:
+        VM_CASE(op_log_and)
             {
                 // grab the top one
                 value top = m_runtime_stack.top();
@@ -555,14 +1239,13 @@ void vmachine::execute(
                 else
                 {
                     // bypass the conversion process
-                    newtop.intval = newtop.to_flt() && top.to_flt();
-                    newtop.type = value::type_int;
+                    newtop = static_cast<int>(newtop.to_flt() && top.to_flt());
                 }
                 ++instr;
             }
-	        break;
+            VM_NEXT;
 
-        case op_log_or:
+        VM_CASE(op_log_or)
             {
                 // grab the top one
                 value top = m_runtime_stack.top();
@@ -577,477 +1260,692 @@ void vmachine::execute(
                 else
                 {
                     // bypass the conversion process
-                    newtop.intval = newtop.to_flt() || top.to_flt();
-                    newtop.type = value::type_int;
+                    newtop = static_cast<int>(newtop.to_flt() || top.to_flt());
                 }
                 ++instr;
             }
-	        break;
+            VM_NEXT;
 
-        case op_decl_func:
+        VM_CASE(op_decl_func)
             {
                 // first thing will be the function name,
                 // second will be offset at which function ends
+                // third is the number of frame slots the function uses,
+                // followed by the name of each slot
+                // see verify_codeblock
+                size_t max_stack = instr->get_profile();
                 ++instr;
                 string_table::entry func_name = instr->get_str();
                 ++instr;
                 int offset = instr->get_int();
-                ++instr; // now points to first instruction of the function
+                ++instr;
+                size_t local_count = instr->get_int();
+                ++instr;
+                instr_iter local_names = instr;
+                instr += local_count;
+                // now points to first instruction of the function
                 instr_iter func_end = begin + offset;
 
                 functions.add_script_func(
                     func_name,
                     begin,
                     instr,
-                    func_end
+                    func_end,
+                    local_count,
+                    local_names,
+                    max_stack
                     );
+                if(!m_compiled.empty())
+                    bind_compiled(*functions.find(func_name));
 
                 instr = func_end;
             }
-	        break;
+            VM_NEXT;
 
-        case op_pop_param:
+        VM_CASE(op_pop_param)
             {
                 // grab the name
                 ++instr;
                 string_table::entry ste = instr->get_str();
                 // pop the top of the param stack into the named var
-                if(m_param_stack.size() > 0)
+                if(m_param_stack.size() > m_callstack.top().param_base)
                 {
-                    stack_frame[ste] = m_param_stack.back();
+                    get_var(ste) = m_param_stack.back();
                     m_param_stack.pop_back();
                 }
                 else
-                    stack_frame[ste].clear();
+                    get_var(ste).clear();
                 ++instr;
             }
-	        break;
+            VM_NEXT;
+
+        VM_CASE(op_return_value)
+            // store the top of the runtime stack in the
+            // return value register, and return
+            m_return_val = m_runtime_stack.top();
+            m_runtime_stack.pop();
+            goto vm_return;
 
-        case op_return:
-            returned = true;
-	        break;
+        VM_CASE(op_return)
+        vm_return:
+            // leave the current frame, running off the end of
+            // its code does the same
+            {
+                instr = m_callstack.top().return_to;
+                bool load_ret = m_callstack.top().load_ret;
+                pop_frame();
+                if(m_callstack.size() == entry_depth)
+                    return;
+                VM_LOAD_FRAME;
+                if(load_ret)
+                    m_runtime_stack.push(m_return_val);
+            }
+            VM_NEXT;
 
-        case op_store_ret:
+        VM_CASE(op_store_ret)
             // store the top of the runtime stack in the return value register
             m_return_val = m_runtime_stack.top();
             m_runtime_stack.pop();
             ++instr;
-	        break;
+            VM_NEXT;
 
-        case op_assign:
+        VM_CASE(op_assign)
             // the top of the stack is a value
             // the next underneath is the name of a variable
             // store the value in the variable
             {
                 value v = m_runtime_stack.top();
                 m_runtime_stack.pop();
-                string_table::entry ste =
-                    strings.insert(m_runtime_stack.top().to_str());
+                value& var = get_named_var(m_runtime_stack.top());
                 m_runtime_stack.pop();
-                dictionary_t& dict = (ste[0] == '$') ? globals : stack_frame;
-                dict[ste] = v;
+                var = v;
                 ++instr;
             }
-	        break;
+            VM_NEXT;
 
-        case op_assign_var:
+        VM_CASE(op_assign_var)
             // assign the variable designated
             // the value on the top of the stack
             {
                 ++instr;
-                string_table::entry ste = instr->get_str();
-                dictionary_t& dict = (ste[0] == '$') ? globals : stack_frame;
-                dict[ste] = m_runtime_stack.top();
+                get_var(instr->get_str()) = m_runtime_stack.top();
                 m_runtime_stack.pop();
                 ++instr;
             }
-	        break;
+            VM_NEXT;
 
-        case op_mul_asn:
-            // the top of the stack is a value
-            // the next underneath is the name of a variable
-            // multiply the variable by the value
+        VM_CASE(op_push_local)
+            // push the value of a frame slot
+            ++instr;
+            m_runtime_stack.push(locals[instr->get_int()]);
+            ++instr;
+            VM_NEXT;
+
+        VM_CASE(op_pop_param_local)
+            // pop the top of the param stack into a frame slot
+            ++instr;
+            if(m_param_stack.size() > m_callstack.top().param_base)
             {
-                value val = m_runtime_stack.top();
-                m_runtime_stack.pop();
-                string_table::entry ste =
-                    strings.insert(m_runtime_stack.top().to_str());
-                m_runtime_stack.pop();
-                // set the var's value
-                value& var = (ste[0] == '$') ? globals[ste] : stack_frame[ste];
-                if(var.type == value::type_int && val.type == value::type_int)
-                    var.intval *= val.intval;
-                else
-                {
-                    var.set_type(value::type_flt);
-                    var.fltval *= val.to_flt();
-                }
+                locals[instr->get_int()] = m_param_stack.back();
+                m_param_stack.pop_back();
+            }
+            else
+                locals[instr->get_int()].clear();
+            ++instr;
+            VM_NEXT;
+
+        VM_CASE(op_inc_local)
+            // increment a frame slot by one
+            {
+                ++instr;
+                value& var = locals[instr->get_int()];
+                var.set_type(value::type_int);
+                ++(var.intval);
                 ++instr;
             }
-	        break;
+            VM_NEXT;
 
-        case op_mul_asn_var:
-            // multiply a specified variable by a value
+        VM_CASE(op_dec_local)
+            // decrement a frame slot by one
             {
                 ++instr;
-                string_table::entry ste = instr->get_str();
-                value& var = (ste[0] == '$') ? globals[ste] : stack_frame[ste];
-                value val = m_runtime_stack.top();
-                m_runtime_stack.pop();
-                if(var.type == value::type_int && val.type == value::type_int)
-                    var.intval *= val.intval;
-                else
-                {
-                    var.set_type(value::type_flt);
-                    var.fltval *= val.to_flt();
-                }
+                value& var = locals[instr->get_int()];
+                var.set_type(value::type_int);
+                --(var.intval);
                 ++instr;
             }
-	        break;
+            VM_NEXT;
 
-        case op_div_asn:
-	        // the top of the stack is a value
-            // the next underneath is the name of a variable
-            // divide the variable by the value
+        VM_CASE(op_assign_local)
+            // assign a frame slot the value on the top of the stack
+            ++instr;
+            locals[instr->get_int()] = m_runtime_stack.top();
+            m_runtime_stack.pop();
+            ++instr;
+            VM_NEXT;
+
+        VM_CASE(op_push_global)
+            // push the value of a global slot
+            ++instr;
+            m_runtime_stack.push(m_globals[instr->get_int()]);
+            ++instr;
+            VM_NEXT;
+
+        VM_CASE(op_inc_global)
+            // increment a global slot by one
             {
-                value val = m_runtime_stack.top();
-                m_runtime_stack.pop();
-                string_table::entry ste =
-                    strings.insert(m_runtime_stack.top().to_str());
-                m_runtime_stack.pop();
-                // set the var's value
-                value& var = (ste[0] == '$') ? globals[ste] : stack_frame[ste];
-                if(var.type == value::type_int && val.type == value::type_int)
-                    var.intval /= val.intval;
-                else
-                {
-                    var.set_type(value::type_flt);
-                    var.fltval /= val.to_flt();
-                }
+                ++instr;
+                value& var = m_globals[instr->get_int()];
+                var.set_type(value::type_int);
+                ++(var.intval);
                 ++instr;
             }
-	        break;
+            VM_NEXT;
 
-        case op_div_asn_var:
-            // divide a specified variable by a value
+        VM_CASE(op_dec_global)
+            // decrement a global slot by one
             {
                 ++instr;
-                string_table::entry ste = instr->get_str();
-                value& var = (ste[0] == '$') ? globals[ste] : stack_frame[ste];
-                value& val = m_runtime_stack.top();
-                m_runtime_stack.pop();
-                if(var.type == value::type_int && val.type == value::type_int)
-                    var.intval /= val.intval;
-                else
-                {
-                    var.set_type(value::type_flt);
-                    var.fltval /= val.to_flt();
-                }
+                value& var = m_globals[instr->get_int()];
+                var.set_type(value::type_int);
+                --(var.intval);
                 ++instr;
             }
-	        break;
+            VM_NEXT;
+
+        VM_CASE(op_assign_global)
+            // assign a global slot the value on the top of the stack
+            ++instr;
+            m_globals[instr->get_int()] = m_runtime_stack.top();
+            m_runtime_stack.pop();
+            ++instr;
+            VM_NEXT;
 
-        case op_mod_asn:
+        VM_CASE(op_mul_asn)
             // the top of the stack is a value
             // the next underneath is the name of a variable
             // multiply the variable by the value
             {
                 value val = m_runtime_stack.top();
                 m_runtime_stack.pop();
-                string_table::entry ste =
-                    strings.insert(m_runtime_stack.top().to_str());
+                value& var = get_named_var(m_runtime_stack.top());
                 m_runtime_stack.pop();
-                // set the var's value
-                value& var = (ste[0] == '$') ? globals[ste] : stack_frame[ste];
-                var.set_type(value::type_int);
-                var.intval %= val.to_int();
+                mul_asn(var,val);
                 ++instr;
             }
-	        break;
+            VM_NEXT;
 
-        case op_mod_asn_var:
-            // mod a specified variable by a value
+        VM_CASE(op_mul_asn_var)
+            // multiply the variable by the value, the variable is named by the operand
             {
                 ++instr;
-                string_table::entry ste = instr->get_str();
-                value& var = (ste[0] == '$') ? globals[ste] : stack_frame[ste];
-                value& val = m_runtime_stack.top();
+                mul_asn(get_var(instr->get_str()),m_runtime_stack.top());
                 m_runtime_stack.pop();
-                // must be an int type
-                var.set_type(value::type_int);
-                var.intval %= val.to_int();
                 ++instr;
             }
-	        break;
+            VM_NEXT;
 
-        case op_add_asn:
-            // the top of the stack is a value
-            // the next underneath is the name of a variable
-            // add the value to the variable
+        VM_CASE(op_mul_asn_local)
+            // multiply the variable by the value, the variable is the frame slot in the operand
             {
-                value val = m_runtime_stack.top();
-                m_runtime_stack.pop();
-                string_table::entry ste =
-                    strings.insert(m_runtime_stack.top().to_str());
+                ++instr;
+                mul_asn(locals[instr->get_int()],m_runtime_stack.top());
                 m_runtime_stack.pop();
-                // set the var's value
-                value& var = (ste[0] == '$') ? globals[ste] : stack_frame[ste];
-                if(var.type == value::type_int && val.type == value::type_int)
-                    var.intval += val.intval;
-                else
-                {
-                    var.set_type(value::type_flt);
-                    var.fltval += val.to_flt();
-                }
                 ++instr;
             }
-	        break;
+            VM_NEXT;
 
-        case op_add_asn_var:
-            // add a specified variable to a value
+        VM_CASE(op_mul_asn_global)
+            // multiply the variable by the value, the variable is the global slot in the operand
             {
                 ++instr;
-                string_table::entry ste = instr->get_str();
-                value& var = (ste[0] == '$') ? globals[ste] : stack_frame[ste];
-                value& val = m_runtime_stack.top();
+                mul_asn(m_globals[instr->get_int()],m_runtime_stack.top());
                 m_runtime_stack.pop();
-                if(var.type == value::type_int && val.type == value::type_int)
-                    var.intval += val.intval;
-                else
-                {
-                    var.set_type(value::type_flt);
-                    var.fltval += val.to_flt();
-                }
                 ++instr;
             }
-	        break;
+            VM_NEXT;
 
-        case op_sub_asn:
+        VM_CASE(op_div_asn)
             // the top of the stack is a value
             // the next underneath is the name of a variable
-            // add the value to the variable
+            // divide the variable by the value
             {
                 value val = m_runtime_stack.top();
                 m_runtime_stack.pop();
-                string_table::entry ste =
-                    strings.insert(m_runtime_stack.top().to_str());
+                value& var = get_named_var(m_runtime_stack.top());
                 m_runtime_stack.pop();
-                // set the var's value
-                value& var = (ste[0] == '$') ? globals[ste] : stack_frame[ste];
-                if(var.type == value::type_int && val.type == value::type_int)
-                    var.intval -= val.intval;
-                else
-                {
-                    var.set_type(value::type_flt);
-                    var.fltval -= val.to_flt();
-                }
+                div_asn(var,val);
                 ++instr;
             }
-	        break;
+            VM_NEXT;
 
-        case op_sub_asn_var:
-            // subtract a value from a specified variable
+        VM_CASE(op_div_asn_var)
+            // divide the variable by the value, the variable is named by the operand
             {
                 ++instr;
-                string_table::entry ste = instr->get_str();
-                value& var = (ste[0] == '$') ? globals[ste] : stack_frame[ste];
-                value& val = m_runtime_stack.top();
+                div_asn(get_var(instr->get_str()),m_runtime_stack.top());
                 m_runtime_stack.pop();
-                if(var.type == value::type_int && val.type == value::type_int)
-                    var.intval -= val.intval;
-                else
-                {
-                    var.set_type(value::type_flt);
-                    var.fltval -= val.to_flt();
-                }
                 ++instr;
             }
-	        break;
+            VM_NEXT;
 
-        case op_cat_asn:
-            // the top of the stack is a value
-            // the next underneath is the name of a variable
-            // add the value to the variable
+        VM_CASE(op_div_asn_local)
+            // divide the variable by the value, the variable is the frame slot in the operand
             {
-                value val = m_runtime_stack.top();
-                m_runtime_stack.pop();
-                string_table::entry ste =
-                    strings.insert(m_runtime_stack.top().to_str());
+                ++instr;
+                div_asn(locals[instr->get_int()],m_runtime_stack.top());
                 m_runtime_stack.pop();
-                // set the var's value
-                value& var = (ste[0] == '$') ? globals[ste] : stack_frame[ste];
-                var.set_type(value::type_str);
-                var.strval.append(val.to_str());
                 ++instr;
             }
-	        break;
+            VM_NEXT;
 
-        case op_cat_asn_var:
-            // add a specified variable to a value
+        VM_CASE(op_div_asn_global)
+            // divide the variable by the value, the variable is the global slot in the operand
             {
                 ++instr;
-                string_table::entry ste = instr->get_str();
-                value& var = (ste[0] == '$') ? globals[ste] : stack_frame[ste];
-                value val = m_runtime_stack.top();
+                div_asn(m_globals[instr->get_int()],m_runtime_stack.top());
                 m_runtime_stack.pop();
-                var.set_type(value::type_str);
-                var.strval.append(val.to_str());
                 ++instr;
             }
-	        break;
+            VM_NEXT;
 
-        case op_band_asn:
-            // binary and a variable's value
+        VM_CASE(op_mod_asn)
+            // the top of the stack is a value
+            // the next underneath is the name of a variable
+            // mod the variable by the value
             {
                 value val = m_runtime_stack.top();
                 m_runtime_stack.pop();
-                string_table::entry ste =
-                    strings.insert(m_runtime_stack.top().to_str());
+                value& var = get_named_var(m_runtime_stack.top());
                 m_runtime_stack.pop();
-                // set the var's value
-                value& var = (ste[0] == '$') ? globals[ste] : stack_frame[ste];
-                var.set_type(value::type_int);
-                var.intval &= val.to_int();
+                mod_asn(var,val);
                 ++instr;
             }
-	        break;
+            VM_NEXT;
 
-        case op_band_asn_var:
+        VM_CASE(op_mod_asn_var)
+            // mod the variable by the value, the variable is named by the operand
             {
                 ++instr;
-                string_table::entry ste = instr->get_str();
-                value& var = (ste[0] == '$') ? globals[ste] : stack_frame[ste];
-                value& val = m_runtime_stack.top();
+                mod_asn(get_var(instr->get_str()),m_runtime_stack.top());
                 m_runtime_stack.pop();
-                // must be an int type
-                var.set_type(value::type_int);
-                var.intval &= val.to_int();
                 ++instr;
             }
-	        break;
+            VM_NEXT;
 
-        case op_bor_asn:
-	        // binary or a variable's value
+        VM_CASE(op_mod_asn_local)
+            // mod the variable by the value, the variable is the frame slot in the operand
             {
-                value val = m_runtime_stack.top();
-                m_runtime_stack.pop();
-                string_table::entry ste =
-                    strings.insert(m_runtime_stack.top().to_str());
+                ++instr;
+                mod_asn(locals[instr->get_int()],m_runtime_stack.top());
                 m_runtime_stack.pop();
-                // set the var's value
-                value& var = (ste[0] == '$') ? globals[ste] : stack_frame[ste];
-                var.set_type(value::type_int);
-                var.intval |= val.to_int();
                 ++instr;
             }
-	        break;
+            VM_NEXT;
 
-        case op_bor_asn_var:
+        VM_CASE(op_mod_asn_global)
+            // mod the variable by the value, the variable is the global slot in the operand
             {
                 ++instr;
-                string_table::entry ste = instr->get_str();
-                value& var = (ste[0] == '$') ? globals[ste] : stack_frame[ste];
-                value& val = m_runtime_stack.top();
+                mod_asn(m_globals[instr->get_int()],m_runtime_stack.top());
                 m_runtime_stack.pop();
-                // must be an int type
-                var.set_type(value::type_int);
-                var.intval |= val.to_int();
                 ++instr;
             }
-	        break;
+            VM_NEXT;
 
-        case op_bxor_asn:
-            // binary xor a variable's value
+        VM_CASE(op_add_asn)
+            // the top of the stack is a value
+            // the next underneath is the name of a variable
+            // add the value to the variable
             {
                 value val = m_runtime_stack.top();
                 m_runtime_stack.pop();
-                string_table::entry ste =
-                    strings.insert(m_runtime_stack.top().to_str());
+                value& var = get_named_var(m_runtime_stack.top());
                 m_runtime_stack.pop();
-                // set the var's value
-                value& var = (ste[0] == '$') ? globals[ste] : stack_frame[ste];
-                var.set_type(value::type_int);
-                var.intval ^= val.to_int();
+                add_asn(var,val);
                 ++instr;
             }
-	        break;
+            VM_NEXT;
 
-        case op_bxor_asn_var:
+        VM_CASE(op_add_asn_var)
+            // add the value to the variable, the variable is named by the operand
             {
                 ++instr;
-                string_table::entry ste = instr->get_str();
-                value& var = (ste[0] == '$') ? globals[ste] : stack_frame[ste];
-                value& val = m_runtime_stack.top();
+                add_asn(get_var(instr->get_str()),m_runtime_stack.top());
                 m_runtime_stack.pop();
-                // must be an int type
-                var.set_type(value::type_int);
-                var.intval ^= val.to_int();
                 ++instr;
             }
-	        break;
+            VM_NEXT;
 
-        case op_shl_asn:
-            // shift left a variable's value
+        VM_CASE(op_add_asn_local)
+            // add the value to the variable, the variable is the frame slot in the operand
             {
-                value val = m_runtime_stack.top();
-                m_runtime_stack.pop();
-                string_table::entry ste =
-                    strings.insert(m_runtime_stack.top().to_str());
+                ++instr;
+                add_asn(locals[instr->get_int()],m_runtime_stack.top());
                 m_runtime_stack.pop();
-                // set the var's value
-                value& var = (ste[0] == '$') ? globals[ste] : stack_frame[ste];
-                var.set_type(value::type_int);
-                var.intval <<= val.to_int();
                 ++instr;
             }
-	        break;
+            VM_NEXT;
 
-        case op_shl_asn_var:
+        VM_CASE(op_add_asn_global)
+            // add the value to the variable, the variable is the global slot in the operand
             {
                 ++instr;
-                string_table::entry ste = instr->get_str();
-                value& var = (ste[0] == '$') ? globals[ste] : stack_frame[ste];
-                value& val = m_runtime_stack.top();
+                add_asn(m_globals[instr->get_int()],m_runtime_stack.top());
                 m_runtime_stack.pop();
-                // must be an int type
-                var.set_type(value::type_int);
-                var.intval <<= val.to_int();
                 ++instr;
             }
-	        break;
+            VM_NEXT;
 
-        case op_shr_asn:
-            // shift right a variable's value
+        VM_CASE(op_sub_asn)
+            // the top of the stack is a value
+            // the next underneath is the name of a variable
+            // subtract the value from the variable
             {
                 value val = m_runtime_stack.top();
                 m_runtime_stack.pop();
-                string_table::entry ste =
-                    strings.insert(m_runtime_stack.top().to_str());
+                value& var = get_named_var(m_runtime_stack.top());
                 m_runtime_stack.pop();
-                // set the var's value
-                value& var =
-                    (ste[0] == '$') ? globals[ste] : stack_frame[ste];
-                var.set_type(value::type_int);
-                var.intval >>= val.to_int();
+                sub_asn(var,val);
                 ++instr;
             }
-	        break;
+            VM_NEXT;
 
-        case op_shr_asn_var:
+        VM_CASE(op_sub_asn_var)
+            // subtract the value from the variable, the variable is named by the operand
             {
                 ++instr;
-                string_table::entry ste = instr->get_str();
-                value& var = (ste[0] == '$') ? globals[ste] : stack_frame[ste];
-                value& val = m_runtime_stack.top();
+                sub_asn(get_var(instr->get_str()),m_runtime_stack.top());
+                m_runtime_stack.pop();
+                ++instr;
+            }
+            VM_NEXT;
+
+        VM_CASE(op_sub_asn_local)
+            // subtract the value from the variable, the variable is the frame slot in the operand
+            {
+                ++instr;
+                sub_asn(locals[instr->get_int()],m_runtime_stack.top());
+                m_runtime_stack.pop();
+                ++instr;
+            }
+            VM_NEXT;
+
+        VM_CASE(op_sub_asn_global)
+            // subtract the value from the variable, the variable is the global slot in the operand
+            {
+                ++instr;
+                sub_asn(m_globals[instr->get_int()],m_runtime_stack.top());
+                m_runtime_stack.pop();
+                ++instr;
+            }
+            VM_NEXT;
+
+        VM_CASE(op_cat_asn)
+            // the top of the stack is a value
+            // the next underneath is the name of a variable
+            // concat the value onto the variable
+            {
+                value val = m_runtime_stack.top();
+                m_runtime_stack.pop();
+                value& var = get_named_var(m_runtime_stack.top());
+                m_runtime_stack.pop();
+                cat_asn(var,val);
+                ++instr;
+            }
+            VM_NEXT;
+
+        VM_CASE(op_cat_asn_var)
+            // concat the value onto the variable, the variable is named by the operand
+            {
+                ++instr;
+                cat_asn(get_var(instr->get_str()),m_runtime_stack.top());
+                m_runtime_stack.pop();
+                ++instr;
+            }
+            VM_NEXT;
+
+        VM_CASE(op_cat_asn_local)
+            // concat the value onto the variable, the variable is the frame slot in the operand
+            {
+                ++instr;
+                cat_asn(locals[instr->get_int()],m_runtime_stack.top());
+                m_runtime_stack.pop();
+                ++instr;
+            }
+            VM_NEXT;
+
+        VM_CASE(op_cat_asn_global)
+            // concat the value onto the variable, the variable is the global slot in the operand
+            {
+                ++instr;
+                cat_asn(m_globals[instr->get_int()],m_runtime_stack.top());
+                m_runtime_stack.pop();
+                ++instr;
+            }
+            VM_NEXT;
+
+        VM_CASE(op_band_asn)
+            // the top of the stack is a value
+            // the next underneath is the name of a variable
+            // binary and the variable with the value
+            {
+                value val = m_runtime_stack.top();
+                m_runtime_stack.pop();
+                value& var = get_named_var(m_runtime_stack.top());
+                m_runtime_stack.pop();
+                band_asn(var,val);
+                ++instr;
+            }
+            VM_NEXT;
+
+        VM_CASE(op_band_asn_var)
+            // binary and the variable with the value, the variable is named by the operand
+            {
+                ++instr;
+                band_asn(get_var(instr->get_str()),m_runtime_stack.top());
+                m_runtime_stack.pop();
+                ++instr;
+            }
+            VM_NEXT;
+
+        VM_CASE(op_band_asn_local)
+            // binary and the variable with the value, the variable is the frame slot in the operand
+            {
+                ++instr;
+                band_asn(locals[instr->get_int()],m_runtime_stack.top());
+                m_runtime_stack.pop();
+                ++instr;
+            }
+            VM_NEXT;
+
+        VM_CASE(op_band_asn_global)
+            // binary and the variable with the value, the variable is the global slot in the operand
+            {
+                ++instr;
+                band_asn(m_globals[instr->get_int()],m_runtime_stack.top());
+                m_runtime_stack.pop();
+                ++instr;
+            }
+            VM_NEXT;
+
+        VM_CASE(op_bor_asn)
+            // the top of the stack is a value
+            // the next underneath is the name of a variable
+            // binary or the variable with the value
+            {
+                value val = m_runtime_stack.top();
+                m_runtime_stack.pop();
+                value& var = get_named_var(m_runtime_stack.top());
+                m_runtime_stack.pop();
+                bor_asn(var,val);
+                ++instr;
+            }
+            VM_NEXT;
+
+        VM_CASE(op_bor_asn_var)
+            // binary or the variable with the value, the variable is named by the operand
+            {
+                ++instr;
+                bor_asn(get_var(instr->get_str()),m_runtime_stack.top());
+                m_runtime_stack.pop();
+                ++instr;
+            }
+            VM_NEXT;
+
+        VM_CASE(op_bor_asn_local)
+            // binary or the variable with the value, the variable is the frame slot in the operand
+            {
+                ++instr;
+                bor_asn(locals[instr->get_int()],m_runtime_stack.top());
+                m_runtime_stack.pop();
+                ++instr;
+            }
+            VM_NEXT;
+
+        VM_CASE(op_bor_asn_global)
+            // binary or the variable with the value, the variable is the global slot in the operand
+            {
+                ++instr;
+                bor_asn(m_globals[instr->get_int()],m_runtime_stack.top());
+                m_runtime_stack.pop();
+                ++instr;
+            }
+            VM_NEXT;
+
+        VM_CASE(op_bxor_asn)
+            // the top of the stack is a value
+            // the next underneath is the name of a variable
+            // binary xor the variable with the value
+            {
+                value val = m_runtime_stack.top();
+                m_runtime_stack.pop();
+                value& var = get_named_var(m_runtime_stack.top());
+                m_runtime_stack.pop();
+                bxor_asn(var,val);
+                ++instr;
+            }
+            VM_NEXT;
+
+        VM_CASE(op_bxor_asn_var)
+            // binary xor the variable with the value, the variable is named by the operand
+            {
+                ++instr;
+                bxor_asn(get_var(instr->get_str()),m_runtime_stack.top());
+                m_runtime_stack.pop();
+                ++instr;
+            }
+            VM_NEXT;
+
+        VM_CASE(op_bxor_asn_local)
+            // binary xor the variable with the value, the variable is the frame slot in the operand
+            {
+                ++instr;
+                bxor_asn(locals[instr->get_int()],m_runtime_stack.top());
+                m_runtime_stack.pop();
+                ++instr;
+            }
+            VM_NEXT;
+
+        VM_CASE(op_bxor_asn_global)
+            // binary xor the variable with the value, the variable is the global slot in the operand
+            {
+                ++instr;
+                bxor_asn(m_globals[instr->get_int()],m_runtime_stack.top());
+                m_runtime_stack.pop();
+                ++instr;
+            }
+            VM_NEXT;
+
+        VM_CASE(op_shl_asn)
+            // the top of the stack is a value
+            // the next underneath is the name of a variable
+            // shift the variable left by the value
+            {
+                value val = m_runtime_stack.top();
+                m_runtime_stack.pop();
+                value& var = get_named_var(m_runtime_stack.top());
+                m_runtime_stack.pop();
+                shl_asn(var,val);
+                ++instr;
+            }
+            VM_NEXT;
+
+        VM_CASE(op_shl_asn_var)
+            // shift the variable left by the value, the variable is named by the operand
+            {
+                ++instr;
+                shl_asn(get_var(instr->get_str()),m_runtime_stack.top());
+                m_runtime_stack.pop();
+                ++instr;
+            }
+            VM_NEXT;
+
+        VM_CASE(op_shl_asn_local)
+            // shift the variable left by the value, the variable is the frame slot in the operand
+            {
+                ++instr;
+                shl_asn(locals[instr->get_int()],m_runtime_stack.top());
+                m_runtime_stack.pop();
+                ++instr;
+            }
+            VM_NEXT;
+
+        VM_CASE(op_shl_asn_global)
+            // shift the variable left by the value, the variable is the global slot in the operand
+            {
+                ++instr;
+                shl_asn(m_globals[instr->get_int()],m_runtime_stack.top());
+                m_runtime_stack.pop();
+                ++instr;
+            }
+            VM_NEXT;
+
+        VM_CASE(op_shr_asn)
+            // the top of the stack is a value
+            // the next underneath is the name of a variable
+            // shift the variable right by the value
+            {
+                value val = m_runtime_stack.top();
+                m_runtime_stack.pop();
+                value& var = get_named_var(m_runtime_stack.top());
+                m_runtime_stack.pop();
+                shr_asn(var,val);
+                ++instr;
+            }
+            VM_NEXT;
+
+        VM_CASE(op_shr_asn_var)
+            // shift the variable right by the value, the variable is named by the operand
+            {
+                ++instr;
+                shr_asn(get_var(instr->get_str()),m_runtime_stack.top());
+                m_runtime_stack.pop();
+                ++instr;
+            }
+            VM_NEXT;
+
+        VM_CASE(op_shr_asn_local)
+            // shift the variable right by the value, the variable is the frame slot in the operand
+            {
+                ++instr;
+                shr_asn(locals[instr->get_int()],m_runtime_stack.top());
+                m_runtime_stack.pop();
+                ++instr;
+            }
+            VM_NEXT;
+
+        VM_CASE(op_shr_asn_global)
+            // shift the variable right by the value, the variable is the global slot in the operand
+            {
+                ++instr;
+                shr_asn(m_globals[instr->get_int()],m_runtime_stack.top());
                 m_runtime_stack.pop();
-                // must be an int type
-                var.set_type(value::type_int);
-                var.intval >>= val.to_int();
                 ++instr;
             }
-	        break;
+            VM_NEXT;
 
-        case op_jmp_false:
+        VM_CASE(op_jmp_false)
             {
                 ++instr;
                 // offset
@@ -1059,16 +1957,234 @@ void vmachine::execute(
                     ++instr;
                 m_runtime_stack.pop();
             }
-	        break;
+            VM_NEXT;
 
-        case op_jmp:
+        VM_CASE(op_jmp)
             {
                 ++instr;
                 // offset
                 instr = begin + instr->get_int();
             }
-	        break;
+            VM_NEXT;
+
+        VM_CASE(op_inline_guard)
+            // run the inlined code, or the call it stands for
+            if(is_inlined(&*instr))
+                instr += 6;
+            else
+                instr = begin + instr[1].get_int();
+            VM_NEXT;
+
+        VM_CASE(op_load_func)
+            // the first call of a function loaded from a compiled file
+            instr = load_func(&*instr);
+            VM_LOAD_FRAME;
+            VM_NEXT;
+
+        VM_CASE(op_mul_ii)
+            VM_QUICK_BINARY(int,type_int,intval,op_mul,newtop.intval = lhs * rhs);
+
+        VM_CASE(op_mul_ff)
+            VM_QUICK_BINARY(double,type_flt,fltval,op_mul,newtop.fltval = lhs * rhs);
+
+        VM_CASE(op_div_ii)
+            VM_QUICK_BINARY(int,type_int,intval,op_div,newtop.intval = div_ii(lhs,rhs));
+
+        VM_CASE(op_div_ff)
+            VM_QUICK_BINARY(double,type_flt,fltval,op_div,newtop.fltval = lhs / rhs);
+
+        VM_CASE(op_add_ii)
+            VM_QUICK_BINARY(int,type_int,intval,op_add,newtop.intval = lhs + rhs);
+
+        VM_CASE(op_add_ff)
+            VM_QUICK_BINARY(double,type_flt,fltval,op_add,newtop.fltval = lhs + rhs);
+
+        VM_CASE(op_sub_ii)
+            VM_QUICK_BINARY(int,type_int,intval,op_sub,newtop.intval = lhs - rhs);
+
+        VM_CASE(op_sub_ff)
+            VM_QUICK_BINARY(double,type_flt,fltval,op_sub,newtop.fltval = lhs - rhs);
+
+        VM_CASE(op_cmp_less_eq_ii)
+            VM_QUICK_BINARY(int,type_int,intval,op_cmp_less_eq,newtop.intval = lhs <= rhs);
+
+        VM_CASE(op_cmp_less_eq_ff)
+            VM_QUICK_BINARY(double,type_flt,fltval,op_cmp_less_eq,newtop = static_cast<int>(lhs <= rhs));
+
+        VM_CASE(op_cmp_less_ii)
+            VM_QUICK_BINARY(int,type_int,intval,op_cmp_less,newtop.intval = lhs < rhs);
+
+        VM_CASE(op_cmp_less_ff)
+            VM_QUICK_BINARY(double,type_flt,fltval,op_cmp_less,newtop = static_cast<int>(lhs < rhs));
+
+        VM_CASE(op_cmp_grtr_eq_ii)
+            VM_QUICK_BINARY(int,type_int,intval,op_cmp_grtr_eq,newtop.intval = lhs >= rhs);
+
+        VM_CASE(op_cmp_grtr_eq_ff)
+            VM_QUICK_BINARY(double,type_flt,fltval,op_cmp_grtr_eq,newtop = static_cast<int>(lhs >= rhs));
+
+        VM_CASE(op_cmp_grtr_ii)
+            VM_QUICK_BINARY(int,type_int,intval,op_cmp_grtr,newtop.intval = lhs > rhs);
+
+        VM_CASE(op_cmp_grtr_ff)
+            VM_QUICK_BINARY(double,type_flt,fltval,op_cmp_grtr,newtop = static_cast<int>(lhs > rhs));
+
+        VM_CASE(op_eq_ii)
+            VM_QUICK_BINARY(int,type_int,intval,op_eq,newtop.intval = lhs == rhs);
+
+        VM_CASE(op_eq_ff)
+            VM_QUICK_BINARY(double,type_flt,fltval,op_eq,newtop = static_cast<int>(lhs == rhs));
+
+        VM_CASE(op_neq_ii)
+            VM_QUICK_BINARY(int,type_int,intval,op_neq,newtop.intval = lhs != rhs);
+
+        VM_CASE(op_neq_ff)
+            VM_QUICK_BINARY(double,type_flt,fltval,op_neq,newtop = static_cast<int>(lhs != rhs));
+
+        VM_CASE(op_param_str)
+            // push a string straight onto the param stack
+            ++instr;
+            m_param_stack.push_back(instr->get_str());
+            ++instr;
+            VM_NEXT;
+
+        VM_CASE(op_param_int)
+            // push an int straight onto the param stack
+            ++instr;
+            m_param_stack.push_back(instr->get_int());
+            ++instr;
+            VM_NEXT;
+
+        VM_CASE(op_param_var)
+            // push the value of the variable straight onto the param stack
+            ++instr;
+            m_param_stack.push_back(get_var(instr->get_str()));
+            ++instr;
+            VM_NEXT;
+
+        VM_CASE(op_param_local)
+            // push the value of a frame slot straight onto the param stack
+            ++instr;
+            m_param_stack.push_back(locals[instr->get_int()]);
+            ++instr;
+            VM_NEXT;
+
+        VM_CASE(op_param_global)
+            // push the value of a global slot straight onto the param stack
+            ++instr;
+            m_param_stack.push_back(m_globals[instr->get_int()]);
+            ++instr;
+            VM_NEXT;
+
+        VM_CASE(op_cmp_less_eq_jmp_false)
+            VM_CMP_JMP_FALSE(<=);
+
+        VM_CASE(op_cmp_less_jmp_false)
+            VM_CMP_JMP_FALSE(<);
+
+        VM_CASE(op_cmp_grtr_eq_jmp_false)
+            VM_CMP_JMP_FALSE(>=);
+
+        VM_CASE(op_cmp_grtr_jmp_false)
+            VM_CMP_JMP_FALSE(>);
+
+        VM_CASE(op_eq_jmp_false)
+            VM_CMP_JMP_FALSE(==);
 
+        VM_CASE(op_neq_jmp_false)
+            VM_CMP_JMP_FALSE(!=);
+
+        VM_CASE(op_bool)
+            // turn the top of the stack into 0 or 1, the same way
+            // op_log_and and op_log_or see their operands
+            {
+                value& top = m_runtime_stack.top();
+                if(top.type == value::type_int)
+                    top.intval = top.intval != 0;
+                else
+                    top = static_cast<int>(top.to_flt() != 0);
+                ++instr;
+            }
+            VM_NEXT;
+
+        VM_CASE(op_jmp_false_peek)
+            // jump if the top of the stack is false, leaving it there
+            {
+                ++instr;
+                if(!m_runtime_stack.top().to_int())
+                    instr = begin + instr->get_int();
+                else
+                {
+                    m_runtime_stack.pop();
+                    ++instr;
+                }
+            }
+            VM_NEXT;
+
+        VM_CASE(op_jmp_true_peek)
+            // jump if the top of the stack is true, leaving it there
+            {
+                ++instr;
+                if(m_runtime_stack.top().to_int())
+                    instr = begin + instr->get_int();
+                else
+                {
+                    m_runtime_stack.pop();
+                    ++instr;
+                }
+            }
+            VM_NEXT;
+
+        VM_CASE(op_push_elem)
+        VM_CASE(op_push_elem_local)
+        VM_CASE(op_push_elem_global)
+            // replace the indexes on the stack with the element they name
+            {
+                op_code op = instr->get_op_code();
+                ++instr;
+                instruction var = *instr;
+                ++instr;
+                pop_indexes(instr->get_int());
+                const value* elem = find_elem(
+                    op == op_push_elem_local ? locals[var.get_int()] :
+                    op == op_push_elem_global ? m_globals[var.get_int()] :
+                    get_var(var.get_str())
+                    );
+                m_runtime_stack.push(elem != 0 ? *elem : value());
+                ++instr;
+            }
+            VM_NEXT;
+
+        VM_CASE(op_asn_elem)
+        VM_CASE(op_asn_elem_local)
+        VM_CASE(op_asn_elem_global)
+            // assign to the element named by the indexes on the stack
+            {
+                op_code op = instr->get_op_code();
+                ++instr;
+                instruction var = *instr;
+                ++instr;
+                size_t count = instr->get_int();
+                ++instr;
+                op_code asn_op = static_cast<op_code>(instr->get_int());
+                value val;
+                if(asn_op != op_inc_var && asn_op != op_dec_var)
+                {
+                    val = m_runtime_stack.top();
+                    m_runtime_stack.pop();
+                }
+                pop_indexes(count);
+                value& elem = get_elem(
+                    op == op_asn_elem_local ? locals[var.get_int()] :
+                    op == op_asn_elem_global ? m_globals[var.get_int()] :
+                    get_var(var.get_str())
+                    );
+                assign_elem(elem,asn_op,val);
+                ++instr;
+            }
+            VM_NEXT;
+
+#ifndef DSCRIPT_THREADED_DISPATCH
         default:
             {
                 stringstream msg;
@@ -1077,9 +2193,388 @@ void vmachine::execute(
                 throw runtime_error(msg.str());
             }
         }
-        if(returned)
-            break; // exit the loop
     }
-    // pop the stack frame
-    m_callstack.pop();
+#endif
+}
+
+value* vmachine::native_locals()
+{
+    call_frame& frame = m_callstack.top();
+    return frame.local_count ? &m_locals[frame.base] : 0;
+}
+
+bool vmachine::native_op(context& ctx,const instruction* instr)
+{
+    op_code op = instr->get_op_code();
+    value* locals = native_locals();
+    asn_func asn = get_asn_func(op);
+    const char* operands = get_op_operands(op);
+    if(asn != 0)
+    {
+        // a binary op, or a compound assignment
+        value val = m_runtime_stack.top();
+        m_runtime_stack.pop();
+        if(operands[0] == '\0')
+            asn(m_runtime_stack.top(),val);
+        else if(operands[0] == 'l')
+            asn(locals[instr[1].get_int()],val);
+        else if(operands[0] == 'g')
+            asn(m_globals[instr[1].get_int()],val);
+        else
+            asn(get_var(instr[1].get_str()),val);
+        return false;
+    }
+
+    switch(op)
+    {
+    case op_cmp_less_eq: case op_cmp_less_eq_ii: case op_cmp_less_eq_ff:
+    case op_cmp_less: case op_cmp_less_ii: case op_cmp_less_ff:
+    case op_cmp_grtr_eq: case op_cmp_grtr_eq_ii: case op_cmp_grtr_eq_ff:
+    case op_cmp_grtr: case op_cmp_grtr_ii: case op_cmp_grtr_ff:
+    case op_eq: case op_eq_ii: case op_eq_ff:
+    case op_neq: case op_neq_ii: case op_neq_ff:
+        {
+            value top = m_runtime_stack.top();
+            m_runtime_stack.pop();
+            value& newtop = m_runtime_stack.top();
+            newtop = static_cast<int>(compare(op,newtop,top));
+        }
+        return false;
+    case op_cmp_less_eq_jmp_false:
+    case op_cmp_less_jmp_false:
+    case op_cmp_grtr_eq_jmp_false:
+    case op_cmp_grtr_jmp_false:
+    case op_eq_jmp_false:
+    case op_neq_jmp_false:
+        {
+            // jumps if the comparison is false
+            const value& top = m_runtime_stack.top();
+            bool jump = !compare(op,(&top)[-1],top);
+            m_runtime_stack.pop();
+            m_runtime_stack.pop();
+            return jump;
+        }
+    case op_jmp_false:
+        {
+            bool jump = !m_runtime_stack.top().to_int();
+            m_runtime_stack.pop();
+            return jump;
+        }
+    case op_jmp_false_peek:
+    case op_jmp_true_peek:
+        {
+            bool truth = m_runtime_stack.top().to_int() != 0;
+            bool jump = op == op_jmp_false_peek ? !truth : truth;
+            if(!jump)
+                m_runtime_stack.pop();
+            return jump;
+        }
+    case op_log_and:
+    case op_log_or:
+        {
+            value top = m_runtime_stack.top();
+            m_runtime_stack.pop();
+            value& newtop = m_runtime_stack.top();
+            bool lhs;
+            bool rhs;
+            if(
+                top.type == value::type_int &&
+                newtop.type == value::type_int
+                )
+            {
+                lhs = newtop.intval != 0;
+                rhs = top.intval != 0;
+            }
+            else
+            {
+                lhs = newtop.to_flt() != 0;
+                rhs = top.to_flt() != 0;
+            }
+            newtop = static_cast<int>(op == op_log_and ? lhs && rhs : lhs || rhs);
+        }
+        return false;
+    case op_bool:
+        {
+            value& top = m_runtime_stack.top();
+            if(top.type == value::type_int)
+                top.intval = top.intval != 0;
+            else
+                top = static_cast<int>(top.to_flt() != 0);
+        }
+        return false;
+    case op_neg:
+    case op_log_not:
+    case op_bit_not:
+        {
+            value& top = m_runtime_stack.top();
+            top.set_type(value::type_int);
+            if(op == op_neg)
+                top.intval = -top.intval;
+            else if(op == op_log_not)
+                top.intval = !top.intval;
+            else
+                top.intval = ~top.intval;
+        }
+        return false;
+    case op_push_str:
+        m_runtime_stack.push(instr[1].get_str());
+        return false;
+    case op_push_int:
+        m_runtime_stack.push(instr[1].get_int());
+        return false;
+    case op_push_float:
+        m_runtime_stack.push(*(instr[1].get_flt()));
+        return false;
+    case op_push_var:
+        m_runtime_stack.push(get_var(instr[1].get_str()));
+        return false;
+    case op_push_local:
+        m_runtime_stack.push(locals[instr[1].get_int()]);
+        return false;
+    case op_push_global:
+        m_runtime_stack.push(m_globals[instr[1].get_int()]);
+        return false;
+    case op_load_ret:
+        m_runtime_stack.push(m_return_val);
+        return false;
+    case op_store_ret:
+    case op_return_value:
+        m_return_val = m_runtime_stack.top();
+        m_runtime_stack.pop();
+        return false;
+    case op_assign_var:
+    case op_assign_local:
+    case op_assign_global:
+        {
+            value& var =
+                op == op_assign_local ? locals[instr[1].get_int()] :
+                op == op_assign_global ? m_globals[instr[1].get_int()] :
+                get_var(instr[1].get_str());
+            var = m_runtime_stack.top();
+            m_runtime_stack.pop();
+        }
+        return false;
+    case op_inc_var: case op_inc_local: case op_inc_global:
+    case op_dec_var: case op_dec_local: case op_dec_global:
+        {
+            value& var =
+                operands[0] == 'l' ? locals[instr[1].get_int()] :
+                operands[0] == 'g' ? m_globals[instr[1].get_int()] :
+                get_var(instr[1].get_str());
+            var.set_type(value::type_int);
+            if(op == op_inc_var || op == op_inc_local || op == op_inc_global)
+                ++(var.intval);
+            else
+                --(var.intval);
+        }
+        return false;
+    case op_pop_param:
+    case op_pop_param_local:
+        {
+            value& var =
+                op == op_pop_param_local ? locals[instr[1].get_int()] :
+                get_var(instr[1].get_str());
+            if(m_param_stack.size() > m_callstack.top().param_base)
+            {
+                var = m_param_stack.back();
+                m_param_stack.pop_back();
+            }
+            else
+                var.clear();
+        }
+        return false;
+    case op_push_param:
+        m_param_stack.push_back(m_runtime_stack.top());
+        m_runtime_stack.pop();
+        return false;
+    case op_param_str:
+        m_param_stack.push_back(instr[1].get_str());
+        return false;
+    case op_param_int:
+        m_param_stack.push_back(instr[1].get_int());
+        return false;
+    case op_param_var:
+        m_param_stack.push_back(get_var(instr[1].get_str()));
+        return false;
+    case op_param_local:
+        m_param_stack.push_back(locals[instr[1].get_int()]);
+        return false;
+    case op_param_global:
+        m_param_stack.push_back(m_globals[instr[1].get_int()]);
+        return false;
+    case op_call_func:
+    case op_call_load_ret:
+        {
+            size_t argc = instr[2].get_int();
+            m_return_val.clear();
+            func_table::entry* e = find_func(instr);
+            if(!call_host(e,instr[1].get_str(),argc,ctx))
+            {
+                // a script function runs to completion in a
+                // dispatch loop of its own
+                execute(e->begin,e->end,e->start,ctx,e,argc);
+            }
+            if(op == op_call_load_ret)
+                m_runtime_stack.push(m_return_val);
+        }
+        return false;
+    case op_inline_guard:
+        return !is_inlined(instr);
+    default:
+        throw runtime_error(
+            string("op_code ") + get_op_name(op) + " can't run natively."
+            );
+    }
+}
+
+namespace
+{
+    // Native code that calls back into the vmachine nests on the C++
+    // stack, so past max_native_depth functions are left to the
+    // interpreter.
+    const size_t max_native_depth = 128;
+}
+
+void vmachine::link_compiled(
+                             string_table::entry name,
+                             compiled_func func,
+                             unsigned int checksum
+                             )
+{
+    compiled_version& version = m_compiled[string_table::get_symbol(name)];
+    version.func = func;
+    version.checksum = checksum;
+    func_table::entry* e = functions.find(name);
+    if(e != 0 && !e->is_host)
+        bind_compiled(*e);
+}
+
+void vmachine::bind_compiled(func_table::entry& func)
+{
+    // a function compiled from different code is left to the interpreter
+    func.compiled = 0;
+    const compiled_version* version =
+        m_compiled.find(string_table::get_symbol(func.name));
+    if(
+        version != 0 &&
+        version->checksum == get_func_checksum(
+            func.begin,
+            func.start,
+            func.end,
+            func.local_count
+            )
+        )
+        func.compiled = version->func;
+}
+
+instr_iter vmachine::enter_compiled(const func_table::entry& func,context& ctx)
+{
+    if(m_jit_depth >= max_native_depth)
+        return func.start;
+    // a function declared while it runs can move func (see symbol_map),
+    // so nothing of it is used once it has been called
+    instr_iter func_start = func.start;
+    // func.start may be the end of the codeblock
+    const instruction* start = &*func.begin + (func.start - func.begin);
+    native_frame frame(*this,ctx,start,start + (func.end - func.start));
+    ++m_jit_depth;
+    const instruction* next;
+    try
+    {
+        next = func.compiled(frame);
+    }
+    catch(...)
+    {
+        --m_jit_depth;
+        throw;
+    }
+    --m_jit_depth;
+    return func_start + (next - start);
+}
+
+native_frame::native_frame(
+                           vmachine& vm,
+                           context& ctx,
+                           const instruction* start,
+                           const instruction* stop
+                           )
+    : code(start),
+      end(stop),
+      locals(vm.native_locals()),
+      stack(vm.m_runtime_stack),
+      m_vm(vm),
+      m_ctx(ctx)
+{
+}
+
+bool native_frame::run_op(size_t off)
+{
+    bool jump = m_vm.native_op(m_ctx,code + off);
+    // a call can move the frame slots
+    locals = m_vm.native_locals();
+    return jump;
+}
+
+#ifdef DSCRIPT_HAS_JIT
+namespace
+{
+    // a function is compiled on its jit_after_calls'th call
+    const size_t jit_after_calls = 50;
+}
+
+instr_iter vmachine::enter_native(
+                                  const func_table::entry& func,
+                                  instr_iter instr,
+                                  context& ctx
+                                  )
+{
+    if(m_jit_depth >= max_native_depth)
+        return instr;
+    native_code code = reinterpret_cast<native_code>(func.native);
+    if(code == 0)
+    {
+        if(++func.call_count != jit_after_calls)
+            return instr;
+        if(m_jit_depth == 0)
+            release_native();
+        code = m_jit->compile(func,*this);
+        func.native = reinterpret_cast<const void*>(code);
+        if(code == 0)
+            return instr;
+    }
+
+    instr_iter begin = m_callstack.top().begin;
+    ++m_jit_depth;
+    const instruction* next = code(this,&ctx,native_locals());
+    --m_jit_depth;
+    if(next == 0)
+        throw runtime_error(m_jit_error);
+    return begin + (next - &*begin);
+}
+
+void vmachine::release_native()
+{
+    vector<const void*> retired;
+    functions.take_retired_native(retired);
+    for(size_t i = 0; i < retired.size(); ++i)
+        m_jit->release(reinterpret_cast<native_code>(retired[i]));
+}
+
+int vmachine::jit_op(context& ctx,const instruction* instr)
+{
+    // errors can't be thrown through native code
+    try
+    {
+        return native_op(ctx,instr);
+    }
+    catch(std::exception& e)
+    {
+        m_jit_error = e.what();
+    }
+    catch(...)
+    {
+        m_jit_error = "Unknown error in native code.";
+    }
+    return -1;
 }
+#endif
@@ -14,6 +14,8 @@
 ////////////////////////////////////////////////////////////////////////////////
 // Standard Library Includes
 #include <stack>
+#include <stdexcept>
+#include <vector>
 ////////////////////////////////////////////////////////////////////////////////
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -25,27 +27,278 @@
 
 namespace dscript
 {
+    /// Identifies the slot of a global variable,
+    /// see context::get_global_handle()
+    typedef size_t global_handle;
+
+    /// The runtime stack. Unlike std::stack, it keeps its values in one
+    /// block, between m_base and m_end, so native code can work on them
+    /// directly (see jit.h). The slots from m_end up to m_limit never hold
+    /// a reference to a string or array, so a number can be stored in
+    /// one without releasing anything first.
+    ///
+    /// The vmachine only runs verified code (see verify_codeblock), and
+    /// reserves as many slots as a frame can use when it enters it, so
+    /// push() doesn't check for room and pop() doesn't check for
+    /// underflow. Define DSCRIPT_CHECKED_STACK to check both anyway.
+    class value_stack
+    {
+    public:
+        value_stack() : m_slots(64)
+        {
+            m_base = m_end = &m_slots[0];
+            m_limit = m_base + m_slots.size();
+        }
+
+        value& top() { check_underflow(); return m_end[-1]; }
+        const value& top() const { check_underflow(); return m_end[-1]; }
+
+        void push(const value& val)
+        {
+#ifdef DSCRIPT_CHECKED_STACK
+            if(m_end == m_limit)
+            {
+                // val may be on the stack itself
+                value copy(val);
+                grow();
+                *m_end++ = copy;
+                return;
+            }
+#endif
+            *m_end++ = val;
+        }
+
+        void pop() { check_underflow(); (--m_end)->clear(); }
+
+        /// Makes room for count more values
+        void reserve(size_t count)
+        {
+            while(size_t(m_limit - m_end) < count)
+                grow();
+        }
+
+        size_t size() const { return m_end - m_base; }
+        bool empty() const { return m_end == m_base; }
+
+        // the first free slot, and the end of the block
+        value* m_end;
+        value* m_limit;
+
+    private:
+        void check_underflow() const
+        {
+#ifdef DSCRIPT_CHECKED_STACK
+            if(m_end == m_base)
+                throw std::runtime_error("Runtime stack underflow.");
+#endif
+        }
+
+        void grow()
+        {
+            std::vector<value> slots(m_slots.size() * 2);
+            for(size_t i = 0; i < size(); ++i)
+                slots[i] = m_base[i];
+            size_t count = size();
+            m_slots.swap(slots);
+            m_base = &m_slots[0];
+            m_end = m_base + count;
+            m_limit = m_base + m_slots.size();
+        }
+
+        std::vector<value> m_slots;
+        value* m_base;
+    };
+
     /// The virtual machine. This object takes care of the actual execution
     /// of the bytecode contained in a codeblock
     class vmachine
     {
     public:
+        vmachine();
+        ~vmachine();
+
+        /// Runs code until it returns. Script functions called from it
+        /// run in the same dispatch loop, on the vmachine's own frame
+        /// stack. func and argc describe the function being called,
+        /// whose argc params are on top of the param stack, if any.
         void execute(
             instr_iter begin,
             instr_iter end,
             instr_iter instr,
-            class context& ctx
+            class context& ctx,
+            const func_table::entry* func = 0,
+            size_t argc = 0
+            );
+
+        /// Verifies a codeblock (see verify_codeblock), and resolves its
+        /// statically named $globals to global slots. This must be done
+        /// once, before the codeblock is executed.
+        void link(codeblock_t& code);
+
+        /// Returns the slot of a global variable, giving it one if needed
+        size_t get_global_slot(string_table::entry name);
+
+        /// Turns the JIT on or off (see jit.h). Returns false if this
+        /// build has no JIT.
+        bool enable_jit(bool enable);
+
+        /// Runs the script function name with func from now on, if the
+        /// function's code has the given checksum (see native.h). Any
+        /// later definition of the function is checked again.
+        void link_compiled(
+            string_table::entry name,
+            compiled_func func,
+            unsigned int checksum
             );
 
         friend class context;
+        friend class jit;
+        friend class native_frame;
     private:
+        /// A function's activation record. Statically named %locals live
+        /// in slots on the local stack, anything else in the dictionary.
+        struct call_frame
+        {
+            call_frame()
+                : load_ret(false), base(0), local_count(0), param_base(0)
+            {}
+            // the codeblock being run, and where the caller continues
+            instr_iter begin;
+            instr_iter end;
+            instr_iter return_to;
+            // whether the caller wants the return value pushed
+            bool load_ret;
+            // the frame's first slot on the local stack
+            size_t base;
+            size_t local_count;
+            instr_iter local_names;
+            // where the frame's params start on the param stack
+            size_t param_base;
+            dictionary_t dynamic;
+        };
+
+        void push_frame(
+            instr_iter begin,
+            instr_iter end,
+            instr_iter return_to,
+            const func_table::entry* func,
+            size_t argc
+            );
+        void pop_frame();
+
+        /// Finds the function an op_call_func (or op_call_load_ret) at
+        /// instr calls, through the cache the call site keeps
+        func_table::entry* find_func(const instruction* instr);
+
+        /// Returns whether the function an op_inline_guard at instr
+        /// stands in for is still the one that was compiled inline, and
+        /// calls no host function that may use its %locals, through the
+        /// cache the guard keeps
+        bool is_inlined(const instruction* instr);
+
+        /// Decodes the body of the function an op_load_func at instr
+        /// stands in for, and runs it in the frame on top of the call
+        /// stack from now on. Returns where the body starts.
+        instr_iter load_func(const instruction* instr);
+
+        /// Calls a host function, or reports a function that doesn't
+        /// exist. Returns false without doing anything if func is a
+        /// script function.
+        bool call_host(
+            const func_table::entry* func,
+            string_table::entry name,
+            size_t argc,
+            class context& ctx
+            );
+
+        /// Runs the native code of the script function in the frame on
+        /// top of the call stack, compiling it if it has been called
+        /// often enough. Returns where the interpreter carries on, which
+        /// is instr if the function has no native code.
+        instr_iter enter_native(
+            const func_table::entry& func,
+            instr_iter instr,
+            class context& ctx
+            );
+
+        /// Frees the native code of the functions redefined since it
+        /// was compiled. Only called while no native code runs.
+        void release_native();
+
+        /// Runs the op_code at instr for native code, as the interpreter
+        /// would, except that jumps are left to the native code. Returns
+        /// whether a jump op jumps. Only the op_codes that aren't
+        /// is_interpreter_only() can be run.
+        bool native_op(class context& ctx,const instruction* instr);
+
+        /// native_op() for JIT code, which errors can't be thrown
+        /// through. Returns -1 if one happened, see m_jit_error.
+        int jit_op(class context& ctx,const instruction* instr);
+
+        /// Returns the frame slots of the frame on top of the call stack
+        value* native_locals();
+
+        /// Uses the compiled_func linked for a script function, if it
+        /// was compiled from the function's current code
+        void bind_compiled(func_table::entry& func);
+
+        /// Runs the compiled_func of the script function in the frame on
+        /// top of the call stack. Returns where the interpreter carries
+        /// on.
+        instr_iter enter_compiled(
+            const func_table::entry& func,
+            class context& ctx
+            );
+
+        /// The dispatch loop. Runs until the frame above entry_depth
+        /// returns.
+        void run(instr_iter instr,class context& ctx,size_t entry_depth);
+
+        /// Finds the variable with the given name in the current frame
+        value& get_var(string_table::entry name);
+
+        /// Finds the variable with the given name in the current frame,
+        /// without creating it. name doesn't have to be in the string
+        /// table. Returns 0 if there is no such variable.
+        value* find_var(const std::string& name);
+
+        /// Returns the frame slot of a %local in the current frame, or 0
+        value* find_local(string_table::symbol name);
+
+        /// Finds the variable named by a value computed at runtime,
+        /// creating it if needed
+        value& get_named_var(const value& name);
+
+        /// Pops the indexes of an array element off the runtime stack
+        /// into m_indexes
+        void pop_indexes(size_t count);
+
+        /// Returns the element of var named by m_indexes, or 0
+        const value* find_elem(const value& var);
+
+        /// Returns the element of var named by m_indexes, creating it
+        /// (and any arrays on the way to it) if needed
+        value& get_elem(value& var);
+
+        // the stack frames, and how deep they may go
+        std::stack<call_frame> m_callstack;
+        size_t m_max_call_depth;
+
+        // the frame slots of all active frames
+        std::vector<value> m_locals;
         
-        // the stack frames
-        std::stack<dictionary_t> m_callstack;
-        
-        // the runtime stack
-        std::stack<value> m_runtime_stack;
-        dictionary_t globals;
+        // the runtime stack, and how deep the code at file scope takes
+        // it in the deepest codeblock linked so far
+        value_stack m_runtime_stack;
+        size_t m_file_stack;
+
+        // the indexes of the array element being accessed
+        std::vector<value> m_indexes;
+
+        // the global slots, and the slot of each global by name
+        typedef symbol_map<size_t> global_map;
+        global_map m_global_names;
+        std::vector<value> m_globals;
         
         // the return register
         value m_return_val;
@@ -61,6 +314,24 @@ namespace dscript
         
         // the function table
         func_table functions;
+
+        // the compiled_funcs linked by name, and the checksum of the
+        // code each was compiled from
+        struct compiled_version
+        {
+            compiled_version() : func(0), checksum(0) {}
+            compiled_func func;
+            unsigned int checksum;
+        };
+        symbol_map<compiled_version> m_compiled;
+
+        // the JIT, if it has ever been enabled, whether it still is, how
+        // deeply native code has called back into the vmachine, and the
+        // message of a runtime error in native code
+        class jit* m_jit;
+        bool m_jit_enabled;
+        size_t m_jit_depth;
+        std::string m_jit_error;
     };
 }
 